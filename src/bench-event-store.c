@@ -0,0 +1,312 @@
+/*
+ * This file is part of matrix-glib-sdk
+ *
+ * matrix-glib-sdk is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * matrix-glib-sdk is distributed in the hope that it will be
+ * useful, but WITHOUT ANY WARRANTY; without even the implied
+ * warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with matrix-glib-sdk. If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Benchmark and sanity checks for MatrixEventStore.
+ *
+ * Appends synthetic events to a fresh store and reports the ingest rate (and whether it meets
+ * the target of 50000 events/s), the time to reopen the store, and the time of the first
+ * event ID lookup (which builds the event ID index).
+ * Then it checks that the stored events decode to what was appended, and that the store
+ * recovers from writes cut short.  Exits with a non-zero status if any check fails.
+ */
+
+#include <string.h>
+#include <glib.h>
+#include <glib/gstdio.h>
+#include <json-glib/json-glib.h>
+
+#include "matrix-event-store.h"
+#include "matrix-json-writer.h"
+
+#define INGEST_TARGET 50000
+
+static gint n_events = 200000;
+static gint n_rooms = 50;
+static gint batch_size = 1000;
+static gchar *store_path = NULL;
+
+static GOptionEntry entries[] = {
+    {"events", 'e', 0, G_OPTION_ARG_INT, &n_events, "The number of events to append", "N"},
+    {"rooms", 'r', 0, G_OPTION_ARG_INT, &n_rooms, "The number of rooms to spread the events over", "N"},
+    {"batch", 'b', 0, G_OPTION_ARG_INT, &batch_size, "The number of events per commit", "N"},
+    {"path", 'p', 0, G_OPTION_ARG_FILENAME, &store_path, "The directory to create the store in (default: a temporary directory)", "path"},
+    {NULL}
+};
+
+static gint failures = 0;
+
+#define check(expr, ...) G_STMT_START { \
+    if (!(expr)) { \
+        g_printerr("FAIL: " __VA_ARGS__); \
+        g_printerr("\n"); \
+        failures++; \
+    } \
+} G_STMT_END
+
+static JsonNode *
+make_event(gint n)
+{
+    gchar *json = g_strdup_printf(
+            "{\"type\":\"m.room.message\","
+            "\"event_id\":\"$event%d:example.org\","
+            "\"sender\":\"@user%d:example.org\","
+            "\"origin_server_ts\":%" G_GINT64_FORMAT ","
+            "\"content\":{\"msgtype\":\"m.text\",\"body\":\"Message number %d, with some text to make it a realistic size\"},"
+            "\"unsigned\":{\"age\":%d}}",
+            n, n % 100, (gint64)1500000000000 + n, n, n % 1000);
+    JsonParser *parser = json_parser_new();
+    JsonNode *node;
+
+    json_parser_load_from_data(parser, json, -1, NULL);
+    node = json_node_copy(json_parser_get_root(parser));
+    g_object_unref(parser);
+    g_free(json);
+
+    return node;
+}
+
+static gchar *
+room_id_for(gint n)
+{
+    return g_strdup_printf("!room%d:example.org", n % n_rooms);
+}
+
+static void
+append_garbage(const gchar *dir, const gchar *name, const gchar *data, gsize len)
+{
+    gchar *filename = g_build_filename(dir, name, NULL);
+    FILE *file = g_fopen(filename, "ab");
+
+    fwrite(data, 1, len, file);
+    fclose(file);
+    g_free(filename);
+}
+
+static void
+check_event(MatrixEventStore *store, gint n)
+{
+    gchar *room_id = room_id_for(n);
+    JsonNode *expected = make_event(n);
+    gchar *event_id = g_strdup_printf("$event%d:example.org", n);
+    GBytes *data;
+    JsonNode *node;
+    gchar *expected_json;
+    gchar *json;
+
+    data = matrix_event_store_lookup_event(store, event_id, NULL, NULL);
+    check(data != NULL, "event %s not found", event_id);
+
+    if (data != NULL) {
+        node = matrix_json_binary_to_node(data, NULL);
+        check(node != NULL, "event %s could not be decoded", event_id);
+
+        if (node != NULL) {
+            expected_json = json_to_string(expected, FALSE);
+            json = json_to_string(node, FALSE);
+            check(g_strcmp0(expected_json, json) == 0, "event %s differs: %s", event_id, json);
+            g_free(expected_json);
+            g_free(json);
+            json_node_unref(node);
+        }
+
+        g_bytes_unref(data);
+    }
+
+    g_free(event_id);
+    g_free(room_id);
+    json_node_unref(expected);
+}
+
+int
+main(int argc, char *argv[])
+{
+    GOptionContext *context;
+    GError *error = NULL;
+    MatrixEventStore *store;
+    JsonNode **events;
+    gchar **room_ids;
+    gchar *room_id;
+    gint64 start;
+    gdouble elapsed;
+    guint64 total = 0;
+
+    context = g_option_context_new(NULL);
+    g_option_context_set_summary(context, "Benchmark the Matrix event store");
+    g_option_context_add_main_entries(context, entries, NULL);
+
+    if (!g_option_context_parse(context, &argc, &argv, &error)) {
+        g_printerr("%s\n", error->message);
+
+        return 1;
+    }
+
+    g_option_context_free(context);
+
+    if ((n_events <= 0) || (n_rooms <= 0) || (batch_size <= 0)) {
+        g_printerr("The number of events, rooms and the batch size must be positive\n");
+
+        return 1;
+    }
+
+    if ((store_path == NULL) && ((store_path = g_dir_make_tmp("matrix-event-store-XXXXXX", &error)) == NULL)) {
+        g_printerr("%s\n", error->message);
+
+        return 1;
+    }
+
+    /* Build the events up front, so only storing them is measured */
+    events = g_new(JsonNode *, n_events);
+    room_ids = g_new(gchar *, n_events);
+
+    for (gint i = 0; i < n_events; i++) {
+        events[i] = make_event(i);
+        room_ids[i] = room_id_for(i);
+    }
+
+    if ((store = matrix_event_store_new(store_path, &error)) == NULL) {
+        g_printerr("Could not open store: %s\n", error->message);
+
+        return 1;
+    }
+
+    start = g_get_monotonic_time();
+
+    for (gint i = 0; i < n_events; i++) {
+        if (!matrix_event_store_append(store, room_ids[i], events[i], &error) && (error != NULL)) {
+            g_printerr("Could not append: %s\n", error->message);
+
+            return 1;
+        }
+
+        if (((i + 1) % batch_size == 0) && !matrix_event_store_commit(store, &error)) {
+            g_printerr("Could not commit: %s\n", error->message);
+
+            return 1;
+        }
+    }
+
+    if (!matrix_event_store_commit(store, &error)) {
+        g_printerr("Could not commit: %s\n", error->message);
+
+        return 1;
+    }
+
+    elapsed = (g_get_monotonic_time() - start) / 1000000.0;
+    g_print("ingest: %d events in %.3f s, %.0f events/s (%d per commit)\n",
+            n_events, elapsed, n_events / elapsed, batch_size);
+    g_print("ingest target of %d events/s: %s\n",
+            INGEST_TARGET, (n_events / elapsed >= INGEST_TARGET) ? "met" : "NOT met");
+
+    g_object_unref(store);
+
+    start = g_get_monotonic_time();
+    store = matrix_event_store_new(store_path, &error);
+    elapsed = (g_get_monotonic_time() - start) / 1000000.0;
+
+    if (store == NULL) {
+        g_printerr("Could not reopen store: %s\n", error->message);
+
+        return 1;
+    }
+
+    g_print("open: %.3f ms\n", elapsed * 1000);
+
+    start = g_get_monotonic_time();
+    check_event(store, n_events / 2);
+    elapsed = (g_get_monotonic_time() - start) / 1000000.0;
+    g_print("first lookup by event ID: %.3f ms\n", elapsed * 1000);
+
+    for (gint i = 0; i < n_rooms; i++) {
+        room_id = room_id_for(i);
+        total += matrix_event_store_get_room_length(store, room_id);
+        g_free(room_id);
+    }
+
+    check(total == (guint64)n_events, "%" G_GUINT64_FORMAT " events stored instead of %d", total, n_events);
+
+    for (gint i = 0; i < n_events; i += MAX(1, n_events / 1000)) {
+        check_event(store, i);
+    }
+
+    check(!matrix_event_store_append(store, room_ids[0], events[0], NULL),
+          "duplicate event was appended");
+
+    g_object_unref(store);
+
+    /* Simulate writes cut short: a partial room ID, and a partial index entry */
+    append_garbage(store_path, "rooms", "!torn", 5);
+    append_garbage(store_path, "room-0.idx", "\1\2\3", 3);
+
+    if ((store = matrix_event_store_new(store_path, &error)) == NULL) {
+        g_printerr("Could not open store after a torn write: %s\n", error->message);
+
+        return 1;
+    }
+
+    room_id = room_id_for(0);
+    check(matrix_event_store_get_room_length(store, room_id) == (guint64)((n_events + n_rooms - 1) / n_rooms),
+          "room length changed after a torn index write");
+
+    {
+        JsonNode *event = make_event(n_events);
+        gchar *new_room_id = g_strdup("!new:example.org");
+        GBytes *data;
+
+        check(matrix_event_store_append(store, room_id, event, NULL), "could not append after a torn write");
+        check(matrix_event_store_append(store, new_room_id, events[1], NULL) == FALSE,
+              "duplicate event was appended to another room");
+        check(matrix_event_store_commit(store, NULL), "could not commit after a torn write");
+        g_object_unref(store);
+
+        store = matrix_event_store_new(store_path, NULL);
+        check(store != NULL, "could not reopen the store");
+
+        if (store != NULL) {
+            data = matrix_event_store_get_event(store, room_id, matrix_event_store_get_room_length(store, room_id) - 1, NULL);
+            check(data != NULL, "event appended after a torn write is missing");
+            g_clear_pointer(&data, g_bytes_unref);
+            check(matrix_event_store_get_room_length(store, "!torn") == 0, "partial room ID was kept");
+            check_event(store, n_events);
+        }
+
+        json_node_unref(event);
+        g_free(new_room_id);
+    }
+
+    g_free(room_id);
+    g_clear_object(&store);
+
+    for (gint i = 0; i < n_events; i++) {
+        json_node_unref(events[i]);
+        g_free(room_ids[i]);
+    }
+
+    g_free(events);
+    g_free(room_ids);
+
+    if (failures > 0) {
+        g_printerr("%d checks failed\n", failures);
+
+        return 1;
+    }
+
+    g_print("all checks passed (store left in %s)\n", store_path);
+
+    return 0;
+}
@@ -0,0 +1,452 @@
+/*
+ * This file is part of matrix-glib-sdk
+ *
+ * matrix-glib-sdk is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * matrix-glib-sdk is distributed in the hope that it will be
+ * useful, but WITHOUT ANY WARRANTY; without even the implied
+ * warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with matrix-glib-sdk. If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Benchmark and checks for event decoding.
+ *
+ * Decodes a sample of every registered event and message type with
+ * matrix_event_base_new_from_json() and reports the rate for each type and for the whole
+ * corpus.  It also reports the cost of matrix_event_base_get_json() on a fresh event (which
+ * builds the node) and on one whose node is already cached, and of reading the "json"
+ * property, and compares decoding events from their binary encoding with
+ * matrix_event_base_new_from_binary() to parsing and decoding their JSON text.  Then it
+ * checks that every sample decodes to its handler class, also from its binary encoding, and
+ * that the cached node is returned until the event changes.  Exits with a non-zero status if
+ * any check fails.
+ */
+
+#include <string.h>
+#include <glib.h>
+#include <json-glib/json-glib.h>
+
+#include "matrix-event-base.h"
+#include "matrix-event-room-member.h"
+#include "matrix-event-room-message.h"
+#include "matrix-message-base.h"
+
+static gint n_rounds = 20000;
+
+static GOptionEntry entries[] = {
+    {"rounds", 'r', 0, G_OPTION_ARG_INT, &n_rounds, "The number of times to decode each sample", "N"},
+    {NULL}
+};
+
+static gint failures = 0;
+
+#define check(expr, ...) G_STMT_START { \
+    if (!(expr)) { \
+        g_printerr("FAIL: " __VA_ARGS__); \
+        g_printerr("\n"); \
+        failures++; \
+    } \
+} G_STMT_END
+
+#define ROOM_FIELDS \
+    "\"event_id\":\"$event:example.org\"," \
+    "\"room_id\":\"!room:example.org\"," \
+    "\"sender\":\"@alice:example.org\"," \
+    "\"origin_server_ts\":1500000000000," \
+    "\"unsigned\":{\"age\":1234,\"transaction_id\":\"txn1\"}"
+
+#define MESSAGE(content) \
+    "{\"type\":\"m.room.message\"," ROOM_FIELDS ",\"content\":" content "}"
+
+typedef struct {
+    const gchar *class_name;
+    const gchar *message_class_name;
+    const gchar *json;
+} Sample;
+
+static const Sample samples[] = {
+    {"MatrixEventRoomMember", NULL,
+     "{\"type\":\"m.room.member\"," ROOM_FIELDS ",\"state_key\":\"@bob:example.org\","
+     "\"content\":{\"membership\":\"join\",\"displayname\":\"Bob\",\"avatar_url\":\"mxc://example.org/bob\"},"
+     "\"prev_content\":{\"membership\":\"invite\"}}"},
+    {"MatrixEventPresence", NULL,
+     "{\"type\":\"m.presence\",\"event_id\":\"$presence:example.org\",\"sender\":\"@bob:example.org\","
+     "\"content\":{\"user_id\":\"@bob:example.org\",\"presence\":\"online\",\"last_active_ago\":2478593,"
+     "\"displayname\":\"Bob\",\"avatar_url\":\"mxc://example.org/bob\"}}"},
+    {"MatrixEventRoomTopic", NULL,
+     "{\"type\":\"m.room.topic\"," ROOM_FIELDS ",\"state_key\":\"\",\"content\":{\"topic\":\"A room topic\"}}"},
+    {"MatrixEventTyping", NULL,
+     "{\"type\":\"m.typing\",\"room_id\":\"!room:example.org\","
+     "\"content\":{\"user_ids\":[\"@alice:example.org\",\"@bob:example.org\"]}}"},
+    {"MatrixEventRoomAliases", NULL,
+     "{\"type\":\"m.room.aliases\"," ROOM_FIELDS ",\"state_key\":\"example.org\","
+     "\"content\":{\"aliases\":[\"#room:example.org\",\"#other:example.org\"]}}"},
+    {"MatrixEventReceipt", NULL,
+     "{\"type\":\"m.receipt\",\"room_id\":\"!room:example.org\",\"content\":{"
+     "\"$event1:example.org\":{\"m.read\":{\"@alice:example.org\":{\"ts\":1500000000000}}},"
+     "\"$event2:example.org\":{\"m.read\":{\"@bob:example.org\":{\"ts\":1500000001000}}}}}"},
+    {"MatrixEventRoomHistoryVisibility", NULL,
+     "{\"type\":\"m.room.history_visibility\"," ROOM_FIELDS ",\"state_key\":\"\","
+     "\"content\":{\"history_visibility\":\"shared\"}}"},
+    {"MatrixEventRoomJoinRules", NULL,
+     "{\"type\":\"m.room.join_rules\"," ROOM_FIELDS ",\"state_key\":\"\",\"content\":{\"join_rule\":\"invite\"}}"},
+    {"MatrixEventRoomName", NULL,
+     "{\"type\":\"m.room.name\"," ROOM_FIELDS ",\"state_key\":\"\",\"content\":{\"name\":\"A room\"}}"},
+    {"MatrixEventTag", NULL,
+     "{\"type\":\"m.tag\",\"content\":{\"tags\":{\"u.work\":{\"order\":0.9},\"m.favourite\":{}}}}"},
+    {"MatrixEventRoomCanonicalAlias", NULL,
+     "{\"type\":\"m.room.canonical_alias\"," ROOM_FIELDS ",\"state_key\":\"\","
+     "\"content\":{\"alias\":\"#room:example.org\"}}"},
+    {"MatrixEventRoomCreate", NULL,
+     "{\"type\":\"m.room.create\"," ROOM_FIELDS ",\"state_key\":\"\","
+     "\"content\":{\"creator\":\"@alice:example.org\",\"m.federate\":true}}"},
+    {"MatrixEventRoomPowerLevels", NULL,
+     "{\"type\":\"m.room.power_levels\"," ROOM_FIELDS ",\"state_key\":\"\",\"content\":{"
+     "\"ban\":50,\"kick\":50,\"redact\":50,\"invite\":0,\"events_default\":0,\"state_default\":50,"
+     "\"users_default\":0,\"events\":{\"m.room.name\":100,\"m.room.power_levels\":100},"
+     "\"users\":{\"@alice:example.org\":100,\"@bob:example.org\":50},"
+     "\"notifications\":{\"room\":50}}}"},
+    {"MatrixEventRoomAvatar", NULL,
+     "{\"type\":\"m.room.avatar\"," ROOM_FIELDS ",\"state_key\":\"\",\"content\":{"
+     "\"url\":\"mxc://example.org/avatar\",\"info\":{\"h\":128,\"w\":128,\"mimetype\":\"image/png\",\"size\":4096},"
+     "\"thumbnail_url\":\"mxc://example.org/thumb\","
+     "\"thumbnail_info\":{\"h\":32,\"w\":32,\"mimetype\":\"image/png\",\"size\":512}}}"},
+    {"MatrixEventRoomMessageFeedback", NULL,
+     "{\"type\":\"m.room.message.feedback\"," ROOM_FIELDS ","
+     "\"content\":{\"type\":\"read\",\"target_event_id\":\"$target:example.org\"}}"},
+    {"MatrixEventRoomGuestAccess", NULL,
+     "{\"type\":\"m.room.guest_access\"," ROOM_FIELDS ",\"state_key\":\"\",\"content\":{\"guest_access\":\"can_join\"}}"},
+    {"MatrixEventRoomRedaction", NULL,
+     "{\"type\":\"m.room.redaction\"," ROOM_FIELDS ",\"redacts\":\"$spam:example.org\","
+     "\"content\":{\"reason\":\"Spam\"}}"},
+    {"MatrixEventRoomThirdPartyInvite", NULL,
+     "{\"type\":\"m.room.third_party_invite\"," ROOM_FIELDS ",\"state_key\":\"token\",\"content\":{"
+     "\"display_name\":\"Carol\",\"key_validity_url\":\"https://example.org/isvalid\","
+     "\"public_key\":\"abc123\","
+     "\"public_keys\":[{\"public_key\":\"def456\",\"key_validity_url\":\"https://example.org/isvalid\"}]}}"},
+    {"MatrixEventCallInvite", NULL,
+     "{\"type\":\"m.call.invite\"," ROOM_FIELDS ",\"content\":{\"call_id\":\"call1\",\"version\":0,"
+     "\"lifetime\":60000,\"offer\":{\"type\":\"offer\",\"sdp\":\"v=0\\r\\no=- 0 0 IN IP4 127.0.0.1\\r\\n\"}}}"},
+    {"MatrixEventCallCandidates", NULL,
+     "{\"type\":\"m.call.candidates\"," ROOM_FIELDS ",\"content\":{\"call_id\":\"call1\",\"version\":0,"
+     "\"candidates\":[{\"sdpMid\":\"audio\",\"sdpMLineIndex\":0,"
+     "\"candidate\":\"candidate:1 1 UDP 2130706431 10.0.0.1 5000 typ host\"}]}}"},
+    {"MatrixEventCallAnswer", NULL,
+     "{\"type\":\"m.call.answer\"," ROOM_FIELDS ",\"content\":{\"call_id\":\"call1\",\"version\":0,"
+     "\"answer\":{\"type\":\"answer\",\"sdp\":\"v=0\\r\\no=- 0 0 IN IP4 127.0.0.1\\r\\n\"}}}"},
+    {"MatrixEventCallHangup", NULL,
+     "{\"type\":\"m.call.hangup\"," ROOM_FIELDS ",\"content\":{\"call_id\":\"call1\",\"version\":0}}"},
+    {"MatrixEventRoomMessage", "MatrixMessageText",
+     MESSAGE("{\"msgtype\":\"m.text\",\"body\":\"Hello, world, with some text to make it a realistic size\"}")},
+    {"MatrixEventRoomMessage", "MatrixMessageEmote",
+     MESSAGE("{\"msgtype\":\"m.emote\",\"body\":\"waves\"}")},
+    {"MatrixEventRoomMessage", "MatrixMessageNotice",
+     MESSAGE("{\"msgtype\":\"m.notice\",\"body\":\"The server restarts in 5 minutes\"}")},
+    {"MatrixEventRoomMessage", "MatrixMessageFile",
+     MESSAGE("{\"msgtype\":\"m.file\",\"body\":\"report.pdf\",\"url\":\"mxc://example.org/file\","
+             "\"info\":{\"mimetype\":\"application/pdf\",\"size\":123456},"
+             "\"thumbnail_url\":\"mxc://example.org/thumb\","
+             "\"thumbnail_info\":{\"h\":64,\"w\":48,\"mimetype\":\"image/png\",\"size\":2048}}")},
+    {"MatrixEventRoomMessage", "MatrixMessageImage",
+     MESSAGE("{\"msgtype\":\"m.image\",\"body\":\"cat.png\",\"url\":\"mxc://example.org/image\","
+             "\"info\":{\"h\":600,\"w\":800,\"mimetype\":\"image/png\",\"size\":654321},"
+             "\"thumbnail_url\":\"mxc://example.org/thumb\","
+             "\"thumbnail_info\":{\"h\":60,\"w\":80,\"mimetype\":\"image/png\",\"size\":4096}}")},
+    {"MatrixEventRoomMessage", "MatrixMessageAudio",
+     MESSAGE("{\"msgtype\":\"m.audio\",\"body\":\"song.ogg\",\"url\":\"mxc://example.org/audio\","
+             "\"info\":{\"duration\":180000,\"mimetype\":\"audio/ogg\",\"size\":3000000}}")},
+    {"MatrixEventRoomMessage", "MatrixMessageVideo",
+     MESSAGE("{\"msgtype\":\"m.video\",\"body\":\"clip.mp4\",\"url\":\"mxc://example.org/video\","
+             "\"info\":{\"duration\":30000,\"h\":720,\"w\":1280,\"mimetype\":\"video/mp4\",\"size\":9000000,"
+             "\"thumbnail_url\":\"mxc://example.org/thumb\","
+             "\"thumbnail_info\":{\"h\":72,\"w\":128,\"mimetype\":\"image/png\",\"size\":4096}}}")},
+    {"MatrixEventRoomMessage", "MatrixMessageLocation",
+     MESSAGE("{\"msgtype\":\"m.location\",\"body\":\"Big Ben\",\"geo_uri\":\"geo:51.5008,0.1247\","
+             "\"thumbnail_url\":\"mxc://example.org/thumb\","
+             "\"thumbnail_info\":{\"h\":64,\"w\":64,\"mimetype\":\"image/png\",\"size\":2048}}")},
+};
+
+static JsonNode *
+parse(const gchar *json)
+{
+    JsonParser *parser = json_parser_new();
+    JsonNode *node = NULL;
+
+    if (json_parser_load_from_data(parser, json, -1, NULL)) {
+        node = json_node_copy(json_parser_get_root(parser));
+    }
+
+    g_object_unref(parser);
+
+    return node;
+}
+
+static const gchar *
+sample_name(const Sample *sample)
+{
+    return (sample->message_class_name != NULL) ? sample->message_class_name : sample->class_name;
+}
+
+static void
+check_sample(const Sample *sample, JsonNode *node)
+{
+    MatrixEventBase *event;
+    MatrixMessageBase *message;
+    GBytes *data;
+    GError *error = NULL;
+
+    event = matrix_event_base_new_from_json(NULL, node, &error);
+    check(event != NULL, "%s could not be decoded: %s", sample_name(sample), (error != NULL) ? error->message : "no error");
+    g_clear_error(&error);
+
+    if (event == NULL) {
+        return;
+    }
+
+    check(strcmp(G_OBJECT_TYPE_NAME(event), sample->class_name) == 0,
+          "%s decoded to %s", sample->class_name, G_OBJECT_TYPE_NAME(event));
+
+    if (sample->message_class_name != NULL) {
+        message = MATRIX_EVENT_IS_ROOM_MESSAGE(event) ? matrix_event_room_message_get_message(MATRIX_EVENT_ROOM_MESSAGE(event)) : NULL;
+        check(message != NULL, "%s has no message", sample->message_class_name);
+        check((message == NULL) || (strcmp(G_OBJECT_TYPE_NAME(message), sample->message_class_name) == 0),
+              "%s decoded to %s", sample->message_class_name, G_OBJECT_TYPE_NAME(message));
+    }
+
+    check(matrix_event_base_get_json(event) == matrix_event_base_get_json(event),
+          "%s: the JSON node is not cached", sample_name(sample));
+
+    data = matrix_event_base_to_binary(event, NULL);
+    g_object_unref(event);
+
+    if (data == NULL) {
+        return;
+    }
+
+    event = matrix_event_base_new_from_binary(data, &error);
+    g_bytes_unref(data);
+    check(event != NULL, "%s could not be decoded from binary: %s", sample_name(sample), (error != NULL) ? error->message : "no error");
+    g_clear_error(&error);
+
+    if (event != NULL) {
+        check(strcmp(G_OBJECT_TYPE_NAME(event), sample->class_name) == 0,
+              "%s decoded from binary to %s", sample->class_name, G_OBJECT_TYPE_NAME(event));
+        g_object_unref(event);
+    }
+}
+
+static void
+check_json_cache(void)
+{
+    JsonNode *node = parse(samples[0].json);
+    MatrixEventBase *event = matrix_event_base_new_from_json(NULL, node, NULL);
+    JsonNode *json;
+    JsonNode *property;
+
+    check(event != NULL, "%s could not be decoded", samples[0].class_name);
+
+    if (event != NULL) {
+        json = json_node_ref(matrix_event_base_get_json(event));
+        g_object_get(event, "json", &property, NULL);
+        check(property == json, "the json property differs from matrix_event_base_get_json()");
+        g_clear_pointer(&property, json_node_unref);
+
+        matrix_event_room_member_set_display_name(MATRIX_EVENT_ROOM_MEMBER(event), "Robert");
+        check(matrix_event_base_get_json(event) != json, "the JSON node is kept after a change");
+
+        json_node_unref(json);
+        g_object_unref(event);
+    }
+
+    json_node_unref(node);
+}
+
+int
+main(int argc, char *argv[])
+{
+    GOptionContext *context;
+    GError *error = NULL;
+    JsonNode *nodes[G_N_ELEMENTS(samples)];
+    GBytes *binary[G_N_ELEMENTS(samples)];
+    MatrixEventBase **events;
+    MatrixEventBase *event;
+    gint64 start;
+    gdouble elapsed;
+    gdouble total = 0;
+    guint n_binary = 0;
+
+    context = g_option_context_new(NULL);
+    g_option_context_set_summary(context, "Benchmark the decoding of Matrix events");
+    g_option_context_add_main_entries(context, entries, NULL);
+
+    if (!g_option_context_parse(context, &argc, &argv, &error)) {
+        g_printerr("%s\n", error->message);
+
+        return 1;
+    }
+
+    g_option_context_free(context);
+
+    if (n_rounds <= 0) {
+        g_printerr("The number of rounds must be positive\n");
+
+        return 1;
+    }
+
+    for (guint i = 0; i < G_N_ELEMENTS(samples); i++) {
+        nodes[i] = parse(samples[i].json);
+
+        if (nodes[i] == NULL) {
+            g_printerr("The %s sample is not valid JSON\n", sample_name(&samples[i]));
+
+            return 1;
+        }
+    }
+
+    /* Only the decoding is measured; the samples are parsed up front */
+    for (guint i = 0; i < G_N_ELEMENTS(samples); i++) {
+        start = g_get_monotonic_time();
+
+        for (gint j = 0; j < n_rounds; j++) {
+            if ((event = matrix_event_base_new_from_json(NULL, nodes[i], NULL)) != NULL) {
+                g_object_unref(event);
+            }
+        }
+
+        elapsed = (g_get_monotonic_time() - start) / 1000000.0;
+        total += elapsed;
+        g_print("%-32s %.0f events/s\n", sample_name(&samples[i]), n_rounds / elapsed);
+    }
+
+    g_print("decode: %" G_GSIZE_FORMAT " events in %.3f s, %.0f events/s\n",
+            n_rounds * G_N_ELEMENTS(samples), total, n_rounds * G_N_ELEMENTS(samples) / total);
+
+    /* Getting the JSON of a fresh event builds the node */
+    events = g_new(MatrixEventBase *, n_rounds);
+    total = 0;
+
+    for (guint i = 0; i < G_N_ELEMENTS(samples); i++) {
+        for (gint j = 0; j < n_rounds; j++) {
+            events[j] = matrix_event_base_new_from_json(NULL, nodes[i], NULL);
+        }
+
+        start = g_get_monotonic_time();
+
+        for (gint j = 0; j < n_rounds; j++) {
+            if (events[j] != NULL) {
+                matrix_event_base_get_json(events[j]);
+            }
+        }
+
+        total += (g_get_monotonic_time() - start) / 1000000.0;
+
+        for (gint j = 0; j < n_rounds; j++) {
+            g_clear_object(&events[j]);
+        }
+    }
+
+    g_free(events);
+    g_print("get_json, first call: %.0f calls/s\n", n_rounds * G_N_ELEMENTS(samples) / total);
+
+    /* Later calls return the cached node */
+    event = matrix_event_base_new_from_json(NULL, nodes[0], NULL);
+    matrix_event_base_get_json(event);
+    start = g_get_monotonic_time();
+
+    for (gint j = 0; j < n_rounds * 100; j++) {
+        matrix_event_base_get_json(event);
+    }
+
+    elapsed = (g_get_monotonic_time() - start) / 1000000.0;
+    g_print("get_json, cached: %.0f calls/s\n", n_rounds * 100 / elapsed);
+
+    start = g_get_monotonic_time();
+
+    for (gint j = 0; j < n_rounds * 100; j++) {
+        JsonNode *json;
+
+        g_object_get(event, "json", &json, NULL);
+        json_node_unref(json);
+    }
+
+    elapsed = (g_get_monotonic_time() - start) / 1000000.0;
+    g_print("json property, cached: %.0f calls/s\n", n_rounds * 100 / elapsed);
+    g_object_unref(event);
+
+    /* Decoding from the binary encoding, compared to parsing and decoding JSON text */
+    for (guint i = 0; i < G_N_ELEMENTS(samples); i++) {
+        event = matrix_event_base_new_from_json(NULL, nodes[i], NULL);
+        binary[i] = (event != NULL) ? matrix_event_base_to_binary(event, NULL) : NULL;
+        g_clear_object(&event);
+
+        if (binary[i] == NULL) {
+            g_print("%s can not be encoded, skipped\n", sample_name(&samples[i]));
+        } else {
+            n_binary++;
+        }
+    }
+
+    start = g_get_monotonic_time();
+
+    for (gint j = 0; j < n_rounds; j++) {
+        for (guint i = 0; i < G_N_ELEMENTS(samples); i++) {
+            if ((binary[i] != NULL) && ((event = matrix_event_base_new_from_binary(binary[i], NULL)) != NULL)) {
+                g_object_unref(event);
+            }
+        }
+    }
+
+    elapsed = (g_get_monotonic_time() - start) / 1000000.0;
+    g_print("decode from binary: %.0f events/s\n", n_rounds * n_binary / elapsed);
+
+    start = g_get_monotonic_time();
+
+    for (gint j = 0; j < n_rounds; j++) {
+        for (guint i = 0; i < G_N_ELEMENTS(samples); i++) {
+            JsonNode *node;
+
+            if ((binary[i] != NULL) && ((node = parse(samples[i].json)) != NULL)) {
+                if ((event = matrix_event_base_new_from_json(NULL, node, NULL)) != NULL) {
+                    g_object_unref(event);
+                }
+
+                json_node_unref(node);
+            }
+        }
+    }
+
+    elapsed = (g_get_monotonic_time() - start) / 1000000.0;
+    g_print("parse and decode JSON text: %.0f events/s\n", n_rounds * n_binary / elapsed);
+
+    for (guint i = 0; i < G_N_ELEMENTS(samples); i++) {
+        g_clear_pointer(&binary[i], g_bytes_unref);
+    }
+
+    for (guint i = 0; i < G_N_ELEMENTS(samples); i++) {
+        check_sample(&samples[i], nodes[i]);
+    }
+
+    check_json_cache();
+
+    for (guint i = 0; i < G_N_ELEMENTS(samples); i++) {
+        json_node_unref(nodes[i]);
+    }
+
+    if (failures > 0) {
+        g_printerr("%d checks failed\n", failures);
+
+        return 1;
+    }
+
+    g_print("all checks passed\n");
+
+    return 0;
+}
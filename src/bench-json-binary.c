@@ -0,0 +1,420 @@
+/*
+ * This file is part of matrix-glib-sdk
+ *
+ * matrix-glib-sdk is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * matrix-glib-sdk is distributed in the hope that it will be
+ * useful, but WITHOUT ANY WARRANTY; without even the implied
+ * warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with matrix-glib-sdk. If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Benchmark and round-trip checks for the binary encoding of MatrixJsonWriter.
+ *
+ * Encodes synthetic events to the binary encoding and back, and reports the encoding and
+ * decoding rates next to those of JSON text, and the size of both encodings.  Then it checks
+ * that values of every kind survive the round trip through matrix_json_binary_to_node() and
+ * matrix_json_writer_add_binary(), that events written by their native writers decode to
+ * their JSON form, and that truncated data is rejected.  Exits with a non-zero status if any
+ * check fails.
+ */
+
+#include <string.h>
+#include <glib.h>
+#include <json-glib/json-glib.h>
+
+#include "matrix-event-base.h"
+#include "matrix-json-writer.h"
+
+static gint n_events = 100000;
+
+static GOptionEntry entries[] = {
+    {"events", 'e', 0, G_OPTION_ARG_INT, &n_events, "The number of events to encode", "N"},
+    {NULL}
+};
+
+static gint failures = 0;
+
+#define check(expr, ...) G_STMT_START { \
+    if (!(expr)) { \
+        g_printerr("FAIL: " __VA_ARGS__); \
+        g_printerr("\n"); \
+        failures++; \
+    } \
+} G_STMT_END
+
+/* Values of every kind the encoding has to preserve */
+static const gchar *samples[] = {
+    "{}",
+    "[]",
+    "null",
+    "\"\"",
+    "[true,false,null]",
+    "[0,1,-1,127,128,-128,2147483647,-2147483648,9007199254740993,4611686018427387904,-4611686018427387904]",
+    "[0.5,-0.25,1e+100,-3.0000000000000001e-300,0.10000000000000001]",
+    "{\"body\":\"\\u00e1rv\\u00edzt\\u0171r\\u0151 t\\u00fck\\u00f6rf\\u00far\\u00f3g\\u00e9p \\ud83d\\ude00\",\"escapes\":\"\\\"\\\\\\/\\b\\f\\n\\r\\t\\u0001\"}",
+    "{\"content\":{\"membership\":\"join\",\"displayname\":null},\"unknown_key\":[{\"unknown_key\":1},{\"unknown_key\":2}]}",
+    "[[[[[[[[[[[[[[[[\"deep\"]]]]]]]]]]]]]]]]",
+    NULL
+};
+
+static JsonNode *
+parse(const gchar *json)
+{
+    JsonParser *parser = json_parser_new();
+    JsonNode *node = NULL;
+
+    if (json_parser_load_from_data(parser, json, -1, NULL)) {
+        node = json_node_copy(json_parser_get_root(parser));
+    }
+
+    g_object_unref(parser);
+
+    return node;
+}
+
+static JsonNode *
+make_event(gint n)
+{
+    gchar *json;
+    JsonNode *node;
+
+    if (n % 10 == 0) {
+        json = g_strdup_printf(
+                "{\"type\":\"m.room.member\","
+                "\"event_id\":\"$event%d:example.org\","
+                "\"room_id\":\"!room%d:example.org\","
+                "\"sender\":\"@user%d:example.org\","
+                "\"state_key\":\"@user%d:example.org\","
+                "\"origin_server_ts\":%" G_GINT64_FORMAT ","
+                "\"content\":{\"membership\":\"join\",\"displayname\":\"User %d\",\"avatar_url\":\"mxc://example.org/avatar%d\"},"
+                "\"unsigned\":{\"age\":%d}}",
+                n, n % 50, n % 100, n % 100, (gint64)1500000000000 + n, n % 100, n % 100, n % 1000);
+    } else {
+        json = g_strdup_printf(
+                "{\"type\":\"m.room.message\","
+                "\"event_id\":\"$event%d:example.org\","
+                "\"room_id\":\"!room%d:example.org\","
+                "\"sender\":\"@user%d:example.org\","
+                "\"origin_server_ts\":%" G_GINT64_FORMAT ","
+                "\"content\":{\"msgtype\":\"m.text\",\"body\":\"Message number %d, with some text to make it a realistic size\"},"
+                "\"unsigned\":{\"age\":%d}}",
+                n, n % 50, n % 100, (gint64)1500000000000 + n, n, n % 1000);
+    }
+
+    node = parse(json);
+    g_free(json);
+
+    return node;
+}
+
+/*
+ * Compare two JSON trees.  Object members are compared by name, so their order doesn’t
+ * matter.
+ */
+static gboolean
+nodes_equal(JsonNode *a, JsonNode *b)
+{
+    if ((a == NULL) || (b == NULL)) {
+        return a == b;
+    }
+
+    if (json_node_get_node_type(a) != json_node_get_node_type(b)) {
+        return FALSE;
+    }
+
+    switch (json_node_get_node_type(a)) {
+        case JSON_NODE_OBJECT: {
+            JsonObject *a_object = json_node_get_object(a);
+            JsonObject *b_object = json_node_get_object(b);
+            GList *members;
+            gboolean equal;
+
+            if (json_object_get_size(a_object) != json_object_get_size(b_object)) {
+                return FALSE;
+            }
+
+            members = json_object_get_members(a_object);
+            equal = TRUE;
+
+            for (GList *l = members; equal && (l != NULL); l = l->next) {
+                equal = nodes_equal(json_object_get_member(a_object, l->data), json_object_get_member(b_object, l->data));
+            }
+
+            g_list_free(members);
+
+            return equal;
+        }
+        case JSON_NODE_ARRAY: {
+            JsonArray *a_array = json_node_get_array(a);
+            JsonArray *b_array = json_node_get_array(b);
+            guint len = json_array_get_length(a_array);
+
+            if (json_array_get_length(b_array) != len) {
+                return FALSE;
+            }
+
+            for (guint i = 0; i < len; i++) {
+                if (!nodes_equal(json_array_get_element(a_array, i), json_array_get_element(b_array, i))) {
+                    return FALSE;
+                }
+            }
+
+            return TRUE;
+        }
+        case JSON_NODE_NULL:
+            return TRUE;
+        case JSON_NODE_VALUE:
+            break;
+    }
+
+    if (json_node_get_value_type(a) != json_node_get_value_type(b)) {
+        return FALSE;
+    }
+
+    switch (json_node_get_value_type(a)) {
+        case G_TYPE_STRING:
+            return g_strcmp0(json_node_get_string(a), json_node_get_string(b)) == 0;
+        case G_TYPE_INT64:
+            return json_node_get_int(a) == json_node_get_int(b);
+        case G_TYPE_DOUBLE:
+            return json_node_get_double(a) == json_node_get_double(b);
+        case G_TYPE_BOOLEAN:
+            return json_node_get_boolean(a) == json_node_get_boolean(b);
+        default:
+            return FALSE;
+    }
+}
+
+static GBytes *
+encode(JsonNode *node)
+{
+    MatrixJsonWriter *writer = matrix_json_writer_new_binary();
+
+    if (!matrix_json_writer_add_node(writer, node, NULL)) {
+        matrix_json_writer_free(writer);
+
+        return NULL;
+    }
+
+    return matrix_json_writer_free_to_bytes(writer);
+}
+
+static void
+check_round_trip(const gchar *json)
+{
+    JsonNode *expected = parse(json);
+    MatrixJsonWriter *writer;
+    GBytes *data;
+    GBytes *text;
+    JsonNode *node;
+    gchar *text_json;
+
+    check(expected != NULL, "sample %s could not be parsed", json);
+
+    if (expected == NULL) {
+        return;
+    }
+
+    data = encode(expected);
+    check(data != NULL, "%s could not be encoded", json);
+
+    if (data == NULL) {
+        json_node_unref(expected);
+
+        return;
+    }
+
+    /* Binary to JsonNode */
+    node = matrix_json_binary_to_node(data, NULL);
+    check(nodes_equal(expected, node), "%s changed after decoding to a node", json);
+    g_clear_pointer(&node, json_node_unref);
+
+    /* Binary to JSON text, without a tree in between */
+    writer = matrix_json_writer_new();
+    check(matrix_json_writer_add_binary(writer, data, NULL), "%s could not be transcoded", json);
+    text = matrix_json_writer_free_to_bytes(writer);
+    text_json = g_strndup(g_bytes_get_data(text, NULL), g_bytes_get_size(text));
+    node = parse(text_json);
+    check(nodes_equal(expected, node), "%s changed after transcoding to %s", json, text_json);
+    g_clear_pointer(&node, json_node_unref);
+    g_free(text_json);
+    g_bytes_unref(text);
+
+    /* Every proper prefix of the data must be rejected, not read past its end */
+    for (gsize len = 0; len < g_bytes_get_size(data); len++) {
+        GBytes *truncated = g_bytes_new_from_bytes(data, 0, len);
+        GError *error = NULL;
+
+        node = matrix_json_binary_to_node(truncated, &error);
+        check((node == NULL) && (error != NULL), "%s truncated to %" G_GSIZE_FORMAT " bytes was accepted", json, len);
+        g_clear_pointer(&node, json_node_unref);
+        g_clear_error(&error);
+        g_bytes_unref(truncated);
+    }
+
+    g_bytes_unref(data);
+    json_node_unref(expected);
+}
+
+/*
+ * Check that the native writer of an event produces the same data as its JSON form.
+ */
+static void
+check_event_round_trip(gint n)
+{
+    JsonNode *json_data = make_event(n);
+    MatrixEventBase *event;
+    MatrixEventBase *decoded;
+    GBytes *data;
+    JsonNode *node;
+    GError *error = NULL;
+
+    event = matrix_event_base_new_from_json(NULL, json_data, &error);
+    check(event != NULL, "event %d could not be loaded: %s", n, (error != NULL) ? error->message : "");
+    g_clear_error(&error);
+
+    if (event == NULL) {
+        json_node_unref(json_data);
+
+        return;
+    }
+
+    data = matrix_event_base_to_binary(event, &error);
+    check(data != NULL, "event %d could not be encoded: %s", n, (error != NULL) ? error->message : "");
+    g_clear_error(&error);
+
+    if (data != NULL) {
+        node = matrix_json_binary_to_node(data, NULL);
+        check(nodes_equal(matrix_event_base_get_json(event), node),
+              "the native writer of %s differs from its JSON form", G_OBJECT_TYPE_NAME(event));
+        g_clear_pointer(&node, json_node_unref);
+
+        decoded = matrix_event_base_new_from_binary(data, NULL);
+        check((decoded != NULL) && (G_OBJECT_TYPE(decoded) == G_OBJECT_TYPE(event)),
+              "event %d decoded to a different class", n);
+        g_clear_object(&decoded);
+        g_bytes_unref(data);
+    }
+
+    g_object_unref(event);
+    json_node_unref(json_data);
+}
+
+int
+main(int argc, char *argv[])
+{
+    GOptionContext *context;
+    GError *error = NULL;
+    JsonNode **events;
+    GBytes **encoded;
+    gint64 start;
+    gdouble elapsed;
+    gsize binary_size = 0;
+    gsize text_size = 0;
+
+    context = g_option_context_new(NULL);
+    g_option_context_set_summary(context, "Benchmark the binary encoding of Matrix events");
+    g_option_context_add_main_entries(context, entries, NULL);
+
+    if (!g_option_context_parse(context, &argc, &argv, &error)) {
+        g_printerr("%s\n", error->message);
+
+        return 1;
+    }
+
+    g_option_context_free(context);
+
+    if (n_events <= 0) {
+        g_printerr("The number of events must be positive\n");
+
+        return 1;
+    }
+
+    /* Build the events up front, so only encoding them is measured */
+    events = g_new(JsonNode *, n_events);
+    encoded = g_new(GBytes *, n_events);
+
+    for (gint i = 0; i < n_events; i++) {
+        events[i] = make_event(i);
+    }
+
+    start = g_get_monotonic_time();
+
+    for (gint i = 0; i < n_events; i++) {
+        encoded[i] = encode(events[i]);
+        binary_size += g_bytes_get_size(encoded[i]);
+    }
+
+    elapsed = (g_get_monotonic_time() - start) / 1000000.0;
+    g_print("binary encode: %d events in %.3f s, %.0f events/s\n", n_events, elapsed, n_events / elapsed);
+
+    start = g_get_monotonic_time();
+
+    for (gint i = 0; i < n_events; i++) {
+        JsonNode *node = matrix_json_binary_to_node(encoded[i], NULL);
+
+        json_node_unref(node);
+    }
+
+    elapsed = (g_get_monotonic_time() - start) / 1000000.0;
+    g_print("binary decode: %d events in %.3f s, %.0f events/s\n", n_events, elapsed, n_events / elapsed);
+
+    start = g_get_monotonic_time();
+
+    for (gint i = 0; i < n_events; i++) {
+        gchar *json = json_to_string(events[i], FALSE);
+        JsonNode *node;
+
+        text_size += strlen(json);
+        node = parse(json);
+        json_node_unref(node);
+        g_free(json);
+    }
+
+    elapsed = (g_get_monotonic_time() - start) / 1000000.0;
+    g_print("JSON text encode and parse: %d events in %.3f s, %.0f events/s\n", n_events, elapsed, n_events / elapsed);
+    g_print("size: %" G_GSIZE_FORMAT " bytes binary, %" G_GSIZE_FORMAT " bytes JSON (%.1f%%)\n",
+            binary_size, text_size, 100.0 * binary_size / text_size);
+
+    for (guint i = 0; samples[i] != NULL; i++) {
+        check_round_trip(samples[i]);
+    }
+
+    for (gint i = 0; i < n_events; i += MAX(1, n_events / 1000)) {
+        JsonNode *node = matrix_json_binary_to_node(encoded[i], NULL);
+
+        check(nodes_equal(events[i], node), "event %d changed after decoding", i);
+        g_clear_pointer(&node, json_node_unref);
+    }
+
+    for (gint i = 0; i < 20; i++) {
+        check_event_round_trip(i);
+    }
+
+    for (gint i = 0; i < n_events; i++) {
+        json_node_unref(events[i]);
+        g_bytes_unref(encoded[i]);
+    }
+
+    g_free(events);
+    g_free(encoded);
+
+    if (failures > 0) {
+        g_printerr("%d checks failed\n", failures);
+
+        return 1;
+    }
+
+    g_print("all checks passed\n");
+
+    return 0;
+}
@@ -0,0 +1,336 @@
+/*
+ * This file is part of matrix-glib-sdk
+ *
+ * matrix-glib-sdk is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * matrix-glib-sdk is distributed in the hope that it will be
+ * useful, but WITHOUT ANY WARRANTY; without even the implied
+ * warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with matrix-glib-sdk. If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Benchmark and checks for MatrixPushRules.
+ *
+ * Loads a rule set shaped like the default one, with a number of keyword rules added, and
+ * reports the rate at which it evaluates synthetic messages.  Then it checks the outcome of
+ * the glob and word matching, the display name, member count and room notification
+ * conditions, and that patterns with many stars are matched in reasonable time.  Exits with a
+ * non-zero status if any check fails.
+ */
+
+#include <string.h>
+#include <glib.h>
+#include <json-glib/json-glib.h>
+
+#include "matrix-profile.h"
+#include "matrix-push-rules.h"
+#include "matrix-room.h"
+
+#define ROOM_ID "!room:example.org"
+#define USER_ID "@alice:example.org"
+
+static gint n_events = 200000;
+static gint n_keywords = 50;
+
+static GOptionEntry entries[] = {
+    {"events", 'e', 0, G_OPTION_ARG_INT, &n_events, "The number of events to evaluate", "N"},
+    {"keywords", 'k', 0, G_OPTION_ARG_INT, &n_keywords, "The number of keyword rules to add", "N"},
+    {NULL}
+};
+
+static gint failures = 0;
+
+#define check(expr, ...) G_STMT_START { \
+    if (!(expr)) { \
+        g_printerr("FAIL: " __VA_ARGS__); \
+        g_printerr("\n"); \
+        failures++; \
+    } \
+} G_STMT_END
+
+static const gchar *rules_json =
+    "{\"global\":{"
+    "\"override\":["
+    "{\"rule_id\":\".m.rule.master\",\"enabled\":false,\"conditions\":[],\"actions\":[\"dont_notify\"]},"
+    "{\"rule_id\":\".m.rule.suppress_notices\",\"conditions\":["
+    "{\"kind\":\"event_match\",\"key\":\"content.msgtype\",\"pattern\":\"m.notice\"}],"
+    "\"actions\":[\"dont_notify\"]},"
+    "{\"rule_id\":\".m.rule.contains_display_name\",\"conditions\":["
+    "{\"kind\":\"contains_display_name\"}],"
+    "\"actions\":[\"notify\",{\"set_tweak\":\"sound\",\"value\":\"default\"},{\"set_tweak\":\"highlight\"}]},"
+    "{\"rule_id\":\".m.rule.roomnotif\",\"conditions\":["
+    "{\"kind\":\"event_match\",\"key\":\"content.body\",\"pattern\":\"@room\"},"
+    "{\"kind\":\"sender_notification_permission\",\"key\":\"room\"}],"
+    "\"actions\":[\"notify\",{\"set_tweak\":\"highlight\",\"value\":true}]},"
+    "{\"rule_id\":\"call\",\"conditions\":["
+    "{\"kind\":\"event_match\",\"key\":\"type\",\"pattern\":\"m.call.*\"}],"
+    "\"actions\":[\"notify\",{\"set_tweak\":\"sound\",\"value\":\"ring\"}]}"
+    "],"
+    "\"content\":["
+    "{\"rule_id\":\".m.rule.contains_user_name\",\"pattern\":\"alice\","
+    "\"actions\":[\"notify\",{\"set_tweak\":\"highlight\"}]},"
+    "{\"rule_id\":\"glob\",\"pattern\":\"foo*bar\",\"actions\":[\"notify\"]},"
+    "{\"rule_id\":\"single\",\"pattern\":\"caf?\",\"actions\":[\"notify\"]},"
+    "{\"rule_id\":\"stars\",\"pattern\":\"*a*a*a*a*a*a*a*a*b\",\"actions\":[\"notify\"]}"
+    "%s"
+    "],"
+    "\"room\":[{\"rule_id\":\"!muted:example.org\",\"actions\":[\"dont_notify\"]}],"
+    "\"sender\":[{\"rule_id\":\"@boss:example.org\",\"actions\":[\"notify\",{\"set_tweak\":\"highlight\"}]}],"
+    "\"underride\":["
+    "{\"rule_id\":\".m.rule.room_one_to_one\",\"conditions\":["
+    "{\"kind\":\"room_member_count\",\"is\":\"2\"},"
+    "{\"kind\":\"event_match\",\"key\":\"type\",\"pattern\":\"m.room.message\"}],"
+    "\"actions\":[\"notify\",{\"set_tweak\":\"sound\",\"value\":\"default\"}]},"
+    "{\"rule_id\":\".m.rule.message\",\"conditions\":["
+    "{\"kind\":\"event_match\",\"key\":\"type\",\"pattern\":\"m.room.message\"}],"
+    "\"actions\":[\"notify\"]}"
+    "]}}";
+
+static JsonNode *
+parse(const gchar *json)
+{
+    JsonParser *parser = json_parser_new();
+    JsonNode *node = NULL;
+
+    if (json_parser_load_from_data(parser, json, -1, NULL)) {
+        node = json_node_copy(json_parser_get_root(parser));
+    }
+
+    g_object_unref(parser);
+
+    return node;
+}
+
+static JsonNode *
+make_event(const gchar *type, const gchar *room_id, const gchar *sender, const gchar *msgtype, const gchar *body)
+{
+    JsonBuilder *builder = json_builder_new();
+    JsonNode *node;
+
+    json_builder_begin_object(builder);
+    json_builder_set_member_name(builder, "type");
+    json_builder_add_string_value(builder, type);
+    json_builder_set_member_name(builder, "room_id");
+    json_builder_add_string_value(builder, room_id);
+    json_builder_set_member_name(builder, "sender");
+    json_builder_add_string_value(builder, sender);
+    json_builder_set_member_name(builder, "content");
+    json_builder_begin_object(builder);
+    json_builder_set_member_name(builder, "msgtype");
+    json_builder_add_string_value(builder, msgtype);
+    json_builder_set_member_name(builder, "body");
+    json_builder_add_string_value(builder, body);
+    json_builder_end_object(builder);
+    json_builder_end_object(builder);
+
+    node = json_builder_get_root(builder);
+    g_object_unref(builder);
+
+    return node;
+}
+
+/*
+ * Evaluate an event, and check the ID of the matching rule (NULL if no rule should match) and
+ * whether it highlights.
+ */
+static void
+check_rule(MatrixPushRules *rules, MatrixRoom *room, const gchar *type, const gchar *room_id, const gchar *sender, const gchar *msgtype, const gchar *body, const gchar *rule_id, gboolean highlight)
+{
+    JsonNode *event = make_event(type, room_id, sender, msgtype, body);
+    MatrixPushRuleResult result;
+    gboolean matched;
+
+    matched = matrix_push_rules_evaluate(rules, event, room, USER_ID, &result);
+
+    if (rule_id == NULL) {
+        check(!matched, "\"%s\" matched %s", body, result.rule_id);
+    } else {
+        check(matched && (g_strcmp0(result.rule_id, rule_id) == 0),
+              "\"%s\" matched %s instead of %s", body, matched ? result.rule_id : "nothing", rule_id);
+        check(!matched || (result.highlight == highlight),
+              "\"%s\" %s highlight", body, highlight ? "should" : "should not");
+    }
+
+    json_node_unref(event);
+}
+
+int
+main(int argc, char *argv[])
+{
+    GOptionContext *context;
+    GError *error = NULL;
+    MatrixPushRules *rules;
+    MatrixRoom *room;
+    MatrixProfile *profile;
+    GString *keywords;
+    gchar *json;
+    JsonNode *rules_node;
+    JsonNode **events;
+    gchar *long_body;
+    gint64 start;
+    gdouble elapsed;
+    guint n_notify = 0;
+
+    context = g_option_context_new(NULL);
+    g_option_context_set_summary(context, "Benchmark the evaluation of Matrix push rules");
+    g_option_context_add_main_entries(context, entries, NULL);
+
+    if (!g_option_context_parse(context, &argc, &argv, &error)) {
+        g_printerr("%s\n", error->message);
+
+        return 1;
+    }
+
+    g_option_context_free(context);
+
+    if ((n_events <= 0) || (n_keywords < 0)) {
+        g_printerr("The number of events must be positive, and the number of keywords not negative\n");
+
+        return 1;
+    }
+
+    keywords = g_string_new(NULL);
+
+    for (gint i = 0; i < n_keywords; i++) {
+        g_string_append_printf(keywords,
+                               ",{\"rule_id\":\"keyword%d\",\"pattern\":\"%skeyword%d\",\"actions\":[\"notify\"]}",
+                               i, (i % 2 == 0) ? "" : "*", i);
+    }
+
+    json = g_strdup_printf(rules_json, keywords->str);
+    g_string_free(keywords, TRUE);
+
+    if ((rules_node = parse(json)) == NULL) {
+        g_printerr("Could not parse the push rules\n");
+
+        return 1;
+    }
+
+    g_free(json);
+
+    rules = matrix_push_rules_new();
+
+    if (!matrix_push_rules_load(rules, rules_node, &error)) {
+        g_printerr("Could not load the push rules: %s\n", error->message);
+
+        return 1;
+    }
+
+    json_node_unref(rules_node);
+
+    // The master rule is disabled, so it’s left out
+    check(matrix_push_rules_get_n_rules(rules) == (guint)(12 + n_keywords),
+          "%u rules were loaded instead of %d", matrix_push_rules_get_n_rules(rules), 12 + n_keywords);
+
+    room = matrix_room_new(ROOM_ID);
+    profile = matrix_profile_new();
+    matrix_profile_set_display_name(profile, "Alice Liddell");
+    matrix_room_add_member(room, USER_ID, profile, FALSE, NULL);
+    matrix_room_set_member_membership(room, USER_ID, MATRIX_ROOM_MEMBERSHIP_JOIN);
+    matrix_room_set_member_membership(room, "@bob:example.org", MATRIX_ROOM_MEMBERSHIP_JOIN);
+
+    /* Build the events up front, so only the evaluation is measured */
+    events = g_new(JsonNode *, n_events);
+
+    for (gint i = 0; i < n_events; i++) {
+        gchar *body = g_strdup_printf("Message number %d, mentioning keyword%d and some other words",
+                                      i, i % (2 * MAX(n_keywords, 1)));
+
+        events[i] = make_event("m.room.message", ROOM_ID, "@bob:example.org", "m.text", body);
+        g_free(body);
+    }
+
+    start = g_get_monotonic_time();
+
+    for (gint i = 0; i < n_events; i++) {
+        MatrixPushRuleResult result;
+
+        if (matrix_push_rules_evaluate(rules, events[i], room, USER_ID, &result) && result.notify) {
+            n_notify++;
+        }
+    }
+
+    elapsed = (g_get_monotonic_time() - start) / 1000000.0;
+    g_print("evaluate: %d events in %.3f s, %.0f events/s (%u rules)\n",
+            n_events, elapsed, n_events / elapsed, matrix_push_rules_get_n_rules(rules));
+    check(n_notify == (guint)n_events, "%u of %d messages notified", n_notify, n_events);
+
+    /* Override rules */
+    check_rule(rules, room, "m.room.message", ROOM_ID, "@bob:example.org", "m.notice", "alice", ".m.rule.suppress_notices", FALSE);
+    check_rule(rules, room, "m.room.message", ROOM_ID, "@bob:example.org", "m.text", "Hi Alice Liddell.", ".m.rule.contains_display_name", TRUE);
+    check_rule(rules, room, "m.room.message", ROOM_ID, "@bob:example.org", "m.text", "Alice Liddellx", ".m.rule.contains_user_name", TRUE);
+    check_rule(rules, room, "m.call.invite", ROOM_ID, "@bob:example.org", "m.text", "call", "call", FALSE);
+    check_rule(rules, room, "m.call", ROOM_ID, "@bob:example.org", "m.text", "m.call", NULL, FALSE);
+
+    /* Only senders with the power level to notify the room can use @room */
+    check_rule(rules, room, "m.room.message", ROOM_ID, "@bob:example.org", "m.text", "Hello @room!", ".m.rule.room_one_to_one", FALSE);
+    matrix_room_set_user_level(room, "@bob:example.org", 100);
+    check_rule(rules, room, "m.room.message", ROOM_ID, "@bob:example.org", "m.text", "Hello @room!", ".m.rule.roomnotif", TRUE);
+    check_rule(rules, room, "m.room.message", ROOM_ID, "@bob:example.org", "m.text", "Hello @roomies", ".m.rule.room_one_to_one", FALSE);
+    matrix_room_set_room_notification_level(room, 101);
+    check_rule(rules, room, "m.room.message", ROOM_ID, "@bob:example.org", "m.text", "Hello @room!", ".m.rule.room_one_to_one", FALSE);
+    matrix_room_set_room_notification_level(room, 50);
+
+    /* Content rules match whole words, case insensitively */
+    check_rule(rules, room, "m.room.message", ROOM_ID, "@bob:example.org", "m.text", "ALICE, are you there?", ".m.rule.contains_user_name", TRUE);
+    check_rule(rules, room, "m.room.message", ROOM_ID, "@bob:example.org", "m.text", "malice", ".m.rule.room_one_to_one", FALSE);
+    check_rule(rules, room, "m.room.message", ROOM_ID, "@bob:example.org", "m.text", "a foo-bar b", "glob", FALSE);
+    check_rule(rules, room, "m.room.message", ROOM_ID, "@bob:example.org", "m.text", "Foobar", "glob", FALSE);
+    check_rule(rules, room, "m.room.message", ROOM_ID, "@bob:example.org", "m.text", "foobar2", ".m.rule.room_one_to_one", FALSE);
+    check_rule(rules, room, "m.room.message", ROOM_ID, "@bob:example.org", "m.text", "fooba", ".m.rule.room_one_to_one", FALSE);
+
+    /* ? matches one character, not one byte */
+    check_rule(rules, room, "m.room.message", ROOM_ID, "@bob:example.org", "m.text", "un caf\xc3\xa9 noir", "single", FALSE);
+    check_rule(rules, room, "m.room.message", ROOM_ID, "@bob:example.org", "m.text", "cafe", "single", FALSE);
+    check_rule(rules, room, "m.room.message", ROOM_ID, "@bob:example.org", "m.text", "caf", ".m.rule.room_one_to_one", FALSE);
+
+    /* Room and sender rules */
+    check_rule(rules, room, "m.room.message", "!muted:example.org", "@bob:example.org", "m.text", "hi", "!muted:example.org", FALSE);
+    check_rule(rules, room, "m.room.message", ROOM_ID, "@boss:example.org", "m.text", "hi", "@boss:example.org", TRUE);
+
+    /* Only joined members count for room_member_count */
+    matrix_room_set_member_membership(room, "@carol:example.org", MATRIX_ROOM_MEMBERSHIP_JOIN);
+    check_rule(rules, room, "m.room.message", ROOM_ID, "@bob:example.org", "m.text", "hi", ".m.rule.message", FALSE);
+    matrix_room_set_member_membership(room, "@carol:example.org", MATRIX_ROOM_MEMBERSHIP_LEAVE);
+    matrix_room_set_member_membership(room, "@dave:example.org", MATRIX_ROOM_MEMBERSHIP_BAN);
+    matrix_room_set_member_membership(room, "@eve:example.org", MATRIX_ROOM_MEMBERSHIP_INVITE);
+    check_rule(rules, room, "m.room.message", ROOM_ID, "@bob:example.org", "m.text", "hi", ".m.rule.room_one_to_one", FALSE);
+    check_rule(rules, NULL, "m.room.message", ROOM_ID, "@bob:example.org", "m.text", "hi", ".m.rule.message", FALSE);
+
+    /* Many stars must not make matching exponential */
+    long_body = g_strnfill(100000, 'a');
+    start = g_get_monotonic_time();
+    check_rule(rules, room, "m.room.message", ROOM_ID, "@bob:example.org", "m.text", long_body, ".m.rule.room_one_to_one", FALSE);
+    elapsed = (g_get_monotonic_time() - start) / 1000000.0;
+    g_print("%d stars against %d characters: %.3f ms\n", 8, 100000, elapsed * 1000);
+    check(elapsed < 1.0, "matching many stars took %.3f s", elapsed);
+    long_body[99999] = 'b';
+    check_rule(rules, room, "m.room.message", ROOM_ID, "@bob:example.org", "m.text", long_body, "stars", FALSE);
+    g_free(long_body);
+
+    for (gint i = 0; i < n_events; i++) {
+        json_node_unref(events[i]);
+    }
+
+    g_free(events);
+    g_object_unref(room);
+    g_object_unref(rules);
+
+    if (failures > 0) {
+        g_printerr("%d checks failed\n", failures);
+
+        return 1;
+    }
+
+    g_print("all checks passed\n");
+
+    return 0;
+}
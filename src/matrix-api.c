@@ -120,6 +120,27 @@ G_DEFINE_INTERFACE(MatrixAPI, matrix_api, G_TYPE_OBJECT);
  * Macro to notify compilers about deprecation, in favour of @f.
  */
 
+/**
+ * MatrixAPICallback:
+ * @api: the #MatrixAPI that sent the request
+ * @content_type: (nullable): the content type of the response
+ * @json_content: (transfer none) (nullable): the content of the response, if it is JSON
+ * @raw_content: (transfer none) (nullable): the content of the response, if it is not JSON
+ * @err: (transfer none) (nullable): the error that happened during the request, if any
+ * @user_data: (nullable): user data set when the request was initiated
+ *
+ * Callback function type for the requests of #MatrixAPI.
+ *
+ * If the homeserver sent an error response, @json_content holds it; details not carried by
+ * @err, like the time to wait before retrying, can be read from it with
+ * matrix_error_response_get_retry_after().
+ *
+ * @json_content, @raw_content and @err are owned by the #MatrixAPI implementation, and are
+ * only valid until the callback returns.  To keep (any part of) @json_content, take a
+ * reference with json_node_ref(); to keep @raw_content, use g_byte_array_ref(); to keep
+ * @err, copy it with g_error_copy().
+ */
+
 /**
  * matrix_api_abort_pending:
  * @api: a #MatrixAPI
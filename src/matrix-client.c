@@ -494,3 +494,37 @@ matrix_client_connect_event(MatrixClient *client,
                                    event_signal_id, equark,
                                    closure, FALSE);
 }
+
+/**
+ * matrix_client_has_event_handler:
+ * @client: a #MatrixClient
+ * @event_gtype: the #GType of a #MatrixEventBase derived type
+ *
+ * Check if anyone would receive a #MatrixClient::event signal emitted for an event of type
+ * @event_gtype.  This includes handlers connected with matrix_client_connect_event() for
+ * @event_gtype, handlers connected to the #MatrixClient::event signal without a detail, and
+ * implementations overriding the event class closure.
+ *
+ * Implementations can use this to avoid constructing event objects nobody listens to.
+ *
+ * Returns: %TRUE if there is at least one consumer for @event_gtype events
+ */
+gboolean
+matrix_client_has_event_handler(MatrixClient *matrix_client, GType event_gtype)
+{
+    MatrixClientInterface *iface;
+
+    g_return_val_if_fail(matrix_client != NULL, FALSE);
+
+    iface = MATRIX_CLIENT_GET_IFACE(matrix_client);
+
+    if (iface->event != matrix_client_real_event) {
+        return TRUE;
+    }
+
+    /* Undetailed handlers are also counted by g_signal_has_handler_pending() */
+    return g_signal_has_handler_pending(matrix_client,
+                                        matrix_client_signals[SIGNAL_EVENT],
+                                        g_type_qname(event_gtype),
+                                        FALSE);
+}
@@ -98,6 +98,7 @@ void matrix_client_connect_event(MatrixClient *client,
                                  MatrixClientEventCallback callback,
                                  gpointer user_data,
                                  GDestroyNotify destroy_notify);
+gboolean matrix_client_has_event_handler(MatrixClient *client, GType event_gtype);
 MatrixProfile *matrix_client_get_user_profile(MatrixClient *client,
                                               const gchar *user_id,
                                               const gchar *room_id,
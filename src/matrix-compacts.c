@@ -19,6 +19,7 @@
 #include <string.h>
 #include <gobject/gvaluecollector.h>
 #include "matrix-compacts.h"
+#include "matrix-json-writer.h"
 #include "matrix-enumtypes.h"
 #include "matrix-types.h"
 #include "utils.h"
@@ -26,6 +27,12 @@
 static JsonNode * matrix_json_compact_get_json_node_impl(MatrixJsonCompact *matrix_json_compact,
                                                          GError **error);
 
+/* Incremented every time a #MatrixJsonCompact changes; used to validate cached data */
+static guint64 matrix_json_compact_stamp = 0;
+
+/* The #MatrixJsonCompact currently being exported by matrix_json_compact_get_json_node() */
+static GPrivate matrix_json_compact_exporting = G_PRIVATE_INIT(NULL);
+
 /**
  * MatrixJsonCompactClass:
  * @finalize: instance finalization function.  Should chain up to the @finalize method of the
@@ -34,9 +41,17 @@ static JsonNode * matrix_json_compact_get_json_node_impl(MatrixJsonCompact *matr
  *
  * Class structure for #MatrixJsonCompact.
  */
+static void
+matrix_json_compact_finalize(MatrixJsonCompact *matrix_json_compact)
+{
+    g_clear_pointer(&(matrix_json_compact->json_data), g_bytes_unref);
+    g_clear_pointer(&(matrix_json_compact->json_deps), g_ptr_array_unref);
+}
+
 static void
 matrix_json_compact_class_init(MatrixJsonCompactClass *klass)
 {
+    ((MatrixJsonCompactClass *)klass)->finalize = matrix_json_compact_finalize;
     ((MatrixJsonCompactClass *)klass)->get_json_node = matrix_json_compact_get_json_node_impl;
 }
 
@@ -62,7 +77,7 @@ matrix_json_compact_init(MatrixJsonCompact *matrix_json_compact)
 
 /**
  * matrix_json_compact_ref:
- * @json_compact: a #MatrixJsonCompact object
+ * @json_compact: (nullable): a #MatrixJsonCompact object
  *
  * Increment reference count on @json_compact.
  *
@@ -71,7 +86,9 @@ matrix_json_compact_init(MatrixJsonCompact *matrix_json_compact)
 MatrixJsonCompact *
 matrix_json_compact_ref(MatrixJsonCompact *matrix_json_compact)
 {
-    g_return_val_if_fail(matrix_json_compact != NULL, NULL);
+    if (matrix_json_compact == NULL) {
+        return NULL;
+    }
 
     ++(matrix_json_compact->refcount);
 
@@ -83,12 +100,13 @@ matrix_json_compact_free(MatrixJsonCompact *matrix_json_compact)
 {
     g_return_if_fail(matrix_json_compact != NULL);
 
-    g_free(matrix_json_compact);
+    MATRIX_JSON_COMPACT_GET_CLASS(matrix_json_compact)->finalize(matrix_json_compact);
+    g_type_free_instance((GTypeInstance *)matrix_json_compact);
 }
 
 /**
  * matrix_json_compact_unref:
- * @json_compact: (transfer full): a #MatrixJsonCompact object
+ * @json_compact: (transfer full) (nullable): a #MatrixJsonCompact object
  *
  * Decrement reference count on @json_compact.
  *
@@ -97,7 +115,9 @@ matrix_json_compact_free(MatrixJsonCompact *matrix_json_compact)
 void
 matrix_json_compact_unref(MatrixJsonCompact *matrix_json_compact)
 {
-    g_return_if_fail(matrix_json_compact != NULL);
+    if (matrix_json_compact == NULL) {
+        return;
+    }
 
     if (--(matrix_json_compact->refcount) == 0) {
         matrix_json_compact_free(matrix_json_compact);
@@ -127,10 +147,139 @@ matrix_json_compact_get_json_node_impl(MatrixJsonCompact *matrix_json_compact, G
 JsonNode *
 matrix_json_compact_get_json_node(MatrixJsonCompact *matrix_json_compact, GError **error)
 {
+    MatrixJsonCompact *parent;
+    JsonNode *result;
+
     g_return_val_if_fail(matrix_json_compact != NULL, NULL);
 
-    return MATRIX_JSON_COMPACT_GET_CLASS(matrix_json_compact)->get_json_node(matrix_json_compact,
-                                                                             error);
+    // Nested compacts export themselves by calling this function, so the compacts a parent
+    // depends on can be recorded here
+    parent = g_private_get(&matrix_json_compact_exporting);
+
+    if (matrix_json_compact->json_deps != NULL) {
+        g_ptr_array_set_size(matrix_json_compact->json_deps, 0);
+    }
+
+    g_private_set(&matrix_json_compact_exporting, matrix_json_compact);
+    result = MATRIX_JSON_COMPACT_GET_CLASS(matrix_json_compact)->get_json_node(matrix_json_compact,
+                                                                               error);
+    g_private_set(&matrix_json_compact_exporting, parent);
+
+    if (parent != NULL) {
+        if (parent->json_deps == NULL) {
+            parent->json_deps = g_ptr_array_new_with_free_func((GDestroyNotify)matrix_json_compact_unref);
+        }
+
+        g_ptr_array_add(parent->json_deps, matrix_json_compact_ref(matrix_json_compact));
+    }
+
+    return result;
+}
+
+/*
+ * Check if neither @json_compact nor any of the compacts it included in its last export
+ * changed since @stamp.
+ */
+static gboolean
+matrix_json_compact_unchanged_since(MatrixJsonCompact *matrix_json_compact, guint64 stamp)
+{
+    guint i;
+
+    if (matrix_json_compact->changed_at > stamp) {
+        return FALSE;
+    }
+
+    if (matrix_json_compact->json_deps == NULL) {
+        return TRUE;
+    }
+
+    for (i = 0; i < matrix_json_compact->json_deps->len; i++) {
+        if (!matrix_json_compact_unchanged_since(g_ptr_array_index(matrix_json_compact->json_deps, i), stamp)) {
+            return FALSE;
+        }
+    }
+
+    return TRUE;
+}
+
+/**
+ * matrix_json_compact_invalidate:
+ * @json_compact: a #MatrixJsonCompact object
+ *
+ * Mark @json_compact as changed, dropping its cached JSON data.  Compacts that include
+ * @json_compact will also be exported again on their next use.
+ *
+ * Subclasses must call this from every function that changes the exported data.
+ */
+void
+matrix_json_compact_invalidate(MatrixJsonCompact *matrix_json_compact)
+{
+    g_return_if_fail(matrix_json_compact != NULL);
+
+    matrix_json_compact->changed_at = ++matrix_json_compact_stamp;
+    g_clear_pointer(&(matrix_json_compact->json_data), g_bytes_unref);
+
+    if (matrix_json_compact->json_deps != NULL) {
+        g_ptr_array_set_size(matrix_json_compact->json_deps, 0);
+    }
+}
+
+/**
+ * matrix_json_compact_get_json_bytes:
+ * @json_compact: a #MatrixJsonCompact object
+ * @error: (nullable): a #GError, or %NULL to ignore errors
+ *
+ * Export the contents of @json_compact as serialized JSON data.
+ *
+ * The result is cached until @json_compact, or any compact included in it, changes, so
+ * exporting the same object repeatedly is cheap.
+ *
+ * Returns: (transfer full): the serialized JSON object, or %NULL on error
+ */
+GBytes *
+matrix_json_compact_get_json_bytes(MatrixJsonCompact *matrix_json_compact, GError **error)
+{
+    MatrixJsonWriter *writer;
+    JsonNode *node;
+    guint64 stamp;
+    GError *inner_error = NULL;
+
+    g_return_val_if_fail(matrix_json_compact != NULL, NULL);
+
+    if ((matrix_json_compact->json_data != NULL) &&
+        matrix_json_compact_unchanged_since(matrix_json_compact, matrix_json_compact->cached_at)) {
+        return g_bytes_ref(matrix_json_compact->json_data);
+    }
+
+    stamp = matrix_json_compact_stamp;
+    node = matrix_json_compact_get_json_node(matrix_json_compact, &inner_error);
+
+    if (inner_error != NULL) {
+        g_propagate_error(error, inner_error);
+
+        return NULL;
+    }
+
+    writer = matrix_json_writer_new();
+
+    if (!matrix_json_writer_add_node(writer, node, &inner_error)) {
+        g_propagate_error(error, inner_error);
+        matrix_json_writer_free(writer);
+        json_node_unref(node);
+
+        return NULL;
+    }
+
+    json_node_unref(node);
+
+    if (matrix_json_compact->json_data != NULL) {
+        g_bytes_unref(matrix_json_compact->json_data);
+    }
+
+    matrix_json_compact->json_data = matrix_json_writer_free_to_bytes(writer);
+    matrix_json_compact->cached_at = stamp;
+
+    return g_bytes_ref(matrix_json_compact->json_data);
 }
 
 /**
@@ -142,8 +291,8 @@ matrix_json_compact_get_json_node(MatrixJsonCompact *matrix_json_compact, GError
  * Export the contents of the @json_compact as a stringified JSON object.  If @datalen is
  * not %NULL, the length of the resulting string is stored there.
  *
- * This function calls matrix_json_compact_get_json_node() internally.  If any error happens
- * during the export, it is stored in @error.
+ * This function calls matrix_json_compact_get_json_bytes() internally, so the serialized
+ * data is cached.  If any error happens during the export, it is stored in @error.
  *
  * The returned string is owned by the caller and must be freed.
  *
@@ -154,28 +303,18 @@ matrix_json_compact_get_json_data(MatrixJsonCompact *matrix_json_compact,
                                   gsize *datalen,
                                   GError **error)
 {
-    gchar* result = NULL;
-    JsonGenerator* generator = NULL;
-    JsonNode* node = NULL;
+    GBytes *data;
+    gchar *result;
     gsize result_len;
-    GError * inner_error = NULL;
 
     g_return_val_if_fail(matrix_json_compact != NULL, NULL);
 
-    node = matrix_json_compact_get_json_node(matrix_json_compact, &inner_error);
-
-    if (inner_error != NULL) {
-        g_object_unref(generator);
-        g_propagate_error (error, inner_error);
-
+    if ((data = matrix_json_compact_get_json_bytes(matrix_json_compact, error)) == NULL) {
         return NULL;
     }
 
-    generator = json_generator_new ();
-    json_generator_set_root (generator, node);
-    result = json_generator_to_data (generator, &result_len);
-    json_node_free(node);
-    g_object_unref(generator);
+    result = g_strndup(g_bytes_get_data(data, &result_len), result_len);
+    g_bytes_unref(data);
 
     if (datalen) {
         *datalen = result_len;
@@ -453,6 +592,8 @@ matrix_filter_rules_set_limit(MatrixFilterRules *matrix_filter_rules, guint limi
     priv = matrix_filter_rules_get_instance_private(matrix_filter_rules);
 
     priv->_limit = limit;
+
+    matrix_json_compact_invalidate(MATRIX_JSON_COMPACT(matrix_filter_rules));
 }
 
 static inline gchar **
@@ -531,6 +672,8 @@ free_array(gpointer *list, gint n_list, GDestroyNotify free_func)
         free_array((gpointer * )priv->_ ## NAME, priv->_ ## NAME ##_len, g_free);  \
         priv->_ ## NAME = copy_str_array(NAME, n_ ## NAME);            \
         priv->_ ## NAME ## _len = n_ ## NAME;                           \
+                                                                        \
+        matrix_json_compact_invalidate(MATRIX_JSON_COMPACT(matrix_filter_rules)); \
     }
 
 /**
@@ -841,6 +984,8 @@ matrix_room_filter_set_include_leave(MatrixRoomFilter *matrix_room_filter, gbool
 
     priv = matrix_room_filter_get_instance_private(matrix_room_filter);
     priv->_include_leave = include_leave;
+
+    matrix_json_compact_invalidate(MATRIX_JSON_COMPACT(matrix_room_filter));
 }
 
 /**
@@ -885,6 +1030,8 @@ matrix_room_filter_set_ephemeral(MatrixRoomFilter *matrix_room_filter, MatrixFil
 
     matrix_json_compact_unref(MATRIX_JSON_COMPACT(priv->_ephemeral));
     priv->_ephemeral = (MatrixFilterRules *)matrix_json_compact_ref(MATRIX_JSON_COMPACT(ephemeral));
+
+    matrix_json_compact_invalidate(MATRIX_JSON_COMPACT(matrix_room_filter));
 }
 
 /**
@@ -927,6 +1074,8 @@ matrix_room_filter_set_state(MatrixRoomFilter *matrix_room_filter, MatrixFilterR
 
     matrix_json_compact_unref(MATRIX_JSON_COMPACT(priv->_state));
     priv->_state = (MatrixFilterRules *)matrix_json_compact_ref(MATRIX_JSON_COMPACT(state));
+
+    matrix_json_compact_invalidate(MATRIX_JSON_COMPACT(matrix_room_filter));
 }
 
 /**
@@ -969,6 +1118,8 @@ matrix_room_filter_set_timeline(MatrixRoomFilter *matrix_room_filter, MatrixFilt
 
     matrix_json_compact_unref(MATRIX_JSON_COMPACT(priv->_timeline));
     priv->_timeline = (MatrixFilterRules *)matrix_json_compact_ref(MATRIX_JSON_COMPACT(timeline));
+
+    matrix_json_compact_invalidate(MATRIX_JSON_COMPACT(matrix_room_filter));
 }
 
 static void
@@ -1139,6 +1290,8 @@ matrix_filter_set_event_fields(MatrixFilter *matrix_filter, gchar **event_fields
     free_array((gpointer *)priv->_event_fields, priv->_event_fields_len, g_free);
     priv->_event_fields = copy_str_array(event_fields, n_event_fields);
     priv->_event_fields_len = n_event_fields;
+
+    matrix_json_compact_invalidate(MATRIX_JSON_COMPACT(matrix_filter));
 }
 
 /**
@@ -1178,6 +1331,8 @@ matrix_filter_set_event_format(MatrixFilter *matrix_filter, MatrixEventFormat ev
     priv = matrix_filter_get_instance_private(matrix_filter);
 
     priv->_event_format = event_format;
+
+    matrix_json_compact_invalidate(MATRIX_JSON_COMPACT(matrix_filter));
 }
 
 /**
@@ -1220,6 +1375,8 @@ matrix_filter_set_presence_filter(MatrixFilter *matrix_filter, MatrixFilterRules
 
     matrix_json_compact_unref(MATRIX_JSON_COMPACT(priv->_presence_filter));
     priv->_presence_filter = (MatrixFilterRules *)matrix_json_compact_ref(MATRIX_JSON_COMPACT(presence_filter));
+
+    matrix_json_compact_invalidate(MATRIX_JSON_COMPACT(matrix_filter));
 }
 
 /**
@@ -1262,6 +1419,8 @@ matrix_filter_set_room_filter(MatrixFilter *matrix_filter, MatrixRoomFilter *roo
 
     matrix_json_compact_unref(MATRIX_JSON_COMPACT(priv->_room_filter));
     priv->_room_filter = (MatrixRoomFilter *)matrix_json_compact_ref(MATRIX_JSON_COMPACT(room_filter));
+
+    matrix_json_compact_invalidate(MATRIX_JSON_COMPACT(matrix_filter));
 }
 
 static void
@@ -1400,6 +1559,8 @@ matrix_3pid_credential_set_id_server(Matrix3PidCredential *matrix_3pid_credentia
 
     g_free(priv->_id_server);
     priv->_id_server = g_strdup(id_server);
+
+    matrix_json_compact_invalidate(MATRIX_JSON_COMPACT(matrix_3pid_credential));
 }
 
 /**
@@ -1442,6 +1603,8 @@ matrix_3pid_credential_set_session_id(Matrix3PidCredential *matrix_3pid_credenti
 
     g_free(priv->_session_id);
     priv->_session_id = g_strdup(session_id);
+
+    matrix_json_compact_invalidate(MATRIX_JSON_COMPACT(matrix_3pid_credential));
 }
 
 /**
@@ -1484,6 +1647,8 @@ matrix_3pid_credential_set_client_secret(Matrix3PidCredential *matrix_3pid_crede
 
     g_free(priv->_client_secret);
     priv->_client_secret = g_strdup(client_secret);
+
+    matrix_json_compact_invalidate(MATRIX_JSON_COMPACT(matrix_3pid_credential));
 }
 
 static void
@@ -1647,6 +1812,8 @@ matrix_pusher_new(void)
                                                                                       \
         g_free(priv->_ ## NAME);                                                     \
         priv->_ ## NAME = g_strdup(NAME);                                            \
+                                                                                      \
+        matrix_json_compact_invalidate(MATRIX_JSON_COMPACT(matrix_pusher));          \
     }
 
 /**
@@ -1752,6 +1919,8 @@ matrix_pusher_set_append(MatrixPusher *matrix_pusher, gboolean append)
     priv = matrix_pusher_get_instance_private(matrix_pusher);
 
     priv->_append = append;
+
+    matrix_json_compact_invalidate(MATRIX_JSON_COMPACT(matrix_pusher));
 }
 
 /**
@@ -1834,6 +2003,8 @@ matrix_pusher_set_profile_tag(MatrixPusher *matrix_pusher, const gchar *profile_
 
     g_free(priv->_profile_tag);
     priv->_profile_tag = g_strndup(profile_tag, 32);
+
+    matrix_json_compact_invalidate(MATRIX_JSON_COMPACT(matrix_pusher));
 }
 
 /**
@@ -1868,6 +2039,8 @@ matrix_pusher_set_pushkey(MatrixPusher *matrix_pusher, const gchar *pushkey)
 
     g_free(priv->_pushkey);
     priv->_pushkey = g_strndup(pushkey, 512);
+
+    matrix_json_compact_invalidate(MATRIX_JSON_COMPACT(matrix_pusher));
 }
 
 /**
@@ -1917,6 +2090,8 @@ matrix_pusher_set_data(MatrixPusher *matrix_pusher, JsonNode *data)
     }
 
     priv->_data = json_node_ref(data);
+
+    matrix_json_compact_invalidate(MATRIX_JSON_COMPACT(matrix_pusher));
 }
 
 static void
@@ -2061,6 +2236,8 @@ matrix_event_context_set_before_limit(MatrixEventContext *matrix_event_context,
     priv = matrix_event_context_get_instance_private(matrix_event_context);
 
     priv->_before_limit = before_limit;
+
+    matrix_json_compact_invalidate(MATRIX_JSON_COMPACT(matrix_event_context));
 }
 
 /**
@@ -2100,6 +2277,8 @@ matrix_event_context_set_after_limit(MatrixEventContext *matrix_event_context, g
     priv = matrix_event_context_get_instance_private(matrix_event_context);
 
     priv->_after_limit = after_limit;
+
+    matrix_json_compact_invalidate(MATRIX_JSON_COMPACT(matrix_event_context));
 }
 
 /**
@@ -2140,6 +2319,8 @@ matrix_event_context_set_include_profile(MatrixEventContext *matrix_event_contex
     priv = matrix_event_context_get_instance_private(matrix_event_context);
 
     priv->_include_profile = include_profile;
+
+    matrix_json_compact_invalidate(MATRIX_JSON_COMPACT(matrix_event_context));
 }
 
 static void
@@ -2263,6 +2444,8 @@ matrix_search_grouping_set_key(MatrixSearchGrouping *matrix_search_grouping, Mat
     priv = matrix_search_grouping_get_instance_private(matrix_search_grouping);
 
     priv->_key = key;
+
+    matrix_json_compact_invalidate(MATRIX_JSON_COMPACT(matrix_search_grouping));
 }
 
 static void
@@ -2423,6 +2606,8 @@ matrix_search_groupings_set_group_by(MatrixSearchGroupings *matrix_search_groupi
     for (gint i = 0; i < n_group_by; i++) {
         priv->_group_by[i] = (MatrixSearchGrouping *)matrix_json_compact_ref(MATRIX_JSON_COMPACT(group_by[i]));
     }
+
+    matrix_json_compact_invalidate(MATRIX_JSON_COMPACT(matrix_search_groupings));
 }
 
 static void
@@ -2616,6 +2801,8 @@ matrix_search_room_events_set_order_by(MatrixSearchRoomEvents *matrix_search_roo
     priv = matrix_search_room_events_get_instance_private(matrix_search_room_events);
 
     priv->_order_by = order_by;
+
+    matrix_json_compact_invalidate(MATRIX_JSON_COMPACT(matrix_search_room_events));
 }
 
 /**
@@ -2669,6 +2856,8 @@ matrix_search_room_events_set_keys(MatrixSearchRoomEvents *matrix_search_room_ev
     for (guint i = 0; i < n_keys; i++) {
         priv->_keys[i] = keys[i];
     }
+
+    matrix_json_compact_invalidate(MATRIX_JSON_COMPACT(matrix_search_room_events));
 }
 
 /**
@@ -2713,6 +2902,8 @@ matrix_search_room_events_set_event_context(MatrixSearchRoomEvents *matrix_searc
 
     matrix_json_compact_unref(MATRIX_JSON_COMPACT(priv->_event_context));
     priv->_event_context = (MatrixEventContext *)matrix_json_compact_ref(MATRIX_JSON_COMPACT(event_context));
+
+    matrix_json_compact_invalidate(MATRIX_JSON_COMPACT(matrix_search_room_events));
 }
 
 /**
@@ -2752,6 +2943,8 @@ matrix_search_room_events_set_include_state(MatrixSearchRoomEvents *matrix_searc
     priv = matrix_search_room_events_get_instance_private(matrix_search_room_events);
 
     priv->_include_state = include_state;
+
+    matrix_json_compact_invalidate(MATRIX_JSON_COMPACT(matrix_search_room_events));
 }
 
 /**
@@ -2797,6 +2990,8 @@ matrix_search_room_events_set_filter_id(MatrixSearchRoomEvents *matrix_search_ro
 
     g_free(priv->_filter_id);
     priv->_filter_id = g_strdup(filter_id);
+
+    matrix_json_compact_invalidate(MATRIX_JSON_COMPACT(matrix_search_room_events));
 }
 
 /**
@@ -2839,6 +3034,8 @@ matrix_search_room_events_set_filter(MatrixSearchRoomEvents *matrix_search_room_
 
     matrix_json_compact_unref(MATRIX_JSON_COMPACT(priv->_filter));
     priv->_filter = (MatrixFilter *)matrix_json_compact_ref(MATRIX_JSON_COMPACT(filter));
+
+    matrix_json_compact_invalidate(MATRIX_JSON_COMPACT(matrix_search_room_events));
 }
 
 /**
@@ -2879,6 +3076,8 @@ matrix_search_room_events_set_search_term(MatrixSearchRoomEvents *matrix_search_
 
     g_free(priv->_search_term);
     priv->_search_term = g_strdup(search_term);
+
+    matrix_json_compact_invalidate(MATRIX_JSON_COMPACT(matrix_search_room_events));
 }
 
 /**
@@ -2921,6 +3120,8 @@ matrix_search_room_events_set_groupings(MatrixSearchRoomEvents *matrix_search_ro
 
     matrix_json_compact_unref(MATRIX_JSON_COMPACT(priv->_groupings));
     priv->_groupings = (MatrixSearchGroupings *)matrix_json_compact_ref(MATRIX_JSON_COMPACT(groupings));
+
+    matrix_json_compact_invalidate(MATRIX_JSON_COMPACT(matrix_search_room_events));
 }
 
 static void
@@ -3066,6 +3267,8 @@ matrix_search_categories_set_room_events(MatrixSearchCategories *matrix_search_c
 
     matrix_json_compact_unref(MATRIX_JSON_COMPACT(priv->_room_events));
     priv->_room_events = (MatrixSearchRoomEvents *)matrix_json_compact_ref(MATRIX_JSON_COMPACT(room_events));
+
+    matrix_json_compact_invalidate(MATRIX_JSON_COMPACT(matrix_search_categories));
 }
 
 static void
@@ -43,6 +43,10 @@ struct _MatrixJsonCompact {
 
     /* < private > */
     volatile int refcount;
+    guint64 changed_at;
+    guint64 cached_at;
+    GBytes *json_data;
+    GPtrArray *json_deps;
 };
 
 struct _MatrixJsonCompactClass {
@@ -57,6 +61,8 @@ MatrixJsonCompact *matrix_json_compact_construct(GType object_type);
 MatrixJsonCompact *matrix_json_compact_ref(MatrixJsonCompact *json_compact);
 JsonNode *matrix_json_compact_get_json_node(MatrixJsonCompact *json_compact, GError **error);
 gchar *matrix_json_compact_get_json_data(MatrixJsonCompact *json_compact, gsize *datalen, GError **error);
+GBytes *matrix_json_compact_get_json_bytes(MatrixJsonCompact *json_compact, GError **error);
+void matrix_json_compact_invalidate(MatrixJsonCompact *json_compact);
 
 #define MATRIX_TYPE_FILTER_RULES matrix_filter_rules_get_type()
 G_DECLARE_DERIVABLE_TYPE(MatrixFilterRules, matrix_filter_rules, MATRIX, FILTER_RULES, MatrixJsonCompact)
@@ -20,6 +20,7 @@
 #include "matrix-types.h"
 #include "matrix-enumtypes.h"
 #include "config.h"
+#include "utils-private.h"
 
 /**
  * SECTION:matrix-event-base
@@ -66,6 +67,8 @@ static void matrix_event_base_g_initable_interface_init (GInitableIface *iface);
  * MatrixEventBaseClass:
  * @from_json: function to initialize themselves from JSON data
  * @to_json: function to export their data to JSON
+ * @to_json_writer: function to write their members into an open JSON object.  Subclasses
+ *     overriding @to_json should override this, too
  *
  * Class structure for #MatrixEventBase.
  */
@@ -153,21 +156,24 @@ matrix_event_base_initialize_from_json(MatrixEventBase *matrix_event_base, JsonN
     priv->_event_type = g_strdup(json_event_type);
 }
 
+static const MatrixJsonField matrix_event_base_fields[] = {
+    MATRIX_JSON_FIELD("type", MATRIX_JSON_FIELD_STRING, MatrixEventBasePrivate, _event_type),
+};
+
 static void
 matrix_event_base_real_from_json(MatrixEventBase *matrix_event_base, JsonNode *json_data, GError **error)
 {
     MatrixEventBasePrivate *priv = matrix_event_base_get_instance_private(matrix_event_base);
-    JsonObject *root;
-    JsonNode *node;
+    guint32 seen;
 
     g_return_if_fail(matrix_event_base != NULL);
 
-    root = json_node_get_object(json_data);
+    seen = _matrix_json_object_decode(json_node_get_object(json_data),
+                                      matrix_event_base_fields,
+                                      G_N_ELEMENTS(matrix_event_base_fields),
+                                      priv);
 
-    if ((node = json_object_get_member(root, "type")) != NULL) {
-        g_free(priv->_event_type);
-        priv->_event_type = g_strdup(json_node_get_string(node));
-    } else if (DEBUG) {
+    if (DEBUG && !(seen & 1)) {
         g_warning("type is not present in an event");
     }
 }
@@ -185,7 +191,7 @@ matrix_event_base_from_json(MatrixEventBase *matrix_event_base, JsonNode *json_d
 {
     g_return_if_fail(matrix_event_base != NULL);
     g_return_if_fail(json_data != NULL);
-    g_return_if_fail(json_node_get_node_type(json_data) != JSON_NODE_OBJECT);
+    g_return_if_fail(json_node_get_node_type(json_data) == JSON_NODE_OBJECT);
 
     MATRIX_EVENT_BASE_GET_CLASS(matrix_event_base)->from_json(matrix_event_base, json_data, error);
 }
@@ -223,11 +229,144 @@ matrix_event_base_to_json(MatrixEventBase *matrix_event_base, JsonNode *json_dat
 {
     g_return_if_fail(matrix_event_base != NULL);
     g_return_if_fail(json_data != NULL);
-    g_return_if_fail(json_node_get_node_type(json_data) != JSON_NODE_OBJECT);
+    g_return_if_fail(json_node_get_node_type(json_data) == JSON_NODE_OBJECT);
 
     MATRIX_EVENT_BASE_GET_CLASS(matrix_event_base)->to_json(matrix_event_base, json_data, error);
 }
 
+static void
+matrix_event_base_real_to_json_writer(MatrixEventBase *matrix_event_base, MatrixJsonWriter *writer, GError **error)
+{
+    MatrixEventBasePrivate *priv = matrix_event_base_get_instance_private(matrix_event_base);
+
+    g_return_if_fail(matrix_event_base != NULL);
+
+    if (priv->_event_type == NULL) {
+        g_set_error(error, MATRIX_ERROR, MATRIX_ERROR_INCOMPLETE,
+                    "Won't generate an event without type");
+
+        return;
+    }
+
+    matrix_json_writer_set_member_name(writer, "type");
+    matrix_json_writer_add_string_value(writer, priv->_event_type);
+}
+
+/*
+ * Check if every class between event_gtype and MatrixEventBase that overrides to_json also
+ * overrides to_json_writer.  If one of them doesn’t, its members would be missing from the
+ * writer’s output.  The result is cached on the type.
+ */
+static gboolean
+matrix_event_base_has_native_writer(GType event_gtype)
+{
+    static GQuark native_writer_quark = 0;
+    gpointer cached;
+    gboolean native = TRUE;
+    GType gtype;
+
+    if (G_UNLIKELY(native_writer_quark == 0)) {
+        native_writer_quark = g_quark_from_static_string("matrix-event-native-writer");
+    }
+
+    if ((cached = g_type_get_qdata(event_gtype, native_writer_quark)) != NULL) {
+        return (GPOINTER_TO_INT(cached) == 1);
+    }
+
+    for (gtype = event_gtype; gtype != MATRIX_EVENT_TYPE_BASE; gtype = g_type_parent(gtype)) {
+        MatrixEventBaseClass *klass = g_type_class_peek(gtype);
+        MatrixEventBaseClass *parent_class = g_type_class_peek(g_type_parent(gtype));
+
+        if ((klass->to_json != parent_class->to_json) &&
+            (klass->to_json_writer == parent_class->to_json_writer)) {
+            native = FALSE;
+
+            break;
+        }
+    }
+
+    g_type_set_qdata(event_gtype, native_writer_quark, GINT_TO_POINTER((native) ? 1 : 2));
+
+    return native;
+}
+
+/**
+ * matrix_event_base_to_json_writer:
+ * @event: a #MatrixEventBase (or derived) object
+ * @writer: a #MatrixJsonWriter
+ * @error: a #GError, or %NULL to ignore errors
+ *
+ * Serialize @event as a JSON object directly into @writer, without building a #JsonNode
+ * tree.  If @writer has an open object, a member name must be set before calling this.
+ *
+ * Event classes that only implement to_json are serialized through a temporary #JsonNode.
+ *
+ * If an error is returned, the contents of @writer are undefined.
+ */
+void
+matrix_event_base_to_json_writer(MatrixEventBase *matrix_event_base, MatrixJsonWriter *writer, GError **error)
+{
+    g_return_if_fail(matrix_event_base != NULL);
+    g_return_if_fail(writer != NULL);
+
+    if (!matrix_event_base_has_native_writer(G_OBJECT_TYPE(matrix_event_base))) {
+        JsonNode *json_data = json_node_new(JSON_NODE_OBJECT);
+        JsonObject *root = json_object_new();
+        GError *inner_error = NULL;
+
+        json_object_set_object_member(root, "content", json_object_new());
+        json_node_take_object(json_data, root);
+
+        MATRIX_EVENT_BASE_GET_CLASS(matrix_event_base)->to_json(matrix_event_base, json_data, &inner_error);
+
+        if (inner_error != NULL) {
+            g_propagate_error(error, inner_error);
+        } else {
+            matrix_json_writer_add_node(writer, json_data, error);
+        }
+
+        json_node_unref(json_data);
+
+        return;
+    }
+
+    matrix_json_writer_begin_object(writer);
+    MATRIX_EVENT_BASE_GET_CLASS(matrix_event_base)->to_json_writer(matrix_event_base, writer, error);
+    matrix_json_writer_end_object(writer);
+}
+
+/**
+ * matrix_event_base_to_binary:
+ * @event: a #MatrixEventBase (or derived) object
+ * @error: a #GError, or %NULL to ignore errors
+ *
+ * Serialize @event into the compact binary encoding of #MatrixJsonWriter, suitable for
+ * storing events locally or passing them to another process.  Use
+ * matrix_event_base_new_from_binary() to load it back.
+ *
+ * Returns: (transfer full) (nullable): the encoded event, or %NULL on error
+ */
+GBytes *
+matrix_event_base_to_binary(MatrixEventBase *matrix_event_base, GError **error)
+{
+    MatrixJsonWriter *writer;
+    GError *inner_error = NULL;
+
+    g_return_val_if_fail(matrix_event_base != NULL, NULL);
+
+    writer = matrix_json_writer_new_binary();
+    matrix_event_base_to_json_writer(matrix_event_base, writer, &inner_error);
+
+    if (inner_error != NULL) {
+        g_propagate_error(error, inner_error);
+        matrix_json_writer_free(writer);
+
+        return NULL;
+    }
+
+    return matrix_json_writer_free_to_bytes(writer);
+}
+
 /**
  * matrix_event_base_new_from_json:
  * @event_type: (nullable) (transfer none): an event type
@@ -293,12 +432,14 @@ matrix_event_base_new_from_json(const gchar *event_type, JsonNode *json_data, GE
 
     ret = (MatrixEventBase *)g_object_new(event_gtype,
                                           "event_type", event_type,
-                                          "json", json_data);
+                                          "json", json_data,
+                                          NULL);
 
     matrix_event_base_initable_init(G_INITABLE(ret), NULL, &inner_error);
 
     if (inner_error != NULL) {
         g_propagate_error(error, inner_error);
+        g_object_unref(ret);
 
         return NULL;
     }
@@ -306,6 +447,37 @@ matrix_event_base_new_from_json(const gchar *event_type, JsonNode *json_data, GE
     return ret;
 }
 
+/**
+ * matrix_event_base_new_from_binary:
+ * @data: (transfer none): event data created by matrix_event_base_to_binary()
+ * @error: (nullable): a #GError, or %NULL to ignore errors
+ *
+ * Create a new #MatrixEventBase derived object from its binary encoding.  See
+ * matrix_event_base_new_from_json() for details on how the event type is chosen.
+ *
+ * The event classes decode themselves from a #JsonNode, so @data is turned into one first;
+ * what this saves compared to JSON text is the parsing.
+ *
+ * Returns: (transfer full) (nullable): a new #MatrixEventBase derived object
+ */
+MatrixEventBase *
+matrix_event_base_new_from_binary(GBytes *data, GError **error)
+{
+    MatrixEventBase *ret;
+    JsonNode *json_data;
+
+    g_return_val_if_fail(data != NULL, NULL);
+
+    if ((json_data = matrix_json_binary_to_node(data, error)) == NULL) {
+        return NULL;
+    }
+
+    ret = matrix_event_base_new_from_json(NULL, json_data, error);
+    json_node_unref(json_data);
+
+    return ret;
+}
+
 /**
  * matrix_event_base_construct:
  * @object_type: a #GType to construct
@@ -352,46 +524,79 @@ matrix_event_base_set_event_type(MatrixEventBase *matrix_event_base, const gchar
                              matrix_event_base_properties[PROP_EVENT_TYPE]);
 }
 
+/**
+ * matrix_event_base_get_json:
+ * @event: a #MatrixEventBase (or derived) object
+ *
+ * Get the JSON representation of @event.
+ *
+ * The node is generated on the first call, and cached until a property of @event changes.
+ * Parts of it may be shared with other nodes, so it must not be modified; to alter it, create
+ * a new object node and add the members to be kept by reference.
+ *
+ * The returned node is owned by @event.  Take a reference with json_node_ref() to keep it
+ * around, as it is released when @event changes or gets finalized.
+ *
+ * Returns: (transfer none) (nullable): the event as a #JsonNode, or %NULL if @event can not
+ *     be exported
+ */
 JsonNode *
 matrix_event_base_get_json(MatrixEventBase *matrix_event_base)
 {
     MatrixEventBasePrivate *priv;
     JsonNode *result;
-    JsonNode *content_node;
     JsonObject *root;
-    JsonObject *content_root;
     GError *inner_error = NULL;
 
     g_return_val_if_fail(matrix_event_base != NULL, NULL);
 
     priv = matrix_event_base_get_instance_private(matrix_event_base);
 
-    result = json_node_new (JSON_NODE_OBJECT);
-    root = json_object_new();
-    json_node_set_object(priv->_json, root);
+    if (priv->_json != NULL) {
+        return priv->_json;
+    }
 
-    content_node = json_node_new(JSON_NODE_OBJECT);
-    content_root = json_object_new();
-    json_node_set_object(content_node, content_root);
-    json_object_set_member(root, "content", content_node);
+    result = json_node_new(JSON_NODE_OBJECT);
+    root = json_object_new();
+    json_object_set_object_member(root, "content", json_object_new());
+    json_node_take_object(result, root);
 
-    matrix_event_base_to_json(matrix_event_base, priv->_json, &inner_error);
+    matrix_event_base_to_json(matrix_event_base, result, &inner_error);
 
     if (inner_error != NULL) {
-        g_error("Unable to generate JSON content: %s", inner_error->message);
+        g_warning("Unable to generate JSON content: %s", inner_error->message);
         g_error_free(inner_error);
-        g_object_unref(result);
+        json_node_unref(result);
 
         return NULL;
     }
 
-    json_node_unref(priv->_json);
-
     priv->_json = result;
 
     return priv->_json;
 }
 
+/**
+ * matrix_event_base_invalidate_json:
+ * @event: a #MatrixEventBase (or derived) object
+ *
+ * Drop the JSON node cached by matrix_event_base_get_json().
+ *
+ * Changing a property of @event does this automatically; subclasses only have to call it
+ * when they change data that is not exposed as a property.
+ */
+void
+matrix_event_base_invalidate_json(MatrixEventBase *matrix_event_base)
+{
+    MatrixEventBasePrivate *priv;
+
+    g_return_if_fail(matrix_event_base != NULL);
+
+    priv = matrix_event_base_get_instance_private(matrix_event_base);
+
+    g_clear_pointer(&(priv->_json), json_node_unref);
+}
+
 static void
 matrix_event_base_set_json(MatrixEventBase *matrix_event_base, JsonNode *json)
 {
@@ -410,6 +615,8 @@ matrix_event_base_set_json(MatrixEventBase *matrix_event_base, JsonNode *json)
         }
     }
 
+    matrix_event_base_invalidate_json(matrix_event_base);
+
     g_object_notify_by_pspec((GObject *)matrix_event_base, matrix_event_base_properties[PROP_JSON]);
 }
 
@@ -465,22 +672,37 @@ matrix_event_base_finalize(GObject *gobject)
         g_error_free(priv->_construct_error);
     }
 
-    priv->_json = (json_node_unref(priv->_json), NULL);
+    g_clear_pointer(&(priv->_json), json_node_unref);
 
     g_free(priv->_event_type);
 
     G_OBJECT_CLASS(matrix_event_base_parent_class)->finalize(gobject);
 }
 
+static void
+matrix_event_base_notify(GObject *gobject, GParamSpec *pspec)
+{
+    // Any property change makes the cached JSON node stale
+    if (pspec != matrix_event_base_properties[PROP_JSON]) {
+        matrix_event_base_invalidate_json(MATRIX_EVENT_BASE(gobject));
+    }
+
+    if (G_OBJECT_CLASS(matrix_event_base_parent_class)->notify != NULL) {
+        G_OBJECT_CLASS(matrix_event_base_parent_class)->notify(gobject, pspec);
+    }
+}
+
 static void
 matrix_event_base_class_init(MatrixEventBaseClass *klass)
 {
     ((MatrixEventBaseClass *)klass)->from_json = matrix_event_base_real_from_json;
     ((MatrixEventBaseClass *)klass)->to_json = matrix_event_base_real_to_json;
+    ((MatrixEventBaseClass *)klass)->to_json_writer = matrix_event_base_real_to_json_writer;
 
     G_OBJECT_CLASS(klass)->get_property = matrix_event_base_get_property;
     G_OBJECT_CLASS(klass)->set_property = matrix_event_base_set_property;
     G_OBJECT_CLASS(klass)->finalize = matrix_event_base_finalize;
+    G_OBJECT_CLASS(klass)->notify = matrix_event_base_notify;
 
     /**
      * MatrixEventBase:event-type:
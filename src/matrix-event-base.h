@@ -21,6 +21,7 @@
 
 # include <glib-object.h>
 # include <json-glib/json-glib.h>
+# include "matrix-json-writer.h"
 
 # define MATRIX_EVENT_TYPE_BASE (matrix_event_base_get_type ())
 # define MATRIX_EVENT_BASE(o) (G_TYPE_CHECK_INSTANCE_CAST((o), MATRIX_EVENT_TYPE_BASE, MatrixEventBase))
@@ -42,6 +43,7 @@ struct _MatrixEventBaseClass {
 
     void (*from_json)(MatrixEventBase *event, JsonNode *json_data, GError **error);
     void (*to_json)(MatrixEventBase *event, JsonNode *json_data, GError **error);
+    void (*to_json_writer)(MatrixEventBase *event, MatrixJsonWriter *writer, GError **error);
 };
 
 GType matrix_event_get_handler(const gchar *event_type);
@@ -51,9 +53,13 @@ void matrix_event_unregister_type(const gchar *event_type);
 GType matrix_event_base_get_type(void) G_GNUC_CONST;
 void matrix_event_base_from_json(MatrixEventBase *event, JsonNode *json_data, GError **error);
 void matrix_event_base_to_json(MatrixEventBase *event, JsonNode *json_data, GError **error);
+void matrix_event_base_to_json_writer(MatrixEventBase *event, MatrixJsonWriter *writer, GError **error);
+GBytes *matrix_event_base_to_binary(MatrixEventBase *event, GError **error);
 MatrixEventBase *matrix_event_base_new_from_json(const gchar *event_type, JsonNode *json_data, GError **error);
+MatrixEventBase *matrix_event_base_new_from_binary(GBytes *data, GError **error);
 MatrixEventBase *matrix_event_base_construct(GType object_type);
 const gchar *matrix_event_base_get_event_type(MatrixEventBase *event);
 JsonNode *matrix_event_base_get_json(MatrixEventBase *event);
+void matrix_event_base_invalidate_json(MatrixEventBase *event);
 
 #endif  /* __MATRIX_GLIX_SDK_EVENT_BASE_H__ */
@@ -416,6 +416,8 @@ matrix_event_call_candidates_set_candidates(MatrixEventCallCandidates *matrix_ev
     for (gint i = 0; i < n_candidates; i++) {
         priv->_candidates[i] = matrix_call_candidate_ref(candidates[i]);
     }
+
+    g_object_notify_by_pspec((GObject *)matrix_event_call_candidates, matrix_event_call_candidates_properties[PROP_CANDIDATES]);
 }
 
 static void
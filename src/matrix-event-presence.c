@@ -20,7 +20,7 @@
 #include "matrix-event-room-base.h"
 #include "matrix-enumtypes.h"
 #include "config.h"
-#include "utils.h"
+#include "utils-private.h"
 
 /**
  * SECTION:matrix-event-presence
@@ -54,6 +54,24 @@ typedef struct {
  */
 G_DEFINE_TYPE_WITH_PRIVATE(MatrixEventPresence, matrix_event_presence, MATRIX_EVENT_TYPE_BASE);
 
+static const MatrixJsonField matrix_event_presence_fields[] = {
+    MATRIX_JSON_FIELD("event_id", MATRIX_JSON_FIELD_STRING, MatrixEventPresencePrivate, _event_id),
+};
+
+enum {
+    CONTENT_FIELD_USER_ID,
+    CONTENT_FIELD_LAST_ACTIVE_AGO,
+    CONTENT_FIELD_AVATAR_URL,
+    CONTENT_FIELD_DISPLAY_NAME
+};
+
+static const MatrixJsonField matrix_event_presence_content_fields[] = {
+    [CONTENT_FIELD_USER_ID] = MATRIX_JSON_FIELD("user_id", MATRIX_JSON_FIELD_STRING, MatrixEventPresencePrivate, _user_id),
+    [CONTENT_FIELD_LAST_ACTIVE_AGO] = MATRIX_JSON_FIELD("last_active_ago", MATRIX_JSON_FIELD_LONG, MatrixEventPresencePrivate, _last_active_ago),
+    [CONTENT_FIELD_AVATAR_URL] = MATRIX_JSON_FIELD("avatar_url", MATRIX_JSON_FIELD_STRING, MatrixEventPresencePrivate, _avatar_url),
+    [CONTENT_FIELD_DISPLAY_NAME] = MATRIX_JSON_FIELD("displayname", MATRIX_JSON_FIELD_STRING, MatrixEventPresencePrivate, _display_name),
+};
+
 static void
 matrix_event_presence_real_from_json(MatrixEventBase *matrix_event_base, JsonNode *json_data, GError **error)
 {
@@ -62,6 +80,7 @@ matrix_event_presence_real_from_json(MatrixEventBase *matrix_event_base, JsonNod
     JsonNode *node;
     JsonObject *root;
     JsonObject *content_root;
+    guint32 seen;
     GError *inner_error = NULL;
 
     g_return_if_fail(json_data != NULL);
@@ -72,17 +91,20 @@ matrix_event_presence_real_from_json(MatrixEventBase *matrix_event_base, JsonNod
     content_node = json_object_get_member(root, "content");
     content_root = json_node_get_object(content_node);
 
-    if ((node = json_object_get_member(root, "event_id")) != NULL) {
-        g_free(priv->_event_id);
-        priv->_event_id = g_strdup(json_node_get_string(node));
-    } else if (DEBUG) {
+    if (!_matrix_json_object_decode(root,
+                                    matrix_event_presence_fields,
+                                    G_N_ELEMENTS(matrix_event_presence_fields),
+                                    priv)
+        && DEBUG) {
         g_warning("event_id is missing from a m.presence event");
     }
 
-    if ((node = json_object_get_member(content_root, "user_id")) != NULL) {
-        g_free(priv->_user_id);
-        priv->_user_id = g_strdup(json_node_get_string(node));
-    } else if (DEBUG) {
+    seen = _matrix_json_object_decode(content_root,
+                                      matrix_event_presence_content_fields,
+                                      G_N_ELEMENTS(matrix_event_presence_content_fields),
+                                      priv);
+
+    if (!(seen & (1 << CONTENT_FIELD_USER_ID)) && DEBUG) {
         g_warning("content.user_id is missing from the m.presence event");
 
         // Workaround for having sender instead of content.user_id
@@ -93,20 +115,6 @@ matrix_event_presence_real_from_json(MatrixEventBase *matrix_event_base, JsonNod
         }
     }
 
-    if ((node = json_object_get_member(content_root, "last_active_ago")) != NULL) {
-        priv->_last_active_ago = json_node_get_int(node);
-    }
-
-    if ((node = json_object_get_member(content_root, "avatar_url")) != NULL) {
-        g_free(priv->_avatar_url);
-        priv->_avatar_url = g_strdup(json_node_get_string(node));
-    }
-
-    if ((node = json_object_get_member(content_root, "displayname")) != NULL) {
-        g_free(priv->_display_name);
-        priv->_display_name = g_strdup(json_node_get_string(node));
-    }
-
     if ((node = json_object_get_member(content_root, "presence")) != NULL) {
         MatrixPresence presence;
 
@@ -20,6 +20,7 @@
 #include "matrix-types.h"
 #include "matrix-enumtypes.h"
 #include "config.h"
+#include "utils-private.h"
 
 /**
  * SECTION:matrix-event-receipt
@@ -44,13 +45,21 @@ typedef struct {
  */
 G_DEFINE_TYPE_WITH_PRIVATE(MatrixEventReceipt, matrix_event_receipt, MATRIX_EVENT_TYPE_BASE);
 
+/* typ is an interned string for the receipt types defined by the spec, and a copy owned by
+ * the receipt data for any other */
 typedef struct {
     gchar *event_id;
-    gchar *typ;
+    const gchar *typ;
     gchar *user;
     guint refcount;
 } ReceiptData;
 
+static guint
+_rd_hash(ReceiptData *key)
+{
+    return g_str_hash(key->event_id) ^ g_str_hash(key->user) ^ g_str_hash(key->typ);
+}
+
 static gboolean
 _rd_equal(ReceiptData *k1, ReceiptData *k2) {
     if ((k1 == NULL) && (k2 == NULL)) {
@@ -62,7 +71,7 @@ _rd_equal(ReceiptData *k1, ReceiptData *k2) {
     }
 
     return ((g_strcmp0(k1->event_id, k2->event_id) == 0) &&
-            (g_strcmp0(k1->typ, k2->typ) == 0) &&
+            ((k1->typ == k2->typ) || (g_strcmp0(k1->typ, k2->typ) == 0)) &&
             (g_strcmp0(k1->user, k2->user) == 0));
 }
 
@@ -71,8 +80,11 @@ _rd_free(ReceiptData *receipt_data) {
     g_return_if_fail(receipt_data != NULL);
 
     if ( --receipt_data->refcount == 0) {
+        if (_matrix_receipt_type_intern(receipt_data->typ) == NULL) {
+            g_free((gchar *)receipt_data->typ);
+        }
+
         g_free(receipt_data->event_id);
-        g_free(receipt_data->typ);
         g_free(receipt_data->user);
 
         g_free(receipt_data);
@@ -82,37 +94,55 @@ _rd_free(ReceiptData *receipt_data) {
 static void
 process_event(JsonObject *obj, const gchar *key, JsonNode *member_node, gpointer user_data)
 {
-    JsonNode *node;
     MatrixEventReceiptPrivate *priv = user_data;
+    JsonObjectIter type_iter;
+    JsonNode *type_node;
+    const gchar *type_key;
+
+    if (!JSON_NODE_HOLDS_OBJECT(member_node)) {
+        g_warning("content.%s is not an object in a m.receipt event", key);
+
+        return;
+    }
+
+    json_object_iter_init(&type_iter, json_node_get_object(member_node));
 
-    if ((node = json_object_get_member(json_node_get_object(member_node), "m.read")) != NULL) {
-        JsonObject *read_obj = json_node_get_object(node);
+    while (json_object_iter_next(&type_iter, &type_key, &type_node)) {
+        const gchar *typ = _matrix_receipt_type_intern(type_key);
         JsonObjectIter inner_iter;
         JsonNode *inner_node;
         const gchar *inner_key;
 
-        json_object_iter_init(&inner_iter, read_obj);
+        if (!JSON_NODE_HOLDS_OBJECT(type_node)) {
+            continue;
+        }
+
+        json_object_iter_init(&inner_iter, json_node_get_object(type_node));
 
         while (json_object_iter_next(&inner_iter, &inner_key, &inner_node)) {
             gulong *value;
             ReceiptData *rd_key;
+            JsonNode *ts_node = NULL;
 
             if (priv->_receipt_data == NULL) {
-                priv->_receipt_data = g_hash_table_new_full(g_direct_hash, (GEqualFunc)_rd_equal, (GDestroyNotify)_rd_free, g_free);
+                priv->_receipt_data = g_hash_table_new_full((GHashFunc)_rd_hash, (GEqualFunc)_rd_equal, (GDestroyNotify)_rd_free, g_free);
             }
 
             rd_key = g_new(ReceiptData, 1);
             rd_key->event_id = g_strdup(key);
-            rd_key->typ = g_strdup("m.read");
+            rd_key->typ = (typ != NULL) ? typ : g_strdup(type_key);
             rd_key->user = g_strdup(inner_key);
+            rd_key->refcount = 1;
+
+            if (JSON_NODE_HOLDS_OBJECT(inner_node)) {
+                ts_node = json_object_get_member(json_node_get_object(inner_node), "ts");
+            }
 
             value = g_new(gulong, 1);
-            *value = json_node_get_int(json_object_get_member(json_node_get_object(inner_node), "ts"));
+            *value = (ts_node != NULL) ? json_node_get_int(ts_node) : 0;
 
             g_hash_table_replace(priv->_receipt_data, rd_key, value);
         }
-    } else {
-        g_warning("content.$event-id.m.read is missing from a m.presence event");
     }
 }
 
@@ -174,6 +204,13 @@ matrix_event_receipt_real_to_json(MatrixEventBase *matrix_event_base, JsonNode *
         return;
     }
 
+    if (priv->_receipt_data == NULL) {
+        g_set_error(error, MATRIX_ERROR, MATRIX_ERROR_INCOMPLETE,
+                    "Won't generate a m.receipt event with no receipts");
+
+        return;
+    }
+
     root = json_node_get_object(json_data);
     content_node = json_object_get_member(root, "content");
     content_root = json_node_get_object(content_node);
@@ -323,7 +360,7 @@ matrix_event_receipt_finalize(GObject *gobject)
     MatrixEventReceiptPrivate *priv = matrix_event_receipt_get_instance_private(MATRIX_EVENT_RECEIPT(gobject));
 
     g_free(priv->_room_id);
-    g_hash_table_unref(priv->_receipt_data);
+    g_clear_pointer(&(priv->_receipt_data), g_hash_table_unref);
 
     G_OBJECT_CLASS(matrix_event_receipt_parent_class)->finalize(gobject);
 }
@@ -211,6 +211,10 @@ matrix_event_room_aliases_set_aliases(MatrixEventRoomAliases *matrix_event_room_
     for (gint i = 0; i < n_aliases; i++) {
         priv->_aliases[i] = g_strdup(aliases[i]);
     }
+
+    priv->_aliases_len = n_aliases;
+
+    g_object_notify_by_pspec((GObject *)matrix_event_room_aliases, matrix_event_room_aliases_properties[PROP_ALIASES]);
 }
 
 static void
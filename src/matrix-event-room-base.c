@@ -18,6 +18,8 @@
 
 #include "matrix-event-room-base.h"
 #include "config.h"
+#include "matrix-types.h"
+#include "utils-private.h"
 
 /**
  * SECTION:matrix-event-room-base
@@ -58,68 +60,58 @@ typedef struct {
  */
 G_DEFINE_ABSTRACT_TYPE_WITH_PRIVATE(MatrixEventRoom, matrix_event_room, MATRIX_EVENT_TYPE_BASE);
 
+static const MatrixJsonField matrix_event_room_unsigned_fields[] = {
+    MATRIX_JSON_FIELD("age", MATRIX_JSON_FIELD_LONG, MatrixEventRoomPrivate, _age),
+    MATRIX_JSON_FIELD("redacted_because", MATRIX_JSON_FIELD_STRING, MatrixEventRoomPrivate, _redacted_because),
+    MATRIX_JSON_FIELD("transaction_id", MATRIX_JSON_FIELD_STRING, MatrixEventRoomPrivate, _transaction_id),
+};
+
+enum {
+    FIELD_EVENT_ID,
+    FIELD_ROOM_ID,
+    FIELD_SENDER,
+    FIELD_UNSIGNED
+};
+
+static const MatrixJsonField matrix_event_room_fields[] = {
+    [FIELD_EVENT_ID] = MATRIX_JSON_FIELD("event_id", MATRIX_JSON_FIELD_STRING, MatrixEventRoomPrivate, _event_id),
+    [FIELD_ROOM_ID] = MATRIX_JSON_FIELD("room_id", MATRIX_JSON_FIELD_STRING, MatrixEventRoomPrivate, _room_id),
+    [FIELD_SENDER] = MATRIX_JSON_FIELD("sender", MATRIX_JSON_FIELD_STRING, MatrixEventRoomPrivate, _sender),
+    [FIELD_UNSIGNED] = MATRIX_JSON_FIELD_NESTED("unsigned", matrix_event_room_unsigned_fields),
+};
+
 static void
 matrix_event_room_real_from_json(MatrixEventBase *matrix_event_base, JsonNode *json_data, GError **error)
 {
-    MatrixEventRoom *matrix_event_room;
     MatrixEventRoomPrivate *priv;
-    JsonObject *root;
-    JsonNode *node;
+    guint32 seen;
     GError *inner_error = NULL;
 
     g_return_if_fail(json_data != NULL);
 
-    matrix_event_room = MATRIX_EVENT_ROOM(matrix_event_base);
-    priv = matrix_event_room_get_instance_private(matrix_event_room);
-
-    root = json_node_get_object(json_data);
-
-    if ((node = json_object_get_member (root, "event_id")) != NULL) {
-        g_free(priv->_event_id);
-        priv->_event_id = g_strdup(json_node_get_string(node));
-    } else if (DEBUG) {
-        g_warning ("matrix-event-room-base.vala:71: event_id is missing from a Room event");
-    }
-
-    if ((node = json_object_get_member(root, "room_id")) != NULL) {
-        g_free(priv->_room_id);
-        priv->_room_id = g_strdup(json_node_get_string(node));
-    } else if (DEBUG) {
-        g_warning ("matrix-event-room-base.vala:77: room_id is missing from a Room event");
-    }
-
-    if ((node = json_object_get_member(root, "sender")) != NULL) {
-        g_free(priv->_sender);
-        priv->_sender = g_strdup(json_node_get_string(node));
-    } else if (DEBUG) {
-        g_warning ("matrix-event-room-base.vala:83: sender is missing from a Room event");
-    }
-
-    if ((node = json_object_get_member(root, "unsigned")) != NULL) {
-        JsonObject* unsigned_root = NULL;
+    priv = matrix_event_room_get_instance_private(MATRIX_EVENT_ROOM(matrix_event_base));
 
-        unsigned_root = json_node_get_object(node);
+    seen = _matrix_json_object_decode(json_node_get_object(json_data),
+                                      matrix_event_room_fields,
+                                      G_N_ELEMENTS(matrix_event_room_fields),
+                                      priv);
 
-        if ((node = json_object_get_member (unsigned_root, "age")) != NULL) {
-            priv->_age = json_node_get_int(node);
+    if (DEBUG) {
+        if (!(seen & (1 << FIELD_EVENT_ID))) {
+            g_warning("event_id is missing from a Room event");
         }
 
-        if ((node = json_object_get_member(unsigned_root, "redacted_because")) != NULL) {
-            g_free(priv->_redacted_because);
-            priv->_redacted_because = g_strdup(json_node_get_string(node));
+        if (!(seen & (1 << FIELD_ROOM_ID))) {
+            g_warning("room_id is missing from a Room event");
         }
 
-        if ((node = json_object_get_member(unsigned_root, "transaction_id")) != NULL) {
-            g_free(priv->_transaction_id);
-            priv->_transaction_id = g_strdup(json_node_get_string(node));
+        if (!(seen & (1 << FIELD_SENDER))) {
+            g_warning("sender is missing from a Room event");
         }
     }
 
     MATRIX_EVENT_BASE_CLASS(matrix_event_room_parent_class)->from_json(matrix_event_base, json_data, &inner_error);
 
-    json_object_unref(root);
-    json_node_unref(node);
-
     if (inner_error != NULL) {
         g_propagate_error(error, inner_error);
 
@@ -180,7 +172,6 @@ matrix_event_room_real_to_json(MatrixEventBase *matrix_event_base, JsonNode *jso
     MATRIX_EVENT_BASE_CLASS(matrix_event_room_parent_class)->to_json(MATRIX_EVENT_BASE(matrix_event_base), json_data, &inner_error);
 
     json_object_unref(unsigned_obj);
-    json_object_unref(root_obj);
 
     if (inner_error != NULL) {
         g_propagate_error(error, inner_error);
@@ -189,6 +180,53 @@ matrix_event_room_real_to_json(MatrixEventBase *matrix_event_base, JsonNode *jso
     }
 }
 
+static void
+matrix_event_room_real_to_json_writer(MatrixEventBase *matrix_event_base, MatrixJsonWriter *writer, GError **error)
+{
+    MatrixEventRoomPrivate *priv;
+
+    priv = matrix_event_room_get_instance_private(MATRIX_EVENT_ROOM(matrix_event_base));
+
+    if (priv->_event_id != NULL) {
+        matrix_json_writer_set_member_name(writer, "event_id");
+        matrix_json_writer_add_string_value(writer, priv->_event_id);
+    }
+
+    if (priv->_room_id != NULL) {
+        matrix_json_writer_set_member_name(writer, "room_id");
+        matrix_json_writer_add_string_value(writer, priv->_room_id);
+    }
+
+    if (priv->_sender != NULL) {
+        matrix_json_writer_set_member_name(writer, "sender");
+        matrix_json_writer_add_string_value(writer, priv->_sender);
+    }
+
+    if ((priv->_age >= 0) || (priv->_redacted_because != NULL) || (priv->_transaction_id != NULL)) {
+        matrix_json_writer_set_member_name(writer, "unsigned");
+        matrix_json_writer_begin_object(writer);
+
+        if (priv->_age >= 0) {
+            matrix_json_writer_set_member_name(writer, "age");
+            matrix_json_writer_add_int_value(writer, priv->_age);
+        }
+
+        if (priv->_redacted_because != NULL) {
+            matrix_json_writer_set_member_name(writer, "redacted_because");
+            matrix_json_writer_add_string_value(writer, priv->_redacted_because);
+        }
+
+        if (priv->_transaction_id != NULL) {
+            matrix_json_writer_set_member_name(writer, "transaction_id");
+            matrix_json_writer_add_string_value(writer, priv->_transaction_id);
+        }
+
+        matrix_json_writer_end_object(writer);
+    }
+
+    MATRIX_EVENT_BASE_CLASS(matrix_event_room_parent_class)->to_json_writer(matrix_event_base, writer, error);
+}
+
 /**
  * matrix_event_room_construct:
  * @object_type: the #GType of the object to be created
@@ -493,6 +531,97 @@ matrix_event_room_set_transaction_id(MatrixEventRoom *matrix_event_room, const g
     }
 }
 
+/**
+ * matrix_event_room_apply_redaction:
+ * @event: a #MatrixEventRoom derived object
+ * @redacted_because: (nullable): the ID of the redaction event
+ * @error: (nullable): a #GError, or %NULL to ignore errors
+ *
+ * Strip @event to the keys a redaction keeps, as described in the Client-Server API, and set
+ * #MatrixEventRoom:redacted-because to @redacted_because.  @event is modified in place, so
+ * everyone holding a reference to it sees the redacted version.
+ *
+ * This only changes the local copy of @event; to redact an event on the server, use
+ * matrix_api_redact_event().
+ *
+ * Returns: %TRUE on success
+ */
+gboolean
+matrix_event_room_apply_redaction(MatrixEventRoom *matrix_event_room, const gchar *redacted_because, GError **error)
+{
+    JsonNode *json;
+    JsonNode *redacted_json;
+    MatrixEventBase *redacted;
+    GParamSpec **pspecs;
+    guint n_pspecs;
+    GError *inner_error = NULL;
+
+    g_return_val_if_fail(matrix_event_room != NULL, FALSE);
+
+    if ((json = matrix_event_base_get_json(MATRIX_EVENT_BASE(matrix_event_room))) == NULL) {
+        g_set_error(error, MATRIX_ERROR, MATRIX_ERROR_INCOMPLETE,
+                    "Event can not be exported to JSON");
+
+        return FALSE;
+    }
+
+    redacted_json = _matrix_event_json_redact(json, redacted_because);
+    redacted = matrix_event_base_new_from_json(matrix_event_base_get_event_type(MATRIX_EVENT_BASE(matrix_event_room)),
+                                               redacted_json, error);
+
+    if (redacted == NULL) {
+        json_node_unref(redacted_json);
+
+        return FALSE;
+    }
+
+    if (G_OBJECT_TYPE(redacted) != G_OBJECT_TYPE(matrix_event_room)) {
+        g_set_error(error, MATRIX_ERROR, MATRIX_ERROR_INVALID_TYPE,
+                    "Redacted event has a different type");
+        g_object_unref(redacted);
+        json_node_unref(redacted_json);
+
+        return FALSE;
+    }
+
+    /* Copy every property of the freshly decoded, redacted event over the existing ones.  This
+     * resets the properties whose data was stripped, whichever subclass defines them.  Loading
+     * the redacted JSON afterwards takes care of data not exposed as writable properties. */
+    pspecs = g_object_class_list_properties(G_OBJECT_GET_CLASS(matrix_event_room), &n_pspecs);
+    g_object_freeze_notify((GObject *)matrix_event_room);
+
+    for (guint i = 0; i < n_pspecs; i++) {
+        GValue value = G_VALUE_INIT;
+
+        if (((pspecs[i]->flags & G_PARAM_READWRITE) != G_PARAM_READWRITE)
+            || (pspecs[i]->flags & G_PARAM_CONSTRUCT_ONLY)) {
+            continue;
+        }
+
+        g_value_init(&value, G_PARAM_SPEC_VALUE_TYPE(pspecs[i]));
+        g_object_get_property((GObject *)redacted, pspecs[i]->name, &value);
+        g_object_set_property((GObject *)matrix_event_room, pspecs[i]->name, &value);
+        g_value_unset(&value);
+    }
+
+    matrix_event_base_from_json(MATRIX_EVENT_BASE(matrix_event_room), redacted_json, &inner_error);
+    g_object_thaw_notify((GObject *)matrix_event_room);
+    g_free(pspecs);
+    g_object_unref(redacted);
+    json_node_unref(redacted_json);
+
+    /* Data changed by from_json doesn’t always emit a notification */
+    matrix_event_base_invalidate_json(MATRIX_EVENT_BASE(matrix_event_room));
+
+    if (inner_error != NULL) {
+        g_propagate_error(error, inner_error);
+
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
 static void
 matrix_event_room_get_property(GObject *gobject, guint property_id, GValue* value, GParamSpec* pspec)
 {
@@ -586,6 +715,7 @@ matrix_event_room_class_init(MatrixEventRoomClass *klass)
 {
     ((MatrixEventBaseClass *)klass)->from_json = matrix_event_room_real_from_json;
     ((MatrixEventBaseClass *)klass)->to_json = matrix_event_room_real_to_json;
+    ((MatrixEventBaseClass *)klass)->to_json_writer = matrix_event_room_real_to_json_writer;
     G_OBJECT_CLASS (klass)->get_property = matrix_event_room_get_property;
     G_OBJECT_CLASS (klass)->set_property = matrix_event_room_set_property;
     G_OBJECT_CLASS (klass)->finalize = matrix_event_room_finalize;
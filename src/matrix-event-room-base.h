@@ -42,5 +42,6 @@ const gchar *matrix_event_room_get_redacted_because(MatrixEventRoom *event);
 void matrix_event_room_set_redacted_because(MatrixEventRoom *event, const gchar *redacted_because);
 const gchar *matrix_event_room_get_transaction_id(MatrixEventRoom *event);
 void matrix_event_room_set_transaction_id(MatrixEventRoom *event, const gchar *transaction_id);
+gboolean matrix_event_room_apply_redaction(MatrixEventRoom *event, const gchar *redacted_because, GError **error);
 
 #endif  /* __MATRIX_GLIB_SDK_EVENT_ROOM_BASE_H__ */
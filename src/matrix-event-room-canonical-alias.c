@@ -19,6 +19,7 @@
 #include "matrix-event-room-canonical-alias.h"
 #include "matrix-types.h"
 #include "config.h"
+#include "utils-private.h"
 
 /**
  * SECTION:matrix-event-room-canonical-alias
@@ -47,6 +48,10 @@ typedef struct {
  */
 G_DEFINE_TYPE_WITH_PRIVATE(MatrixEventRoomCanonicalAlias, matrix_event_room_canonical_alias, MATRIX_EVENT_TYPE_STATE);
 
+static const MatrixJsonField matrix_event_room_canonical_alias_content_fields[] = {
+    MATRIX_JSON_FIELD("alias", MATRIX_JSON_FIELD_STRING, MatrixEventRoomCanonicalAliasPrivate, _canonical_alias),
+};
+
 static void
 matrix_event_room_canonical_alias_real_from_json(MatrixEventBase *matrix_event_base, JsonNode *json_data, GError **error)
 {
@@ -54,7 +59,9 @@ matrix_event_room_canonical_alias_real_from_json(MatrixEventBase *matrix_event_b
     JsonObject *root;
     JsonObject *content_root;
     JsonNode *content_node;
+#if DEBUG
     JsonNode *node;
+#endif
 
     g_return_if_fail (json_data != NULL);
 
@@ -68,16 +75,16 @@ matrix_event_room_canonical_alias_real_from_json(MatrixEventBase *matrix_event_b
     if ((node = json_object_get_member(root, "state_key")) != NULL) {
         const gchar *state_key = json_node_get_string(node);
 
-        if ((state_key == NULL) || (*state_key == 0)) {
+        if ((state_key != NULL) && (*state_key != 0)) {
             g_warning("state_key of a m.room.canonical_alias event is non-empty");
         }
     }
 #endif
 
-    if ((node = json_object_get_member(content_root, "alias")) != NULL) {
-        g_free(priv->_canonical_alias);
-        priv->_canonical_alias = g_strdup(json_node_get_string(node));
-    }
+    _matrix_json_object_decode(content_root,
+                               matrix_event_room_canonical_alias_content_fields,
+                               G_N_ELEMENTS(matrix_event_room_canonical_alias_content_fields),
+                               priv);
 
     MATRIX_EVENT_BASE_CLASS(matrix_event_room_canonical_alias_parent_class)->from_json(matrix_event_base, json_data, error);
 }
@@ -99,7 +106,7 @@ matrix_event_room_canonical_alias_real_to_json(MatrixEventBase *matrix_event_bas
     content_root = json_node_get_object(content_node);
 
     state_key = matrix_event_state_get_state_key(MATRIX_EVENT_STATE(matrix_event_base));
-    if ((state_key == NULL) || (*state_key == 0)) {
+    if ((state_key != NULL) && (*state_key != 0)) {
         g_set_error(error, MATRIX_ERROR, MATRIX_ERROR_INCOMPLETE,
                     "Won't generate a m.room.canonical_alias event with a non-empty state_key");
 
@@ -113,6 +120,35 @@ matrix_event_room_canonical_alias_real_to_json(MatrixEventBase *matrix_event_bas
     MATRIX_EVENT_BASE_CLASS(matrix_event_room_canonical_alias_parent_class)->to_json(matrix_event_base, json_data, error);
 }
 
+static void
+matrix_event_room_canonical_alias_real_to_json_writer(MatrixEventBase *matrix_event_base, MatrixJsonWriter *writer, GError **error)
+{
+    MatrixEventRoomCanonicalAliasPrivate *priv;
+    const gchar *state_key;
+
+    priv = matrix_event_room_canonical_alias_get_instance_private(MATRIX_EVENT_ROOM_CANONICAL_ALIAS(matrix_event_base));
+    state_key = matrix_event_state_get_state_key(MATRIX_EVENT_STATE(matrix_event_base));
+
+    if ((state_key != NULL) && (*state_key != 0)) {
+        g_set_error(error, MATRIX_ERROR, MATRIX_ERROR_INCOMPLETE,
+                    "Won't generate a m.room.canonical_alias event with a non-empty state_key");
+
+        return;
+    }
+
+    matrix_json_writer_set_member_name(writer, "content");
+    matrix_json_writer_begin_object(writer);
+
+    if (priv->_canonical_alias != NULL) {
+        matrix_json_writer_set_member_name(writer, "alias");
+        matrix_json_writer_add_string_value(writer, priv->_canonical_alias);
+    }
+
+    matrix_json_writer_end_object(writer);
+
+    MATRIX_EVENT_BASE_CLASS(matrix_event_room_canonical_alias_parent_class)->to_json_writer(matrix_event_base, writer, error);
+}
+
 /**
  * matrix_event_room_canonical_alias_new:
  *
@@ -220,6 +256,7 @@ matrix_event_room_canonical_alias_class_init(MatrixEventRoomCanonicalAliasClass
 {
     ((MatrixEventBaseClass *)klass)->from_json = matrix_event_room_canonical_alias_real_from_json;
     ((MatrixEventBaseClass *)klass)->to_json = matrix_event_room_canonical_alias_real_to_json;
+    ((MatrixEventBaseClass *)klass)->to_json_writer = matrix_event_room_canonical_alias_real_to_json_writer;
     G_OBJECT_CLASS(klass)->get_property = matrix_event_room_canonical_alias_get_property;
     G_OBJECT_CLASS(klass)->set_property = matrix_event_room_canonical_alias_set_property;
     G_OBJECT_CLASS(klass)->finalize = matrix_event_room_canonical_alias_finalize;
@@ -19,6 +19,7 @@
 #include "matrix-event-room-create.h"
 #include "matrix-types.h"
 #include "config.h"
+#include "utils-private.h"
 
 /**
  * SECTION:matrix-event-room-create
@@ -48,6 +49,16 @@ typedef struct {
  */
 G_DEFINE_TYPE_WITH_PRIVATE(MatrixEventRoomCreate, matrix_event_room_create, MATRIX_EVENT_TYPE_STATE);
 
+enum {
+    CONTENT_FIELD_CREATOR,
+    CONTENT_FIELD_FEDERATE
+};
+
+static const MatrixJsonField matrix_event_room_create_content_fields[] = {
+    [CONTENT_FIELD_CREATOR] = MATRIX_JSON_FIELD("creator", MATRIX_JSON_FIELD_STRING, MatrixEventRoomCreatePrivate, _creator),
+    [CONTENT_FIELD_FEDERATE] = MATRIX_JSON_FIELD("m.federate", MATRIX_JSON_FIELD_BOOLEAN, MatrixEventRoomCreatePrivate, _federate),
+};
+
 static void
 matrix_event_room_create_real_from_json(MatrixEventBase *matrix_event_base, JsonNode *json_data, GError **error)
 {
@@ -65,27 +76,21 @@ matrix_event_room_create_real_from_json(MatrixEventBase *matrix_event_base, Json
     content_node = json_object_get_member(root, "content");
     content_root = json_node_get_object(content_node);
 
-#if DEBUG
-    if ((node = json_object_get_member(root, "state_key")) != NULL) {
+    if (DEBUG && ((node = json_object_get_member(root, "state_key")) != NULL)) {
         const gchar *state_key = json_node_get_string(node);
 
         if ((state_key == NULL) || (*state_key == 0)) {
             g_warning("state_key of a m.room.create event is non-empty");
         }
     }
-#endif
 
-    if ((node = json_object_get_member(content_root, "creator")) != NULL) {
-        g_free(priv->_creator);
-        priv->_creator = g_strdup(json_node_get_string(node));
-    } else {
+    if (!(_matrix_json_object_decode(content_root,
+                                     matrix_event_room_create_content_fields,
+                                     G_N_ELEMENTS(matrix_event_room_create_content_fields),
+                                     priv) & (1 << CONTENT_FIELD_CREATOR))) {
         g_warning("content.creator is missing from a m.room.create event");
     }
 
-    if ((node = json_object_get_member(content_root, "m.federate")) != NULL) {
-        priv->_federate = json_node_get_boolean(node);
-    }
-
     MATRIX_EVENT_BASE_CLASS(matrix_event_room_create_parent_class)->from_json(matrix_event_base, json_data, error);
 }
 
@@ -19,7 +19,7 @@
 #include "matrix-event-room-member.h"
 #include "config.h"
 #include "matrix-enumtypes.h"
-#include "utils.h"
+#include "utils-private.h"
 
 /**
  * SECTION:matrix-event-room-member
@@ -90,6 +90,11 @@ typedef struct {
  */
 G_DEFINE_TYPE_WITH_PRIVATE(MatrixEventRoomMember, matrix_event_room_member, MATRIX_EVENT_TYPE_STATE);
 
+static const MatrixJsonField matrix_event_room_member_content_fields[] = {
+    MATRIX_JSON_FIELD("avatar_url", MATRIX_JSON_FIELD_STRING, MatrixEventRoomMemberPrivate, _avatar_url),
+    MATRIX_JSON_FIELD("displayname", MATRIX_JSON_FIELD_STRING, MatrixEventRoomMemberPrivate, _display_name),
+};
+
 static void
 matrix_event_room_member_real_from_json(MatrixEventBase *matrix_event_base, JsonNode *json_data, GError **error)
 {
@@ -134,15 +139,10 @@ matrix_event_room_member_real_from_json(MatrixEventBase *matrix_event_base, Json
         g_warning("membership key is missing from the m.room.member event");
     }
 
-    if ((node = json_object_get_member(content_root, "avatar_url")) != NULL) {
-        g_free(priv->_avatar_url);
-        priv->_avatar_url = g_strdup(json_node_get_string(node));
-    }
-
-    if ((node = json_object_get_member(content_root, "displayname")) != NULL) {
-        g_free(priv->_display_name);
-        priv->_display_name = g_strdup(json_node_get_string(node));
-    }
+    _matrix_json_object_decode(content_root,
+                               matrix_event_room_member_content_fields,
+                               G_N_ELEMENTS(matrix_event_room_member_content_fields),
+                               priv);
 
     if ((node = json_object_get_member(content_root, "third_party_invite")) != NULL) {
         JsonObject *tpi_root = json_node_get_object(node);
@@ -339,6 +339,124 @@ matrix_event_room_member_real_to_json(MatrixEventBase *matrix_event_base, JsonNo
     }
 }
 
+static void
+matrix_event_room_member_real_to_json_writer(MatrixEventBase *matrix_event_base, MatrixJsonWriter *writer, GError **error)
+{
+    MatrixEventRoomMemberPrivate *priv;
+    const gchar *state_key;
+    gchar *membership;
+    guint n_signed;
+    gboolean write_tpi;
+
+    priv = matrix_event_room_member_get_instance_private(MATRIX_EVENT_ROOM_MEMBER(matrix_event_base));
+
+    if (priv->_membership == MATRIX_ROOM_MEMBERSHIP_UNKNOWN) {
+        g_set_error(error, MATRIX_ERROR, MATRIX_ERROR_UNKNOWN_VALUE,
+                    "Unknown membership value cannot be added to a room member event");
+
+        return;
+    }
+
+    state_key = matrix_event_state_get_state_key(MATRIX_EVENT_STATE(matrix_event_base));
+
+    if ((state_key == NULL) || (*state_key == 0)) {
+        g_set_error(error, MATRIX_ERROR, MATRIX_ERROR_INCOMPLETE,
+                    "Won't generate a m.room.member event with an empty state_key");
+
+        return;
+    }
+
+    // The third party invite is only written if it is complete, the same way to_json does it
+    n_signed = ((priv->_tpi_signed_mxid != NULL) ? 1 : 0)
+        + ((priv->_tpi_signed_token != NULL) ? 1 : 0)
+        + ((priv->_tpi_signature != NULL) ? 1 : 0);
+
+    if ((n_signed != 3) && (n_signed != 0)) {
+        g_warning("3rd party invite data is not filled; ignoring");
+        n_signed = 0;
+    }
+
+    write_tpi = ((n_signed == 3) && (priv->_tpi_display_name != NULL));
+
+    if (!write_tpi && ((n_signed != 0) || (priv->_tpi_display_name != NULL))) {
+        g_warning("3rd party invite data is incomplete; ignoring");
+    }
+
+    matrix_json_writer_set_member_name(writer, "content");
+    matrix_json_writer_begin_object(writer);
+
+    membership = _matrix_g_enum_to_string(MATRIX_TYPE_ROOM_MEMBERSHIP, priv->_membership, '_');
+
+    if (membership != NULL) {
+        matrix_json_writer_set_member_name(writer, "membership");
+        matrix_json_writer_add_string_value(writer, membership);
+        g_free(membership);
+    } else {
+        g_critical("Won't generate a m.room.member event with an unknown membership");
+    }
+
+    if (priv->_avatar_url != NULL) {
+        matrix_json_writer_set_member_name(writer, "avatar_url");
+        matrix_json_writer_add_string_value(writer, priv->_avatar_url);
+    }
+
+    if (priv->_display_name != NULL) {
+        matrix_json_writer_set_member_name(writer, "displayname");
+        matrix_json_writer_add_string_value(writer, priv->_display_name);
+    }
+
+    if (write_tpi) {
+        matrix_json_writer_set_member_name(writer, "third_party_invite");
+        matrix_json_writer_begin_object(writer);
+
+        matrix_json_writer_set_member_name(writer, "display_name");
+        matrix_json_writer_add_string_value(writer, priv->_tpi_display_name);
+
+        matrix_json_writer_set_member_name(writer, "signed");
+        matrix_json_writer_begin_object(writer);
+        matrix_json_writer_set_member_name(writer, "mxid");
+        matrix_json_writer_add_string_value(writer, priv->_tpi_signed_mxid);
+        matrix_json_writer_set_member_name(writer, "token");
+        matrix_json_writer_add_string_value(writer, priv->_tpi_signed_token);
+        matrix_json_writer_set_member_name(writer, "signature");
+
+        if (!matrix_json_writer_add_node(writer, priv->_tpi_signature, error)) {
+            return;
+        }
+
+        matrix_json_writer_end_object(writer);
+
+        matrix_json_writer_end_object(writer);
+    }
+
+    matrix_json_writer_end_object(writer);
+
+    if ((priv->_invite_room_state != NULL) && (priv->_invite_room_state_len > 0)) {
+        matrix_json_writer_set_member_name(writer, "invite_room_state");
+        matrix_json_writer_begin_array(writer);
+
+        for (gint i = 0; i < priv->_invite_room_state_len; i++) {
+            JsonNode *state_node = matrix_event_state_get_stripped_node(priv->_invite_room_state[i]);
+            gboolean written;
+
+            if (state_node == NULL) {
+                continue;
+            }
+
+            written = matrix_json_writer_add_node(writer, state_node, error);
+            json_node_unref(state_node);
+
+            if (!written) {
+                return;
+            }
+        }
+
+        matrix_json_writer_end_array(writer);
+    }
+
+    MATRIX_EVENT_BASE_CLASS(matrix_event_room_member_parent_class)->to_json_writer(matrix_event_base, writer, error);
+}
+
 /**
  * matrix_event_room_member_new:
  *
@@ -729,6 +847,8 @@ matrix_event_room_member_set_invite_room_state(MatrixEventRoomMember *matrix_eve
     }
 
     priv->_invite_room_state_len = n_invite_room_state;
+
+    matrix_event_base_invalidate_json(MATRIX_EVENT_BASE(matrix_event_room_member));
 }
 
 /**
@@ -884,6 +1004,7 @@ matrix_event_room_member_class_init (MatrixEventRoomMemberClass *klass)
 {
     ((MatrixEventBaseClass *)klass)->from_json = matrix_event_room_member_real_from_json;
     ((MatrixEventBaseClass *)klass)->to_json = matrix_event_room_member_real_to_json;
+    ((MatrixEventBaseClass *)klass)->to_json_writer = matrix_event_room_member_real_to_json_writer;
     G_OBJECT_CLASS(klass)->get_property = matrix_event_room_member_get_property;
     G_OBJECT_CLASS(klass)->set_property = matrix_event_room_member_set_property;
     G_OBJECT_CLASS(klass)->finalize = matrix_event_room_member_finalize;
@@ -52,6 +52,33 @@ typedef struct {
  */
 G_DEFINE_TYPE_WITH_PRIVATE(MatrixEventRoomMessage, matrix_event_room_message, MATRIX_EVENT_TYPE_ROOM);
 
+static void
+_message_notify_cb(MatrixMessageBase *message, GParamSpec *pspec, MatrixEventRoomMessage *matrix_event_room_message)
+{
+    // The message is part of the event’s JSON, so a change in it makes the cached node stale
+    matrix_event_base_invalidate_json(MATRIX_EVENT_BASE(matrix_event_room_message));
+}
+
+/*
+ * Replace the message object of the event, taking ownership of message.
+ */
+static void
+_matrix_event_room_message_take_message(MatrixEventRoomMessage *matrix_event_room_message, MatrixMessageBase *message)
+{
+    MatrixEventRoomMessagePrivate *priv = matrix_event_room_message_get_instance_private(matrix_event_room_message);
+
+    if (priv->_message != NULL) {
+        g_signal_handlers_disconnect_by_func(priv->_message, _message_notify_cb, matrix_event_room_message);
+        g_object_unref(priv->_message);
+    }
+
+    priv->_message = message;
+
+    if (message != NULL) {
+        g_signal_connect(message, "notify", G_CALLBACK(_message_notify_cb), matrix_event_room_message);
+    }
+}
+
 static void
 matrix_event_room_message_real_from_json(MatrixEventBase *matrix_event_base, JsonNode *json_data, GError **error)
 {
@@ -76,20 +103,25 @@ matrix_event_room_message_real_from_json(MatrixEventBase *matrix_event_base, Jso
     node = json_object_get_member(content_root, "body");
 
     g_free(priv->body);
-    priv->body = g_strdup(json_node_get_string(node));
+    priv->body = (node != NULL) ? g_strdup(json_node_get_string(node)) : NULL;
 
     /*
      * We don't want to fail on unknown message types, so let's save the JSON content
      * instead. Silent (ie. without exception) null is only returned if there is no handler class
-     * installed
+     * installed.  Redacted messages have no msgtype at all; their (empty) content is saved the
+     * same way.
      */
-    message = matrix_message_base_new_from_json(content_node, &inner_error);
+    if (json_object_has_member(content_root, "msgtype")) {
+        message = matrix_message_base_new_from_json(content_node, &inner_error);
+    } else {
+        message = NULL;
+    }
 
     if (inner_error != NULL) {
         g_propagate_error(error, inner_error);
     }
 
-    priv->_message = message;
+    _matrix_event_room_message_take_message(MATRIX_EVENT_ROOM_MESSAGE(matrix_event_base), message);
 
     if (message == NULL) {
         priv->_fallback_content = json_node_ref(content_node);
@@ -110,7 +142,7 @@ matrix_event_room_message_real_to_json(MatrixEventBase *matrix_event_base, JsonN
 
     priv = matrix_event_room_message_get_instance_private(MATRIX_EVENT_ROOM_MESSAGE(matrix_event_base));
 
-    if (priv->_message == NULL) {
+    if ((priv->_message == NULL) && (priv->_fallback_content == NULL)) {
         g_set_error(error, MATRIX_ERROR, MATRIX_ERROR_INCOMPLETE,
                     "Won't generate a m.room.message event without content");
 
@@ -119,7 +151,11 @@ matrix_event_room_message_real_to_json(MatrixEventBase *matrix_event_base, JsonN
 
     root = json_node_get_object(json_data);
 
-    node = matrix_message_base_get_json(priv->_message, &inner_error);
+    if (priv->_message == NULL) {
+        node = json_node_ref(priv->_fallback_content);
+    } else {
+        node = matrix_message_base_get_json(priv->_message, &inner_error);
+    }
 
     if (inner_error != NULL) {
         g_propagate_error(error, inner_error);
@@ -132,6 +168,41 @@ matrix_event_room_message_real_to_json(MatrixEventBase *matrix_event_base, JsonN
     MATRIX_EVENT_BASE_CLASS(matrix_event_room_message_parent_class)->to_json(matrix_event_base, json_data, error);
 }
 
+static void
+matrix_event_room_message_real_to_json_writer(MatrixEventBase *matrix_event_base, MatrixJsonWriter *writer, GError **error)
+{
+    MatrixEventRoomMessagePrivate *priv;
+    JsonNode *content_node;
+    GError *inner_error = NULL;
+
+    priv = matrix_event_room_message_get_instance_private(MATRIX_EVENT_ROOM_MESSAGE(matrix_event_base));
+
+    if ((priv->_message == NULL) && (priv->_fallback_content == NULL)) {
+        g_set_error(error, MATRIX_ERROR, MATRIX_ERROR_INCOMPLETE,
+                    "Won't generate a m.room.message event without content");
+
+        return;
+    }
+
+    // Message classes only know how to export themselves as a JsonNode, so only the content
+    // goes through one
+    if (priv->_message == NULL) {
+        content_node = priv->_fallback_content;
+    } else if ((content_node = matrix_message_base_get_json(priv->_message, &inner_error)) == NULL) {
+        g_propagate_error(error, inner_error);
+
+        return;
+    }
+
+    matrix_json_writer_set_member_name(writer, "content");
+
+    if (!matrix_json_writer_add_node(writer, content_node, error)) {
+        return;
+    }
+
+    MATRIX_EVENT_BASE_CLASS(matrix_event_room_message_parent_class)->to_json_writer(matrix_event_base, writer, error);
+}
+
 /**
  * matrix_event_room_message_new:
  *
@@ -151,7 +222,8 @@ matrix_event_room_message_new(void) {
  * Get the message object from @event, if it could be resoled to a known message type.
  * Resolution is done by matrix_message_get_handler().
  *
- * The returned value is owned by @event and should not be freed.
+ * The returned value is owned by @event and should not be freed.  It may be modified through
+ * its property setters; @event notices the change and regenerates its JSON.
  *
  * Returns: (transfer none) (nullable): a #MatrixMessageBase derived object
  */
@@ -170,7 +242,7 @@ matrix_event_room_message_get_message(MatrixEventRoomMessage *matrix_event_room_
 /**
  * matrix_event_room_message_set_message:
  * @event: a #MatrixEventRoomMessage
- * @message: (transfer none): a #MatrixMessageBase derived object
+ * @message: (transfer none) (nullable): a #MatrixMessageBase derived object
  *
  * Set the message of @event.
  *
@@ -186,8 +258,7 @@ matrix_event_room_message_set_message(MatrixEventRoomMessage *matrix_event_room_
     priv = matrix_event_room_message_get_instance_private(matrix_event_room_message);
 
     if (message != priv->_message) {
-        g_object_unref(priv->_message);
-        priv->_message = g_object_ref(message);
+        _matrix_event_room_message_take_message(matrix_event_room_message, (message != NULL) ? g_object_ref(message) : NULL);
 
         g_object_notify_by_pspec((GObject *)matrix_event_room_message, matrix_event_room_message_properties[PROP_MESSAGE]);
     }
@@ -198,6 +269,11 @@ matrix_event_room_message_set_message(MatrixEventRoomMessage *matrix_event_room_
  * @event: a #MatrixEventRoomMessage
  *
  * Get the fallback content from @event.
+ *
+ * The fallback content is part of the event’s JSON representation, so it must not be
+ * modified.
+ *
+ * Returns: (transfer none) (nullable): the content of @event, if it has no known message type
  */
 JsonNode *
 matrix_event_room_message_get_fallback_content(MatrixEventRoomMessage *matrix_event_room_message)
@@ -258,7 +334,7 @@ matrix_event_room_message_finalize(GObject *gobject)
 {
     MatrixEventRoomMessagePrivate *priv = matrix_event_room_message_get_instance_private(MATRIX_EVENT_ROOM_MESSAGE(gobject));
 
-    g_object_unref(priv->_message);
+    _matrix_event_room_message_take_message(MATRIX_EVENT_ROOM_MESSAGE(gobject), NULL);
     json_node_unref(priv->_fallback_content);
 
     G_OBJECT_CLASS(matrix_event_room_message_parent_class)->finalize(gobject);
@@ -315,6 +391,7 @@ matrix_event_room_message_class_init(MatrixEventRoomMessageClass *klass)
 {
     ((MatrixEventBaseClass *)klass)->from_json = matrix_event_room_message_real_from_json;
     ((MatrixEventBaseClass *)klass)->to_json = matrix_event_room_message_real_to_json;
+    ((MatrixEventBaseClass *)klass)->to_json_writer = matrix_event_room_message_real_to_json_writer;
     G_OBJECT_CLASS(klass)->get_property = matrix_event_room_message_get_property;
     G_OBJECT_CLASS(klass)->set_property = matrix_event_room_message_set_property;
     G_OBJECT_CLASS(klass)->finalize = matrix_event_room_message_finalize;
@@ -19,6 +19,7 @@
 #include "matrix-event-room-name.h"
 #include "matrix-types.h"
 #include "config.h"
+#include "utils-private.h"
 
 /**
  * SECTION:matrix-event-room-name
@@ -49,6 +50,10 @@ typedef struct {
  */
 G_DEFINE_TYPE_WITH_PRIVATE(MatrixEventRoomName, matrix_event_room_name, MATRIX_EVENT_TYPE_STATE);
 
+static const MatrixJsonField matrix_event_room_name_content_fields[] = {
+    MATRIX_JSON_FIELD("name", MATRIX_JSON_FIELD_STRING, MatrixEventRoomNamePrivate, _name),
+};
+
 static void
 matrix_event_room_name_real_from_json(MatrixEventBase *matrix_event_base, JsonNode *json_data, GError **error)
 {
@@ -73,10 +78,10 @@ matrix_event_room_name_real_from_json(MatrixEventBase *matrix_event_base, JsonNo
         }
     }
 
-    if ((node = json_object_get_member(content_root, "name")) != NULL) {
-        g_free(priv->_name);
-        priv->_name = g_strdup(json_node_get_string(node));
-    } else {
+    if (!_matrix_json_object_decode(content_root,
+                                    matrix_event_room_name_content_fields,
+                                    G_N_ELEMENTS(matrix_event_room_name_content_fields),
+                                    priv)) {
         g_warning("content.name is missing from a m.room.name event");
     }
 
@@ -100,7 +105,7 @@ matrix_event_room_name_real_to_json(MatrixEventBase *matrix_event_base, JsonNode
     content_root = json_node_get_object(content_node);
     state_key = matrix_event_state_get_state_key(MATRIX_EVENT_STATE(matrix_event_base));
 
-    if ((state_key == NULL) || (*state_key == 0)) {
+    if ((state_key != NULL) && (*state_key != 0)) {
         g_set_error(error, MATRIX_ERROR, MATRIX_ERROR_INCOMPLETE,
                     "Won't send a m.room.name with a non-empty state key");
 
@@ -119,6 +124,38 @@ matrix_event_room_name_real_to_json(MatrixEventBase *matrix_event_base, JsonNode
     MATRIX_EVENT_BASE_CLASS(matrix_event_room_name_parent_class)->to_json(matrix_event_base, json_data, error);
 }
 
+static void
+matrix_event_room_name_real_to_json_writer(MatrixEventBase *matrix_event_base, MatrixJsonWriter *writer, GError **error)
+{
+    MatrixEventRoomNamePrivate *priv;
+    const gchar *state_key;
+
+    priv = matrix_event_room_name_get_instance_private(MATRIX_EVENT_ROOM_NAME(matrix_event_base));
+    state_key = matrix_event_state_get_state_key(MATRIX_EVENT_STATE(matrix_event_base));
+
+    if ((state_key != NULL) && (*state_key != 0)) {
+        g_set_error(error, MATRIX_ERROR, MATRIX_ERROR_INCOMPLETE,
+                    "Won't send a m.room.name with a non-empty state key");
+
+        return;
+    }
+
+    if ((priv->_name == NULL) || (*(priv->_name) == 0)) {
+        g_set_error(error, MATRIX_ERROR, MATRIX_ERROR_INCOMPLETE,
+                    "Won't send a m.room.name event without a name");
+
+        return;
+    }
+
+    matrix_json_writer_set_member_name(writer, "content");
+    matrix_json_writer_begin_object(writer);
+    matrix_json_writer_set_member_name(writer, "name");
+    matrix_json_writer_add_string_value(writer, priv->_name);
+    matrix_json_writer_end_object(writer);
+
+    MATRIX_EVENT_BASE_CLASS(matrix_event_room_name_parent_class)->to_json_writer(matrix_event_base, writer, error);
+}
+
 /**
  * matrix_event_room_name_new:
  *
@@ -227,6 +264,7 @@ matrix_event_room_name_class_init(MatrixEventRoomNameClass *klass)
 {
     ((MatrixEventBaseClass *)klass)->from_json = matrix_event_room_name_real_from_json;
     ((MatrixEventBaseClass *)klass)->to_json = matrix_event_room_name_real_to_json;
+    ((MatrixEventBaseClass *)klass)->to_json_writer = matrix_event_room_name_real_to_json_writer;
     G_OBJECT_CLASS(klass)->get_property = matrix_event_room_name_get_property;
     G_OBJECT_CLASS(klass)->set_property = matrix_event_room_name_set_property;
     G_OBJECT_CLASS(klass)->finalize = matrix_event_room_name_finalize;
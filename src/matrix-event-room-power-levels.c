@@ -45,6 +45,7 @@ enum  {
     PROP_KICK,
     PROP_REDACT,
     PROP_INVITE,
+    PROP_ROOM_NOTIFICATION,
     PROP_EVENT_LEVELS,
     PROP_USER_LEVELS,
     NUM_PROPERTIES
@@ -60,6 +61,7 @@ typedef struct {
     gint _kick;
     gint _redact;
     gint _invite;
+    gint _room_notification;
     GHashTable* _event_levels;
     GHashTable* _user_levels;
 } MatrixEventRoomPowerLevelsPrivate;
@@ -133,6 +135,12 @@ matrix_event_room_power_levels_real_from_json(MatrixEventBase *matrix_event_base
         priv->_invite = json_node_get_int(node);
     }
 
+    if (((node = json_object_get_member(content_root, "notifications")) != NULL)
+        && (json_node_get_node_type(node) == JSON_NODE_OBJECT)
+        && ((node = json_object_get_member(json_node_get_object(node), "room")) != NULL)) {
+        priv->_room_notification = json_node_get_int(node);
+    }
+
     if ((node = json_object_get_member(content_root, "events")) != NULL) {
         JsonObject *events_root;
         JsonObjectIter iter;
@@ -176,6 +184,7 @@ matrix_event_room_power_levels_real_to_json(MatrixEventBase *matrix_event_base,
     JsonObject *content_root;
     JsonObject *users_root;
     JsonObject *events_root;
+    JsonObject *notifications_root;
     JsonNode *content_node;
     JsonNode *users_node;
     JsonNode *events_node;
@@ -220,6 +229,10 @@ matrix_event_room_power_levels_real_to_json(MatrixEventBase *matrix_event_base,
     json_object_set_int_member(content_root, "state_default", priv->_state_default);
     json_object_set_int_member(content_root, "events_default", priv->_events_default);
 
+    notifications_root = json_object_new();
+    json_object_set_int_member(notifications_root, "room", priv->_room_notification);
+    json_object_set_object_member(content_root, "notifications", notifications_root);
+
     users_root = json_object_new();
     users_node = json_node_new(JSON_NODE_OBJECT);
     json_node_set_object(users_node, users_root);
@@ -266,6 +279,8 @@ matrix_event_room_power_levels_set_user_level(MatrixEventRoomPowerLevels *matrix
     priv = matrix_event_room_power_levels_get_instance_private(matrix_event_room_power_levels);
 
     g_hash_table_insert(priv->_user_levels, g_strdup(user_id), GINT_TO_POINTER(level));
+
+    g_object_notify_by_pspec((GObject *)matrix_event_room_power_levels, matrix_event_room_power_levels_properties[PROP_USER_LEVELS]);
 }
 
 /**
@@ -287,6 +302,8 @@ matrix_event_room_power_levels_set_event_level(MatrixEventRoomPowerLevels *matri
     priv = matrix_event_room_power_levels_get_instance_private(matrix_event_room_power_levels);
 
     g_hash_table_insert(priv->_event_levels, g_strdup(event_type), GINT_TO_POINTER(level));
+
+    g_object_notify_by_pspec((GObject *)matrix_event_room_power_levels, matrix_event_room_power_levels_properties[PROP_EVENT_LEVELS]);
 }
 
 /**
@@ -527,6 +544,49 @@ matrix_event_room_power_levels_set_invite(MatrixEventRoomPowerLevels *matrix_eve
     }
 }
 
+/**
+ * matrix_event_room_power_levels_get_room_notification:
+ * @event: a #MatrixEventRoomPowerLevels
+ *
+ * Get the level required to notify everyone in the room with `@room`.
+ *
+ * Returns: the required level
+ */
+gint
+matrix_event_room_power_levels_get_room_notification(MatrixEventRoomPowerLevels *matrix_event_room_power_levels)
+{
+    MatrixEventRoomPowerLevelsPrivate *priv;
+
+    g_return_val_if_fail(matrix_event_room_power_levels != NULL, 0);
+
+    priv = matrix_event_room_power_levels_get_instance_private(matrix_event_room_power_levels);
+
+    return priv->_room_notification;
+}
+
+/**
+ * matrix_event_room_power_levels_set_room_notification:
+ * @event: a #MatrixEventRoomPowerLevels
+ * @room_notification: the level required to notify everyone in the room
+ *
+ * Set the level required to notify everyone in the room with `@room`.
+ */
+void
+matrix_event_room_power_levels_set_room_notification(MatrixEventRoomPowerLevels *matrix_event_room_power_levels, gint room_notification)
+{
+    MatrixEventRoomPowerLevelsPrivate *priv;
+
+    g_return_if_fail(matrix_event_room_power_levels != NULL);
+
+    priv = matrix_event_room_power_levels_get_instance_private(matrix_event_room_power_levels);
+
+    if (priv->_room_notification != room_notification) {
+        priv->_room_notification = room_notification;
+
+        g_object_notify_by_pspec((GObject *)matrix_event_room_power_levels, matrix_event_room_power_levels_properties[PROP_ROOM_NOTIFICATION]);
+    }
+}
+
 /**
  * matrix_event_room_power_levels_get_event_levels:
  * @event: a #MatrixEventRoomPowerLevels
@@ -614,6 +674,10 @@ matrix_event_room_power_levels_get_property(GObject *gobject, guint property_id,
         case PROP_INVITE:
             g_value_set_int(value, matrix_event_room_power_levels_get_invite(matrix_event_room_power_levels));
 
+            break;
+        case PROP_ROOM_NOTIFICATION:
+            g_value_set_int(value, matrix_event_room_power_levels_get_room_notification(matrix_event_room_power_levels));
+
             break;
         case PROP_EVENT_LEVELS:
             g_value_set_boxed(value, matrix_event_room_power_levels_get_event_levels(matrix_event_room_power_levels));
@@ -663,6 +727,10 @@ matrix_event_room_power_levels_set_property(GObject *gobject, guint property_id,
         case PROP_INVITE:
             matrix_event_room_power_levels_set_invite(matrix_event_room_power_levels, g_value_get_int(value));
 
+            break;
+        case PROP_ROOM_NOTIFICATION:
+            matrix_event_room_power_levels_set_room_notification(matrix_event_room_power_levels, g_value_get_int(value));
+
             break;
         default:
             G_OBJECT_WARN_INVALID_PROPERTY_ID(gobject, property_id, pspec);
@@ -759,6 +827,17 @@ matrix_event_room_power_levels_class_init(MatrixEventRoomPowerLevelsClass *klass
             G_PARAM_STATIC_STRINGS | G_PARAM_READWRITE);
     g_object_class_install_property(G_OBJECT_CLASS(klass), PROP_INVITE, matrix_event_room_power_levels_properties[PROP_INVITE]);
 
+    /**
+     * MatrixEventRoomPowerLevels:room-notification:
+     *
+     * The level required to notify everyone in the room with `@room`.
+     */
+    matrix_event_room_power_levels_properties[PROP_ROOM_NOTIFICATION] = g_param_spec_int(
+            "room-notification", "room-notification", "room-notification",
+            G_MININT, G_MAXINT, 50,
+            G_PARAM_STATIC_STRINGS | G_PARAM_READWRITE);
+    g_object_class_install_property(G_OBJECT_CLASS(klass), PROP_ROOM_NOTIFICATION, matrix_event_room_power_levels_properties[PROP_ROOM_NOTIFICATION]);
+
     /**
      * MatrixEventRoomPowerLevels:event-levels:
      *
@@ -794,6 +873,7 @@ matrix_event_room_power_levels_init(MatrixEventRoomPowerLevels *matrix_event_roo
     priv->_kick = 5;
     priv->_redact = 20;
     priv->_invite = 0;
+    priv->_room_notification = 50;
     priv->_event_levels = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
     priv->_user_levels = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
 }
@@ -48,6 +48,8 @@ gint matrix_event_room_power_levels_get_redact(MatrixEventRoomPowerLevels *event
 void matrix_event_room_power_levels_set_redact(MatrixEventRoomPowerLevels *event, gint redact);
 gint matrix_event_room_power_levels_get_invite(MatrixEventRoomPowerLevels *event);
 void matrix_event_room_power_levels_set_invite(MatrixEventRoomPowerLevels *event, gint invite);
+gint matrix_event_room_power_levels_get_room_notification(MatrixEventRoomPowerLevels *event);
+void matrix_event_room_power_levels_set_room_notification(MatrixEventRoomPowerLevels *event, gint room_notification);
 GHashTable *matrix_event_room_power_levels_get_event_levels(MatrixEventRoomPowerLevels *event);
 GHashTable *matrix_event_room_power_levels_get_user_levels(MatrixEventRoomPowerLevels *event);
 
@@ -408,6 +408,8 @@ matrix_event_room_third_party_invite_set_public_keys(MatrixEventRoomThirdPartyIn
     }
 
     priv->_public_keys_len = n_public_keys;
+
+    matrix_event_base_invalidate_json(MATRIX_EVENT_BASE(matrix_event_room_third_party_invite));
 }
 
 const gchar *
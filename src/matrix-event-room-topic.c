@@ -19,6 +19,7 @@
 #include "matrix-event-room-topic.h"
 #include "matrix-types.h"
 #include "config.h"
+#include "utils-private.h"
 
 /**
  * SECTION:matrix-event-room-topic
@@ -47,6 +48,10 @@ typedef struct {
  */
 G_DEFINE_TYPE_WITH_PRIVATE(MatrixEventRoomTopic, matrix_event_room_topic, MATRIX_EVENT_TYPE_STATE);
 
+static const MatrixJsonField matrix_event_room_topic_content_fields[] = {
+    MATRIX_JSON_FIELD("topic", MATRIX_JSON_FIELD_STRING, MatrixEventRoomTopicPrivate, _topic),
+};
+
 static void
 matrix_event_room_topic_real_from_json(MatrixEventBase *matrix_event_base, JsonNode *json_data, GError **error)
 {
@@ -67,15 +72,16 @@ matrix_event_room_topic_real_from_json(MatrixEventBase *matrix_event_base, JsonN
     if (DEBUG && ((node = json_object_get_member(root, "state_key")) != NULL)) {
         const gchar *state_key = json_node_get_string(node);
 
-        if ((state_key == NULL) || (*state_key == 0)) {
+        if ((state_key != NULL) && (*state_key != 0)) {
             g_warning("state_key of a m.room.topic event is non-empty");
         }
     }
 
-    if ((node = json_object_get_member(content_root, "topic")) != NULL) {
-        g_free(priv->_topic);
-        priv->_topic = g_strdup(json_node_get_string(node));
-    } else if (DEBUG) {
+    if (!_matrix_json_object_decode(content_root,
+                                    matrix_event_room_topic_content_fields,
+                                    G_N_ELEMENTS(matrix_event_room_topic_content_fields),
+                                    priv)
+        && DEBUG) {
         g_warning("content.topic is missing from an m.room.topic event");
     }
 
@@ -104,7 +110,7 @@ matrix_event_room_topic_real_to_json(MatrixEventBase *matrix_event_base, JsonNod
     content_root = json_node_get_object(content_node);
     state_key = matrix_event_state_get_state_key(MATRIX_EVENT_STATE(matrix_event_base));
 
-    if ((state_key == NULL) || (*state_key == 0)) {
+    if ((state_key != NULL) && (*state_key != 0)) {
         g_set_error(error, MATRIX_ERROR, MATRIX_ERROR_INCOMPLETE,
                     "Won't generate a m.room.topic event with a non-empty state_key");
 
@@ -122,6 +128,35 @@ matrix_event_room_topic_real_to_json(MatrixEventBase *matrix_event_base, JsonNod
     }
 }
 
+static void
+matrix_event_room_topic_real_to_json_writer(MatrixEventBase *matrix_event_base, MatrixJsonWriter *writer, GError **error)
+{
+    MatrixEventRoomTopicPrivate *priv;
+    const gchar *state_key;
+
+    priv = matrix_event_room_topic_get_instance_private(MATRIX_EVENT_ROOM_TOPIC(matrix_event_base));
+    state_key = matrix_event_state_get_state_key(MATRIX_EVENT_STATE(matrix_event_base));
+
+    if ((state_key != NULL) && (*state_key != 0)) {
+        g_set_error(error, MATRIX_ERROR, MATRIX_ERROR_INCOMPLETE,
+                    "Won't generate a m.room.topic event with a non-empty state_key");
+
+        return;
+    }
+
+    matrix_json_writer_set_member_name(writer, "content");
+    matrix_json_writer_begin_object(writer);
+
+    if (priv->_topic != NULL) {
+        matrix_json_writer_set_member_name(writer, "topic");
+        matrix_json_writer_add_string_value(writer, priv->_topic);
+    }
+
+    matrix_json_writer_end_object(writer);
+
+    MATRIX_EVENT_BASE_CLASS(matrix_event_room_topic_parent_class)->to_json_writer(matrix_event_base, writer, error);
+}
+
 MatrixEventRoomTopic *
 matrix_event_room_topic_new(void) {
     return (MatrixEventRoomTopic *)matrix_event_state_construct(MATRIX_EVENT_TYPE_ROOM_TOPIC);
@@ -207,6 +242,7 @@ matrix_event_room_topic_class_init(MatrixEventRoomTopicClass *klass)
 {
     ((MatrixEventBaseClass *)klass)->from_json = matrix_event_room_topic_real_from_json;
     ((MatrixEventBaseClass *)klass)->to_json = matrix_event_room_topic_real_to_json;
+    ((MatrixEventBaseClass *)klass)->to_json_writer = matrix_event_room_topic_real_to_json_writer;
     G_OBJECT_CLASS (klass)->get_property = matrix_event_room_topic_get_property;
     G_OBJECT_CLASS (klass)->set_property = matrix_event_room_topic_set_property;
     G_OBJECT_CLASS (klass)->finalize = matrix_event_room_topic_finalize;
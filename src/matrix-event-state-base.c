@@ -19,6 +19,7 @@
 #include "matrix-event-state-base.h"
 #include "matrix-types.h"
 #include "config.h"
+#include "utils-private.h"
 
 /**
  * SECTION:matrix-event-state-base
@@ -52,35 +53,33 @@ typedef struct {
  */
 G_DEFINE_ABSTRACT_TYPE_WITH_PRIVATE(MatrixEventState, matrix_event_state, MATRIX_EVENT_TYPE_ROOM);
 
+static const MatrixJsonField matrix_event_state_fields[] = {
+    MATRIX_JSON_FIELD("state_key", MATRIX_JSON_FIELD_STRING, MatrixEventStatePrivate, _state_key),
+    MATRIX_JSON_FIELD("prev_content", MATRIX_JSON_FIELD_NODE, MatrixEventStatePrivate, _prev_content),
+};
+
 static void
 matrix_event_state_real_from_json(MatrixEventBase *matrix_event_base, JsonNode *json_data, GError **error)
 {
     MatrixEventStatePrivate *priv;
-    JsonObject *root;
-    JsonNode *node;
+    guint32 seen;
     GError *inner_error = NULL;
 
     g_return_if_fail(json_data != NULL);
 
     priv = matrix_event_state_get_instance_private(MATRIX_EVENT_STATE(matrix_event_base));
-    root = json_node_get_object(json_data);
 
-    if ((node = json_object_get_member(root, "state_key")) != NULL) {
-        g_free(priv->_state_key);
-        priv->_state_key = g_strdup(json_node_get_string(node));
-    } else if (DEBUG) {
-        g_warning("state_key is not present in a State event");
-    }
+    seen = _matrix_json_object_decode(json_node_get_object(json_data),
+                                      matrix_event_state_fields,
+                                      G_N_ELEMENTS(matrix_event_state_fields),
+                                      priv);
 
-    if ((node = json_object_get_member(root, "prev_content")) != NULL) {
-        priv->_prev_content = node;
+    if (DEBUG && !(seen & 1)) {
+        g_warning("state_key is not present in a State event");
     }
 
     MATRIX_EVENT_BASE_CLASS(matrix_event_state_parent_class)->from_json(matrix_event_base, json_data, &inner_error);
 
-    json_node_unref(node);
-    json_object_unref(root);
-
     if (inner_error != NULL) {
         g_propagate_error(error, inner_error);
     }
@@ -109,18 +108,43 @@ matrix_event_state_real_to_json(MatrixEventBase *matrix_event_base, JsonNode *js
     json_object_set_string_member(root, "state_key", priv->_state_key);
 
     if (priv->_prev_content != NULL) {
-        json_object_set_member(root, "prev_content", priv->_prev_content);
+        json_object_set_member(root, "prev_content", json_node_ref(priv->_prev_content));
     }
 
     MATRIX_EVENT_BASE_CLASS(matrix_event_state_parent_class)->to_json(MATRIX_EVENT_BASE(matrix_event_base), json_node, &inner_error);
 
-    json_object_unref(root);
-
     if (inner_error != NULL) {
         g_propagate_error(error, inner_error);
     }
 }
 
+static void
+matrix_event_state_real_to_json_writer(MatrixEventBase *matrix_event_base, MatrixJsonWriter *writer, GError **error)
+{
+    MatrixEventStatePrivate *priv;
+
+    priv = matrix_event_state_get_instance_private(MATRIX_EVENT_STATE(matrix_event_base));
+
+    if (priv->_state_key == NULL) {
+        g_set_error(error, MATRIX_ERROR, MATRIX_ERROR_INCOMPLETE,
+                    "Won't generate state events without state_key");
+
+        return;
+    }
+
+    matrix_json_writer_set_member_name(writer, "state_key");
+    matrix_json_writer_add_string_value(writer, priv->_state_key);
+
+    if (priv->_prev_content != NULL) {
+        matrix_json_writer_set_member_name(writer, "prev_content");
+        if (!matrix_json_writer_add_node(writer, priv->_prev_content, error)) {
+            return;
+        }
+    }
+
+    MATRIX_EVENT_BASE_CLASS(matrix_event_state_parent_class)->to_json_writer(matrix_event_base, writer, error);
+}
+
 /**
  * matrix_event_state_get_stripped_node:
  * @event: a #MatrixEventState derived object
@@ -135,6 +159,7 @@ matrix_event_state_get_stripped_node(MatrixEventState *matrix_event_state)
 {
     MatrixEventBase *matrix_event_base;
     const gchar *event_type;
+    JsonNode *node;
 
     g_return_val_if_fail(matrix_event_state != NULL, NULL);
 
@@ -151,7 +176,11 @@ matrix_event_state_get_stripped_node(MatrixEventState *matrix_event_state)
             return NULL;
         }
 
-    return matrix_event_base_get_json(matrix_event_base);
+    if ((node = matrix_event_base_get_json(matrix_event_base)) == NULL) {
+        return NULL;
+    }
+
+    return json_node_ref(node);
 }
 
 /**
@@ -314,6 +343,7 @@ matrix_event_state_class_init(MatrixEventStateClass *klass)
 {
     ((MatrixEventBaseClass *)klass)->from_json = matrix_event_state_real_from_json;
     ((MatrixEventBaseClass *)klass)->to_json = matrix_event_state_real_to_json;
+    ((MatrixEventBaseClass *)klass)->to_json_writer = matrix_event_state_real_to_json_writer;
     G_OBJECT_CLASS(klass)->get_property = matrix_event_state_get_property;
     G_OBJECT_CLASS(klass)->set_property = matrix_event_state_set_property;
     G_OBJECT_CLASS(klass)->finalize = matrix_event_state_finalize;
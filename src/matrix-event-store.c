@@ -0,0 +1,1344 @@
+/*
+ * This file is part of matrix-glib-sdk
+ *
+ * matrix-glib-sdk is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * matrix-glib-sdk is distributed in the hope that it will be
+ * useful, but WITHOUT ANY WARRANTY; without even the implied
+ * warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with matrix-glib-sdk. If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#include <errno.h>
+#include <string.h>
+#include <glib/gstdio.h>
+
+#ifdef G_OS_UNIX
+# include <unistd.h>
+#endif
+
+#include "matrix-event-store.h"
+#include "matrix-json-writer.h"
+#include "matrix-types.h"
+#include "utils.h"
+
+/**
+ * SECTION:matrix-event-store
+ * @short_description: durable local storage of room events
+ * @title: event store
+ *
+ * #MatrixEventStore keeps the history of rooms on disk, for archiving or replaying events.
+ *
+ * Events are appended to segment files in the binary encoding of #MatrixJsonWriter, and each
+ * room has an index file that maps the position of an event in the room (in the order they
+ * were stored) to its place in the segments.  All of these files are memory mapped for
+ * reading, so events are returned without copying them.
+ *
+ * Appended events are kept in memory until matrix_event_store_commit() is called, which
+ * writes them out in one batch.  They can’t be read back before that.
+ *
+ * The store is append-only, with one exception: matrix_event_store_redact() strips an event
+ * in place, so redacted content doesn’t stay on disk.
+ */
+
+/*
+ * On disk layout:
+ *
+ * rooms: the list of room IDs, one per line.  The line number is the room number.
+ *
+ * segment-NNNNNN: records, each of them a 32 bit data length, a 32 bit room number, a 16 bit
+ *     event ID length, the event ID with a terminating NUL byte, and the event data.
+ *
+ * room-N.idx: a list of (32 bit segment number, 32 bit offset) pairs, pointing to the records
+ *     of the room, in order.
+ *
+ * All integers are little endian.  Files are written in the order above, so an index entry
+ * never points to a record that was not written completely.  A write cut short (eg. by a
+ * crash) can leave a partial line or entry at the end of a file; these are cut off when the
+ * store is opened, and before appending to a file whose last append failed.
+ */
+#define MATRIX_EVENT_STORE_SEGMENT_SIZE (64 * 1024 * 1024)
+#define MATRIX_EVENT_STORE_RECORD_HEADER_LEN 10
+#define MATRIX_EVENT_STORE_INDEX_ENTRY_LEN 8
+
+enum  {
+    PROP_0,
+    PROP_PATH,
+    NUM_PROPERTIES
+};
+
+static GParamSpec *matrix_event_store_properties[NUM_PROPERTIES];
+
+typedef struct {
+    guint32 number;
+    gchar *room_id;
+
+    /* The index file, as it was mapped last.  It may be shorter than n_committed entries
+     * after a commit; it is remapped when needed. */
+    GMappedFile *index_map;
+    guint64 n_committed;
+
+    /* Index entries not yet written */
+    GByteArray *pending;
+} MatrixEventStoreRoom;
+
+typedef struct {
+    guint32 room;
+    guint64 position;
+} MatrixEventStoreLocation;
+
+typedef struct {
+    gchar *path;
+    GPtrArray *rooms;
+    GHashTable *rooms_by_id;
+    gsize rooms_size;
+
+    /* Event ID => MatrixEventStoreLocation.  Building it means reading every record, so it
+     * is only done the first time it is needed, not when the store is opened. */
+    GHashTable *event_ids;
+    gboolean event_ids_loaded;
+
+    /* Mapped segment files, indexed by segment number.  NULL entries are mapped on demand */
+    GPtrArray *segments;
+    guint32 active_segment;
+    guint64 active_size;
+
+    GByteArray *pending_data;
+    GString *pending_rooms;
+    GPtrArray *dirty_rooms;
+} MatrixEventStorePrivate;
+
+/**
+ * MatrixEventStore:
+ *
+ * An append-only store of room events.
+ */
+G_DEFINE_TYPE_WITH_PRIVATE(MatrixEventStore, matrix_event_store, G_TYPE_OBJECT);
+
+static void
+matrix_event_store_room_free(MatrixEventStoreRoom *room)
+{
+    g_free(room->room_id);
+    g_clear_pointer(&(room->index_map), g_mapped_file_unref);
+    g_byte_array_unref(room->pending);
+    g_free(room);
+}
+
+static void
+matrix_event_store_segment_free(GMappedFile *map)
+{
+    if (map != NULL) {
+        g_mapped_file_unref(map);
+    }
+}
+
+static MatrixEventStoreRoom *
+matrix_event_store_add_room(MatrixEventStorePrivate *priv, const gchar *room_id)
+{
+    MatrixEventStoreRoom *room = g_new0(MatrixEventStoreRoom, 1);
+
+    room->number = priv->rooms->len;
+    room->room_id = g_strdup(room_id);
+    room->pending = g_byte_array_new();
+
+    g_ptr_array_add(priv->rooms, room);
+    g_hash_table_insert(priv->rooms_by_id, room->room_id, room);
+
+    return room;
+}
+
+static void
+matrix_event_store_put_uint32(GByteArray *array, guint32 value)
+{
+    value = GUINT32_TO_LE(value);
+    g_byte_array_append(array, (const guint8 *)&value, sizeof(value));
+}
+
+static guint32
+matrix_event_store_get_uint32(const gchar *data)
+{
+    guint32 value;
+
+    memcpy(&value, data, sizeof(value));
+
+    return GUINT32_FROM_LE(value);
+}
+
+static guint16
+matrix_event_store_get_uint16(const gchar *data)
+{
+    guint16 value;
+
+    memcpy(&value, data, sizeof(value));
+
+    return GUINT16_FROM_LE(value);
+}
+
+static gchar *
+matrix_event_store_build_filename(MatrixEventStorePrivate *priv, const gchar *format, guint number)
+{
+    gchar *basename = g_strdup_printf(format, number);
+    gchar *ret = g_build_filename(priv->path, basename, NULL);
+
+    g_free(basename);
+
+    return ret;
+}
+
+/*
+ * Get the mapping of a segment, mapping it if it’s not mapped yet.  If min_len is not 0, the
+ * active segment is remapped if the current mapping is shorter than that.
+ */
+static GMappedFile *
+matrix_event_store_get_segment(MatrixEventStorePrivate *priv, guint32 segment, gsize min_len, GError **error)
+{
+    GMappedFile *map = NULL;
+    gchar *filename;
+
+    if (segment < priv->segments->len) {
+        map = g_ptr_array_index(priv->segments, segment);
+    }
+
+    if ((map != NULL) && (g_mapped_file_get_length(map) >= min_len)) {
+        return map;
+    }
+
+    filename = matrix_event_store_build_filename(priv, "segment-%06u", segment);
+    map = g_mapped_file_new(filename, FALSE, error);
+    g_free(filename);
+
+    if (map == NULL) {
+        return NULL;
+    }
+
+    if (segment >= priv->segments->len) {
+        g_ptr_array_set_size(priv->segments, segment + 1);
+    }
+
+    if (g_ptr_array_index(priv->segments, segment) != NULL) {
+        g_mapped_file_unref(g_ptr_array_index(priv->segments, segment));
+    }
+
+    g_ptr_array_index(priv->segments, segment) = map;
+
+    return map;
+}
+
+/*
+ * Get the mapped index of room, with at least n_entries entries in it.
+ */
+static const gchar *
+matrix_event_store_get_index(MatrixEventStorePrivate *priv, MatrixEventStoreRoom *room, guint64 n_entries, GError **error)
+{
+    gchar *filename;
+
+    if ((room->index_map != NULL)
+        && (g_mapped_file_get_length(room->index_map) >= n_entries * MATRIX_EVENT_STORE_INDEX_ENTRY_LEN)) {
+        return g_mapped_file_get_contents(room->index_map);
+    }
+
+    g_clear_pointer(&(room->index_map), g_mapped_file_unref);
+
+    filename = matrix_event_store_build_filename(priv, "room-%u.idx", room->number);
+    room->index_map = g_mapped_file_new(filename, FALSE, error);
+    g_free(filename);
+
+    if (room->index_map == NULL) {
+        return NULL;
+    }
+
+    if (g_mapped_file_get_length(room->index_map) < n_entries * MATRIX_EVENT_STORE_INDEX_ENTRY_LEN) {
+        g_set_error(error, MATRIX_ERROR, MATRIX_ERROR_INVALID_FORMAT,
+                    "Index of room %s is truncated", room->room_id);
+
+        return NULL;
+    }
+
+    return g_mapped_file_get_contents(room->index_map);
+}
+
+/*
+ * Locate the record an index entry points to.  On success, returns the mapped segment and
+ * sets offset and len to the position and length of the whole record.
+ */
+static GMappedFile *
+matrix_event_store_get_record(MatrixEventStorePrivate *priv, const gchar *entry, gsize *offset, gsize *len, GError **error)
+{
+    guint32 segment = matrix_event_store_get_uint32(entry);
+    gsize record_offset = matrix_event_store_get_uint32(entry + 4);
+    GMappedFile *map;
+    const gchar *data;
+    gsize map_len;
+    gsize record_len;
+
+    if ((map = matrix_event_store_get_segment(priv, segment, record_offset + MATRIX_EVENT_STORE_RECORD_HEADER_LEN, error)) == NULL) {
+        return NULL;
+    }
+
+    data = g_mapped_file_get_contents(map);
+    map_len = g_mapped_file_get_length(map);
+
+    if (map_len < record_offset + MATRIX_EVENT_STORE_RECORD_HEADER_LEN) {
+        goto invalid;
+    }
+
+    record_len = MATRIX_EVENT_STORE_RECORD_HEADER_LEN
+        + matrix_event_store_get_uint16(data + record_offset + 8) + 1
+        + matrix_event_store_get_uint32(data + record_offset);
+
+    if (map_len - record_offset < record_len) {
+        if ((map = matrix_event_store_get_segment(priv, segment, record_offset + record_len, error)) == NULL) {
+            return NULL;
+        }
+
+        if (g_mapped_file_get_length(map) - record_offset < record_len) {
+            goto invalid;
+        }
+    }
+
+    *offset = record_offset;
+    *len = record_len;
+
+    return map;
+
+invalid:
+    g_set_error(error, MATRIX_ERROR, MATRIX_ERROR_INVALID_FORMAT,
+                "Event store segment %u is truncated", segment);
+
+    return NULL;
+}
+
+/*
+ * Wrap the event data of a record into a #GBytes, without copying it.
+ */
+static GBytes *
+matrix_event_store_record_to_bytes(GMappedFile *map, gsize offset, gsize len)
+{
+    const gchar *record = g_mapped_file_get_contents(map) + offset;
+    gsize header_len = MATRIX_EVENT_STORE_RECORD_HEADER_LEN + matrix_event_store_get_uint16(record + 8) + 1;
+
+    return g_bytes_new_with_free_func(record + header_len, len - header_len,
+                                      (GDestroyNotify)g_mapped_file_unref,
+                                      g_mapped_file_ref(map));
+}
+
+static gboolean
+matrix_event_store_truncate_file(const gchar *filename, gsize len, GError **error)
+{
+#ifdef G_OS_UNIX
+    if (truncate(filename, len) != 0) {
+        int errsv = errno;
+
+        g_set_error(error, G_FILE_ERROR, g_file_error_from_errno(errsv),
+                    "Could not truncate %s: %s", filename, g_strerror(errsv));
+
+        return FALSE;
+    }
+
+    return TRUE;
+#else
+    gchar *contents;
+    gsize file_len;
+    gboolean ok;
+
+    if (!g_file_get_contents(filename, &contents, &file_len, error)) {
+        return FALSE;
+    }
+
+    ok = g_file_set_contents(filename, contents, MIN(len, file_len), error);
+    g_free(contents);
+
+    return ok;
+#endif
+}
+
+/*
+ * Check if an index entry points to a complete record of room inside its segment.
+ */
+static gboolean
+matrix_event_store_entry_is_valid(MatrixEventStorePrivate *priv, MatrixEventStoreRoom *room, const gchar *entry)
+{
+    GMappedFile *map;
+    gsize offset;
+    gsize len;
+
+    if ((map = matrix_event_store_get_record(priv, entry, &offset, &len, NULL)) == NULL) {
+        return FALSE;
+    }
+
+    return matrix_event_store_get_uint32(g_mapped_file_get_contents(map) + offset + 4) == room->number;
+}
+
+/*
+ * Map the index of room, and drop a partial entry, and entries pointing to records that
+ * don’t exist, from its end.  Those can be left behind by a write that was cut short.
+ */
+static gboolean
+matrix_event_store_load_index(MatrixEventStorePrivate *priv, MatrixEventStoreRoom *room, GError **error)
+{
+    const gchar *index;
+    gsize len;
+    gsize valid_len;
+    gchar *filename;
+    gboolean ok;
+
+    if ((index = matrix_event_store_get_index(priv, room, 0, error)) == NULL) {
+        return FALSE;
+    }
+
+    len = g_mapped_file_get_length(room->index_map);
+    valid_len = len - len % MATRIX_EVENT_STORE_INDEX_ENTRY_LEN;
+
+    while ((valid_len > 0)
+           && !matrix_event_store_entry_is_valid(priv, room, index + valid_len - MATRIX_EVENT_STORE_INDEX_ENTRY_LEN)) {
+        valid_len -= MATRIX_EVENT_STORE_INDEX_ENTRY_LEN;
+    }
+
+    room->n_committed = valid_len / MATRIX_EVENT_STORE_INDEX_ENTRY_LEN;
+
+    if (valid_len == len) {
+        return TRUE;
+    }
+
+    g_warning("Dropping %" G_GSIZE_FORMAT " bytes of damaged index of room %s",
+              len - valid_len, room->room_id);
+
+    g_clear_pointer(&(room->index_map), g_mapped_file_unref);
+    filename = matrix_event_store_build_filename(priv, "room-%u.idx", room->number);
+    ok = matrix_event_store_truncate_file(filename, valid_len, error);
+    g_free(filename);
+
+    return ok;
+}
+
+/*
+ * Fill the event ID index from the committed records.  Entries that can’t be read are
+ * skipped, so one damaged record doesn’t make the rest of the store unusable.
+ */
+static void
+matrix_event_store_load_event_ids(MatrixEventStorePrivate *priv)
+{
+    if (priv->event_ids_loaded) {
+        return;
+    }
+
+    priv->event_ids_loaded = TRUE;
+
+    for (guint i = 0; i < priv->rooms->len; i++) {
+        MatrixEventStoreRoom *room = g_ptr_array_index(priv->rooms, i);
+        GError *inner_error = NULL;
+        const gchar *index;
+
+        if (room->n_committed == 0) {
+            continue;
+        }
+
+        if ((index = matrix_event_store_get_index(priv, room, room->n_committed, &inner_error)) == NULL) {
+            g_warning("Could not read the index of room %s: %s", room->room_id, inner_error->message);
+            g_clear_error(&inner_error);
+
+            continue;
+        }
+
+        for (guint64 position = 0; position < room->n_committed; position++) {
+            const gchar *entry = index + position * MATRIX_EVENT_STORE_INDEX_ENTRY_LEN;
+            MatrixEventStoreLocation *location;
+            GMappedFile *map;
+            gsize offset;
+            gsize len;
+            const gchar *record;
+
+            if ((map = matrix_event_store_get_record(priv, entry, &offset, &len, &inner_error)) == NULL) {
+                g_warning("Skipping event %" G_GUINT64_FORMAT " of room %s: %s",
+                          position, room->room_id, inner_error->message);
+                g_clear_error(&inner_error);
+
+                continue;
+            }
+
+            record = g_mapped_file_get_contents(map) + offset;
+
+            if (matrix_event_store_get_uint16(record + 8) == 0) {
+                continue;
+            }
+
+            location = g_new(MatrixEventStoreLocation, 1);
+            location->room = room->number;
+            location->position = position;
+
+            g_hash_table_replace(priv->event_ids,
+                                 g_strndup(record + MATRIX_EVENT_STORE_RECORD_HEADER_LEN,
+                                           matrix_event_store_get_uint16(record + 8)),
+                                 location);
+        }
+    }
+}
+
+static gboolean
+matrix_event_store_load(MatrixEventStore *matrix_event_store, GError **error)
+{
+    MatrixEventStorePrivate *priv = matrix_event_store_get_instance_private(matrix_event_store);
+    gchar *filename;
+    gchar *contents = NULL;
+    gsize len;
+    GError *inner_error = NULL;
+
+    if (g_mkdir_with_parents(priv->path, 0700) != 0) {
+        int errsv = errno;
+
+        g_set_error(error, G_FILE_ERROR, g_file_error_from_errno(errsv),
+                    "Could not create event store directory %s: %s",
+                    priv->path, g_strerror(errsv));
+
+        return FALSE;
+    }
+
+    /* Room list */
+    filename = g_build_filename(priv->path, "rooms", NULL);
+
+    if (g_file_get_contents(filename, &contents, &len, NULL)) {
+        gchar *last_newline = g_strrstr_len(contents, len, "\n");
+        gchar **lines;
+
+        priv->rooms_size = (last_newline == NULL) ? 0 : last_newline - contents + 1;
+
+        /* A room ID without a newline is a partial write.  Its room has no events yet (the
+         * room list is written first), so it is dropped, and added again when needed. */
+        if (priv->rooms_size < len) {
+            g_warning("Dropping partial line from the room list of event store %s", priv->path);
+
+            if (!matrix_event_store_truncate_file(filename, priv->rooms_size, error)) {
+                g_free(contents);
+                g_free(filename);
+
+                return FALSE;
+            }
+        }
+
+        contents[priv->rooms_size] = '\0';
+        lines = g_strsplit(contents, "\n", -1);
+
+        for (gchar **line = lines; *line != NULL; line++) {
+            if (**line != '\0') {
+                matrix_event_store_add_room(priv, *line);
+            }
+        }
+
+        g_strfreev(lines);
+        g_free(contents);
+    }
+
+    g_free(filename);
+
+    /* Segments */
+    for (guint32 segment = 0; ; segment++) {
+        GMappedFile *map;
+
+        filename = matrix_event_store_build_filename(priv, "segment-%06u", segment);
+
+        if (!g_file_test(filename, G_FILE_TEST_EXISTS)) {
+            g_free(filename);
+
+            break;
+        }
+
+        g_free(filename);
+
+        if ((map = matrix_event_store_get_segment(priv, segment, 0, error)) == NULL) {
+            return FALSE;
+        }
+
+        priv->active_segment = segment;
+        priv->active_size = g_mapped_file_get_length(map);
+    }
+
+    /* Room indices */
+    for (guint i = 0; i < priv->rooms->len; i++) {
+        MatrixEventStoreRoom *room = g_ptr_array_index(priv->rooms, i);
+
+        if (!matrix_event_store_load_index(priv, room, &inner_error)) {
+            /* The room was added, but none of its events were written */
+            if (g_error_matches(inner_error, G_FILE_ERROR, G_FILE_ERROR_NOENT)) {
+                g_clear_error(&inner_error);
+
+                continue;
+            }
+
+            g_propagate_error(error, inner_error);
+
+            return FALSE;
+        }
+    }
+
+    return TRUE;
+}
+
+/**
+ * matrix_event_store_new:
+ * @path: the directory holding the store
+ * @error: (nullable): a #GError, or %NULL to ignore errors
+ *
+ * Open the event store in @path.  The directory is created if it doesn’t exist.
+ *
+ * Returns: (transfer full) (nullable): a new #MatrixEventStore, or %NULL if the store could
+ *     not be opened
+ */
+MatrixEventStore *
+matrix_event_store_new(const gchar *path, GError **error)
+{
+    MatrixEventStore *ret;
+
+    g_return_val_if_fail(path != NULL, NULL);
+
+    ret = (MatrixEventStore *)g_object_new(MATRIX_TYPE_EVENT_STORE,
+                                           "path", path,
+                                           NULL);
+
+    if (!matrix_event_store_load(ret, error)) {
+        g_object_unref(ret);
+
+        return NULL;
+    }
+
+    return ret;
+}
+
+/**
+ * matrix_event_store_get_path:
+ * @store: a #MatrixEventStore
+ *
+ * Returns: (transfer none): the directory holding @store
+ */
+const gchar *
+matrix_event_store_get_path(MatrixEventStore *matrix_event_store)
+{
+    MatrixEventStorePrivate *priv;
+
+    g_return_val_if_fail(matrix_event_store != NULL, NULL);
+
+    priv = matrix_event_store_get_instance_private(matrix_event_store);
+
+    return priv->path;
+}
+
+/**
+ * matrix_event_store_append:
+ * @store: a #MatrixEventStore
+ * @room_id: the room @event belongs to
+ * @event: a #JsonNode holding an event
+ * @error: (nullable): a #GError, or %NULL to ignore errors
+ *
+ * Append @event to the history of @room_id.  The event is only written when
+ * matrix_event_store_commit() is called.
+ *
+ * Events with an event ID already in the store are skipped.
+ *
+ * Returns: %TRUE if @event was appended, %FALSE if it is already stored or on error
+ */
+gboolean
+matrix_event_store_append(MatrixEventStore *matrix_event_store, const gchar *room_id, JsonNode *event, GError **error)
+{
+    MatrixEventStorePrivate *priv;
+    MatrixEventStoreRoom *room;
+    MatrixEventStoreLocation *location;
+    MatrixJsonWriter *writer;
+    JsonNode *node;
+    GBytes *data;
+    const gchar *event_id = NULL;
+    gsize event_id_len = 0;
+    gsize data_len;
+    gsize record_len;
+    guint16 event_id_len_le;
+
+    g_return_val_if_fail(matrix_event_store != NULL, FALSE);
+    g_return_val_if_fail(room_id != NULL, FALSE);
+    g_return_val_if_fail(event != NULL, FALSE);
+
+    priv = matrix_event_store_get_instance_private(matrix_event_store);
+
+    if (json_node_get_node_type(event) != JSON_NODE_OBJECT) {
+        g_set_error(error, MATRIX_ERROR, MATRIX_ERROR_INVALID_FORMAT,
+                    "Event is not a JSON object");
+
+        return FALSE;
+    }
+
+    if (((node = json_object_get_member(json_node_get_object(event), "event_id")) != NULL)
+        && ((event_id = json_node_get_string(node)) != NULL)) {
+        matrix_event_store_load_event_ids(priv);
+
+        if (g_hash_table_contains(priv->event_ids, event_id)) {
+            return FALSE;
+        }
+
+        if ((event_id_len = strlen(event_id)) > G_MAXUINT16) {
+            g_set_error(error, MATRIX_ERROR, MATRIX_ERROR_INVALID_FORMAT,
+                        "Event ID is too long");
+
+            return FALSE;
+        }
+    }
+
+    if ((room = g_hash_table_lookup(priv->rooms_by_id, room_id)) == NULL) {
+        if (strchr(room_id, '\n') != NULL) {
+            g_set_error(error, MATRIX_ERROR, MATRIX_ERROR_INVALID_ROOM_ID,
+                        "Invalid room ID");
+
+            return FALSE;
+        }
+
+        room = matrix_event_store_add_room(priv, room_id);
+        g_string_append_printf(priv->pending_rooms, "%s\n", room_id);
+    }
+
+    writer = matrix_json_writer_new_binary();
+
+    if (!matrix_json_writer_add_node(writer, event, error)) {
+        matrix_json_writer_free(writer);
+
+        return FALSE;
+    }
+
+    data = matrix_json_writer_free_to_bytes(writer);
+    data_len = g_bytes_get_size(data);
+    record_len = MATRIX_EVENT_STORE_RECORD_HEADER_LEN + event_id_len + 1 + data_len;
+
+    /* Start a new segment if this record would overflow the current one */
+    if ((priv->active_size + priv->pending_data->len > 0)
+        && (priv->active_size + priv->pending_data->len + record_len > MATRIX_EVENT_STORE_SEGMENT_SIZE)) {
+        if ((priv->pending_data->len > 0) && !matrix_event_store_commit(matrix_event_store, error)) {
+            g_bytes_unref(data);
+
+            return FALSE;
+        }
+
+        priv->active_segment++;
+        priv->active_size = 0;
+    }
+
+    if (room->pending->len == 0) {
+        g_ptr_array_add(priv->dirty_rooms, room);
+    }
+
+    matrix_event_store_put_uint32(room->pending, priv->active_segment);
+    matrix_event_store_put_uint32(room->pending, priv->active_size + priv->pending_data->len);
+
+    event_id_len_le = GUINT16_TO_LE((guint16)event_id_len);
+    matrix_event_store_put_uint32(priv->pending_data, data_len);
+    matrix_event_store_put_uint32(priv->pending_data, room->number);
+    g_byte_array_append(priv->pending_data, (const guint8 *)&event_id_len_le, sizeof(event_id_len_le));
+    g_byte_array_append(priv->pending_data, (const guint8 *)((event_id != NULL) ? event_id : ""), event_id_len + 1);
+    g_byte_array_append(priv->pending_data, g_bytes_get_data(data, NULL), data_len);
+    g_bytes_unref(data);
+
+    if (event_id != NULL) {
+        location = g_new(MatrixEventStoreLocation, 1);
+        location->room = room->number;
+        location->position = room->n_committed + room->pending->len / MATRIX_EVENT_STORE_INDEX_ENTRY_LEN - 1;
+        g_hash_table_insert(priv->event_ids, g_strdup(event_id), location);
+    }
+
+    return TRUE;
+}
+
+/*
+ * Append data to filename, which should be size bytes long.  If it is longer, the extra
+ * bytes are left over from an append that failed halfway, and they are cut off first, so
+ * the offsets computed from size stay right.
+ */
+static gboolean
+matrix_event_store_append_to_file(const gchar *filename, gsize size, const guint8 *data, gsize len, GError **error)
+{
+    GStatBuf st;
+    FILE *file;
+    gboolean ok;
+    int errsv;
+
+    if (g_stat(filename, &st) == 0) {
+        if ((gsize)st.st_size < size) {
+            g_set_error(error, MATRIX_ERROR, MATRIX_ERROR_INVALID_FORMAT,
+                        "%s is shorter than expected", filename);
+
+            return FALSE;
+        }
+
+        if (((gsize)st.st_size > size) && !matrix_event_store_truncate_file(filename, size, error)) {
+            return FALSE;
+        }
+    } else if (size > 0) {
+        g_set_error(error, MATRIX_ERROR, MATRIX_ERROR_INVALID_FORMAT,
+                    "%s is missing", filename);
+
+        return FALSE;
+    }
+
+    if ((file = g_fopen(filename, "ab")) == NULL) {
+        errsv = errno;
+        g_set_error(error, G_FILE_ERROR, g_file_error_from_errno(errsv),
+                    "Could not open %s: %s", filename, g_strerror(errsv));
+
+        return FALSE;
+    }
+
+    ok = (fwrite(data, 1, len, file) == len) && (fflush(file) == 0);
+
+#ifdef G_OS_UNIX
+    ok = ok && (fsync(fileno(file)) == 0);
+#endif
+
+    errsv = errno;
+
+    if (fclose(file) != 0) {
+        if (ok) {
+            errsv = errno;
+        }
+
+        ok = FALSE;
+    }
+
+    if (!ok) {
+        g_set_error(error, G_FILE_ERROR, g_file_error_from_errno(errsv),
+                    "Could not write %s: %s", filename, g_strerror(errsv));
+    }
+
+    return ok;
+}
+
+/**
+ * matrix_event_store_commit:
+ * @store: a #MatrixEventStore
+ * @error: (nullable): a #GError, or %NULL to ignore errors
+ *
+ * Write out all events appended since the last commit.  Each file is written with a single
+ * call, and synced to disk.  If the commit fails, it can be retried; data written partially by
+ * the failed attempt is discarded first.
+ *
+ * Returns: %TRUE on success
+ */
+gboolean
+matrix_event_store_commit(MatrixEventStore *matrix_event_store, GError **error)
+{
+    MatrixEventStorePrivate *priv;
+    gchar *filename;
+    gboolean ok;
+
+    g_return_val_if_fail(matrix_event_store != NULL, FALSE);
+
+    priv = matrix_event_store_get_instance_private(matrix_event_store);
+
+    if (priv->pending_rooms->len > 0) {
+        filename = g_build_filename(priv->path, "rooms", NULL);
+        ok = matrix_event_store_append_to_file(filename, priv->rooms_size, (const guint8 *)priv->pending_rooms->str, priv->pending_rooms->len, error);
+        g_free(filename);
+
+        if (!ok) {
+            return FALSE;
+        }
+
+        priv->rooms_size += priv->pending_rooms->len;
+        g_string_truncate(priv->pending_rooms, 0);
+    }
+
+    if (priv->pending_data->len > 0) {
+        filename = matrix_event_store_build_filename(priv, "segment-%06u", priv->active_segment);
+        ok = matrix_event_store_append_to_file(filename, priv->active_size, priv->pending_data->data, priv->pending_data->len, error);
+        g_free(filename);
+
+        if (!ok) {
+            return FALSE;
+        }
+
+        priv->active_size += priv->pending_data->len;
+        g_byte_array_set_size(priv->pending_data, 0);
+    }
+
+    while (priv->dirty_rooms->len > 0) {
+        MatrixEventStoreRoom *room = g_ptr_array_index(priv->dirty_rooms, priv->dirty_rooms->len - 1);
+
+        filename = matrix_event_store_build_filename(priv, "room-%u.idx", room->number);
+        ok = matrix_event_store_append_to_file(filename, room->n_committed * MATRIX_EVENT_STORE_INDEX_ENTRY_LEN,
+                                               room->pending->data, room->pending->len, error);
+        g_free(filename);
+
+        if (!ok) {
+            return FALSE;
+        }
+
+        room->n_committed += room->pending->len / MATRIX_EVENT_STORE_INDEX_ENTRY_LEN;
+        g_byte_array_set_size(room->pending, 0);
+        g_ptr_array_remove_index(priv->dirty_rooms, priv->dirty_rooms->len - 1);
+    }
+
+    return TRUE;
+}
+
+/**
+ * matrix_event_store_get_room_length:
+ * @store: a #MatrixEventStore
+ * @room_id: a room ID
+ *
+ * Returns: the number of committed events stored for @room_id
+ */
+guint64
+matrix_event_store_get_room_length(MatrixEventStore *matrix_event_store, const gchar *room_id)
+{
+    MatrixEventStorePrivate *priv;
+    MatrixEventStoreRoom *room;
+
+    g_return_val_if_fail(matrix_event_store != NULL, 0);
+    g_return_val_if_fail(room_id != NULL, 0);
+
+    priv = matrix_event_store_get_instance_private(matrix_event_store);
+
+    if ((room = g_hash_table_lookup(priv->rooms_by_id, room_id)) == NULL) {
+        return 0;
+    }
+
+    return room->n_committed;
+}
+
+/**
+ * matrix_event_store_get_events:
+ * @store: a #MatrixEventStore
+ * @room_id: a room ID
+ * @start: the position of the first event to get
+ * @count: the maximum number of events to get
+ * @error: (nullable): a #GError, or %NULL to ignore errors
+ *
+ * Get the events of @room_id stored at positions @start to @start + @count - 1, in the order
+ * they were appended.  If there are less events in the store, only those that exist are
+ * returned.
+ *
+ * The returned data points directly into the memory mapped store; it can be decoded with
+ * matrix_event_base_new_from_binary() or matrix_json_binary_to_node().
+ *
+ * Returns: (transfer full) (element-type GBytes) (nullable): the list of events, or %NULL
+ *     on error
+ */
+GPtrArray *
+matrix_event_store_get_events(MatrixEventStore *matrix_event_store, const gchar *room_id, guint64 start, guint count, GError **error)
+{
+    MatrixEventStorePrivate *priv;
+    MatrixEventStoreRoom *room;
+    const gchar *index;
+    GPtrArray *ret;
+    guint64 end;
+
+    g_return_val_if_fail(matrix_event_store != NULL, NULL);
+    g_return_val_if_fail(room_id != NULL, NULL);
+
+    priv = matrix_event_store_get_instance_private(matrix_event_store);
+    ret = g_ptr_array_new_with_free_func((GDestroyNotify)g_bytes_unref);
+
+    if (((room = g_hash_table_lookup(priv->rooms_by_id, room_id)) == NULL)
+        || (start >= room->n_committed)) {
+        return ret;
+    }
+
+    end = MIN(room->n_committed, start + count);
+
+    if ((index = matrix_event_store_get_index(priv, room, end, error)) == NULL) {
+        g_ptr_array_unref(ret);
+
+        return NULL;
+    }
+
+    for (guint64 position = start; position < end; position++) {
+        GMappedFile *map;
+        gsize offset;
+        gsize len;
+
+        if ((map = matrix_event_store_get_record(priv, index + position * MATRIX_EVENT_STORE_INDEX_ENTRY_LEN, &offset, &len, error)) == NULL) {
+            g_ptr_array_unref(ret);
+
+            return NULL;
+        }
+
+        g_ptr_array_add(ret, matrix_event_store_record_to_bytes(map, offset, len));
+    }
+
+    return ret;
+}
+
+/**
+ * matrix_event_store_get_event:
+ * @store: a #MatrixEventStore
+ * @room_id: a room ID
+ * @position: the position of the event in the room
+ * @error: (nullable): a #GError, or %NULL to ignore errors
+ *
+ * Get a single event of @room_id.  See matrix_event_store_get_events() for details.
+ *
+ * Returns: (transfer full) (nullable): the event data, or %NULL if there is no such event
+ */
+GBytes *
+matrix_event_store_get_event(MatrixEventStore *matrix_event_store, const gchar *room_id, guint64 position, GError **error)
+{
+    GPtrArray *events;
+    GBytes *ret = NULL;
+
+    if ((events = matrix_event_store_get_events(matrix_event_store, room_id, position, 1, error)) == NULL) {
+        return NULL;
+    }
+
+    if (events->len == 0) {
+        g_set_error(error, MATRIX_ERROR, MATRIX_ERROR_NOT_FOUND,
+                    "No event at position %" G_GUINT64_FORMAT " in room %s", position, room_id);
+    } else {
+        ret = g_bytes_ref(g_ptr_array_index(events, 0));
+    }
+
+    g_ptr_array_unref(events);
+
+    return ret;
+}
+
+/**
+ * matrix_event_store_lookup_event:
+ * @store: a #MatrixEventStore
+ * @event_id: an event ID
+ * @room_id: (out) (optional) (transfer none): the room the event belongs to
+ * @position: (out) (optional): the position of the event in its room
+ *
+ * Find a committed event by its ID.
+ *
+ * Returns: (transfer full) (nullable): the event data, or %NULL if the event is not in the
+ *     store
+ */
+GBytes *
+matrix_event_store_lookup_event(MatrixEventStore *matrix_event_store, const gchar *event_id, const gchar **room_id, guint64 *position)
+{
+    MatrixEventStorePrivate *priv;
+    MatrixEventStoreLocation *location;
+    MatrixEventStoreRoom *room;
+    GBytes *ret;
+
+    g_return_val_if_fail(matrix_event_store != NULL, NULL);
+    g_return_val_if_fail(event_id != NULL, NULL);
+
+    priv = matrix_event_store_get_instance_private(matrix_event_store);
+    matrix_event_store_load_event_ids(priv);
+
+    if ((location = g_hash_table_lookup(priv->event_ids, event_id)) == NULL) {
+        return NULL;
+    }
+
+    room = g_ptr_array_index(priv->rooms, location->room);
+
+    if ((ret = matrix_event_store_get_event(matrix_event_store, room->room_id, location->position, NULL)) == NULL) {
+        return NULL;
+    }
+
+    if (room_id != NULL) {
+        *room_id = room->room_id;
+    }
+
+    if (position != NULL) {
+        *position = location->position;
+    }
+
+    return ret;
+}
+
+/*
+ * Build the redacted version of a record.  The result has the same length as the original,
+ * with the unused part of the data zeroed out.
+ */
+static GByteArray *
+matrix_event_store_redact_record(const gchar *record, gsize record_len, const gchar *redacted_because, GError **error)
+{
+    gsize header_len = MATRIX_EVENT_STORE_RECORD_HEADER_LEN + matrix_event_store_get_uint16(record + 8) + 1;
+    GBytes *data;
+    JsonNode *node;
+    JsonNode *redacted;
+    MatrixJsonWriter *writer;
+    GByteArray *ret;
+
+    data = g_bytes_new_static(record + header_len, record_len - header_len);
+    node = matrix_json_binary_to_node(data, error);
+    g_bytes_unref(data);
+
+    if (node == NULL) {
+        return NULL;
+    }
+
+    redacted = _matrix_event_json_redact(node, redacted_because);
+    writer = matrix_json_writer_new_binary();
+    matrix_json_writer_add_node(writer, redacted, NULL);
+    data = matrix_json_writer_free_to_bytes(writer);
+    json_node_unref(redacted);
+
+    /* Stripping never makes an event longer, but adding redacted_because may; the record is
+     * rewritten in place, so drop it if there is no room for it */
+    if ((g_bytes_get_size(data) > record_len - header_len) && (redacted_because != NULL)) {
+        g_bytes_unref(data);
+        redacted = _matrix_event_json_redact(node, NULL);
+        writer = matrix_json_writer_new_binary();
+        matrix_json_writer_add_node(writer, redacted, NULL);
+        data = matrix_json_writer_free_to_bytes(writer);
+        json_node_unref(redacted);
+    }
+
+    json_node_unref(node);
+
+    if (g_bytes_get_size(data) > record_len - header_len) {
+        g_set_error(error, MATRIX_ERROR, MATRIX_ERROR_INVALID_FORMAT,
+                    "Redacted event doesn’t fit in its record");
+        g_bytes_unref(data);
+
+        return NULL;
+    }
+
+    ret = g_byte_array_sized_new(record_len);
+    matrix_event_store_put_uint32(ret, g_bytes_get_size(data));
+    g_byte_array_append(ret, (const guint8 *)record + 4, header_len - 4);
+    g_byte_array_append(ret, g_bytes_get_data(data, NULL), g_bytes_get_size(data));
+    g_bytes_unref(data);
+
+    /* Zero out the rest, so nothing of the original content remains */
+    g_byte_array_set_size(ret, record_len);
+    memset(ret->data + header_len + matrix_event_store_get_uint32((const gchar *)ret->data), 0,
+           record_len - header_len - matrix_event_store_get_uint32((const gchar *)ret->data));
+
+    return ret;
+}
+
+static gboolean
+matrix_event_store_write_at(const gchar *filename, gsize offset, const guint8 *data, gsize len, GError **error)
+{
+    FILE *file;
+    gboolean ok;
+    int errsv;
+
+    if ((file = g_fopen(filename, "r+b")) == NULL) {
+        errsv = errno;
+        g_set_error(error, G_FILE_ERROR, g_file_error_from_errno(errsv),
+                    "Could not open %s: %s", filename, g_strerror(errsv));
+
+        return FALSE;
+    }
+
+    ok = (fseek(file, offset, SEEK_SET) == 0)
+        && (fwrite(data, 1, len, file) == len)
+        && (fflush(file) == 0);
+
+#ifdef G_OS_UNIX
+    ok = ok && (fsync(fileno(file)) == 0);
+#endif
+
+    errsv = errno;
+
+    if (fclose(file) != 0) {
+        if (ok) {
+            errsv = errno;
+        }
+
+        ok = FALSE;
+    }
+
+    if (!ok) {
+        g_set_error(error, G_FILE_ERROR, g_file_error_from_errno(errsv),
+                    "Could not write %s: %s", filename, g_strerror(errsv));
+    }
+
+    return ok;
+}
+
+/**
+ * matrix_event_store_redact:
+ * @store: a #MatrixEventStore
+ * @event_id: the ID of the event to redact
+ * @redacted_because: (nullable): the ID of the redaction event
+ * @error: (nullable): a #GError, or %NULL to ignore errors
+ *
+ * Strip a stored event to the keys a redaction keeps.  The event is rewritten in place, so
+ * its position doesn’t change, and its original content is overwritten on disk.  Events not
+ * committed yet are redacted in memory, before they get written.
+ *
+ * @redacted_because is added to the unsigned data of the event if there is room for it in
+ * the original record.
+ *
+ * Data returned earlier by matrix_event_store_get_events() and friends may or may not reflect
+ * the change.
+ *
+ * Returns: %TRUE on success.  If the event is not in @store, @error is set to
+ *     %MATRIX_ERROR_NOT_FOUND
+ */
+gboolean
+matrix_event_store_redact(MatrixEventStore *matrix_event_store, const gchar *event_id, const gchar *redacted_because, GError **error)
+{
+    MatrixEventStorePrivate *priv;
+    MatrixEventStoreLocation *location;
+    MatrixEventStoreRoom *room;
+    GByteArray *redacted;
+    const gchar *index;
+    const gchar *entry;
+    GMappedFile *map;
+    gsize offset;
+    gsize record_len;
+    guint32 segment;
+    gchar *filename;
+    gboolean ok;
+
+    g_return_val_if_fail(matrix_event_store != NULL, FALSE);
+    g_return_val_if_fail(event_id != NULL, FALSE);
+
+    priv = matrix_event_store_get_instance_private(matrix_event_store);
+    matrix_event_store_load_event_ids(priv);
+
+    if ((location = g_hash_table_lookup(priv->event_ids, event_id)) == NULL) {
+        g_set_error(error, MATRIX_ERROR, MATRIX_ERROR_NOT_FOUND,
+                    "Event %s is not in the store", event_id);
+
+        return FALSE;
+    }
+
+    room = g_ptr_array_index(priv->rooms, location->room);
+
+    if (location->position >= room->n_committed) {
+        /* Still pending; the index entry points past the committed part of the active
+         * segment, into pending_data */
+        const gchar *record;
+
+        entry = (const gchar *)room->pending->data
+            + (location->position - room->n_committed) * MATRIX_EVENT_STORE_INDEX_ENTRY_LEN;
+        offset = matrix_event_store_get_uint32(entry + 4) - priv->active_size;
+        record = (const gchar *)priv->pending_data->data + offset;
+        record_len = MATRIX_EVENT_STORE_RECORD_HEADER_LEN
+            + matrix_event_store_get_uint16(record + 8) + 1
+            + matrix_event_store_get_uint32(record);
+
+        if ((redacted = matrix_event_store_redact_record(record, record_len, redacted_because, error)) == NULL) {
+            return FALSE;
+        }
+
+        memcpy(priv->pending_data->data + offset, redacted->data, record_len);
+        g_byte_array_unref(redacted);
+
+        return TRUE;
+    }
+
+    if ((index = matrix_event_store_get_index(priv, room, location->position + 1, error)) == NULL) {
+        return FALSE;
+    }
+
+    entry = index + location->position * MATRIX_EVENT_STORE_INDEX_ENTRY_LEN;
+    segment = matrix_event_store_get_uint32(entry);
+
+    if ((map = matrix_event_store_get_record(priv, entry, &offset, &record_len, error)) == NULL) {
+        return FALSE;
+    }
+
+    if ((redacted = matrix_event_store_redact_record(g_mapped_file_get_contents(map) + offset, record_len, redacted_because, error)) == NULL) {
+        return FALSE;
+    }
+
+    filename = matrix_event_store_build_filename(priv, "segment-%06u", segment);
+    ok = matrix_event_store_write_at(filename, offset, redacted->data, record_len, error);
+    g_free(filename);
+    g_byte_array_unref(redacted);
+
+    /* Mappings are private, so they may not see the change; map the segment again
+     * next time it is needed */
+    g_ptr_array_index(priv->segments, segment) = NULL;
+    g_mapped_file_unref(map);
+
+    return ok;
+}
+
+static void
+matrix_event_store_finalize(GObject *gobject)
+{
+    MatrixEventStorePrivate *priv = matrix_event_store_get_instance_private(MATRIX_EVENT_STORE(gobject));
+
+    if ((priv->pending_data->len > 0) || (priv->dirty_rooms->len > 0)) {
+        g_warning("Event store %s finalized with uncommitted events", priv->path);
+    }
+
+    g_free(priv->path);
+    g_ptr_array_unref(priv->dirty_rooms);
+    g_ptr_array_unref(priv->rooms);
+    g_hash_table_unref(priv->rooms_by_id);
+    g_hash_table_unref(priv->event_ids);
+    g_ptr_array_unref(priv->segments);
+    g_byte_array_unref(priv->pending_data);
+    g_string_free(priv->pending_rooms, TRUE);
+
+    G_OBJECT_CLASS(matrix_event_store_parent_class)->finalize(gobject);
+}
+
+static void
+matrix_event_store_get_property(GObject *gobject, guint property_id, GValue *value, GParamSpec *pspec)
+{
+    MatrixEventStore *matrix_event_store = MATRIX_EVENT_STORE(gobject);
+
+    switch (property_id) {
+        case PROP_PATH:
+            g_value_set_string(value, matrix_event_store_get_path(matrix_event_store));
+
+            break;
+        default:
+            G_OBJECT_WARN_INVALID_PROPERTY_ID(gobject, property_id, pspec);
+
+            break;
+    }
+}
+
+static void
+matrix_event_store_set_property(GObject *gobject, guint property_id, const GValue *value, GParamSpec *pspec)
+{
+    MatrixEventStorePrivate *priv = matrix_event_store_get_instance_private(MATRIX_EVENT_STORE(gobject));
+
+    switch (property_id) {
+        case PROP_PATH:
+            g_free(priv->path);
+            priv->path = g_value_dup_string(value);
+
+            break;
+        default:
+            G_OBJECT_WARN_INVALID_PROPERTY_ID(gobject, property_id, pspec);
+
+            break;
+    }
+}
+
+static void
+matrix_event_store_class_init(MatrixEventStoreClass *klass)
+{
+    G_OBJECT_CLASS(klass)->get_property = matrix_event_store_get_property;
+    G_OBJECT_CLASS(klass)->set_property = matrix_event_store_set_property;
+    G_OBJECT_CLASS(klass)->finalize = matrix_event_store_finalize;
+
+    /**
+     * MatrixEventStore:path:
+     *
+     * The directory holding the store.
+     */
+    matrix_event_store_properties[PROP_PATH] = g_param_spec_string(
+            "path", "path", "path",
+            NULL,
+            G_PARAM_STATIC_STRINGS | G_PARAM_READWRITE | G_PARAM_CONSTRUCT_ONLY);
+    g_object_class_install_property(G_OBJECT_CLASS(klass), PROP_PATH, matrix_event_store_properties[PROP_PATH]);
+}
+
+static void
+matrix_event_store_init(MatrixEventStore *matrix_event_store)
+{
+    MatrixEventStorePrivate *priv = matrix_event_store_get_instance_private(matrix_event_store);
+
+    priv->rooms = g_ptr_array_new_with_free_func((GDestroyNotify)matrix_event_store_room_free);
+    priv->rooms_by_id = g_hash_table_new(g_str_hash, g_str_equal);
+    priv->event_ids = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_free);
+    priv->event_ids_loaded = FALSE;
+    priv->segments = g_ptr_array_new_with_free_func((GDestroyNotify)matrix_event_store_segment_free);
+    priv->pending_data = g_byte_array_sized_new(64 * 1024);
+    priv->pending_rooms = g_string_new(NULL);
+    priv->dirty_rooms = g_ptr_array_new();
+}
@@ -0,0 +1,49 @@
+/*
+ * This file is part of matrix-glib-sdk
+ *
+ * matrix-glib-sdk is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * matrix-glib-sdk is distributed in the hope that it will be
+ * useful, but WITHOUT ANY WARRANTY; without even the implied
+ * warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with matrix-glib-sdk. If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __MATRIX_GLIB_SDK_EVENT_STORE_H__
+# define __MATRIX_GLIB_SDK_EVENT_STORE_H__
+
+# include <glib-object.h>
+# include <json-glib/json-glib.h>
+
+G_BEGIN_DECLS
+
+# define MATRIX_TYPE_EVENT_STORE matrix_event_store_get_type()
+G_DECLARE_DERIVABLE_TYPE(MatrixEventStore, matrix_event_store, MATRIX, EVENT_STORE, GObject)
+
+struct _MatrixEventStoreClass {
+    GObjectClass parent_class;
+
+    /* < private > */
+    gpointer padding[12];
+};
+
+MatrixEventStore *matrix_event_store_new(const gchar *path, GError **error);
+const gchar *matrix_event_store_get_path(MatrixEventStore *store);
+gboolean matrix_event_store_append(MatrixEventStore *store, const gchar *room_id, JsonNode *event, GError **error);
+gboolean matrix_event_store_commit(MatrixEventStore *store, GError **error);
+guint64 matrix_event_store_get_room_length(MatrixEventStore *store, const gchar *room_id);
+GBytes *matrix_event_store_get_event(MatrixEventStore *store, const gchar *room_id, guint64 position, GError **error);
+GPtrArray *matrix_event_store_get_events(MatrixEventStore *store, const gchar *room_id, guint64 start, guint count, GError **error);
+GBytes *matrix_event_store_lookup_event(MatrixEventStore *store, const gchar *event_id, const gchar **room_id, guint64 *position);
+gboolean matrix_event_store_redact(MatrixEventStore *store, const gchar *event_id, const gchar *redacted_because, GError **error);
+
+G_END_DECLS
+
+#endif  /* __MATRIX_GLIB_SDK_EVENT_STORE_H__ */
@@ -184,6 +184,8 @@ matrix_event_tag_set_tags(MatrixEventTag *event, GHashTable *tags)
 
     g_hash_table_unref(priv->tags);
     priv->tags = g_hash_table_ref(tags);
+
+    g_object_notify_by_pspec((GObject *)event, matrix_event_tag_properties[PROP_TAGS]);
 }
 
 static void
@@ -20,10 +20,12 @@
 #include <json-glib/json-glib.h>
 #include <string.h>
 #include "matrix-http-api.h"
+#include "matrix-http-api-private.h"
 #include "matrix-enumtypes.h"
 #include "config.h"
-#include "utils.h"
+#include "utils-private.h"
 #include "matrix-compacts.h"
+#include "matrix-json-writer.h"
 #include "matrix-event-state-base.h"
 #include "matrix-event-base.h"
 
@@ -45,6 +47,24 @@ enum  {
 
 static GParamSpec *matrix_http_api_properties[NUM_PROPERTIES];
 
+/* Requests are grouped into these classes when backing off, so a failing media repository
+ * doesn’t slow down message sending and vice versa */
+typedef enum {
+    ENDPOINT_CLASS_SYNC,
+    ENDPOINT_CLASS_SEND,
+    ENDPOINT_CLASS_MEDIA,
+    ENDPOINT_CLASS_OTHER,
+    NUM_ENDPOINT_CLASSES
+} EndpointClass;
+
+#define HTTP_STATUS_TOO_MANY_REQUESTS 429
+#define RETRY_MAX_ATTEMPTS 5
+#define RETRY_BASE_DELAY 500
+#define RETRY_MAX_DELAY 60000
+/* The client side rate limiter is off unless enabled with matrix_http_api_set_rate_limit() */
+#define RATE_LIMIT_DEFAULT_RATE 0.0
+#define RATE_LIMIT_DEFAULT_BURST 20
+
 typedef struct {
     SoupSession *soup_session;
     gchar *base_url;
@@ -53,6 +73,16 @@ typedef struct {
     gchar *token;
     gchar *homeserver;
     gchar *user_id;
+    guint endpoint_failures[NUM_ENDPOINT_CLASSES];
+    gdouble rate_limit;
+    guint rate_limit_burst;
+    gdouble rate_limit_tokens;
+    gint64 rate_limit_updated;
+    GList *delayed_requests;
+    guint stat_retried;
+    guint stat_rate_limited;
+    guint stat_throttled;
+    guint stat_failed;
 } MatrixHTTPAPIPrivate;
 
 static void matrix_http_api_matrix_api_interface_init(MatrixAPIInterface * iface);
@@ -132,15 +162,359 @@ _matrix_http_api_create_query_params(void)
     return g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_free);
 }
 
+typedef enum {
+    REQUEST_KIND_DATA,
+    REQUEST_KIND_AUTH,
+    REQUEST_KIND_TRANSACTION
+} RequestKind;
+
+typedef struct {
+    gchar *access_token;
+    gchar *home_server;
+    gchar *user_id;
+} AuthResponseFields;
+
+enum {
+    AUTH_FIELD_ACCESS_TOKEN,
+    AUTH_FIELD_HOME_SERVER,
+    AUTH_FIELD_USER_ID
+};
+
+/* Top level members of login, registration and whoami responses that update our credentials */
+static const MatrixJsonField auth_response_fields[] = {
+    [AUTH_FIELD_ACCESS_TOKEN] = MATRIX_JSON_FIELD("access_token", MATRIX_JSON_FIELD_STRING, AuthResponseFields, access_token),
+    [AUTH_FIELD_HOME_SERVER] = MATRIX_JSON_FIELD("home_server", MATRIX_JSON_FIELD_STRING, AuthResponseFields, home_server),
+    [AUTH_FIELD_USER_ID] = MATRIX_JSON_FIELD("user_id", MATRIX_JSON_FIELD_STRING, AuthResponseFields, user_id),
+};
+
+typedef struct {
+    gchar *errcode;
+    gchar *error;
+    glong retry_after_ms;
+} ErrorResponseFields;
+
+enum {
+    ERROR_FIELD_ERRCODE,
+    ERROR_FIELD_ERROR,
+    ERROR_FIELD_RETRY_AFTER_MS
+};
+
+static const MatrixJsonField error_response_fields[] = {
+    [ERROR_FIELD_ERRCODE] = MATRIX_JSON_FIELD("errcode", MATRIX_JSON_FIELD_STRING, ErrorResponseFields, errcode),
+    [ERROR_FIELD_ERROR] = MATRIX_JSON_FIELD("error", MATRIX_JSON_FIELD_STRING, ErrorResponseFields, error),
+    [ERROR_FIELD_RETRY_AFTER_MS] = MATRIX_JSON_FIELD("retry_after_ms", MATRIX_JSON_FIELD_LONG, ErrorResponseFields, retry_after_ms),
+};
+
+/* Error codes sent by the homeserver, as defined by the Client-Server API */
+static const struct {
+    const gchar *errcode;
+    MatrixError code;
+} errcode_map[] = {
+    {"M_MISSING_TOKEN", MATRIX_ERROR_M_MISSING_TOKEN},
+    {"M_FORBIDDEN", MATRIX_ERROR_M_FORBIDDEN},
+    {"M_UNKNOWN", MATRIX_ERROR_M_UNKNOWN},
+    {"M_UNKNOWN_TOKEN", MATRIX_ERROR_M_UNKNOWN_TOKEN},
+    {"M_NOT_JSON", MATRIX_ERROR_M_NOT_JSON},
+    {"M_UNRECOGNIZED", MATRIX_ERROR_M_UNRECOGNIZED},
+    {"M_UNAUTHORIZED", MATRIX_ERROR_M_UNAUTHORIZED},
+    {"M_BAD_JSON", MATRIX_ERROR_M_BAD_JSON},
+    {"M_USER_IN_USE", MATRIX_ERROR_M_USER_IN_USE},
+    {"M_ROOM_IN_USE", MATRIX_ERROR_M_ROOM_IN_USE},
+    {"M_BAD_PAGINATION", MATRIX_ERROR_M_BAD_PAGINATION},
+    {"M_BAD_STATE", MATRIX_ERROR_M_BAD_STATE},
+    {"M_NOT_FOUND", MATRIX_ERROR_M_NOT_FOUND},
+    {"M_GUEST_ACCESS_FORBIDDEN", MATRIX_ERROR_M_GUEST_ACCESS_FORBIDDEN},
+    {"M_LIMIT_EXCEEDED", MATRIX_ERROR_M_LIMIT_EXCEEDED},
+    {"M_CAPTCHA_NEEDED", MATRIX_ERROR_M_CAPTCHA_NEEDED},
+    {"M_CAPTCHA_INVALID", MATRIX_ERROR_M_CAPTCHA_INVALID},
+    {"M_MISSING_PARAM", MATRIX_ERROR_M_MISSING_PARAM},
+    {"M_TOO_LARGE", MATRIX_ERROR_M_TOO_LARGE},
+    {"M_EXCLUSIVE", MATRIX_ERROR_M_EXCLUSIVE},
+    {"M_THREEPID_AUTH_FAILED", MATRIX_ERROR_M_THREEPID_AUTH_FAILED},
+    {"M_THREEPID_IN_USE", MATRIX_ERROR_M_THREEPID_IN_USE},
+    {"M_INVALID_USERNAME", MATRIX_ERROR_M_INVALID_USERNAME},
+    {"M_THREEPID_NOT_FOUND", MATRIX_ERROR_M_THREEPID_NOT_FOUND},
+};
+
+/* errcode_map as a hash table, built by matrix_http_api_class_init() */
+static GHashTable *errcode_table = NULL;
+
+static MatrixError
+_matrix_http_api_errcode_to_error(const gchar *errcode)
+{
+    gpointer code;
+
+    if ((code = g_hash_table_lookup(errcode_table, errcode)) == NULL) {
+        return MATRIX_ERROR_UNKNOWN_ERROR;
+    }
+
+    return GPOINTER_TO_INT(code);
+}
+
 typedef struct {
     MatrixHTTPAPI *matrix_http_api;
     MatrixAPICallback cb;
     CallType call_type;
+    RequestKind request_kind;
+    EndpointClass endpoint_class;
     gboolean accept_non_json;
     gpointer cb_target;
-    guint refcount;
+    gchar *method;
+    SoupURI *uri;
+    gchar *content_type;
+    GBytes *body;
+    guint attempts;
+    guint source_id;
 } SendCallbackData;
 
+static void
+_matrix_http_api_send_callback_data_free(SendCallbackData *callback_data)
+{
+    g_free(callback_data->method);
+    soup_uri_free(callback_data->uri);
+    g_free(callback_data->content_type);
+    g_bytes_unref(callback_data->body);
+    g_free(callback_data);
+}
+
+static void _matrix_http_api_response_callback(SoupSession *session, SoupMessage *msg, gpointer user_data);
+
+static void
+_matrix_http_api_queue_message(SendCallbackData *callback_data)
+{
+    MatrixHTTPAPIPrivate *priv = matrix_http_api_get_instance_private(callback_data->matrix_http_api);
+    SoupMessage *message;
+    SoupBuffer *buffer;
+    gsize length;
+    gconstpointer data = g_bytes_get_data(callback_data->body, &length);
+
+    message = soup_message_new_from_uri(callback_data->method, callback_data->uri);
+
+    soup_message_set_flags(message, SOUP_MESSAGE_NO_REDIRECT);
+    soup_message_headers_set_content_type(message->request_headers,
+                                          callback_data->content_type,
+                                          NULL);
+
+    /* The buffer holds a reference on the body, so it is never copied, not even on retries */
+    buffer = soup_buffer_new_with_owner(data, length,
+                                        g_bytes_ref(callback_data->body),
+                                        (GDestroyNotify)g_bytes_unref);
+    soup_message_body_append_buffer(message->request_body, buffer);
+    soup_buffer_free(buffer);
+
+    callback_data->attempts++;
+
+    soup_session_queue_message(priv->soup_session, message, _matrix_http_api_response_callback, callback_data);
+}
+
+/*
+ * Take a token from the client side rate limiter.  Returns the number of milliseconds the
+ * caller has to wait before sending its request; the token is reserved even if this is not
+ * zero, so requests are let through in the order they arrived.
+ */
+static guint
+_matrix_http_api_take_token(MatrixHTTPAPIPrivate *priv)
+{
+    gint64 now = g_get_monotonic_time();
+    gdouble available;
+
+    if (priv->rate_limit <= 0) {
+        return 0;
+    }
+
+    priv->rate_limit_tokens = MIN((gdouble)priv->rate_limit_burst,
+                                  priv->rate_limit_tokens + (now - priv->rate_limit_updated) * priv->rate_limit / G_USEC_PER_SEC);
+    priv->rate_limit_updated = now;
+
+    available = priv->rate_limit_tokens;
+    priv->rate_limit_tokens -= 1;
+
+    if (available >= 1) {
+        return 0;
+    }
+
+    return (guint)((1 - available) * 1000 / priv->rate_limit) + 1;
+}
+
+static void _matrix_http_api_dispatch(SendCallbackData *callback_data);
+
+static gboolean
+_matrix_http_api_delayed_request_cb(gpointer user_data)
+{
+    SendCallbackData *callback_data = user_data;
+    MatrixHTTPAPIPrivate *priv = matrix_http_api_get_instance_private(callback_data->matrix_http_api);
+
+    priv->delayed_requests = g_list_remove(priv->delayed_requests, callback_data);
+    callback_data->source_id = 0;
+
+    _matrix_http_api_dispatch(callback_data);
+
+    return G_SOURCE_REMOVE;
+}
+
+static void
+_matrix_http_api_delay(SendCallbackData *callback_data, guint delay)
+{
+    MatrixHTTPAPIPrivate *priv = matrix_http_api_get_instance_private(callback_data->matrix_http_api);
+
+    callback_data->source_id = g_timeout_add(delay, _matrix_http_api_delayed_request_cb, callback_data);
+    priv->delayed_requests = g_list_prepend(priv->delayed_requests, callback_data);
+}
+
+static void
+_matrix_http_api_dispatch(SendCallbackData *callback_data)
+{
+    MatrixHTTPAPIPrivate *priv = matrix_http_api_get_instance_private(callback_data->matrix_http_api);
+    guint delay;
+
+    if ((delay = _matrix_http_api_take_token(priv)) == 0) {
+        _matrix_http_api_queue_message(callback_data);
+
+        return;
+    }
+
+#if DEBUG
+    g_debug("Rate limiting ourselves, delaying request by %u ms", delay);
+#endif
+
+    priv->stat_throttled++;
+    _matrix_http_api_delay(callback_data, delay);
+}
+
+/*
+ * Check if a failed request can be sent again.  Only requests that the homeserver handles
+ * idempotently are retried: GET requests, and PUT requests carrying a transaction ID.
+ */
+static gboolean
+_matrix_http_api_can_retry(SendCallbackData *callback_data, SoupMessage *msg, GError *err)
+{
+    if ((g_ascii_strcasecmp(callback_data->method, "GET") != 0)
+        && ((g_ascii_strcasecmp(callback_data->method, "PUT") != 0)
+            || (callback_data->request_kind != REQUEST_KIND_TRANSACTION))) {
+        return FALSE;
+    }
+
+    if (msg->status_code == SOUP_STATUS_CANCELLED) {
+        return FALSE;
+    }
+
+    return (msg->status_code < 100)
+        || (msg->status_code == HTTP_STATUS_TOO_MANY_REQUESTS)
+        || (msg->status_code >= 500)
+        || g_error_matches(err, MATRIX_ERROR, MATRIX_ERROR_M_LIMIT_EXCEEDED);
+}
+
+/*
+ * Get the time to wait before retrying a request of @endpoint_class.  If the homeserver told
+ * us how long to wait (retry_after, from the retry_after_ms field of the failed request’s
+ * error response), that is used, up to RETRY_MAX_DELAY; otherwise it is an exponential backoff
+ * with jitter, based on the number of consecutive failures of the endpoint class.
+ */
+static guint
+_matrix_http_api_retry_delay(MatrixHTTPAPIPrivate *priv, EndpointClass endpoint_class, glong retry_after)
+{
+    guint failures = ++priv->endpoint_failures[endpoint_class];
+    guint delay;
+
+    if (retry_after > 0) {
+        return (guint)MIN(retry_after, RETRY_MAX_DELAY);
+    }
+
+    delay = MIN(RETRY_MAX_DELAY, RETRY_BASE_DELAY << MIN(failures - 1, 16));
+
+    return (guint)g_random_int_range(delay / 2, delay + 1);
+}
+
+static void
+_matrix_http_api_update_credentials(MatrixHTTPAPI *matrix_http_api, JsonObject *root)
+{
+    MatrixHTTPAPIPrivate *priv = matrix_http_api_get_instance_private(matrix_http_api);
+    AuthResponseFields fields = {NULL, NULL, NULL};
+    guint32 seen;
+
+    seen = _matrix_json_object_decode(root,
+                                      auth_response_fields, G_N_ELEMENTS(auth_response_fields),
+                                      &fields);
+
+    /* Check if the response holds an access token; if it
+     * does, set it as our new token */
+    if (fields.access_token != NULL) {
+#if DEBUG
+        g_debug("Got new access token: %s", fields.access_token);
+#endif
+
+        g_free(priv->token);
+        priv->token = g_steal_pointer(&fields.access_token);
+    }
+
+    /* Check if the response holds a homeserver name */
+    if (seen & (1 << AUTH_FIELD_HOME_SERVER)) {
+#if DEBUG
+        g_debug("Our home server calls itself %s", fields.home_server);
+#endif
+
+        g_free(priv->homeserver);
+        priv->homeserver = g_steal_pointer(&fields.home_server);
+    }
+
+    /* Check if the response holds a user ID; if it does,
+     * set this as our user ID */
+    if (seen & (1 << AUTH_FIELD_USER_ID)) {
+#if DEBUG
+        g_debug("We are reported to be logged in as %s", fields.user_id);
+#endif
+
+        g_free(priv->user_id);
+        priv->user_id = g_steal_pointer(&fields.user_id);
+    }
+}
+
+/*
+ * Decode an error response.  The retry_after_ms field, if any, is stored in retry_after_ms;
+ * it is not part of the returned error.
+ */
+static GError *
+_matrix_http_api_decode_error(JsonObject *root, glong *retry_after_ms)
+{
+    ErrorResponseFields fields = {NULL, NULL, 0};
+    GError *err = NULL;
+    MatrixError code;
+    guint32 seen;
+
+    seen = _matrix_json_object_decode(root,
+                                      error_response_fields, G_N_ELEMENTS(error_response_fields),
+                                      &fields);
+
+    if (!(seen & ((1 << ERROR_FIELD_ERRCODE) | (1 << ERROR_FIELD_ERROR)))) {
+        return NULL;
+    }
+
+    if (fields.errcode != NULL) {
+        if ((code = _matrix_http_api_errcode_to_error(fields.errcode)) == MATRIX_ERROR_UNKNOWN_ERROR) {
+            g_warning("An unknown error code '%s' was sent by the homeserver. You may want to report it to the Matrix GLib developers", fields.errcode);
+        }
+
+        if (fields.error != NULL) {
+            err = g_error_new(MATRIX_ERROR, code, "%s: %s", fields.errcode, fields.error);
+        } else {
+            err = g_error_new_literal(MATRIX_ERROR, code, fields.errcode);
+        }
+    } else {
+        g_warning("An error was sent by the homeserver, but no error code was specified. You may want to report this to the homeserver admins.");
+
+        err = g_error_new(MATRIX_ERROR, MATRIX_ERROR_UNSPECIFIED,
+                          "(No errcode given) %s", fields.error);
+    }
+
+    /* Rate limited responses tell us how long to wait before retrying */
+    *retry_after_ms = MAX(fields.retry_after_ms, 0);
+
+    g_free(fields.errcode);
+    g_free(fields.error);
+
+    return err;
+}
+
 static void
 _matrix_http_api_response_callback(SoupSession *session, SoupMessage *msg, gpointer user_data)
 {
@@ -150,36 +524,38 @@ _matrix_http_api_response_callback(SoupSession *session, SoupMessage *msg, gpoin
     CallType call_type = callback_data->call_type;
     gboolean accept_non_json = callback_data->accept_non_json;
     MatrixAPICallback cb = callback_data->cb;
-    void *cb_target = callback_data->cb;
+    void *cb_target = callback_data->cb_target;
     SoupURI *request_uri = soup_message_get_uri(msg);
-    const gchar *request_url = soup_uri_get_path(request_uri);
+    const gchar *request_path = soup_uri_get_path(request_uri);
+    gchar *request_url = NULL;
     GError *err = NULL;
     GByteArray *raw_content = NULL;
+    JsonParser *parser = NULL;
     JsonNode *content = NULL;
+    glong retry_after_ms = 0;
 
     switch (call_type) {
         case CALL_TYPE_API:
-            request_url = g_strdup(request_url + strlen(API_ENDPOINT));
+            request_url = g_strdup(request_path + strlen(API_ENDPOINT));
 
             break;
         case CALL_TYPE_MEDIA:
-            request_url = g_strdup(request_url + strlen(MEDIA_ENDPOINT));
+            request_url = g_strdup(request_path + strlen(MEDIA_ENDPOINT));
 
             break;
     }
 
-    if ((msg->status_code < 100) || (msg->status_code >= 400)) {
+    if (msg->status_code < 100) {
         err = g_error_new(MATRIX_ERROR, MATRIX_ERROR_COMMUNICATION_ERROR,
-                          "%s %u: %s",
-                          (msg->status_code < 100) ? "Network error" : "HTTP",
+                          "Network error %u: %s",
                           msg->status_code,
                           msg->reason_phrase);
     } else {
         SoupBuffer *buffer = soup_message_body_flatten(msg->response_body);
         gsize datalen = buffer->length;
-        JsonParser *parser = json_parser_new();
         gboolean is_json;
 
+        parser = json_parser_new();
         is_json = json_parser_load_from_data(parser, buffer->data, (gssize)buffer->length, NULL);
 
         if (is_json) {
@@ -191,100 +567,20 @@ _matrix_http_api_response_callback(SoupSession *session, SoupMessage *msg, gpoin
 
             if (json_node_get_node_type(content) == JSON_NODE_OBJECT) {
                 JsonObject *root = json_node_get_object(content);
-                JsonNode *node;
-                JsonNode *errcode_node;
-                JsonNode *error_node;
-
-                /* Check if the response holds an access token; if it
-                 * does, set it as our new token */
-                if ((node = json_object_get_member(root, "access_token")) != NULL) {
-                    const gchar *access_token;
-
-                    if ((access_token = json_node_get_string(node)) != NULL) {
-#if DEBUG
-                        g_debug("Got new access token: %s", access_token);
-#endif
 
-                        g_free(priv->token);
-                        priv->token = g_strdup(access_token);
-                    }
+                /* Only error responses may hold an error code, and only
+                 * authentication responses may hold new credentials */
+                if (msg->status_code >= 400) {
+                    err = _matrix_http_api_decode_error(root, &retry_after_ms);
+                } else if (callback_data->request_kind == REQUEST_KIND_AUTH) {
+                    _matrix_http_api_update_credentials(matrix_http_api, root);
                 }
-
-                /* Check if the response holds a homeserver name */
-                if ((node = json_object_get_member(root, "home_server")) != NULL) {
-                    const gchar *homeserver = json_node_get_string(node);
-
-#if DEBUG
-                    g_debug("Our home server calls itself %s", homeserver);
-#endif
-
-                    g_free(priv->homeserver);
-                    priv->homeserver = g_strdup(homeserver);
-                }
-
-                /* Check if the response holds a user ID; if it does,
-                 * set this as our user ID */
-                if ((node = json_object_get_member(root, "user_id")) != NULL) {
-                    const gchar *user_id = json_node_get_string(node);
-
-#if DEBUG
-                    g_debug("We are reported to be logged in as %s", user_id);
-#endif
-
-                    g_free(priv->user_id);
-                    priv->user_id = g_strdup(user_id);
-                }
-
-                /* Check if the response holds an error */
-                errcode_node = json_object_get_member(root, "errcode");
-                error_node = json_object_get_member(root, "error");
-                const gchar *error = NULL;
-                const gchar *errcode = NULL;
-
-                if ((errcode_node != NULL) || (error_node != NULL)) {
-                    err = g_error_new_literal(MATRIX_ERROR, MATRIX_ERROR_UNKNOWN_ERROR,
-                                              "The error is not known to this library");
-
-                    if (error_node != NULL) {
-                        error = json_node_get_string(error_node);
-                    }
-
-                    if (errcode_node != NULL) {
-                        errcode = json_node_get_string(errcode_node);
-
-                        if (g_ascii_strncasecmp(errcode, "M_", 2) == 0) {
-                            gchar *errcode_enum_name = g_strdup_printf("MATRIX_ERROR_%s", errcode);
-                            GEnumClass *error_class = g_type_class_ref(MATRIX_TYPE_ERROR);
-                            GEnumValue *enum_value = g_enum_get_value_by_name(error_class, errcode_enum_name);
-                            g_type_class_unref(error_class);
-                            g_free(errcode_enum_name);
-
-                            if (enum_value != NULL) {
-                                err->code = enum_value->value;
-                            } else {
-                                g_warning("An unknown error code '%s' was sent by the homeserver. You may want to report it to the Matrix GLib developers", errcode);
-                            }
-                        }
-                    } else {
-                        g_warning("An error was sent by the homeserver, but no error code was specified. You may want to report this to the homeserver admins.");
-                        g_clear_error(&err);
-
-                        err = g_error_new_literal(MATRIX_ERROR, MATRIX_ERROR_UNSPECIFIED, "No error code was sent by the server");
-                    }
-
-                    if ((errcode_node != NULL) && (error_node != NULL)) {
-                        err->message = g_strdup_printf("%s: %s", errcode, error);
-                    } else if (errcode_node != NULL) {
-                        err->message = g_strdup(errcode);
-                    } else {
-                        err->message = g_strdup_printf("(No errcode given) %s", error);
-                    }
-                }
-            } else if (json_node_get_node_type(content) != JSON_NODE_ARRAY) {
+            } else if ((json_node_get_node_type(content) != JSON_NODE_ARRAY)
+                       && (msg->status_code < 400)) {
                 err = g_error_new_literal(MATRIX_ERROR, MATRIX_ERROR_BAD_RESPONSE,
                                           "Bad response: not a JSON object, nor an array.");
             }
-        } else {
+        } else if (msg->status_code < 400) {
             if (accept_non_json) {
                 raw_content = g_byte_array_sized_new((uint)datalen);
                 g_byte_array_append(raw_content, (guint8 *)buffer->data, buffer->length);
@@ -301,10 +597,44 @@ _matrix_http_api_response_callback(SoupSession *session, SoupMessage *msg, gpoin
 #endif
             }
         }
+
+        /* An HTTP error without a Matrix error in its body */
+        if ((err == NULL) && (msg->status_code >= 400)) {
+            err = g_error_new(MATRIX_ERROR, MATRIX_ERROR_COMMUNICATION_ERROR,
+                              "HTTP %u: %s",
+                              msg->status_code,
+                              msg->reason_phrase);
+        }
+
+        soup_buffer_free(buffer);
+    }
+
+    if (err == NULL) {
+        priv->endpoint_failures[callback_data->endpoint_class] = 0;
+    } else if (_matrix_http_api_can_retry(callback_data, msg, err)) {
+        if (callback_data->attempts < RETRY_MAX_ATTEMPTS) {
+            guint delay = _matrix_http_api_retry_delay(priv, callback_data->endpoint_class, retry_after_ms);
+
+#if DEBUG
+            g_debug("Request (%s) failed (%s), retrying in %u ms", request_url, err->message, delay);
+#endif
+
+            priv->stat_retried++;
+
+            if ((msg->status_code == HTTP_STATUS_TOO_MANY_REQUESTS)
+                || g_error_matches(err, MATRIX_ERROR, MATRIX_ERROR_M_LIMIT_EXCEEDED)) {
+                priv->stat_rate_limited++;
+            }
+
+            _matrix_http_api_delay(callback_data, delay);
+            callback_data = NULL;
+        } else {
+            priv->stat_failed++;
+        }
     }
 
-    /* Call the assigned function, if any */
-    if (cb != NULL) {
+    /* Call the assigned function, if any, unless the request is sent again */
+    if ((callback_data != NULL) && (cb != NULL)) {
         cb(MATRIX_API(matrix_http_api),
            soup_message_headers_get_content_type(msg->response_headers, NULL),
            content, raw_content,
@@ -312,46 +642,58 @@ _matrix_http_api_response_callback(SoupSession *session, SoupMessage *msg, gpoin
            cb_target);
     }
 
-    g_free(callback_data);
+    g_clear_error(&err);
+
+    if (raw_content != NULL) {
+        g_byte_array_unref(raw_content);
+    }
+
+    if (parser != NULL) {
+        g_object_unref(parser);
+    }
+
+    g_free(request_url);
+
+    if (callback_data != NULL) {
+        _matrix_http_api_send_callback_data_free(callback_data);
+    }
 }
 
+/*
+ * Send a request with an already serialized body.  Ownership of @body is taken.
+ */
 static void
-_matrix_http_api_send(MatrixHTTPAPI *matrix_http_api,
-                      MatrixAPICallback cb,
-                      void *cb_target,
-                      CallType call_type,
-                      const gchar *method,
-                      const gchar *path,
-                      GHashTable *parms,
-                      const gchar *content_type,
-                      JsonNode *json_content,
-                      GByteArray *raw_content,
-                      gboolean accept_non_json,
-                      GError **error)
+_matrix_http_api_send_body(MatrixHTTPAPI *matrix_http_api,
+                           MatrixAPICallback cb,
+                           void *cb_target,
+                           CallType call_type,
+                           RequestKind request_kind,
+                           const gchar *method,
+                           const gchar *path,
+                           GHashTable *parms,
+                           const gchar *content_type,
+                           GBytes *body,
+                           gboolean accept_non_json,
+                           GError **error)
 {
     MatrixHTTPAPIPrivate *priv;
-    SoupMessage *message;
     SoupURI *request_path = NULL;
-    gpointer request_data;
-    gsize request_len;
     SendCallbackData *callback_data;
 
     g_return_if_fail(matrix_http_api != NULL);
     g_return_if_fail(method != NULL);
     g_return_if_fail(path != NULL);
+    g_return_if_fail(body != NULL);
 
     priv = matrix_http_api_get_instance_private(matrix_http_api);
 
     if ((priv->api_uri == NULL) || (priv->media_uri == NULL)) {
         g_set_error(error, MATRIX_ERROR, MATRIX_ERROR_COMMUNICATION_ERROR, "No valid base URL");
+        g_bytes_unref(body);
 
         return;
     }
 
-    if ((json_content != NULL) && (raw_content != NULL)) {
-        g_critical("json_content and raw_content cannot be used together. This is a bug.");
-    }
-
     if (!g_str_is_ascii(method)) {
         g_critical("Method must be ASCII. This is a bug.");
     }
@@ -363,6 +705,10 @@ _matrix_http_api_send(MatrixHTTPAPI *matrix_http_api,
         g_critical("Method %s is invalid. This is a bug.", method);
     }
 
+    if (content_type == NULL) {
+        content_type = "application/json";
+    }
+
     if (call_type == CALL_TYPE_MEDIA) {
         request_path = soup_uri_new_with_base(priv->media_uri, path);
     } else {
@@ -371,6 +717,8 @@ _matrix_http_api_send(MatrixHTTPAPI *matrix_http_api,
 
     if (parms == NULL) {
         parms = _matrix_http_api_create_query_params();
+    } else {
+        g_hash_table_ref(parms);
     }
 
     if (priv->token != NULL) {
@@ -378,51 +726,218 @@ _matrix_http_api_send(MatrixHTTPAPI *matrix_http_api,
         g_debug("Adding access token '%s'", priv->token);
 #endif
 
-        g_hash_table_replace(parms, g_strdup("access_token"), priv->token);
+        g_hash_table_replace(parms, g_strdup("access_token"), g_strdup(priv->token));
     }
 
     soup_uri_set_query_from_form(request_path, parms);
-
-    message = soup_message_new_from_uri(method, request_path);
-
-    if (json_content != NULL) {
-        JsonGenerator *generator = json_generator_new();
-
-        json_generator_set_root(generator, json_content);
-        request_data = json_generator_to_data(generator, &request_len);
-    } else if (raw_content != NULL) {
-        request_len = raw_content->len;
-        request_data = raw_content->data;
-    } else {
-        request_len = 2;
-        request_data = g_strdup("{}");
-    }
+    g_hash_table_unref(parms);
 
 #if DEBUG
-    g_debug("Sending %lu bytes (%s %s): %s",
-            request_len,
-            method,
-            soup_uri_to_string(request_path, FALSE),  // TODO: Free this!
-            (raw_content != NULL) ? "<Binary data>" : (gchar *)request_data);
+    {
+        gchar *uri = soup_uri_to_string(request_path, FALSE);
+        gsize request_len;
+        gconstpointer request_data = g_bytes_get_data(body, &request_len);
+        gboolean binary = (strcmp(content_type, "application/json") != 0);
+
+        g_debug("Sending %" G_GSIZE_FORMAT " bytes (%s %s): %.*s",
+                request_len,
+                method,
+                uri,
+                (binary) ? 13 : (int)request_len,
+                (binary) ? "<Binary data>" : (const gchar *)request_data);
+        g_free(uri);
+    }
 #endif
 
-    soup_message_set_flags(message, SOUP_MESSAGE_NO_REDIRECT);
-    soup_message_set_request(message,
-                             (content_type == NULL) ? "application/json" : content_type,
-                             SOUP_MEMORY_COPY,
-                             request_data,
-                             request_len);
-
     callback_data = g_new0(SendCallbackData, 1);
 
     callback_data->matrix_http_api = matrix_http_api;
-    callback_data->refcount = 1;
     callback_data->cb = cb;
     callback_data->cb_target = cb_target;
     callback_data->call_type = call_type;
+    callback_data->request_kind = request_kind;
     callback_data->accept_non_json = accept_non_json;
+    callback_data->method = g_strdup(method);
+    callback_data->uri = request_path;
+    callback_data->content_type = g_strdup(content_type);
+    callback_data->body = body;
 
-    soup_session_queue_message(priv->soup_session, message, _matrix_http_api_response_callback, callback_data);
+    if (call_type == CALL_TYPE_MEDIA) {
+        callback_data->endpoint_class = ENDPOINT_CLASS_MEDIA;
+    } else if (g_str_has_prefix(path, "sync")) {
+        callback_data->endpoint_class = ENDPOINT_CLASS_SYNC;
+    } else if (request_kind == REQUEST_KIND_TRANSACTION) {
+        callback_data->endpoint_class = ENDPOINT_CLASS_SEND;
+    } else {
+        callback_data->endpoint_class = ENDPOINT_CLASS_OTHER;
+    }
+
+    _matrix_http_api_dispatch(callback_data);
+}
+
+static void
+_matrix_http_api_send_request(MatrixHTTPAPI *matrix_http_api,
+                              MatrixAPICallback cb,
+                              void *cb_target,
+                              CallType call_type,
+                              RequestKind request_kind,
+                              const gchar *method,
+                              const gchar *path,
+                              GHashTable *parms,
+                              const gchar *content_type,
+                              JsonNode *json_content,
+                              GByteArray *raw_content,
+                              gboolean accept_non_json,
+                              GError **error)
+{
+    GBytes *body;
+
+    g_return_if_fail(matrix_http_api != NULL);
+
+    if ((json_content != NULL) && (raw_content != NULL)) {
+        g_critical("json_content and raw_content cannot be used together. This is a bug.");
+    }
+
+    if (json_content != NULL) {
+        MatrixJsonWriter *writer = matrix_json_writer_new();
+
+        if (!matrix_json_writer_add_node(writer, json_content, error)) {
+            matrix_json_writer_free(writer);
+
+            return;
+        }
+
+        // The writer’s buffer is handed over to the message as is, without copying
+        body = matrix_json_writer_free_to_bytes(writer);
+    } else if (raw_content != NULL) {
+        body = g_bytes_new(raw_content->data, raw_content->len);
+    } else {
+        body = g_bytes_new_static("{}", 2);
+    }
+
+    _matrix_http_api_send_body(matrix_http_api,
+                               cb, cb_target,
+                               call_type, request_kind,
+                               method, path, parms,
+                               content_type, body,
+                               accept_non_json,
+                               error);
+}
+
+/*
+ * Send @event to @room_id.  State events are set as the current state of the room, other
+ * events are sent as a new message with @txn_id as their transaction ID.
+ *
+ * The request body is the content of @event, written straight from the event object with
+ * matrix_event_base_to_json_writer(), so no #JsonNode is built for it.
+ */
+void
+_matrix_http_api_send_event(MatrixHTTPAPI *matrix_http_api,
+                            MatrixAPICallback cb,
+                            void *cb_target,
+                            const gchar *room_id,
+                            MatrixEventBase *event,
+                            const gchar *txn_id,
+                            GError **error)
+{
+    const gchar *event_type;
+    MatrixJsonWriter *writer;
+    GError *inner_error = NULL;
+    GBytes *body;
+    gchar *path;
+    RequestKind request_kind;
+
+    g_return_if_fail(matrix_http_api != NULL);
+    g_return_if_fail(room_id != NULL);
+    g_return_if_fail(event != NULL);
+
+    if ((event_type = matrix_event_base_get_event_type(event)) == NULL) {
+        g_set_error(error, MATRIX_ERROR, MATRIX_ERROR_INCOMPLETE,
+                    "Won't send an event without type");
+
+        return;
+    }
+
+    if (!MATRIX_EVENT_IS_STATE(event) && (txn_id == NULL)) {
+        g_set_error(error, MATRIX_ERROR, MATRIX_ERROR_INCOMPLETE,
+                    "Won't send a message event without a transaction ID");
+
+        return;
+    }
+
+    writer = matrix_json_writer_new_for_member("content");
+    matrix_event_base_to_json_writer(event, writer, &inner_error);
+
+    if (inner_error != NULL) {
+        g_propagate_error(error, inner_error);
+        matrix_json_writer_free(writer);
+
+        return;
+    }
+
+    body = matrix_json_writer_free_to_bytes(writer);
+
+    if (g_bytes_get_size(body) == 0) {
+        g_set_error(error, MATRIX_ERROR, MATRIX_ERROR_INCOMPLETE,
+                    "Won't send an event without content");
+        g_bytes_unref(body);
+
+        return;
+    }
+
+    uri_encode(room_id);
+    uri_encode(event_type);
+
+    if (MATRIX_EVENT_IS_STATE(event)) {
+        // State events are always written with a state key, or not at all
+        const gchar *state_key = matrix_event_state_get_state_key(MATRIX_EVENT_STATE(event));
+
+        uri_encode(state_key);
+        path = g_strconcat("rooms/", enc_room_id, "/state/", enc_event_type, "/", enc_state_key, NULL);
+        g_free(enc_state_key);
+        request_kind = REQUEST_KIND_DATA;
+    } else {
+        uri_encode(txn_id);
+        path = g_strconcat("rooms/", enc_room_id, "/send/", enc_event_type, "/", enc_txn_id, NULL);
+        g_free(enc_txn_id);
+        request_kind = REQUEST_KIND_TRANSACTION;
+    }
+
+    g_free(enc_room_id);
+    g_free(enc_event_type);
+
+    _matrix_http_api_send_body(matrix_http_api,
+                               cb, cb_target,
+                               CALL_TYPE_API, request_kind,
+                               "PUT", path, NULL,
+                               NULL, body,
+                               FALSE,
+                               error);
+
+    g_free(path);
+}
+
+static void
+_matrix_http_api_send(MatrixHTTPAPI *matrix_http_api,
+                      MatrixAPICallback cb,
+                      void *cb_target,
+                      CallType call_type,
+                      const gchar *method,
+                      const gchar *path,
+                      GHashTable *parms,
+                      const gchar *content_type,
+                      JsonNode *json_content,
+                      GByteArray *raw_content,
+                      gboolean accept_non_json,
+                      GError **error)
+{
+    _matrix_http_api_send_request(matrix_http_api,
+                                  cb, cb_target,
+                                  call_type, REQUEST_KIND_DATA,
+                                  method, path, parms,
+                                  content_type, json_content, raw_content,
+                                  accept_non_json,
+                                  error);
 }
 
 static void
@@ -821,7 +1336,9 @@ matrix_http_api_create_room(MatrixAPI *matrix_api, MatrixAPICallback cb, void *c
         for (gint i = 0; i < n_initial_state; i++) {
             JsonNode *event_node = matrix_event_base_get_json(MATRIX_EVENT_BASE(initial_state[i]));
 
-            json_builder_add_value(builder, event_node);
+            if (event_node != NULL) {
+                json_builder_add_value(builder, json_node_ref(event_node));
+            }
         }
 
         json_builder_end_array(builder);
@@ -1414,10 +1931,10 @@ matrix_http_api_redact_event(MatrixAPI *matrix_api, MatrixAPICallback cb, void *
         body = json_builder_get_root(builder);
     }
 
-    _matrix_http_api_send(MATRIX_HTTP_API(matrix_api),
-                          cb, cb_target,
-                          CALL_TYPE_API, "PUT", path,
-                          NULL, NULL, body, NULL, FALSE, error);
+    _matrix_http_api_send_request(MATRIX_HTTP_API(matrix_api),
+                                  cb, cb_target,
+                                  CALL_TYPE_API, REQUEST_KIND_TRANSACTION, "PUT", path,
+                                  NULL, NULL, body, NULL, FALSE, error);
 
     g_free(path);
     json_node_unref(body);
@@ -1441,10 +1958,10 @@ matrix_http_api_send_event(MatrixAPI *matrix_api, MatrixAPICallback cb, void *cb
     g_free(enc_event_type);
     g_free(enc_txn_id);
 
-    _matrix_http_api_send(MATRIX_HTTP_API(matrix_api),
-                          cb, cb_target,
-                          CALL_TYPE_API, "PUT", path,
-                          NULL, NULL, content, NULL, FALSE, error);
+    _matrix_http_api_send_request(MATRIX_HTTP_API(matrix_api),
+                                  cb, cb_target,
+                                  CALL_TYPE_API, REQUEST_KIND_TRANSACTION, "PUT", path,
+                                  NULL, NULL, content, NULL, FALSE, error);
 
     g_free(path);
 }
@@ -1617,17 +2134,12 @@ static void
 matrix_http_api_create_filter(MatrixAPI *matrix_api, MatrixAPICallback cb, void *cb_target, const gchar *user_id, MatrixFilter *filter, GError **error)
 {
     gchar *path;
-    JsonNode *filter_node;
-    GError *inner_error = NULL;
+    GBytes *filter_data;
 
     g_return_if_fail(user_id != NULL);
     g_return_if_fail(filter != NULL);
 
-    filter_node = matrix_json_compact_get_json_node(MATRIX_JSON_COMPACT(filter), &inner_error);
-
-    if (inner_error != NULL) {
-        g_propagate_error(error, inner_error);
-
+    if ((filter_data = matrix_json_compact_get_json_bytes(MATRIX_JSON_COMPACT(filter), error)) == NULL) {
         return;
     }
 
@@ -1635,12 +2147,12 @@ matrix_http_api_create_filter(MatrixAPI *matrix_api, MatrixAPICallback cb, void
     path = g_strconcat("user/", enc_user_id, "/filter", NULL);
     g_free(enc_user_id);
 
-    _matrix_http_api_send(MATRIX_HTTP_API(matrix_api),
-                          cb, cb_target,
-                          CALL_TYPE_API, "POST", path,
-                          NULL, NULL, filter_node, NULL, FALSE, error);
+    _matrix_http_api_send_body(MATRIX_HTTP_API(matrix_api),
+                               cb, cb_target,
+                               CALL_TYPE_API, REQUEST_KIND_DATA,
+                               "POST", path,
+                               NULL, NULL, filter_data, FALSE, error);
 
-    json_node_unref(filter_node);
     g_free(path);
 }
 
@@ -1670,16 +2182,11 @@ static void
 matrix_http_api_search(MatrixAPI *matrix_api, MatrixAPICallback cb, void *cb_target, const gchar *next_batch, MatrixSearchCategories *search_categories, GError **error)
 {
     GHashTable *parms = NULL;
-    JsonNode *search_node;
-    GError *inner_error = NULL;
+    GBytes *search_data;
 
     g_return_if_fail(search_categories != NULL);
 
-    search_node = matrix_json_compact_get_json_node(MATRIX_JSON_COMPACT(search_categories), &inner_error);
-
-    if (inner_error != NULL) {
-        g_propagate_error(error, inner_error);
-
+    if ((search_data = matrix_json_compact_get_json_bytes(MATRIX_JSON_COMPACT(search_categories), error)) == NULL) {
         return;
     }
 
@@ -1689,13 +2196,15 @@ matrix_http_api_search(MatrixAPI *matrix_api, MatrixAPICallback cb, void *cb_tar
         g_hash_table_replace(parms, g_strdup("next_batch"), g_strdup(next_batch));
     }
 
-    _matrix_http_api_send(MATRIX_HTTP_API(matrix_api),
-                          cb, cb_target,
-                          CALL_TYPE_API, "POST", "search",
-                          parms, NULL, search_node, NULL, FALSE, error);
+    _matrix_http_api_send_body(MATRIX_HTTP_API(matrix_api),
+                               cb, cb_target,
+                               CALL_TYPE_API, REQUEST_KIND_DATA,
+                               "POST", "search",
+                               parms, NULL, search_data, FALSE, error);
 
-    json_node_unref(search_node);
-    g_hash_table_unref(parms);
+    if (parms != NULL) {
+        g_hash_table_unref(parms);
+    }
 }
 
 static void
@@ -1734,15 +2243,15 @@ matrix_http_api_login(MatrixAPI *matrix_api, MatrixAPICallback cb, void *cb_targ
 
     g_return_if_fail(login_type != NULL);
 
-    body = _matrix_json_node_deep_copy(content);
+    body = _matrix_json_node_dup_object(content);
     root = json_node_get_object(body);
 
     json_object_set_string_member(root, "type", login_type);
 
-    _matrix_http_api_send(MATRIX_HTTP_API(matrix_api),
-                          cb, cb_target,
-                          CALL_TYPE_API, "POST", "login",
-                          NULL, NULL, body, NULL, FALSE, error);
+    _matrix_http_api_send_request(MATRIX_HTTP_API(matrix_api),
+                                  cb, cb_target,
+                                  CALL_TYPE_API, REQUEST_KIND_AUTH, "POST", "login",
+                                  NULL, NULL, body, NULL, FALSE, error);
 
     json_node_unref(body);
 }
@@ -1996,10 +2505,10 @@ matrix_http_api_register_account(MatrixAPI *matrix_api, MatrixAPICallback cb, vo
         }
     }
 
-    _matrix_http_api_send(MATRIX_HTTP_API(matrix_api),
-                          cb, cb_target,
-                          CALL_TYPE_API, "POST", "register",
-                          parms, NULL, root_node, NULL, FALSE, error);
+    _matrix_http_api_send_request(MATRIX_HTTP_API(matrix_api),
+                                  cb, cb_target,
+                                  CALL_TYPE_API, REQUEST_KIND_AUTH, "POST", "register",
+                                  parms, NULL, root_node, NULL, FALSE, error);
 
     json_node_unref(root_node);
     g_object_unref(builder);
@@ -2200,10 +2709,10 @@ matrix_http_api_get_turn_server(MatrixAPI *matrix_api, MatrixAPICallback cb, voi
 static void
 whoami(MatrixAPI *api, MatrixAPICallback cb, void *cb_target, GError **error)
 {
-    _matrix_http_api_send(MATRIX_HTTP_API(api),
-                          cb, cb_target,
-                          CALL_TYPE_API, "GET", "account/whoami",
-                          NULL, NULL, NULL, NULL, FALSE, error);
+    _matrix_http_api_send_request(MATRIX_HTTP_API(api),
+                                  cb, cb_target,
+                                  CALL_TYPE_API, REQUEST_KIND_AUTH, "GET", "account/whoami",
+                                  NULL, NULL, NULL, NULL, FALSE, error);
 }
 
 static void
@@ -2254,6 +2763,28 @@ static void
 matrix_http_api_abort_pending (MatrixAPI *matrix_api)
 {
     MatrixHTTPAPIPrivate *priv = matrix_http_api_get_instance_private(MATRIX_HTTP_API(matrix_api));
+    GList *delayed_requests = priv->delayed_requests;
+
+    priv->delayed_requests = NULL;
+
+    /* Requests waiting for a retry or for the rate limiter are not known to the session, so
+     * cancel them the same way as the ones already queued */
+    for (GList *l = delayed_requests; l; l = g_list_next(l)) {
+        SendCallbackData *callback_data = l->data;
+        GError *err = g_error_new_literal(MATRIX_ERROR, MATRIX_ERROR_COMMUNICATION_ERROR,
+                                          "Request cancelled");
+
+        g_source_remove(callback_data->source_id);
+
+        if (callback_data->cb != NULL) {
+            callback_data->cb(matrix_api, NULL, NULL, NULL, err, callback_data->cb_target);
+        }
+
+        g_error_free(err);
+        _matrix_http_api_send_callback_data_free(callback_data);
+    }
+
+    g_list_free(delayed_requests);
 
     soup_session_abort(priv->soup_session);
 }
@@ -2352,6 +2883,79 @@ matrix_http_api_set_base_url(MatrixHTTPAPI *matrix_http_api, const gchar *base_u
     g_object_notify_by_pspec((GObject *)matrix_http_api, matrix_http_api_properties[PROP_BASE_URL]);
 }
 
+/**
+ * matrix_http_api_set_rate_limit:
+ * @http_api: a #MatrixHTTPAPI object
+ * @rate: the number of requests allowed per second, or 0 to disable rate limiting
+ * @burst: the number of requests that can be sent at once after an idle period
+ *
+ * Set up the client side rate limiter.  Requests exceeding the limit are not dropped, but
+ * delayed until they fit in.  Rate limiting is disabled by default.
+ */
+void
+matrix_http_api_set_rate_limit(MatrixHTTPAPI *matrix_http_api, gdouble rate, guint burst)
+{
+    MatrixHTTPAPIPrivate *priv;
+
+    g_return_if_fail(matrix_http_api != NULL);
+    g_return_if_fail(rate >= 0);
+
+    priv = matrix_http_api_get_instance_private(matrix_http_api);
+
+    priv->rate_limit = rate;
+    priv->rate_limit_burst = MAX(burst, 1);
+    priv->rate_limit_tokens = MIN(priv->rate_limit_tokens, (gdouble)priv->rate_limit_burst);
+}
+
+/**
+ * matrix_http_api_get_request_stats:
+ * @http_api: a #MatrixHTTPAPI object
+ * @retried: (out) (optional): a place to store the number of requests sent again after a failure
+ * @rate_limited: (out) (optional): a place to store how many of those failures were rate limits
+ *     imposed by the homeserver
+ * @throttled: (out) (optional): a place to store the number of requests delayed by the client
+ *     side rate limiter
+ * @failed: (out) (optional): a place to store the number of requests given up on after the
+ *     maximum number of attempts
+ *
+ * Get the counters of the retry engine.
+ *
+ * Failed GET requests, and failed PUT requests carrying a transaction ID are sent again if the
+ * failure was a network error, a server error (HTTP 5xx), or a rate limit
+ * (#MATRIX_ERROR_M_LIMIT_EXCEEDED).  Retries honour the delay requested by the homeserver;
+ * otherwise they back off exponentially (with some jitter) per endpoint class.  Requests are
+ * only reported to the caller after the last attempt.
+ */
+void
+matrix_http_api_get_request_stats(MatrixHTTPAPI *matrix_http_api,
+                                  guint *retried,
+                                  guint *rate_limited,
+                                  guint *throttled,
+                                  guint *failed)
+{
+    MatrixHTTPAPIPrivate *priv;
+
+    g_return_if_fail(matrix_http_api != NULL);
+
+    priv = matrix_http_api_get_instance_private(matrix_http_api);
+
+    if (retried != NULL) {
+        *retried = priv->stat_retried;
+    }
+
+    if (rate_limited != NULL) {
+        *rate_limited = priv->stat_rate_limited;
+    }
+
+    if (throttled != NULL) {
+        *throttled = priv->stat_throttled;
+    }
+
+    if (failed != NULL) {
+        *failed = priv->stat_failed;
+    }
+}
+
 gboolean
 matrix_http_api_get_validate_certificate(MatrixHTTPAPI *matrix_http_api)
 {
@@ -2422,6 +3026,14 @@ matrix_http_api_finalize(GObject *gobject)
 {
     MatrixHTTPAPIPrivate *priv = matrix_http_api_get_instance_private(MATRIX_HTTP_API(gobject));
 
+    for (GList *l = priv->delayed_requests; l; l = g_list_next(l)) {
+        SendCallbackData *callback_data = l->data;
+
+        g_source_remove(callback_data->source_id);
+        _matrix_http_api_send_callback_data_free(callback_data);
+    }
+
+    g_list_free(priv->delayed_requests);
     g_object_unref(priv->soup_session);
     g_free(priv->base_url);
 
@@ -2505,6 +3117,14 @@ matrix_http_api_class_init(MatrixHTTPAPIClass *klass)
     G_OBJECT_CLASS(klass)->set_property = matrix_http_api_set_property;
     G_OBJECT_CLASS(klass)->finalize = matrix_http_api_finalize;
 
+    errcode_table = g_hash_table_new(g_str_hash, g_str_equal);
+
+    for (gsize i = 0; i < G_N_ELEMENTS(errcode_map); i++) {
+        g_hash_table_insert(errcode_table,
+                            (gpointer)errcode_map[i].errcode,
+                            GINT_TO_POINTER(errcode_map[i].code));
+    }
+
     /**
      * MatrixHTTPAPI:base-url:
      *
@@ -2637,4 +3257,9 @@ matrix_http_api_init(MatrixHTTPAPI *matrix_http_api)
     priv->token = NULL;
     priv->homeserver = NULL;
     priv->user_id = NULL;
+    priv->rate_limit = RATE_LIMIT_DEFAULT_RATE;
+    priv->rate_limit_burst = RATE_LIMIT_DEFAULT_BURST;
+    priv->rate_limit_tokens = RATE_LIMIT_DEFAULT_BURST;
+    priv->rate_limit_updated = g_get_monotonic_time();
+    priv->delayed_requests = NULL;
 }
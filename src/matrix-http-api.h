@@ -49,6 +49,12 @@ const gchar *matrix_http_api_get_base_url(MatrixHTTPAPI *http_api);
 void matrix_http_api_set_base_url(MatrixHTTPAPI *http_api, const gchar *base_url);
 gboolean matrix_http_api_get_validate_certificate(MatrixHTTPAPI *http_api);
 void matrix_http_api_set_validate_certificate(MatrixHTTPAPI *http_api, gboolean validate_certificate);
+void matrix_http_api_set_rate_limit(MatrixHTTPAPI *http_api, gdouble rate, guint burst);
+void matrix_http_api_get_request_stats(MatrixHTTPAPI *http_api,
+                                       guint *retried,
+                                       guint *rate_limited,
+                                       guint *throttled,
+                                       guint *failed);
 
 G_END_DECLS
 
@@ -17,8 +17,10 @@
  */
 
 #include "matrix-http-client.h"
+#include "matrix-http-api-private.h"
 #include "matrix-client.h"
 #include "matrix-event-room-base.h"
+#include "matrix-event-state-base.h"
 #include "matrix-event-presence.h"
 #include "matrix-event-room-member.h"
 #include "matrix-event-room-aliases.h"
@@ -31,6 +33,8 @@
 #include "matrix-event-room-name.h"
 #include "matrix-event-room-power-levels.h"
 #include "matrix-event-room-topic.h"
+#include "matrix-event-room-redaction.h"
+#include "utils.h"
 
 /**
  * SECTION:matrix-http-client
@@ -48,8 +52,64 @@ typedef struct {
     GHashTable* _user_global_presence;
     GHashTable* _rooms;
     gulong _last_txn_id;
+    guint _sync_failures;
+    guint _poll_source_id;
+    MatrixEventStore *_event_store;
+    MatrixSearchIndex *_search_index;
+    MatrixRelationIndex *_relation_index;
+    MatrixPushRules *_push_rules;
+    guint _timeline_capacity;
+
+    /* Redactions whose target we haven’t seen yet; target event ID => redaction event ID */
+    GHashTable *_pending_redactions;
+    GQueue *_pending_redaction_order;
+
+    /* The rooms touched by the sync response being processed, with a reference held on each.
+     * Each of them is in a matrix_room_begin_update() batch until the whole response is
+     * processed. */
+    GHashTable *_updating_rooms;
+
+    /* Rooms we are invited to; room ID => MatrixInvitePreview.  A #MatrixRoom is only created
+     * when we join. */
+    GHashTable *_invites;
+
+    /* Rooms waiting for their full state to be fetched, the set of rooms either waiting or
+     * being fetched, and the number of state requests running */
+    GQueue *_hydration_queue;
+    GHashTable *_hydration_pending;
+    guint _hydration_running;
+    guint _hydration_max_requests;
 } MatrixHTTPClientPrivate;
 
+enum {
+    SIGNAL_ROOM_STATE_HYDRATED,
+    NUM_SIGNALS
+};
+static guint matrix_http_client_signals[NUM_SIGNALS] = {0};
+
+#define POLL_RETRY_BASE_DELAY 1000
+#define POLL_RETRY_MAX_DELAY 60000
+#define MAX_PENDING_REDACTIONS 1000
+#define DEFAULT_HYDRATION_MAX_REQUESTS 4
+
+/*
+ * A redaction that arrived before its target.  These are stored in _pending_redactions, keyed
+ * by the target event ID.  link is the entry of the target ID in _pending_redaction_order, so
+ * it can be removed from there without searching when the redaction is consumed.  The queue
+ * entries point to the hash table keys and don’t own them.
+ */
+typedef struct {
+    gchar *redaction_id;
+    GList *link;
+} PendingRedaction;
+
+static void
+_pending_redaction_free(PendingRedaction *pending)
+{
+    g_free(pending->redaction_id);
+    g_free(pending);
+}
+
 G_DEFINE_TYPE_EXTENDED(MatrixHTTPClient, matrix_http_client, MATRIX_TYPE_HTTP_API, 0, G_ADD_PRIVATE(MatrixHTTPClient) G_IMPLEMENT_INTERFACE(MATRIX_TYPE_CLIENT, matrix_http_client_matrix_client_interface_init));
 
 MatrixHTTPClient *
@@ -67,7 +127,7 @@ login_callback(MatrixAPI *matrix_api, const gchar *content_type, JsonNode *json_
 {
     g_signal_emit_by_name((MatrixClient *)matrix_api,
                           "login-finished",
-                          g_error_matches(err, MATRIX_ERROR, MATRIX_ERROR_NONE));
+                          (err == NULL));
 }
 
 static void
@@ -120,6 +180,60 @@ matrix_http_client_real_logout(MatrixClient *matrix_client, GError **error)
     matrix_api_logout(MATRIX_API(matrix_client), logout_callback, NULL, error);
 }
 
+static void _apply_redaction(MatrixHTTPClient *matrix_http_client, const gchar *room_id, const gchar *target_id, const gchar *redaction_id);
+
+/*
+ * Called for every event fetched by back pagination.  These are older than what arrived
+ * through sync, so they must not change the current state of the room, its unread counters,
+ * or trigger notifications.
+ *
+ * The event store and the search index keep the events of a room in the order they happened
+ * (the store by stream position, the index for ranking and context), and have no way to
+ * insert older events, so only events received through sync go there.  The relation index
+ * orders edits by origin_server_ts, so it can take them in any order.
+ */
+static void
+_timeline_event_fetched_cb(MatrixRoom *room, JsonNode *event_node, MatrixEventRoom *event, MatrixHTTPClient *matrix_http_client)
+{
+    MatrixHTTPClientPrivate *priv = matrix_http_client_get_instance_private(matrix_http_client);
+    const gchar *room_id = matrix_room_get_room_id(room);
+    const gchar *event_id = matrix_event_room_get_event_id(event);
+    JsonNode *node = json_node_ref(event_node);
+    PendingRedaction *pending;
+    GError *inner_error = NULL;
+
+    /* If a redaction of this event arrived earlier, only the redacted version is kept */
+    if ((event_id != NULL)
+        && ((pending = g_hash_table_lookup(priv->_pending_redactions, event_id)) != NULL)) {
+        json_node_unref(node);
+        node = _matrix_event_json_redact(event_node, pending->redaction_id);
+
+        if (!matrix_event_room_apply_redaction(event, pending->redaction_id, &inner_error)) {
+            g_warning("Could not redact event %s: %s", event_id, inner_error->message);
+            g_clear_error(&inner_error);
+        }
+
+        g_queue_delete_link(priv->_pending_redaction_order, pending->link);
+        g_hash_table_remove(priv->_pending_redactions, event_id);
+    }
+
+    if (priv->_relation_index != NULL) {
+        matrix_relation_index_add_event(priv->_relation_index, node);
+    }
+
+    /* Older events arrive newest first, so a fetched redaction may target an event that is
+     * fetched later; _apply_redaction() keeps it pending until then */
+    if (MATRIX_EVENT_IS_ROOM_REDACTION(event)) {
+        const gchar *target_id = matrix_event_room_redaction_get_redacted_event_id(MATRIX_EVENT_ROOM_REDACTION(event));
+
+        if (target_id != NULL) {
+            _apply_redaction(matrix_http_client, room_id, target_id, event_id);
+        }
+    }
+
+    json_node_unref(node);
+}
+
 static MatrixRoom *
 _get_or_create_room(MatrixHTTPClient *matrix_http_client, const gchar *room_id)
 {
@@ -133,19 +247,212 @@ _get_or_create_room(MatrixHTTPClient *matrix_http_client, const gchar *room_id)
 
     if ((room = g_hash_table_lookup(priv->_rooms, room_id)) == NULL) {
         room = matrix_room_new(room_id);
+        matrix_room_set_api(room, MATRIX_API(matrix_http_client));
+        matrix_room_set_timeline_capacity(room, priv->_timeline_capacity);
+        g_signal_connect_object(room, "timeline-event-fetched",
+                                G_CALLBACK(_timeline_event_fetched_cb), matrix_http_client, 0);
         g_hash_table_insert(priv->_rooms, g_strdup(room_id), room);
     }
 
+    if ((priv->_updating_rooms != NULL) && !g_hash_table_contains(priv->_updating_rooms, room)) {
+        g_hash_table_add(priv->_updating_rooms, g_object_ref(room));
+        matrix_room_begin_update(room);
+    }
+
     return room;
 }
 
+/*
+ * Apply a redaction to every copy of its target we hold: the room timeline, the event store,
+ * the search index, and the relation index.  All of these are looked up by event ID.  If the target is not found
+ * anywhere, the redaction is remembered, and applied when the target arrives.
+ */
+static void
+_apply_redaction(MatrixHTTPClient *matrix_http_client, const gchar *room_id, const gchar *target_id, const gchar *redaction_id)
+{
+    MatrixHTTPClientPrivate *priv = matrix_http_client_get_instance_private(matrix_http_client);
+    MatrixRoom *room;
+    MatrixEventRoom *target;
+    PendingRedaction *pending;
+    gchar *key;
+    gboolean found = FALSE;
+    GError *inner_error = NULL;
+
+    if (((room = g_hash_table_lookup(priv->_rooms, room_id)) != NULL)
+        && ((target = matrix_room_get_timeline_event(room, target_id)) != NULL)) {
+        found = TRUE;
+
+        if (!matrix_event_room_apply_redaction(target, redaction_id, &inner_error)) {
+            g_warning("Could not redact event %s: %s", target_id, inner_error->message);
+            g_clear_error(&inner_error);
+        }
+    }
+
+    if (priv->_event_store != NULL) {
+        if (matrix_event_store_redact(priv->_event_store, target_id, redaction_id, &inner_error)) {
+            found = TRUE;
+        } else if (!g_error_matches(inner_error, MATRIX_ERROR, MATRIX_ERROR_NOT_FOUND)) {
+            found = TRUE;
+            g_warning("Could not redact stored event %s: %s", target_id, inner_error->message);
+        }
+
+        g_clear_error(&inner_error);
+    }
+
+    if ((priv->_search_index != NULL) && matrix_search_index_remove_event(priv->_search_index, target_id)) {
+        found = TRUE;
+    }
+
+    if ((priv->_relation_index != NULL) && matrix_relation_index_remove_event(priv->_relation_index, target_id)) {
+        found = TRUE;
+    }
+
+    if (found) {
+        return;
+    }
+
+    if ((pending = g_hash_table_lookup(priv->_pending_redactions, target_id)) != NULL) {
+        // A newer redaction of the same target; keep only one entry, as the most recent one
+        g_free(pending->redaction_id);
+        pending->redaction_id = g_strdup(redaction_id);
+        g_queue_unlink(priv->_pending_redaction_order, pending->link);
+        g_queue_push_tail_link(priv->_pending_redaction_order, pending->link);
+
+        return;
+    }
+
+    pending = g_new(PendingRedaction, 1);
+    key = g_strdup(target_id);
+    pending->redaction_id = g_strdup(redaction_id);
+    g_queue_push_tail(priv->_pending_redaction_order, key);
+    pending->link = g_queue_peek_tail_link(priv->_pending_redaction_order);
+    g_hash_table_insert(priv->_pending_redactions, key, pending);
+
+    while (g_queue_get_length(priv->_pending_redaction_order) > MAX_PENDING_REDACTIONS) {
+        // The key is freed by the hash table
+        g_hash_table_remove(priv->_pending_redactions, g_queue_pop_head(priv->_pending_redaction_order));
+    }
+}
+
+/*
+ * Merge the receipts of an m.receipt event into the receipt store of its room.  This works on
+ * the raw JSON, so receipts are kept even if the event is not decoded.
+ */
 static void
-_process_event(MatrixHTTPClient *matrix_http_client, JsonNode *event_node, const gchar *room_id)
+_process_receipts(MatrixHTTPClient *matrix_http_client, const gchar *room_id, JsonObject *root)
+{
+    MatrixRoom *room;
+    JsonNode *content_node;
+    JsonObjectIter event_iter;
+    const gchar *event_id;
+    JsonNode *event_node;
+
+    if (((content_node = json_object_get_member(root, "content")) == NULL)
+        || !JSON_NODE_HOLDS_OBJECT(content_node)) {
+        return;
+    }
+
+    room = _get_or_create_room(matrix_http_client, room_id);
+    json_object_iter_init(&event_iter, json_node_get_object(content_node));
+
+    while (json_object_iter_next(&event_iter, &event_id, &event_node)) {
+        JsonObjectIter type_iter;
+        const gchar *receipt_type;
+        JsonNode *type_node;
+
+        if (!JSON_NODE_HOLDS_OBJECT(event_node)) {
+            continue;
+        }
+
+        json_object_iter_init(&type_iter, json_node_get_object(event_node));
+
+        while (json_object_iter_next(&type_iter, &receipt_type, &type_node)) {
+            JsonObjectIter user_iter;
+            const gchar *user_id;
+            JsonNode *user_node;
+
+            if (!JSON_NODE_HOLDS_OBJECT(type_node)) {
+                continue;
+            }
+
+            json_object_iter_init(&user_iter, json_node_get_object(type_node));
+
+            while (json_object_iter_next(&user_iter, &user_id, &user_node)) {
+                JsonNode *ts_node = NULL;
+
+                if (JSON_NODE_HOLDS_OBJECT(user_node)) {
+                    ts_node = json_object_get_member(json_node_get_object(user_node), "ts");
+                }
+
+                matrix_room_set_receipt(room, user_id, receipt_type, event_id,
+                                        (ts_node != NULL) ? json_node_get_int(ts_node) : 0);
+            }
+        }
+    }
+}
+
+/*
+ * Process the summary of a joined room.  Every field of the summary is only sent when it
+ * changes, so missing fields keep their current values.
+ */
+static void
+_process_summary(MatrixRoom *room, JsonNode *summary_node)
+{
+    JsonObject *summary;
+    JsonNode *node;
+    guint joined_member_count = matrix_room_get_joined_member_count(room);
+    guint invited_member_count = matrix_room_get_invited_member_count(room);
+    gboolean has_counts = FALSE;
+
+    if ((summary_node == NULL) || !JSON_NODE_HOLDS_OBJECT(summary_node)) {
+        return;
+    }
+
+    summary = json_node_get_object(summary_node);
+
+    if (((node = json_object_get_member(summary, "m.heroes")) != NULL) && JSON_NODE_HOLDS_ARRAY(node)) {
+        JsonArray *heroes_array = json_node_get_array(node);
+        guint len = json_array_get_length(heroes_array);
+        const gchar **heroes = g_new(const gchar *, len);
+        gint n_heroes = 0;
+
+        for (guint i = 0; i < len; i++) {
+            JsonNode *hero = json_array_get_element(heroes_array, i);
+
+            if (json_node_get_value_type(hero) == G_TYPE_STRING) {
+                heroes[n_heroes++] = json_node_get_string(hero);
+            }
+        }
+
+        matrix_room_set_heroes(room, heroes, n_heroes);
+        g_free(heroes);
+    }
+
+    if ((node = json_object_get_member(summary, "m.joined_member_count")) != NULL) {
+        joined_member_count = (guint)CLAMP(json_node_get_int(node), 0, G_MAXUINT);
+        has_counts = TRUE;
+    }
+
+    if ((node = json_object_get_member(summary, "m.invited_member_count")) != NULL) {
+        invited_member_count = (guint)CLAMP(json_node_get_int(node), 0, G_MAXUINT);
+        has_counts = TRUE;
+    }
+
+    if (has_counts) {
+        matrix_room_set_member_counts(room, joined_member_count, invited_member_count);
+    }
+}
+
+static void
+_process_event(MatrixHTTPClient *matrix_http_client, JsonNode *event_node, const gchar *room_id, gboolean timeline)
 {
     MatrixHTTPClientPrivate *priv;
+    MatrixRoom *timeline_room = NULL;
     JsonObject *root;
     JsonNode *node;
+    PendingRedaction *pending;
     const gchar *event_type;
+    GType event_gtype;
     MatrixEventBase *evt = NULL;
     GError *inner_error = NULL;
 
@@ -171,12 +478,126 @@ _process_event(MatrixHTTPClient *matrix_http_client, JsonNode *event_node, const
     }
 
     priv = matrix_http_client_get_instance_private(matrix_http_client);
+
+    /* If the event got redacted before it arrived, process the redacted version instead */
+    if ((g_hash_table_size(priv->_pending_redactions) > 0)
+        && ((node = json_object_get_member(root, "event_id")) != NULL)
+        && (json_node_get_string(node) != NULL)
+        && ((pending = g_hash_table_lookup(priv->_pending_redactions, json_node_get_string(node))) != NULL)) {
+        JsonNode *redacted_node = _matrix_event_json_redact(event_node, pending->redaction_id);
+
+        g_queue_delete_link(priv->_pending_redaction_order, pending->link);
+        g_hash_table_remove(priv->_pending_redactions, json_node_get_string(node));
+        _process_event(matrix_http_client, redacted_node, room_id, timeline);
+        json_node_unref(redacted_node);
+
+        return;
+    }
+
+    node = json_object_get_member(root, "type");
     event_type = json_node_get_string(node);
-    evt = matrix_event_base_new_from_json(event_type, event_node, &inner_error);
+    event_gtype = matrix_event_get_handler(event_type);
 
-    if (inner_error != NULL) {
-        evt = NULL;
-        g_clear_error(&inner_error);
+    if (timeline && (room_id != NULL) && (priv->_event_store != NULL)) {
+        matrix_event_store_append(priv->_event_store, room_id, event_node, &inner_error);
+
+        if (inner_error != NULL) {
+            g_warning("Could not store event: %s", inner_error->message);
+            g_clear_error(&inner_error);
+        }
+    }
+
+    if (timeline && (room_id != NULL) && (priv->_relation_index != NULL)) {
+        matrix_relation_index_add_event(priv->_relation_index, event_node);
+    }
+
+    /* The search index reads the JSON itself, so events don’t have to be decoded for it */
+    if (timeline && (room_id != NULL) && (priv->_search_index != NULL)) {
+        matrix_search_index_add_event_node(priv->_search_index, room_id, event_node);
+    }
+
+    if (timeline && (room_id != NULL) && (g_strcmp0(event_type, "m.room.redaction") == 0)) {
+        const gchar *target_id = NULL;
+        const gchar *redaction_id = NULL;
+
+        if ((node = json_object_get_member(root, "redacts")) != NULL) {
+            target_id = json_node_get_string(node);
+        }
+
+        if ((node = json_object_get_member(root, "event_id")) != NULL) {
+            redaction_id = json_node_get_string(node);
+        }
+
+        if (target_id != NULL) {
+            _apply_redaction(matrix_http_client, room_id, target_id, redaction_id);
+        }
+    }
+
+    /* Keep the versioned state of the room.  Only state events get a snapshot of their own;
+     * the state of other events is found through the sync token snapshots, see cb_sync() */
+    if ((room_id != NULL) && json_object_has_member(root, "state_key")) {
+        matrix_room_apply_state_event(_get_or_create_room(matrix_http_client, room_id), event_node);
+    }
+
+    if ((room_id != NULL) && (g_strcmp0(event_type, "m.receipt") == 0)) {
+        _process_receipts(matrix_http_client, room_id, root);
+    }
+
+    if ((room_id == NULL)
+        && (priv->_push_rules != NULL)
+        && (g_strcmp0(event_type, "m.push_rules") == 0)
+        && ((node = json_object_get_member(root, "content")) != NULL)) {
+        matrix_push_rules_load(priv->_push_rules, node, &inner_error);
+
+        if (inner_error != NULL) {
+            g_warning("Could not load push rules: %s", inner_error->message);
+            g_clear_error(&inner_error);
+        }
+    }
+
+    /* Unread counters are kept for every room, even the ones without a timeline */
+    if (timeline && (room_id != NULL) && json_object_has_member(root, "event_id")) {
+        MatrixRoom *room = _get_or_create_room(matrix_http_client, room_id);
+        const gchar *user_id = matrix_api_get_user_id(MATRIX_API(matrix_http_client));
+        const gchar *sender = NULL;
+
+        if ((node = json_object_get_member(root, "sender")) != NULL) {
+            sender = json_node_get_string(node);
+        }
+
+        matrix_room_add_unread_event(room, event_type, sender);
+
+        if ((priv->_push_rules != NULL) && (g_strcmp0(sender, user_id) != 0)) {
+            matrix_push_rules_process_event(priv->_push_rules, room_id, event_node, room, user_id);
+        }
+    }
+
+    if (event_gtype != G_TYPE_NONE) {
+        /* Timeline events are kept by their room if it has a timeline */
+        if (timeline && (room_id != NULL) && g_type_is_a(event_gtype, MATRIX_EVENT_TYPE_ROOM)) {
+            timeline_room = _get_or_create_room(matrix_http_client, room_id);
+
+            if (matrix_room_get_timeline_capacity(timeline_room) == 0) {
+                timeline_room = NULL;
+            }
+        }
+
+        /* State and presence events update our caches, so they are always decoded.  Anything
+         * else (typing notifications, receipts, messages, etc.) is only turned into an object
+         * if there is someone to deliver it to. */
+        if ((timeline_room == NULL)
+            && !g_type_is_a(event_gtype, MATRIX_EVENT_TYPE_STATE)
+            && !g_type_is_a(event_gtype, MATRIX_EVENT_TYPE_PRESENCE)
+            && !matrix_client_has_event_handler(MATRIX_CLIENT(matrix_http_client), event_gtype)) {
+            return;
+        }
+
+        evt = matrix_event_base_new_from_json(event_type, event_node, &inner_error);
+
+        if (inner_error != NULL) {
+            evt = NULL;
+            g_clear_error(&inner_error);
+        }
     }
 
     if (evt != NULL) {
@@ -189,7 +610,7 @@ _process_event(MatrixHTTPClient *matrix_http_client, JsonNode *event_node, const
             }
         }
 
-        else if (MATRIX_EVENT_IS_PRESENCE(evt)) {
+        if (MATRIX_EVENT_IS_PRESENCE(evt)) {
             MatrixEventPresence *pevt = MATRIX_EVENT_PRESENCE(evt);
             const gchar *user_id = matrix_event_presence_get_user_id(pevt);
             MatrixProfile *profile;
@@ -205,7 +626,8 @@ _process_event(MatrixHTTPClient *matrix_http_client, JsonNode *event_node, const
 
             matrix_profile_set_avatar_url(profile, matrix_event_presence_get_avatar_url(pevt));
             matrix_profile_set_display_name(profile, matrix_event_presence_get_display_name(pevt));
-        } else if (MATRIX_EVENT_IS_ROOM(evt)) {
+        } else if (MATRIX_EVENT_IS_STATE(evt)
+                   && (matrix_event_room_get_room_id(MATRIX_EVENT_ROOM(evt)) != NULL)) {
             MatrixEventRoom *revt = MATRIX_EVENT_ROOM(evt);
             MatrixRoom *room = _get_or_create_room(matrix_http_client, matrix_event_room_get_room_id(revt));
 
@@ -216,6 +638,7 @@ _process_event(MatrixHTTPClient *matrix_http_client, JsonNode *event_node, const
 
                 matrix_profile_set_avatar_url(profile, matrix_event_room_member_get_avatar_url(mevt));
                 matrix_profile_set_display_name(profile, matrix_event_room_member_get_display_name(mevt));
+                matrix_room_set_member_membership(room, user_id, matrix_event_room_member_get_membership(mevt));
             } else if (MATRIX_EVENT_IS_ROOM_ALIASES(evt)) {
                 gint n_aliases;
                 const gchar **aliases;
@@ -251,17 +674,14 @@ _process_event(MatrixHTTPClient *matrix_http_client, JsonNode *event_node, const
                 MatrixEventRoomJoinRules *jevt = MATRIX_EVENT_ROOM_JOIN_RULES(evt);
 
                 matrix_room_set_join_rules(room, matrix_event_room_join_rules_get_join_rules(jevt));
-            } else if (MATRIX_EVENT_ROOM_NAME(evt)) {
+            } else if (MATRIX_EVENT_IS_ROOM_NAME(evt)) {
                 MatrixEventRoomName *nevt = MATRIX_EVENT_ROOM_NAME(evt);
 
                 matrix_room_set_name(room, matrix_event_room_name_get_name(nevt));
-            } else if (MATRIX_EVENT_ROOM_POWER_LEVELS(evt)) {
+            } else if (MATRIX_EVENT_IS_ROOM_POWER_LEVELS(evt)) {
                 MatrixEventRoomPowerLevels *levt = MATRIX_EVENT_ROOM_POWER_LEVELS(evt);
-                GHashTable *user_levels;
-                GHashTable *event_levels;
-                GHashTableIter iter;
-                gchar *key;
-                gpointer level;
+
+                matrix_room_begin_update(room);
 
                 matrix_room_set_default_power_level(room, matrix_event_room_power_levels_get_users_default(levt));
                 matrix_room_set_default_event_level(room, matrix_event_room_power_levels_get_events_default(levt));
@@ -270,22 +690,11 @@ _process_event(MatrixHTTPClient *matrix_http_client, JsonNode *event_node, const
                 matrix_room_set_kick_level(room, matrix_event_room_power_levels_get_kick(levt));
                 matrix_room_set_redact_level(room, matrix_event_room_power_levels_get_redact(levt));
                 matrix_room_set_invite_level(room, matrix_event_room_power_levels_get_invite(levt));
-                matrix_room_clear_user_levels(room);
-                matrix_room_clear_event_levels(room);
-
-                user_levels = matrix_event_room_power_levels_get_user_levels(levt);
-                g_hash_table_iter_init(&iter, user_levels);
-
-                while (g_hash_table_iter_next(&iter, (gpointer *)&key, &level)) {
-                    matrix_room_set_user_level(room, key, GPOINTER_TO_INT(level));
-                }
-
-                event_levels = matrix_event_room_power_levels_get_event_levels(levt);
-                g_hash_table_iter_init(&iter, event_levels);
+                matrix_room_set_room_notification_level(room, matrix_event_room_power_levels_get_room_notification(levt));
+                matrix_room_set_user_levels(room, matrix_event_room_power_levels_get_user_levels(levt));
+                matrix_room_set_event_levels(room, matrix_event_room_power_levels_get_event_levels(levt));
 
-                while (g_hash_table_iter_next(&iter, (gpointer *)&key, &level)) {
-                    matrix_room_set_event_level(room, key, GPOINTER_TO_INT(level));
-                }
+                matrix_room_end_update(room);
             } else if (MATRIX_EVENT_IS_ROOM_TOPIC(evt)) {
                 MatrixEventRoomTopic *tevt = MATRIX_EVENT_ROOM_TOPIC(evt);
 
@@ -294,18 +703,27 @@ _process_event(MatrixHTTPClient *matrix_http_client, JsonNode *event_node, const
         }
     }
 
+    if ((timeline_room != NULL) && (evt != NULL)) {
+        matrix_room_append_timeline_event(timeline_room, MATRIX_EVENT_ROOM(evt), _matrix_json_node_get_size(event_node));
+    }
+
     matrix_client_incoming_event(MATRIX_CLIENT(matrix_http_client), room_id, event_node, evt);
-    g_object_unref(evt);
-    json_node_unref(node);
-    json_object_unref(root);
+
+    if (evt != NULL) {
+        g_object_unref(evt);
+    }
 }
 
 static void
-_process_event_list_obj(MatrixHTTPClient *matrix_http_client, JsonNode* node, const gchar* room_id)
+_process_event_list_obj(MatrixHTTPClient *matrix_http_client, JsonNode* node, const gchar* room_id, gboolean timeline)
 {
     JsonObject *root;
     JsonNode *events_node;
 
+    if ((node == NULL) || (json_node_get_node_type(node) != JSON_NODE_OBJECT)) {
+        return;
+    }
+
     root = json_node_get_object(node);
 
     if ((events_node = json_object_get_member(root, "events")) != NULL) {
@@ -316,38 +734,207 @@ _process_event_list_obj(MatrixHTTPClient *matrix_http_client, JsonNode* node, co
             for (gint idx = 0; idx < len; idx++) {
                 JsonNode *event_node = json_array_get_element(events_array, idx);
 
-                _process_event(matrix_http_client, event_node, room_id);
+                _process_event(matrix_http_client, event_node, room_id, timeline);
+            }
+        }
+    }
+}
+
+/*
+ * Process the invite_state of a room we are invited to.  The stripped state only goes into
+ * the room's invite preview; event handlers still get each event.
+ */
+static void
+_process_invite(MatrixHTTPClient *matrix_http_client, JsonNode *invite_state_node, const gchar *room_id)
+{
+    MatrixHTTPClientPrivate *priv = matrix_http_client_get_instance_private(matrix_http_client);
+    const gchar *user_id = matrix_api_get_user_id(MATRIX_API(matrix_http_client));
+    MatrixInvitePreview *preview;
+    JsonNode *events_node;
+    JsonArray *events;
+    guint len;
+
+    if ((preview = g_hash_table_lookup(priv->_invites, room_id)) == NULL) {
+        preview = matrix_invite_preview_new(room_id);
+        g_hash_table_insert(priv->_invites, g_strdup(room_id), preview);
+    }
+
+    if ((invite_state_node == NULL)
+        || (json_node_get_node_type(invite_state_node) != JSON_NODE_OBJECT)
+        || ((events_node = json_object_get_member(json_node_get_object(invite_state_node), "events")) == NULL)
+        || (json_node_get_node_type(events_node) != JSON_NODE_ARRAY)) {
+        return;
+    }
+
+    events = json_node_get_array(events_node);
+    len = json_array_get_length(events);
+
+    for (guint i = 0; i < len; i++) {
+        JsonNode *event_node = json_array_get_element(events, i);
+        JsonNode *node;
+        MatrixEventBase *evt = NULL;
+        GType event_gtype;
+
+        matrix_invite_preview_update(preview, event_node, user_id);
+
+        if ((json_node_get_node_type(event_node) != JSON_NODE_OBJECT)
+            || ((node = json_object_get_member(json_node_get_object(event_node), "type")) == NULL)
+            || (json_node_get_string(node) == NULL)) {
+            continue;
+        }
+
+        event_gtype = matrix_event_get_handler(json_node_get_string(node));
+
+        if ((event_gtype != G_TYPE_NONE)
+            && matrix_client_has_event_handler(MATRIX_CLIENT(matrix_http_client), event_gtype)) {
+            GError *inner_error = NULL;
+
+            evt = matrix_event_base_new_from_json(json_node_get_string(node), event_node, &inner_error);
+
+            if (inner_error != NULL) {
+                evt = NULL;
+                g_clear_error(&inner_error);
             }
         }
+
+        if ((evt != NULL)
+            && MATRIX_EVENT_IS_ROOM(evt)
+            && (matrix_event_room_get_room_id(MATRIX_EVENT_ROOM(evt)) == NULL)) {
+            matrix_event_room_set_room_id(MATRIX_EVENT_ROOM(evt), room_id);
+        }
+
+        matrix_client_incoming_event(MATRIX_CLIENT(matrix_http_client), room_id, event_node, evt);
+
+        if (evt != NULL) {
+            g_object_unref(evt);
+        }
+    }
+}
+
+/*
+ * Get a counter from the unread_notifications object of a room.  Missing members and values
+ * that are not integers count as 0, and the value is clamped to the range of a guint.
+ */
+static guint
+_get_unread_count(JsonObject *unread_root, const gchar *member_name)
+{
+    JsonNode *node;
+    gint64 count;
+
+    if (((node = json_object_get_member(unread_root, member_name)) == NULL)
+        || (json_node_get_value_type(node) != G_TYPE_INT64)) {
+        return 0;
+    }
+
+    count = json_node_get_int(node);
+
+    return (guint)CLAMP(count, 0, G_MAXUINT);
+}
+
+/*
+ * Process the timeline section of a room in a sync response.  If the timeline is limited
+ * (there are events missing before it), record the gap so it can be filled later.
+ */
+static void
+_process_timeline(MatrixHTTPClient *matrix_http_client, JsonNode *timeline_node, const gchar *room_id)
+{
+    if ((timeline_node != NULL) && (json_node_get_node_type(timeline_node) == JSON_NODE_OBJECT)) {
+        JsonObject *timeline_root = json_node_get_object(timeline_node);
+        JsonNode *node;
+
+        if (((node = json_object_get_member(timeline_root, "prev_batch")) != NULL)
+            && (json_node_get_value_type(node) == G_TYPE_STRING)) {
+            MatrixRoom *room = _get_or_create_room(matrix_http_client, room_id);
+            JsonNode *limited_node = json_object_get_member(timeline_root, "limited");
+
+            if (((limited_node != NULL) && json_node_get_boolean(limited_node))
+                || (matrix_room_get_timeline_length(room) == 0)) {
+                matrix_room_mark_timeline_gap(room, json_node_get_string(node));
+            }
+        }
+    }
+
+    _process_event_list_obj(matrix_http_client, timeline_node, room_id, TRUE);
+}
+
+/*
+ * Get the time to wait before the next sync after one failed.  Only the failed sync’s own
+ * error response (error_content) is used, so other requests being rate limited don’t affect
+ * it.
+ */
+static guint
+_get_poll_retry_delay(MatrixHTTPClient *matrix_http_client, JsonNode *error_content)
+{
+    MatrixHTTPClientPrivate *priv = matrix_http_client_get_instance_private(matrix_http_client);
+    gulong retry_after = matrix_error_response_get_retry_after(error_content);
+    guint delay;
+
+    priv->_sync_failures++;
+
+    // Don’t let the server stall syncing for longer than our own backoff would
+    if (retry_after > 0) {
+        return (guint)MIN(retry_after, POLL_RETRY_MAX_DELAY);
     }
+
+    delay = MIN(POLL_RETRY_MAX_DELAY, POLL_RETRY_BASE_DELAY << MIN(priv->_sync_failures - 1, 16));
+
+    return (guint)g_random_int_range(delay / 2, delay + 1);
+}
+
+static gboolean
+_poll_again_cb(gpointer user_data)
+{
+    MatrixHTTPClientPrivate *priv = matrix_http_client_get_instance_private(MATRIX_HTTP_CLIENT(user_data));
+
+    priv->_poll_source_id = 0;
+
+    if (priv->_polling) {
+        matrix_client_begin_polling(MATRIX_CLIENT(user_data), NULL);
+    }
+
+    return G_SOURCE_REMOVE;
 }
 
 static void
 cb_sync(MatrixAPI *matrix_api, const gchar *content_type, JsonNode *json_content, GByteArray *raw_content, GError *error, gpointer user_data)
 {
     MatrixHTTPClientPrivate *priv = matrix_http_client_get_instance_private(MATRIX_HTTP_CLIENT(matrix_api));
+    GError *bad_response = NULL;
+
+    // Treat a malformed response like a failed request, so polling backs off
+    if ((error == NULL) && ((json_content == NULL) || !JSON_NODE_HOLDS_OBJECT(json_content))) {
+        bad_response = g_error_new_literal(MATRIX_ERROR, MATRIX_ERROR_BAD_RESPONSE,
+                                           "Sync response is not a JSON object");
+        error = bad_response;
+    }
 
     if (error == NULL) {
         JsonObject *root = json_node_get_object(json_content);
         JsonNode *node;
+        GHashTable *updating_rooms;
+        GHashTableIter room_iter;
+        gpointer updated_room;
+
+        /* Changes to the rooms are reported once, after the whole response is processed */
+        priv->_updating_rooms = g_hash_table_new_full(g_direct_hash, g_direct_equal, g_object_unref, NULL);
 
 #if DEBUG
         g_debug("Processing account data");
 #endif
 
-        _process_event_list_obj(MATRIX_HTTP_CLIENT(matrix_api), json_object_get_member(root, "account_data"), NULL);
+        _process_event_list_obj(MATRIX_HTTP_CLIENT(matrix_api), json_object_get_member(root, "account_data"), NULL, FALSE);
 
 #if DEBUG
         g_debug("Processing presence");
 #endif
 
-        _process_event_list_obj(MATRIX_HTTP_CLIENT(matrix_api), json_object_get_member(root, "presence"), NULL);
+        _process_event_list_obj(MATRIX_HTTP_CLIENT(matrix_api), json_object_get_member(root, "presence"), NULL, FALSE);
 
         if ((node = json_object_get_member(root, "rooms")) != NULL) {
             if (json_node_get_node_type(node) == JSON_NODE_OBJECT) {
                 JsonObject *rooms_root = json_node_get_object(node);
                 JsonNode *rooms_node;
-                        MatrixHTTPClient *matrix_http_client = MATRIX_HTTP_CLIENT(matrix_api);
+                MatrixHTTPClient *matrix_http_client = MATRIX_HTTP_CLIENT(matrix_api);
 
 #if DEBUG
                 g_debug("Processing rooms");
@@ -369,7 +956,7 @@ cb_sync(MatrixAPI *matrix_api, const gchar *content_type, JsonNode *json_content
 
                         room_root = json_node_get_object(room_node);
 
-                        _process_event_list_obj(MATRIX_HTTP_CLIENT(matrix_api), json_object_get_member(room_root, "invite_state"), room_id);
+                        _process_invite(matrix_http_client, json_object_get_member(room_root, "invite_state"), room_id);
                     }
                 }
 
@@ -382,17 +969,30 @@ cb_sync(MatrixAPI *matrix_api, const gchar *content_type, JsonNode *json_content
 
                     while (json_object_iter_next(&iter, &room_id, &room_node)) {
                         JsonObject *room_root;
+                        MatrixRoom *room;
 
                         if (json_node_get_node_type(room_node) != JSON_NODE_OBJECT) {
                             continue;
                         }
 
                         room_root = json_node_get_object(room_node);
-
-                        _process_event_list_obj(matrix_http_client, json_object_get_member(room_root, "timeline"), room_id);
-                        _process_event_list_obj(matrix_http_client, json_object_get_member(room_root, "state"), room_id);
-                        _process_event_list_obj(matrix_http_client, json_object_get_member(room_root, "account_data"), room_id);
-                        _process_event_list_obj(matrix_http_client, json_object_get_member(room_root, "ephemeral"), room_id);
+                        room = _get_or_create_room(matrix_http_client, room_id);
+                        g_hash_table_remove(priv->_invites, room_id);
+
+                        _process_summary(room, json_object_get_member(room_root, "summary"));
+                        _process_event_list_obj(matrix_http_client, json_object_get_member(room_root, "state"), room_id, FALSE);
+                        _process_timeline(matrix_http_client, json_object_get_member(room_root, "timeline"), room_id);
+                        _process_event_list_obj(matrix_http_client, json_object_get_member(room_root, "account_data"), room_id, FALSE);
+                        _process_event_list_obj(matrix_http_client, json_object_get_member(room_root, "ephemeral"), room_id, FALSE);
+
+                        if (((node = json_object_get_member(room_root, "unread_notifications")) != NULL)
+                            && (json_node_get_node_type(node) == JSON_NODE_OBJECT)) {
+                            JsonObject *unread_root = json_node_get_object(node);
+
+                            matrix_room_set_unread_notifications(room,
+                                                                 _get_unread_count(unread_root, "notification_count"),
+                                                                 _get_unread_count(unread_root, "highlight_count"));
+                        }
                     }
                 }
 
@@ -411,18 +1011,45 @@ cb_sync(MatrixAPI *matrix_api, const gchar *content_type, JsonNode *json_content
                         }
 
                         room_root = json_node_get_object(room_node);
+                        g_hash_table_remove(priv->_invites, room_id);
 
-                        _process_event_list_obj(matrix_http_client, json_object_get_member(room_root, "timeline"), room_id);
-                        _process_event_list_obj(matrix_http_client, json_object_get_member(room_root, "state"), room_id);
+                        _process_event_list_obj(matrix_http_client, json_object_get_member(room_root, "state"), room_id, FALSE);
+                        _process_timeline(matrix_http_client, json_object_get_member(room_root, "timeline"), room_id);
                     }
                 }
             }
         }
 
+        if (priv->_event_store != NULL) {
+            GError *store_error = NULL;
+
+            if (!matrix_event_store_commit(priv->_event_store, &store_error)) {
+                g_warning("Could not write event store: %s", store_error->message);
+                g_clear_error(&store_error);
+            }
+        }
+
         if ((node = json_object_get_member(root, "next_batch")) != NULL) {
             g_free(priv->_last_sync_token);
             priv->_last_sync_token = g_strdup(json_node_get_string(node));
         }
+
+        /* Ending the updates emits signals, and their handlers may call back into the client
+         * or drop their rooms, so work on a table nobody else can see, with a reference on
+         * each room */
+        updating_rooms = g_steal_pointer(&(priv->_updating_rooms));
+        g_hash_table_iter_init(&room_iter, updating_rooms);
+
+        while (g_hash_table_iter_next(&room_iter, &updated_room, NULL)) {
+            /* Record the state each room had at the end of this batch */
+            if (priv->_last_sync_token != NULL) {
+                matrix_room_snapshot_state(MATRIX_ROOM(updated_room), priv->_last_sync_token);
+            }
+
+            matrix_room_end_update(MATRIX_ROOM(updated_room));
+        }
+
+        g_hash_table_unref(updating_rooms);
     } else if ((error->domain == MATRIX_ERROR) &&
                ((error->code == MATRIX_ERROR_M_FORBIDDEN) ||
                 (error->code == MATRIX_ERROR_M_UNKNOWN_TOKEN) ||
@@ -433,13 +1060,27 @@ cb_sync(MatrixAPI *matrix_api, const gchar *content_type, JsonNode *json_content
     // It is possible that polling has been disabled while we were processing events. Don’t
     // continue polling if that is the case.
     if (priv->_polling) {
-        if ((error == NULL) || (error->code < MATRIX_ERROR_M_MISSING_TOKEN)) {
+        if (error == NULL) {
+            priv->_sync_failures = 0;
             matrix_client_begin_polling(MATRIX_CLIENT(matrix_api), NULL);
-        } else if ((error != NULL) && (error->code >= MATRIX_ERROR_M_MISSING_TOKEN)) {
+        } else if ((error->code < MATRIX_ERROR_M_MISSING_TOKEN)
+                   || (error->code == MATRIX_ERROR_M_LIMIT_EXCEEDED)) {
+            guint delay = _get_poll_retry_delay(MATRIX_HTTP_CLIENT(matrix_api), json_content);
+
+#if DEBUG
+            g_debug("Sync failed (%s), polling again in %u ms", error->message, delay);
+#endif
+
+            // Don’t hammer a failing server; the HTTP layer has already retried this request,
+            // so wait a bit before the next sync
+            priv->_poll_source_id = g_timeout_add(delay, _poll_again_cb, matrix_api);
+        } else {
             g_signal_emit_by_name(MATRIX_CLIENT(matrix_api), "polling-stopped", error);
             matrix_client_stop_polling(MATRIX_CLIENT(matrix_api), FALSE, NULL);
         }
     }
+
+    g_clear_error(&bad_response);
 }
 
 static void
@@ -448,6 +1089,11 @@ matrix_http_client_real_begin_polling(MatrixClient *matrix_client, GError **erro
     MatrixHTTPClientPrivate *priv = matrix_http_client_get_instance_private(MATRIX_HTTP_CLIENT(matrix_client));
     GError *inner_error = NULL;
 
+    if (priv->_poll_source_id != 0) {
+        g_source_remove(priv->_poll_source_id);
+        priv->_poll_source_id = 0;
+    }
+
     matrix_api_sync(MATRIX_API(matrix_client),
                     NULL, NULL,
                     priv->_last_sync_token, FALSE, FALSE,
@@ -474,6 +1120,12 @@ matrix_http_client_real_stop_polling (MatrixClient *matrix_client, gboolean canc
     MatrixHTTPClientPrivate *priv = matrix_http_client_get_instance_private(MATRIX_HTTP_CLIENT(matrix_client));
 
     priv->_polling = FALSE;
+    priv->_sync_failures = 0;
+
+    if (priv->_poll_source_id != 0) {
+        g_source_remove(priv->_poll_source_id);
+        priv->_poll_source_id = 0;
+    }
 
     if (cancel_ongoing) {
         matrix_api_abort_pending(MATRIX_API(matrix_client));
@@ -620,6 +1272,449 @@ matrix_http_client_next_txn_id(MatrixHTTPClient *matrix_http_client)
     return ++(priv->_last_txn_id);
 }
 
+/**
+ * matrix_http_client_set_event_store:
+ * @client: a #MatrixHTTPClient
+ * @event_store: (nullable): a #MatrixEventStore
+ *
+ * Store the timeline events of all rooms received during sync in @event_store.  Events from
+ * each sync response are committed together.
+ */
+void
+matrix_http_client_set_event_store(MatrixHTTPClient *matrix_http_client, MatrixEventStore *event_store)
+{
+    MatrixHTTPClientPrivate *priv;
+
+    g_return_if_fail(matrix_http_client != NULL);
+
+    priv = matrix_http_client_get_instance_private(matrix_http_client);
+
+    if (event_store != NULL) {
+        g_object_ref(event_store);
+    }
+
+    g_clear_object(&(priv->_event_store));
+    priv->_event_store = event_store;
+}
+
+/**
+ * matrix_http_client_get_event_store:
+ * @client: a #MatrixHTTPClient
+ *
+ * Returns: (transfer none) (nullable): the #MatrixEventStore set for @client
+ */
+MatrixEventStore *
+matrix_http_client_get_event_store(MatrixHTTPClient *matrix_http_client)
+{
+    MatrixHTTPClientPrivate *priv;
+
+    g_return_val_if_fail(matrix_http_client != NULL, NULL);
+
+    priv = matrix_http_client_get_instance_private(matrix_http_client);
+
+    return priv->_event_store;
+}
+
+/**
+ * matrix_http_client_set_search_index:
+ * @client: a #MatrixHTTPClient
+ * @search_index: (nullable): a #MatrixSearchIndex
+ *
+ * Add the timeline events of all rooms received during sync to @search_index.
+ */
+void
+matrix_http_client_set_search_index(MatrixHTTPClient *matrix_http_client, MatrixSearchIndex *search_index)
+{
+    MatrixHTTPClientPrivate *priv;
+
+    g_return_if_fail(matrix_http_client != NULL);
+
+    priv = matrix_http_client_get_instance_private(matrix_http_client);
+
+    if (search_index != NULL) {
+        g_object_ref(search_index);
+    }
+
+    g_clear_object(&(priv->_search_index));
+    priv->_search_index = search_index;
+}
+
+/**
+ * matrix_http_client_get_search_index:
+ * @client: a #MatrixHTTPClient
+ *
+ * Returns: (transfer none) (nullable): the #MatrixSearchIndex set for @client
+ */
+MatrixSearchIndex *
+matrix_http_client_get_search_index(MatrixHTTPClient *matrix_http_client)
+{
+    MatrixHTTPClientPrivate *priv;
+
+    g_return_val_if_fail(matrix_http_client != NULL, NULL);
+
+    priv = matrix_http_client_get_instance_private(matrix_http_client);
+
+    return priv->_search_index;
+}
+
+/**
+ * matrix_http_client_set_relation_index:
+ * @client: a #MatrixHTTPClient
+ * @relation_index: (nullable): a #MatrixRelationIndex
+ *
+ * Add the relations of the timeline events received during sync to @relation_index.
+ */
+void
+matrix_http_client_set_relation_index(MatrixHTTPClient *matrix_http_client, MatrixRelationIndex *relation_index)
+{
+    MatrixHTTPClientPrivate *priv;
+
+    g_return_if_fail(matrix_http_client != NULL);
+
+    priv = matrix_http_client_get_instance_private(matrix_http_client);
+
+    if (relation_index != NULL) {
+        g_object_ref(relation_index);
+    }
+
+    g_clear_object(&(priv->_relation_index));
+    priv->_relation_index = relation_index;
+}
+
+/**
+ * matrix_http_client_get_relation_index:
+ * @client: a #MatrixHTTPClient
+ *
+ * Returns: (transfer none) (nullable): the #MatrixRelationIndex set for @client
+ */
+MatrixRelationIndex *
+matrix_http_client_get_relation_index(MatrixHTTPClient *matrix_http_client)
+{
+    MatrixHTTPClientPrivate *priv;
+
+    g_return_val_if_fail(matrix_http_client != NULL, NULL);
+
+    priv = matrix_http_client_get_instance_private(matrix_http_client);
+
+    return priv->_relation_index;
+}
+
+/**
+ * matrix_http_client_set_push_rules:
+ * @client: a #MatrixHTTPClient
+ * @push_rules: (nullable): a #MatrixPushRules
+ *
+ * Evaluate the timeline events received during sync with @push_rules.  The rules are reloaded
+ * whenever an `m.push_rules` account data event arrives.  Events sent by the user of @client
+ * are not evaluated.
+ */
+void
+matrix_http_client_set_push_rules(MatrixHTTPClient *matrix_http_client, MatrixPushRules *push_rules)
+{
+    MatrixHTTPClientPrivate *priv;
+
+    g_return_if_fail(matrix_http_client != NULL);
+
+    priv = matrix_http_client_get_instance_private(matrix_http_client);
+
+    if (push_rules != NULL) {
+        g_object_ref(push_rules);
+    }
+
+    g_clear_object(&(priv->_push_rules));
+    priv->_push_rules = push_rules;
+}
+
+/**
+ * matrix_http_client_get_push_rules:
+ * @client: a #MatrixHTTPClient
+ *
+ * Returns: (transfer none) (nullable): the #MatrixPushRules set for @client
+ */
+MatrixPushRules *
+matrix_http_client_get_push_rules(MatrixHTTPClient *matrix_http_client)
+{
+    MatrixHTTPClientPrivate *priv;
+
+    g_return_val_if_fail(matrix_http_client != NULL, NULL);
+
+    priv = matrix_http_client_get_instance_private(matrix_http_client);
+
+    return priv->_push_rules;
+}
+
+/**
+ * matrix_http_client_set_timeline_capacity:
+ * @client: a #MatrixHTTPClient
+ * @capacity: the maximum number of events to hold per room
+ *
+ * Set the timeline capacity of every room known to @client, and of the rooms it creates
+ * later (see matrix_room_set_timeline_capacity()).  It is 0 by default, so timeline events
+ * are only decoded if there is a handler for their type.
+ */
+void
+matrix_http_client_set_timeline_capacity(MatrixHTTPClient *matrix_http_client, guint capacity)
+{
+    MatrixHTTPClientPrivate *priv;
+    GHashTableIter iter;
+    gpointer room;
+
+    g_return_if_fail(matrix_http_client != NULL);
+
+    priv = matrix_http_client_get_instance_private(matrix_http_client);
+    priv->_timeline_capacity = capacity;
+
+    g_hash_table_iter_init(&iter, priv->_rooms);
+
+    while (g_hash_table_iter_next(&iter, NULL, &room)) {
+        matrix_room_set_timeline_capacity(MATRIX_ROOM(room), capacity);
+    }
+}
+
+/**
+ * matrix_http_client_get_timeline_capacity:
+ * @client: a #MatrixHTTPClient
+ *
+ * Returns: the timeline capacity given to the rooms of @client
+ */
+guint
+matrix_http_client_get_timeline_capacity(MatrixHTTPClient *matrix_http_client)
+{
+    MatrixHTTPClientPrivate *priv;
+
+    g_return_val_if_fail(matrix_http_client != NULL, 0);
+
+    priv = matrix_http_client_get_instance_private(matrix_http_client);
+
+    return priv->_timeline_capacity;
+}
+
+/**
+ * matrix_http_client_get_invite:
+ * @client: a #MatrixHTTPClient
+ * @room_id: a room ID
+ *
+ * Get the preview of a room we are invited to.  Rooms we are invited to have no #MatrixRoom
+ * until we join them.
+ *
+ * Returns: (transfer none) (nullable): the invite preview, or %NULL if we have no pending
+ *     invite to @room_id
+ */
+MatrixInvitePreview *
+matrix_http_client_get_invite(MatrixHTTPClient *matrix_http_client, const gchar *room_id)
+{
+    MatrixHTTPClientPrivate *priv;
+
+    g_return_val_if_fail(matrix_http_client != NULL, NULL);
+    g_return_val_if_fail(room_id != NULL, NULL);
+
+    priv = matrix_http_client_get_instance_private(matrix_http_client);
+
+    return g_hash_table_lookup(priv->_invites, room_id);
+}
+
+/**
+ * matrix_http_client_get_invites:
+ * @client: a #MatrixHTTPClient
+ *
+ * Get the previews of all the rooms we have a pending invite to.
+ *
+ * Returns: (transfer container) (element-type MatrixInvitePreview): the invite previews
+ */
+GList *
+matrix_http_client_get_invites(MatrixHTTPClient *matrix_http_client)
+{
+    MatrixHTTPClientPrivate *priv;
+
+    g_return_val_if_fail(matrix_http_client != NULL, NULL);
+
+    priv = matrix_http_client_get_instance_private(matrix_http_client);
+
+    return g_hash_table_get_values(priv->_invites);
+}
+
+typedef struct {
+    MatrixHTTPClient *client;
+    gchar *room_id;
+    JsonArray *changed;
+    JsonArray *removed;
+} HydrationData;
+
+static void _hydrate_next_rooms(MatrixHTTPClient *matrix_http_client);
+
+static void
+_hydration_diff_cb(const gchar *event_type, const gchar *state_key, JsonNode *old_event, JsonNode *new_event, gpointer user_data)
+{
+    HydrationData *data = user_data;
+
+    if (new_event == NULL) {
+        json_array_add_element(data->removed, json_node_copy(old_event));
+
+        return;
+    }
+
+    json_array_add_element(data->changed, json_node_copy(new_event));
+
+    /* Update the room (and our caches) the same way as if the event came in a sync */
+    _process_event(data->client, new_event, data->room_id, FALSE);
+}
+
+static void
+cb_hydrate_room_state(MatrixAPI *matrix_api, const gchar *content_type, JsonNode *json_content, GByteArray *raw_content, GError *err, gpointer user_data)
+{
+    HydrationData *data = user_data;
+    MatrixHTTPClientPrivate *priv = matrix_http_client_get_instance_private(data->client);
+    MatrixRoomState *state;
+    MatrixRoomState *old_state;
+    MatrixRoom *room;
+    JsonArray *events;
+    guint len;
+
+    priv->_hydration_running--;
+
+    if ((err != NULL) || (json_content == NULL) || (json_node_get_node_type(json_content) != JSON_NODE_ARRAY)) {
+        g_warning("Could not fetch the state of room %s: %s",
+                  data->room_id, (err != NULL) ? err->message : "invalid response");
+
+        goto out;
+    }
+
+    /* Build the new state on the side, so the room keeps its old state until the whole
+     * response is applied */
+    events = json_node_get_array(json_content);
+    len = json_array_get_length(events);
+    state = matrix_room_state_new();
+
+    for (guint i = 0; i < len; i++) {
+        MatrixRoomState *next = matrix_room_state_apply_event(state, json_array_get_element(events, i));
+
+        matrix_room_state_unref(state);
+        state = next;
+    }
+
+    room = _get_or_create_room(data->client, data->room_id);
+    old_state = matrix_room_state_ref(matrix_room_get_state(room));
+    data->changed = json_array_new();
+    data->removed = json_array_new();
+
+    matrix_room_begin_update(room);
+    matrix_room_state_diff(old_state, state, _hydration_diff_cb, data);
+    matrix_room_replace_state(room, state);
+    matrix_room_end_update(room);
+
+    if ((json_array_get_length(data->changed) > 0) || (json_array_get_length(data->removed) > 0)) {
+        JsonNode *changed_node = json_node_new(JSON_NODE_ARRAY);
+        JsonNode *removed_node = json_node_new(JSON_NODE_ARRAY);
+
+        json_node_take_array(changed_node, data->changed);
+        json_node_take_array(removed_node, data->removed);
+        data->changed = NULL;
+        data->removed = NULL;
+
+        g_signal_emit(data->client, matrix_http_client_signals[SIGNAL_ROOM_STATE_HYDRATED], 0,
+                      data->room_id, changed_node, removed_node);
+
+        json_node_unref(changed_node);
+        json_node_unref(removed_node);
+    }
+
+    matrix_room_state_unref(old_state);
+    matrix_room_state_unref(state);
+
+out:
+    g_hash_table_remove(priv->_hydration_pending, data->room_id);
+    _hydrate_next_rooms(data->client);
+
+    if (data->changed != NULL) {
+        json_array_unref(data->changed);
+    }
+
+    if (data->removed != NULL) {
+        json_array_unref(data->removed);
+    }
+
+    g_object_unref(data->client);
+    g_free(data->room_id);
+    g_free(data);
+}
+
+/*
+ * Start fetching the state of queued rooms, until there are _hydration_max_requests requests
+ * running.
+ */
+static void
+_hydrate_next_rooms(MatrixHTTPClient *matrix_http_client)
+{
+    MatrixHTTPClientPrivate *priv = matrix_http_client_get_instance_private(matrix_http_client);
+
+    while ((priv->_hydration_running < priv->_hydration_max_requests)
+           && !g_queue_is_empty(priv->_hydration_queue)) {
+        HydrationData *data = g_new0(HydrationData, 1);
+        GError *inner_error = NULL;
+
+        data->client = g_object_ref(matrix_http_client);
+        data->room_id = g_queue_pop_head(priv->_hydration_queue);
+        priv->_hydration_running++;
+
+        matrix_api_get_room_state(MATRIX_API(matrix_http_client),
+                                  cb_hydrate_room_state, data,
+                                  data->room_id, NULL, NULL,
+                                  &inner_error);
+
+        if (inner_error != NULL) {
+            g_warning("Could not fetch the state of room %s: %s", data->room_id, inner_error->message);
+            g_clear_error(&inner_error);
+
+            priv->_hydration_running--;
+            g_hash_table_remove(priv->_hydration_pending, data->room_id);
+            g_object_unref(data->client);
+            g_free(data->room_id);
+            g_free(data);
+        }
+    }
+}
+
+/**
+ * matrix_http_client_hydrate_room_state:
+ * @client: a #MatrixHTTPClient
+ * @room_ids: (array length=n_room_ids): the IDs of the rooms to fetch the state of
+ * @n_room_ids: the length of @room_ids
+ * @max_requests: the maximum number of state requests to run at once, or 0 to keep the
+ *     current limit (4 by default)
+ *
+ * Fetch the full state of @room_ids from the homeserver, eg. to repair rooms whose state has
+ * drifted.  The state events of each room are applied like the ones received during a sync,
+ * and the state of the room is replaced in one update when all of them are processed.  Only
+ * the state events that differ from the known state are applied; they are reported by the
+ * #MatrixHTTPClient::room-state-hydrated signal.
+ *
+ * Rooms that are already waiting to be fetched, or whose state is being fetched, are not
+ * queued again.
+ */
+void
+matrix_http_client_hydrate_room_state(MatrixHTTPClient *matrix_http_client, const gchar **room_ids, int n_room_ids, guint max_requests)
+{
+    MatrixHTTPClientPrivate *priv;
+
+    g_return_if_fail(matrix_http_client != NULL);
+    g_return_if_fail((room_ids != NULL) || (n_room_ids == 0));
+
+    priv = matrix_http_client_get_instance_private(matrix_http_client);
+
+    if (max_requests > 0) {
+        priv->_hydration_max_requests = max_requests;
+    }
+
+    for (gint i = 0; i < n_room_ids; i++) {
+        if (!g_hash_table_contains(priv->_hydration_pending, room_ids[i])) {
+            g_hash_table_add(priv->_hydration_pending, g_strdup(room_ids[i]));
+            g_queue_push_tail(priv->_hydration_queue, g_strdup(room_ids[i]));
+        }
+    }
+
+    _hydrate_next_rooms(matrix_http_client);
+}
+
 typedef struct {
     MatrixClientSendCallback cb;
     gpointer callback_target;
@@ -636,10 +1731,15 @@ send_callback(MatrixAPI *matrix_api, const gchar *content_type, JsonNode *json_c
 
     // If there is no callback, there is no point to continue
     if (cb_data->cb == NULL) {
+        g_free(cb_data);
+
         return;
     }
 
-    if (err == NULL) {
+    if ((err == NULL) && ((json_content == NULL) || !JSON_NODE_HOLDS_OBJECT(json_content))) {
+        new_err = g_error_new_literal(MATRIX_ERROR, MATRIX_ERROR_BAD_RESPONSE,
+                                      "Event response is not a JSON object");
+    } else if (err == NULL) {
         JsonObject *root = json_node_get_object(json_content);
 
         if (json_object_has_member(root, "event_id")) {
@@ -651,49 +1751,44 @@ send_callback(MatrixAPI *matrix_api, const gchar *content_type, JsonNode *json_c
     }
 
     cb_data->cb(MATRIX_CLIENT(matrix_api), event_id, new_err, cb_data->callback_target);
+
+    if (new_err != err) {
+        g_error_free(new_err);
+    }
+
+    g_free(cb_data);
 }
 
 static void
 matrix_http_client_real_send(MatrixClient *matrix_client, const gchar *room_id, MatrixEventBase *evt, MatrixClientSendCallback cb, void *cb_target, gulong txn_id, GError **error)
 {
-    JsonNode *evt_node;
-    JsonObject *evt_root;
-    const gchar *state_key = NULL;
-    SendCallbackData cb_data;
+    SendCallbackData *cb_data;
+    GError *inner_error = NULL;
+    gchar *txn_id_str = NULL;
 
     g_return_if_fail (room_id != NULL);
     g_return_if_fail (evt != NULL);
 
-    evt_node = matrix_event_base_get_json(evt);
-    evt_root = json_node_get_object(evt_node);
+    // The callback data must outlive this call, as the request finishes asynchronously
+    cb_data = g_new(SendCallbackData, 1);
+    cb_data->cb = cb;
+    cb_data->callback_target = cb_target;
 
-    if (json_object_has_member(evt_root, "state_key")) {
-        state_key = json_object_get_string_member(evt_root, "state_key");
+    if (!MATRIX_EVENT_IS_STATE(evt)) {
+        txn_id = matrix_http_client_next_txn_id(MATRIX_HTTP_CLIENT(matrix_client));
+        txn_id_str = g_strdup_printf("%lu", txn_id);
     }
 
-    cb_data.cb = cb;
-    cb_data.callback_target = cb_target;
-
-    if (state_key != NULL) {
-        matrix_api_send_state_event(MATRIX_API(matrix_client),
-                                    room_id,
-                                    matrix_event_base_get_event_type(evt),
-                                    state_key,
-                                    json_object_get_member(evt_root, "content"),
-                                    send_callback, &cb_data,
-                                    error);
-    } else {
-        txn_id = matrix_http_client_next_txn_id(MATRIX_HTTP_CLIENT(matrix_client));
-        gchar *txn_id_str = g_strdup_printf("%lu", txn_id);
+    // The event is serialized straight into the request body, without building its JSON node
+    _matrix_http_api_send_event(MATRIX_HTTP_API(matrix_client),
+                                send_callback, cb_data,
+                                room_id, evt, txn_id_str,
+                                &inner_error);
+    g_free(txn_id_str);
 
-        matrix_api_send_event(MATRIX_API(matrix_client),
-                              room_id,
-                              matrix_event_base_get_event_type(evt),
-                              txn_id_str,
-                              json_object_get_member(evt_root, "content"),
-                              send_callback, &cb_data,
-                              error);
-        g_free(txn_id_str);
+    if (inner_error != NULL) {
+        g_propagate_error(error, inner_error);
+        g_free(cb_data);
     }
 }
 
@@ -833,10 +1928,23 @@ matrix_http_client_finalize(GObject *gobject)
 {
     MatrixHTTPClientPrivate *priv = matrix_http_client_get_instance_private(MATRIX_HTTP_CLIENT(gobject));
 
+    if (priv->_poll_source_id != 0) {
+        g_source_remove(priv->_poll_source_id);
+    }
+
     g_free(priv->_last_sync_token);
     g_hash_table_unref(priv->_user_global_profiles);
     g_hash_table_unref(priv->_user_global_presence);
     g_hash_table_unref(priv->_rooms);
+    g_clear_object(&(priv->_event_store));
+    g_clear_object(&(priv->_search_index));
+    g_clear_object(&(priv->_relation_index));
+    g_clear_object(&(priv->_push_rules));
+    g_hash_table_unref(priv->_pending_redactions);
+    g_queue_free(priv->_pending_redaction_order);
+    g_queue_free_full(priv->_hydration_queue, g_free);
+    g_hash_table_unref(priv->_hydration_pending);
+    g_hash_table_unref(priv->_invites);
 
     G_OBJECT_CLASS(matrix_http_client_parent_class)->finalize(gobject);
 }
@@ -845,6 +1953,25 @@ static void
 matrix_http_client_class_init(MatrixHTTPClientClass *klass)
 {
     G_OBJECT_CLASS(klass)->finalize = matrix_http_client_finalize;
+
+    /**
+     * MatrixHTTPClient::room-state-hydrated:
+     * @client: the object that received the signal
+     * @room_id: the ID of the room
+     * @changed: a JSON array of the state events that were added or replaced
+     * @removed: a JSON array of the state events that are no longer part of the room state
+     *
+     * This signal is emitted when the full state fetched by
+     * matrix_http_client_hydrate_room_state() differs from the state we had for a room.
+     */
+    matrix_http_client_signals[SIGNAL_ROOM_STATE_HYDRATED] = g_signal_new(
+            "room-state-hydrated",
+            MATRIX_TYPE_HTTP_CLIENT,
+            G_SIGNAL_RUN_LAST,
+            0,
+            NULL, NULL,
+            NULL,
+            G_TYPE_NONE, 3, G_TYPE_STRING, JSON_TYPE_NODE, JSON_TYPE_NODE);
 }
 
 static void
@@ -875,4 +2002,14 @@ matrix_http_client_init(MatrixHTTPClient *matrix_http_client)
     priv->_user_global_presence = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
     priv->_rooms = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_object_unref);
     priv->_last_txn_id = (gulong)0;
+    priv->_sync_failures = 0;
+    priv->_poll_source_id = 0;
+    priv->_pending_redactions = g_hash_table_new_full(g_str_hash, g_str_equal,
+                                                      g_free, (GDestroyNotify)_pending_redaction_free);
+    priv->_pending_redaction_order = g_queue_new();
+    priv->_hydration_queue = g_queue_new();
+    priv->_hydration_pending = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+    priv->_invites = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, (GDestroyNotify)matrix_invite_preview_unref);
+    priv->_hydration_running = 0;
+    priv->_hydration_max_requests = DEFAULT_HYDRATION_MAX_REQUESTS;
 }
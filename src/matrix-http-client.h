@@ -21,6 +21,11 @@
 
 # include <glib-object.h>
 # include "matrix-http-api.h"
+# include "matrix-event-store.h"
+# include "matrix-search-index.h"
+# include "matrix-relation-index.h"
+# include "matrix-push-rules.h"
+# include "matrix-invite-preview.h"
 
 G_BEGIN_DECLS
 
@@ -33,6 +38,19 @@ struct _MatrixHTTPClientClass {
 
 MatrixHTTPClient* matrix_http_client_new(const gchar* base_url);
 gulong matrix_http_client_next_txn_id(MatrixHTTPClient *client);
+void matrix_http_client_set_event_store(MatrixHTTPClient *client, MatrixEventStore *event_store);
+MatrixEventStore *matrix_http_client_get_event_store(MatrixHTTPClient *client);
+void matrix_http_client_set_search_index(MatrixHTTPClient *client, MatrixSearchIndex *search_index);
+MatrixSearchIndex *matrix_http_client_get_search_index(MatrixHTTPClient *client);
+void matrix_http_client_set_relation_index(MatrixHTTPClient *client, MatrixRelationIndex *relation_index);
+MatrixRelationIndex *matrix_http_client_get_relation_index(MatrixHTTPClient *client);
+void matrix_http_client_set_push_rules(MatrixHTTPClient *client, MatrixPushRules *push_rules);
+MatrixPushRules *matrix_http_client_get_push_rules(MatrixHTTPClient *client);
+void matrix_http_client_set_timeline_capacity(MatrixHTTPClient *client, guint capacity);
+guint matrix_http_client_get_timeline_capacity(MatrixHTTPClient *client);
+MatrixInvitePreview *matrix_http_client_get_invite(MatrixHTTPClient *client, const gchar *room_id);
+GList *matrix_http_client_get_invites(MatrixHTTPClient *client);
+void matrix_http_client_hydrate_room_state(MatrixHTTPClient *client, const gchar **room_ids, int n_room_ids, guint max_requests);
 
 G_END_DECLS
 
@@ -0,0 +1,309 @@
+/*
+ * This file is part of matrix-glib-sdk
+ *
+ * matrix-glib-sdk is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * matrix-glib-sdk is distributed in the hope that it will be
+ * useful, but WITHOUT ANY WARRANTY; without even the implied
+ * warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with matrix-glib-sdk. If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#include "matrix-invite-preview.h"
+#include "matrix-enumtypes.h"
+#include "utils.h"
+
+/**
+ * SECTION:matrix-invite-preview
+ * @short_description: summary of a room we are invited to
+ * @title: invite previews
+ *
+ * #MatrixInvitePreview holds what can be shown about a room before joining it, as found in
+ * the stripped state events sent with an invite: the room’s name, avatar, canonical alias
+ * and join rules, and who sent the invite.  It is much smaller than a #MatrixRoom, so it can
+ * be kept for any number of pending invites.
+ */
+
+/**
+ * MatrixInvitePreview: (ref-func matrix_invite_preview_ref) (unref-func matrix_invite_preview_unref)
+ *
+ * A preview of a room we are invited to.
+ */
+struct _MatrixInvitePreview {
+    gchar *room_id;
+    gchar *name;
+    gchar *avatar_url;
+    gchar *canonical_alias;
+    MatrixJoinRules join_rules;
+    gchar *inviter;
+    gboolean is_direct;
+
+    volatile int refcount;
+};
+G_DEFINE_BOXED_TYPE(MatrixInvitePreview, matrix_invite_preview, (GBoxedCopyFunc)matrix_invite_preview_ref, (GBoxedFreeFunc)matrix_invite_preview_unref);
+
+/**
+ * matrix_invite_preview_new:
+ * @room_id: the ID of the room
+ *
+ * Create a new, empty #MatrixInvitePreview with a reference count of 1.
+ *
+ * Returns: (transfer full): a new #MatrixInvitePreview
+ */
+MatrixInvitePreview *
+matrix_invite_preview_new(const gchar *room_id)
+{
+    MatrixInvitePreview *ret;
+
+    g_return_val_if_fail(room_id != NULL, NULL);
+
+    ret = g_new0(MatrixInvitePreview, 1);
+    ret->refcount = 1;
+    ret->room_id = g_strdup(room_id);
+    ret->join_rules = MATRIX_JOIN_RULES_UNKNOWN;
+
+    return ret;
+}
+
+/**
+ * matrix_invite_preview_ref:
+ * @preview: a #MatrixInvitePreview
+ *
+ * Increment reference count on @preview.
+ *
+ * Returns: (transfer full): @preview
+ */
+MatrixInvitePreview *
+matrix_invite_preview_ref(MatrixInvitePreview *matrix_invite_preview)
+{
+    g_return_val_if_fail(matrix_invite_preview != NULL, NULL);
+
+    matrix_invite_preview->refcount++;
+
+    return matrix_invite_preview;
+}
+
+/**
+ * matrix_invite_preview_unref:
+ * @preview: (transfer full): a #MatrixInvitePreview
+ *
+ * Decrement reference count on @preview.  If reference count reaches zero, the object is
+ * freed.
+ */
+void
+matrix_invite_preview_unref(MatrixInvitePreview *matrix_invite_preview)
+{
+    g_return_if_fail(matrix_invite_preview != NULL);
+
+    if (--(matrix_invite_preview->refcount) == 0) {
+        g_free(matrix_invite_preview->room_id);
+        g_free(matrix_invite_preview->name);
+        g_free(matrix_invite_preview->avatar_url);
+        g_free(matrix_invite_preview->canonical_alias);
+        g_free(matrix_invite_preview->inviter);
+        g_free(matrix_invite_preview);
+    }
+}
+
+static const gchar *
+matrix_invite_preview_get_string(JsonObject *object, const gchar *member_name)
+{
+    JsonNode *node;
+
+    if (((node = json_object_get_member(object, member_name)) == NULL)
+        || (json_node_get_value_type(node) != G_TYPE_STRING)) {
+        return NULL;
+    }
+
+    return json_node_get_string(node);
+}
+
+static void
+matrix_invite_preview_set_string(gchar **field, const gchar *value)
+{
+    g_free(*field);
+    *field = g_strdup(value);
+}
+
+/**
+ * matrix_invite_preview_update:
+ * @preview: a #MatrixInvitePreview
+ * @event: a stripped state event from the invite_state of a room
+ * @user_id: (nullable): our own user ID
+ *
+ * Update @preview from @event.  Only the state events that are allowed to be stripped (see
+ * matrix_event_state_get_stripped_node()) are used, along with our own membership event,
+ * which tells who invited us.
+ *
+ * Returns: %TRUE if @event was used
+ */
+gboolean
+matrix_invite_preview_update(MatrixInvitePreview *matrix_invite_preview, JsonNode *event, const gchar *user_id)
+{
+    JsonObject *root;
+    JsonObject *content;
+    JsonNode *node;
+    const gchar *event_type;
+    const gchar *state_key;
+
+    g_return_val_if_fail(matrix_invite_preview != NULL, FALSE);
+    g_return_val_if_fail(event != NULL, FALSE);
+
+    if (json_node_get_node_type(event) != JSON_NODE_OBJECT) {
+        return FALSE;
+    }
+
+    root = json_node_get_object(event);
+
+    if (((event_type = matrix_invite_preview_get_string(root, "type")) == NULL)
+        || ((state_key = matrix_invite_preview_get_string(root, "state_key")) == NULL)
+        || ((node = json_object_get_member(root, "content")) == NULL)
+        || (json_node_get_node_type(node) != JSON_NODE_OBJECT)) {
+        return FALSE;
+    }
+
+    content = json_node_get_object(node);
+
+    if (g_strcmp0(event_type, "m.room.name") == 0) {
+        matrix_invite_preview_set_string(&(matrix_invite_preview->name),
+                                         matrix_invite_preview_get_string(content, "name"));
+    } else if (g_strcmp0(event_type, "m.room.avatar") == 0) {
+        matrix_invite_preview_set_string(&(matrix_invite_preview->avatar_url),
+                                         matrix_invite_preview_get_string(content, "url"));
+    } else if (g_strcmp0(event_type, "m.room.canonical_alias") == 0) {
+        matrix_invite_preview_set_string(&(matrix_invite_preview->canonical_alias),
+                                         matrix_invite_preview_get_string(content, "alias"));
+    } else if (g_strcmp0(event_type, "m.room.join_rules") == 0) {
+        const gchar *join_rule = matrix_invite_preview_get_string(content, "join_rule");
+        GError *inner_error = NULL;
+        MatrixJoinRules join_rules = MATRIX_JOIN_RULES_UNKNOWN;
+
+        if (join_rule != NULL) {
+            join_rules = _matrix_g_enum_nick_to_value(MATRIX_TYPE_JOIN_RULES, join_rule, &inner_error);
+        }
+
+        if (inner_error != NULL) {
+            g_clear_error(&inner_error);
+            join_rules = MATRIX_JOIN_RULES_UNKNOWN;
+        }
+
+        matrix_invite_preview->join_rules = join_rules;
+    } else if ((g_strcmp0(event_type, "m.room.member") == 0)
+               && (user_id != NULL)
+               && (g_strcmp0(state_key, user_id) == 0)) {
+        matrix_invite_preview_set_string(&(matrix_invite_preview->inviter),
+                                         matrix_invite_preview_get_string(root, "sender"));
+        matrix_invite_preview->is_direct = ((node = json_object_get_member(content, "is_direct")) != NULL)
+            && (json_node_get_value_type(node) == G_TYPE_BOOLEAN)
+            && json_node_get_boolean(node);
+    } else {
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+/**
+ * matrix_invite_preview_get_room_id:
+ * @preview: a #MatrixInvitePreview
+ *
+ * Returns: (transfer none): the ID of the room
+ */
+const gchar *
+matrix_invite_preview_get_room_id(MatrixInvitePreview *matrix_invite_preview)
+{
+    g_return_val_if_fail(matrix_invite_preview != NULL, NULL);
+
+    return matrix_invite_preview->room_id;
+}
+
+/**
+ * matrix_invite_preview_get_name:
+ * @preview: a #MatrixInvitePreview
+ *
+ * Returns: (transfer none) (nullable): the name of the room
+ */
+const gchar *
+matrix_invite_preview_get_name(MatrixInvitePreview *matrix_invite_preview)
+{
+    g_return_val_if_fail(matrix_invite_preview != NULL, NULL);
+
+    return matrix_invite_preview->name;
+}
+
+/**
+ * matrix_invite_preview_get_avatar_url:
+ * @preview: a #MatrixInvitePreview
+ *
+ * Returns: (transfer none) (nullable): the URL of the room’s avatar
+ */
+const gchar *
+matrix_invite_preview_get_avatar_url(MatrixInvitePreview *matrix_invite_preview)
+{
+    g_return_val_if_fail(matrix_invite_preview != NULL, NULL);
+
+    return matrix_invite_preview->avatar_url;
+}
+
+/**
+ * matrix_invite_preview_get_canonical_alias:
+ * @preview: a #MatrixInvitePreview
+ *
+ * Returns: (transfer none) (nullable): the canonical alias of the room
+ */
+const gchar *
+matrix_invite_preview_get_canonical_alias(MatrixInvitePreview *matrix_invite_preview)
+{
+    g_return_val_if_fail(matrix_invite_preview != NULL, NULL);
+
+    return matrix_invite_preview->canonical_alias;
+}
+
+/**
+ * matrix_invite_preview_get_join_rules:
+ * @preview: a #MatrixInvitePreview
+ *
+ * Returns: the join rules of the room, or %MATRIX_JOIN_RULES_UNKNOWN if they were not sent
+ */
+MatrixJoinRules
+matrix_invite_preview_get_join_rules(MatrixInvitePreview *matrix_invite_preview)
+{
+    g_return_val_if_fail(matrix_invite_preview != NULL, MATRIX_JOIN_RULES_UNKNOWN);
+
+    return matrix_invite_preview->join_rules;
+}
+
+/**
+ * matrix_invite_preview_get_inviter:
+ * @preview: a #MatrixInvitePreview
+ *
+ * Returns: (transfer none) (nullable): the user ID of the user who sent the invite
+ */
+const gchar *
+matrix_invite_preview_get_inviter(MatrixInvitePreview *matrix_invite_preview)
+{
+    g_return_val_if_fail(matrix_invite_preview != NULL, NULL);
+
+    return matrix_invite_preview->inviter;
+}
+
+/**
+ * matrix_invite_preview_get_is_direct:
+ * @preview: a #MatrixInvitePreview
+ *
+ * Returns: %TRUE if the invite is for a direct chat
+ */
+gboolean
+matrix_invite_preview_get_is_direct(MatrixInvitePreview *matrix_invite_preview)
+{
+    g_return_val_if_fail(matrix_invite_preview != NULL, FALSE);
+
+    return matrix_invite_preview->is_direct;
+}
@@ -0,0 +1,47 @@
+/*
+ * This file is part of matrix-glib-sdk
+ *
+ * matrix-glib-sdk is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * matrix-glib-sdk is distributed in the hope that it will be
+ * useful, but WITHOUT ANY WARRANTY; without even the implied
+ * warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with matrix-glib-sdk. If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __MATRIX_GLIB_SDK_INVITE_PREVIEW_H__
+# define __MATRIX_GLIB_SDK_INVITE_PREVIEW_H__
+
+# include <glib-object.h>
+# include <json-glib/json-glib.h>
+# include "matrix-types.h"
+
+G_BEGIN_DECLS
+
+typedef struct _MatrixInvitePreview MatrixInvitePreview;
+
+GType matrix_invite_preview_get_type(void);
+# define MATRIX_TYPE_INVITE_PREVIEW matrix_invite_preview_get_type()
+
+MatrixInvitePreview *matrix_invite_preview_new(const gchar *room_id);
+MatrixInvitePreview *matrix_invite_preview_ref(MatrixInvitePreview *preview);
+void matrix_invite_preview_unref(MatrixInvitePreview *preview);
+gboolean matrix_invite_preview_update(MatrixInvitePreview *preview, JsonNode *event, const gchar *user_id);
+const gchar *matrix_invite_preview_get_room_id(MatrixInvitePreview *preview);
+const gchar *matrix_invite_preview_get_name(MatrixInvitePreview *preview);
+const gchar *matrix_invite_preview_get_avatar_url(MatrixInvitePreview *preview);
+const gchar *matrix_invite_preview_get_canonical_alias(MatrixInvitePreview *preview);
+MatrixJoinRules matrix_invite_preview_get_join_rules(MatrixInvitePreview *preview);
+const gchar *matrix_invite_preview_get_inviter(MatrixInvitePreview *preview);
+gboolean matrix_invite_preview_get_is_direct(MatrixInvitePreview *preview);
+
+G_END_DECLS
+
+#endif  /* __MATRIX_GLIB_SDK_INVITE_PREVIEW_H__ */
@@ -0,0 +1,1270 @@
+/*
+ * This file is part of matrix-glib-sdk
+ *
+ * matrix-glib-sdk is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * matrix-glib-sdk is distributed in the hope that it will be
+ * useful, but WITHOUT ANY WARRANTY; without even the implied
+ * warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with matrix-glib-sdk. If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#include "matrix-json-writer.h"
+#include "matrix-types.h"
+#include <string.h>
+#include <math.h>
+
+/**
+ * SECTION:matrix-json-writer
+ * @short_description: append-only JSON serializer
+ * @title: JSON writer
+ *
+ * #MatrixJsonWriter serializes JSON directly into a growing memory buffer, without building
+ * an intermediate #JsonNode tree first.  Its API mirrors that of #JsonBuilder: objects and
+ * arrays are opened and closed with the begin/end functions, object members are named with
+ * matrix_json_writer_set_member_name() before adding their value.
+ *
+ * The finished buffer can be taken over with matrix_json_writer_free_to_bytes(), which doesn’t
+ * copy the serialized data.
+ *
+ * Writers created with matrix_json_writer_new_binary() produce a compact binary encoding of
+ * the same data instead of JSON text, suitable for local persistence or passing events between
+ * processes.  It is a tag-length-value layout, where object member names are interned: common
+ * Matrix keys are replaced by a small index, and other keys are only written in full the first
+ * time they appear.  Binary data can be turned back into JSON with
+ * matrix_json_writer_add_binary() or matrix_json_binary_to_node(), without any loss.
+ */
+
+/**
+ * MatrixJsonWriter:
+ *
+ * An opaque structure holding a JSON writer.
+ */
+struct _MatrixJsonWriter {
+    GString *buffer;
+
+    /* One entry for every open object or array; TRUE if a separator is needed before the
+     * next value */
+    GArray *need_comma;
+
+    /* TRUE if a member name was written, but its value was not yet */
+    gboolean after_member_name;
+
+    /* TRUE if this writer produces the binary encoding */
+    gboolean binary;
+
+    /* Member names interned by this writer, beyond the well known ones */
+    GHashTable *keys;
+
+    /* For writers created with matrix_json_writer_new_for_member(): the name of the only member
+     * of the root object that is kept, the buffer receiving its value, and a scratch buffer for
+     * everything else.  buffer points to one of the two, depending on what is being written. */
+    gchar *only_member;
+    GString *output;
+    GString *discard;
+};
+
+#define MATRIX_JSON_WRITER_DEFAULT_SIZE 256
+
+/*
+ * The binary encoding starts with a magic string and a version byte, followed by exactly one
+ * value.  Every value starts with a tag byte.  Integers and lengths are stored as unsigned
+ * LEB128 varints, signed integers are zigzag encoded, and doubles are stored as 8 little
+ * endian bytes.
+ *
+ * Object members are a key code followed by the value.  Key code 0 closes the object, 1 is
+ * followed by a literal key (varint length and UTF-8 data) which is then added to the key
+ * table, while any other code refers to entry (code - 2) of the key table.  The key table
+ * starts with matrix_json_binary_keys, so the order of that list must never change.
+ *
+ * Arrays hold values until a BINARY_TAG_END tag.
+ */
+#define MATRIX_JSON_BINARY_MAGIC "MXB"
+#define MATRIX_JSON_BINARY_VERSION 1
+#define MATRIX_JSON_BINARY_HEADER_LEN 4
+#define MATRIX_JSON_BINARY_MAX_DEPTH 256
+
+enum {
+    BINARY_TAG_NULL = 0,
+    BINARY_TAG_FALSE,
+    BINARY_TAG_TRUE,
+    BINARY_TAG_INT,
+    BINARY_TAG_DOUBLE,
+    BINARY_TAG_STRING,
+    BINARY_TAG_OBJECT,
+    BINARY_TAG_ARRAY,
+    BINARY_TAG_END
+};
+
+enum {
+    BINARY_KEY_END = 0,
+    BINARY_KEY_LITERAL,
+    BINARY_KEY_FIRST_INDEX
+};
+
+static const gchar *matrix_json_binary_keys[] = {
+    "type", "content", "event_id", "room_id", "sender", "state_key", "origin_server_ts",
+    "unsigned", "age", "prev_content", "redacted_because", "transaction_id", "redacts",
+    "membership", "displayname", "avatar_url", "body", "msgtype", "format", "formatted_body",
+    "url", "info", "mimetype", "size", "w", "h", "duration", "thumbnail_url", "thumbnail_info",
+    "name", "topic", "alias", "aliases", "join_rule", "history_visibility", "guest_access",
+    "creator", "users", "users_default", "events", "events_default", "state_default", "ban",
+    "kick", "redact", "invite", "user_id", "user_ids", "event_ids", "presence",
+    "last_active_ago", "currently_active", "tags", "order", "call_id", "version", "lifetime",
+    "offer", "answer", "candidates", "sdp", "sdpMid", "sdpMLineIndex", "candidate", "reason",
+    "third_party_invite", "signed", "mxid", "token", "signatures", "public_key", "public_keys",
+    "key_validity_url", "display_name", "invite_room_state", "m.read", "ts", "m.relates_to",
+    "rel_type", "key", "geo_uri", "file", "m.federate",
+};
+
+static GHashTable *
+matrix_json_binary_get_static_keys(void)
+{
+    static gsize initialised = 0;
+    static GHashTable *static_keys = NULL;
+
+    if (g_once_init_enter(&initialised)) {
+        guint i;
+
+        static_keys = g_hash_table_new(g_str_hash, g_str_equal);
+
+        for (i = 0; i < G_N_ELEMENTS(matrix_json_binary_keys); i++) {
+            g_hash_table_insert(static_keys, (gpointer)matrix_json_binary_keys[i], GUINT_TO_POINTER(i + 1));
+        }
+
+        g_once_init_leave(&initialised, 1);
+    }
+
+    return static_keys;
+}
+
+/**
+ * matrix_json_writer_new:
+ *
+ * Create a new, empty #MatrixJsonWriter.
+ *
+ * Returns: (transfer full): a new #MatrixJsonWriter.  Free it with
+ *     matrix_json_writer_free() or matrix_json_writer_free_to_bytes()
+ */
+MatrixJsonWriter *
+matrix_json_writer_new(void)
+{
+    return matrix_json_writer_new_sized(MATRIX_JSON_WRITER_DEFAULT_SIZE);
+}
+
+/**
+ * matrix_json_writer_new_sized:
+ * @reserved_size: the number of bytes to preallocate
+ *
+ * Create a new, empty #MatrixJsonWriter with @reserved_size bytes preallocated for the
+ * output.  Use this if the size of the output can be estimated, so the buffer doesn’t have to
+ * be reallocated while writing.
+ *
+ * Returns: (transfer full): a new #MatrixJsonWriter.  Free it with
+ *     matrix_json_writer_free() or matrix_json_writer_free_to_bytes()
+ */
+MatrixJsonWriter *
+matrix_json_writer_new_sized(gsize reserved_size)
+{
+    MatrixJsonWriter *ret = g_new0(MatrixJsonWriter, 1);
+
+    ret->buffer = g_string_sized_new(reserved_size);
+    ret->need_comma = g_array_sized_new(FALSE, FALSE, sizeof(gboolean), 8);
+    ret->after_member_name = FALSE;
+
+    return ret;
+}
+
+/**
+ * matrix_json_writer_new_binary:
+ *
+ * Create a new, empty #MatrixJsonWriter that produces the compact binary encoding instead of
+ * JSON text.
+ *
+ * Returns: (transfer full): a new #MatrixJsonWriter.  Free it with
+ *     matrix_json_writer_free() or matrix_json_writer_free_to_bytes()
+ */
+MatrixJsonWriter *
+matrix_json_writer_new_binary(void)
+{
+    MatrixJsonWriter *ret = matrix_json_writer_new();
+
+    ret->binary = TRUE;
+    g_string_append_len(ret->buffer, MATRIX_JSON_BINARY_MAGIC, 3);
+    g_string_append_c(ret->buffer, MATRIX_JSON_BINARY_VERSION);
+
+    return ret;
+}
+
+/**
+ * matrix_json_writer_new_for_member:
+ * @member_name: the name of the member to keep
+ *
+ * Create a new, empty #MatrixJsonWriter that keeps only the value of the @member_name member
+ * of the root object, and drops everything else.  This makes it possible to write only a part
+ * of an object (like the content of an event) with code that serializes the whole object.
+ *
+ * If the root value is not an object, or it has no @member_name member, the output will be
+ * empty.
+ *
+ * Returns: (transfer full): a new #MatrixJsonWriter.  Free it with
+ *     matrix_json_writer_free() or matrix_json_writer_free_to_bytes()
+ */
+MatrixJsonWriter *
+matrix_json_writer_new_for_member(const gchar *member_name)
+{
+    MatrixJsonWriter *ret;
+
+    g_return_val_if_fail(member_name != NULL, NULL);
+
+    ret = matrix_json_writer_new();
+    ret->only_member = g_strdup(member_name);
+    ret->output = ret->buffer;
+    ret->discard = g_string_new(NULL);
+    ret->buffer = ret->discard;
+
+    return ret;
+}
+
+/**
+ * matrix_json_writer_free:
+ * @writer: (nullable): a #MatrixJsonWriter
+ *
+ * Free @writer, and all the data it wrote.
+ */
+void
+matrix_json_writer_free(MatrixJsonWriter *matrix_json_writer)
+{
+    if (matrix_json_writer == NULL) {
+        return;
+    }
+
+    if (matrix_json_writer->only_member != NULL) {
+        g_string_free(matrix_json_writer->output, TRUE);
+        g_string_free(matrix_json_writer->discard, TRUE);
+        g_free(matrix_json_writer->only_member);
+    } else {
+        g_string_free(matrix_json_writer->buffer, TRUE);
+    }
+
+    g_array_free(matrix_json_writer->need_comma, TRUE);
+    g_clear_pointer(&(matrix_json_writer->keys), g_hash_table_unref);
+    g_free(matrix_json_writer);
+}
+
+/**
+ * matrix_json_writer_free_to_bytes:
+ * @writer: (transfer full): a #MatrixJsonWriter
+ *
+ * Free @writer, and return the data it wrote as a #GBytes.  The data is not copied.
+ *
+ * All objects and arrays must be closed before calling this function.
+ *
+ * Returns: (transfer full): the serialized JSON data
+ */
+GBytes *
+matrix_json_writer_free_to_bytes(MatrixJsonWriter *matrix_json_writer)
+{
+    GBytes *ret;
+
+    g_return_val_if_fail(matrix_json_writer != NULL, NULL);
+
+    if (matrix_json_writer->need_comma->len > 0) {
+        g_warning("JSON writer freed with %u unclosed containers", matrix_json_writer->need_comma->len);
+    }
+
+    if (matrix_json_writer->only_member != NULL) {
+        ret = g_string_free_to_bytes(matrix_json_writer->output);
+        g_string_free(matrix_json_writer->discard, TRUE);
+        g_free(matrix_json_writer->only_member);
+    } else {
+        ret = g_string_free_to_bytes(matrix_json_writer->buffer);
+    }
+
+    g_array_free(matrix_json_writer->need_comma, TRUE);
+    g_clear_pointer(&(matrix_json_writer->keys), g_hash_table_unref);
+    g_free(matrix_json_writer);
+
+    return ret;
+}
+
+/*
+ * Emit a separator if needed before writing a new value (or member name) to the current
+ * container.
+ */
+static void
+matrix_json_writer_begin_value(MatrixJsonWriter *matrix_json_writer)
+{
+    gboolean *need_comma;
+
+    if (matrix_json_writer->after_member_name) {
+        matrix_json_writer->after_member_name = FALSE;
+
+        return;
+    }
+
+    if (matrix_json_writer->binary || (matrix_json_writer->need_comma->len == 0)) {
+        return;
+    }
+
+    need_comma = &g_array_index(matrix_json_writer->need_comma,
+                                gboolean,
+                                matrix_json_writer->need_comma->len - 1);
+
+    if (*need_comma) {
+        g_string_append_c(matrix_json_writer->buffer, ',');
+    }
+
+    *need_comma = TRUE;
+}
+
+static void
+matrix_json_writer_write_varint(MatrixJsonWriter *matrix_json_writer, guint64 value)
+{
+    while (value >= 0x80) {
+        g_string_append_c(matrix_json_writer->buffer, (gchar)((value & 0x7f) | 0x80));
+        value >>= 7;
+    }
+
+    g_string_append_c(matrix_json_writer->buffer, (gchar)value);
+}
+
+static void
+matrix_json_writer_write_binary_key(MatrixJsonWriter *matrix_json_writer, const gchar *key)
+{
+    gpointer index;
+    gsize len;
+
+    if ((index = g_hash_table_lookup(matrix_json_binary_get_static_keys(), key)) != NULL) {
+        matrix_json_writer_write_varint(matrix_json_writer, GPOINTER_TO_UINT(index) - 1 + BINARY_KEY_FIRST_INDEX);
+
+        return;
+    }
+
+    if (matrix_json_writer->keys == NULL) {
+        matrix_json_writer->keys = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+    } else if ((index = g_hash_table_lookup(matrix_json_writer->keys, key)) != NULL) {
+        matrix_json_writer_write_varint(matrix_json_writer, GPOINTER_TO_UINT(index) - 1 + BINARY_KEY_FIRST_INDEX);
+
+        return;
+    }
+
+    g_hash_table_insert(matrix_json_writer->keys,
+                        g_strdup(key),
+                        GUINT_TO_POINTER(G_N_ELEMENTS(matrix_json_binary_keys) + g_hash_table_size(matrix_json_writer->keys) + 1));
+
+    len = strlen(key);
+    matrix_json_writer_write_varint(matrix_json_writer, BINARY_KEY_LITERAL);
+    matrix_json_writer_write_varint(matrix_json_writer, len);
+    g_string_append_len(matrix_json_writer->buffer, key, len);
+}
+
+static void
+matrix_json_writer_write_string(MatrixJsonWriter *matrix_json_writer, const gchar *str)
+{
+    GString *buffer = matrix_json_writer->buffer;
+    const gchar *run_start = str;
+    const gchar *p;
+
+    g_string_append_c(buffer, '"');
+
+    for (p = str; *p != 0; p++) {
+        guchar c = (guchar)*p;
+        const gchar *escape;
+
+        if ((c >= 0x20) && (c != '"') && (c != '\\')) {
+            continue;
+        }
+
+        g_string_append_len(buffer, run_start, p - run_start);
+        run_start = p + 1;
+
+        switch (c) {
+            case '"':
+                escape = "\\\"";
+
+                break;
+            case '\\':
+                escape = "\\\\";
+
+                break;
+            case '\b':
+                escape = "\\b";
+
+                break;
+            case '\f':
+                escape = "\\f";
+
+                break;
+            case '\n':
+                escape = "\\n";
+
+                break;
+            case '\r':
+                escape = "\\r";
+
+                break;
+            case '\t':
+                escape = "\\t";
+
+                break;
+            default:
+                escape = NULL;
+                g_string_append_printf(buffer, "\\u%04x", c);
+
+                break;
+        }
+
+        if (escape != NULL) {
+            g_string_append(buffer, escape);
+        }
+    }
+
+    g_string_append_len(buffer, run_start, p - run_start);
+    g_string_append_c(buffer, '"');
+}
+
+/**
+ * matrix_json_writer_begin_object:
+ * @writer: a #MatrixJsonWriter
+ *
+ * Open a new JSON object.
+ */
+void
+matrix_json_writer_begin_object(MatrixJsonWriter *matrix_json_writer)
+{
+    gboolean need_comma = FALSE;
+
+    g_return_if_fail(matrix_json_writer != NULL);
+
+    matrix_json_writer_begin_value(matrix_json_writer);
+    g_string_append_c(matrix_json_writer->buffer, (matrix_json_writer->binary) ? BINARY_TAG_OBJECT : '{');
+    g_array_append_val(matrix_json_writer->need_comma, need_comma);
+}
+
+/**
+ * matrix_json_writer_end_object:
+ * @writer: a #MatrixJsonWriter
+ *
+ * Close the currently open JSON object.
+ */
+void
+matrix_json_writer_end_object(MatrixJsonWriter *matrix_json_writer)
+{
+    g_return_if_fail(matrix_json_writer != NULL);
+    g_return_if_fail(matrix_json_writer->need_comma->len > 0);
+    g_return_if_fail(!matrix_json_writer->after_member_name);
+
+    // Whatever comes after the root object is not kept
+    if ((matrix_json_writer->only_member != NULL) && (matrix_json_writer->need_comma->len == 1)) {
+        matrix_json_writer->buffer = matrix_json_writer->discard;
+    }
+
+    g_array_set_size(matrix_json_writer->need_comma, matrix_json_writer->need_comma->len - 1);
+
+    if (matrix_json_writer->binary) {
+        matrix_json_writer_write_varint(matrix_json_writer, BINARY_KEY_END);
+    } else {
+        g_string_append_c(matrix_json_writer->buffer, '}');
+    }
+}
+
+/**
+ * matrix_json_writer_begin_array:
+ * @writer: a #MatrixJsonWriter
+ *
+ * Open a new JSON array.
+ */
+void
+matrix_json_writer_begin_array(MatrixJsonWriter *matrix_json_writer)
+{
+    gboolean need_comma = FALSE;
+
+    g_return_if_fail(matrix_json_writer != NULL);
+
+    matrix_json_writer_begin_value(matrix_json_writer);
+    g_string_append_c(matrix_json_writer->buffer, (matrix_json_writer->binary) ? BINARY_TAG_ARRAY : '[');
+    g_array_append_val(matrix_json_writer->need_comma, need_comma);
+}
+
+/**
+ * matrix_json_writer_end_array:
+ * @writer: a #MatrixJsonWriter
+ *
+ * Close the currently open JSON array.
+ */
+void
+matrix_json_writer_end_array(MatrixJsonWriter *matrix_json_writer)
+{
+    g_return_if_fail(matrix_json_writer != NULL);
+    g_return_if_fail(matrix_json_writer->need_comma->len > 0);
+
+    g_array_set_size(matrix_json_writer->need_comma, matrix_json_writer->need_comma->len - 1);
+    g_string_append_c(matrix_json_writer->buffer, (matrix_json_writer->binary) ? BINARY_TAG_END : ']');
+}
+
+/**
+ * matrix_json_writer_set_member_name:
+ * @writer: a #MatrixJsonWriter
+ * @member_name: the name of the next member
+ *
+ * Set the name of the next member of the currently open object.  The next value added will be
+ * the value of this member.
+ */
+void
+matrix_json_writer_set_member_name(MatrixJsonWriter *matrix_json_writer, const gchar *member_name)
+{
+    g_return_if_fail(matrix_json_writer != NULL);
+    g_return_if_fail(member_name != NULL);
+    g_return_if_fail(matrix_json_writer->need_comma->len > 0);
+    g_return_if_fail(!matrix_json_writer->after_member_name);
+
+    // Members of the root object are dropped, except the value of the one to keep
+    if ((matrix_json_writer->only_member != NULL) && (matrix_json_writer->need_comma->len == 1)) {
+        matrix_json_writer->buffer = matrix_json_writer->discard;
+        g_string_truncate(matrix_json_writer->discard, 0);
+    }
+
+    matrix_json_writer_begin_value(matrix_json_writer);
+
+    if (matrix_json_writer->binary) {
+        matrix_json_writer_write_binary_key(matrix_json_writer, member_name);
+    } else {
+        matrix_json_writer_write_string(matrix_json_writer, member_name);
+        g_string_append_c(matrix_json_writer->buffer, ':');
+    }
+
+    matrix_json_writer->after_member_name = TRUE;
+
+    if ((matrix_json_writer->only_member != NULL)
+        && (matrix_json_writer->need_comma->len == 1)
+        && (matrix_json_writer->output->len == 0)
+        && (strcmp(member_name, matrix_json_writer->only_member) == 0)) {
+        matrix_json_writer->buffer = matrix_json_writer->output;
+    }
+}
+
+/**
+ * matrix_json_writer_add_string_value:
+ * @writer: a #MatrixJsonWriter
+ * @value: (nullable): a string value
+ *
+ * Add a string value.  If @value is %NULL, a JSON null is written instead.
+ */
+void
+matrix_json_writer_add_string_value(MatrixJsonWriter *matrix_json_writer, const gchar *value)
+{
+    g_return_if_fail(matrix_json_writer != NULL);
+
+    if (value == NULL) {
+        matrix_json_writer_add_null_value(matrix_json_writer);
+
+        return;
+    }
+
+    matrix_json_writer_begin_value(matrix_json_writer);
+
+    if (matrix_json_writer->binary) {
+        gsize len = strlen(value);
+
+        g_string_append_c(matrix_json_writer->buffer, BINARY_TAG_STRING);
+        matrix_json_writer_write_varint(matrix_json_writer, len);
+        g_string_append_len(matrix_json_writer->buffer, value, len);
+    } else {
+        matrix_json_writer_write_string(matrix_json_writer, value);
+    }
+}
+
+/**
+ * matrix_json_writer_add_int_value:
+ * @writer: a #MatrixJsonWriter
+ * @value: an integer value
+ *
+ * Add an integer value.
+ */
+void
+matrix_json_writer_add_int_value(MatrixJsonWriter *matrix_json_writer, gint64 value)
+{
+    g_return_if_fail(matrix_json_writer != NULL);
+
+    matrix_json_writer_begin_value(matrix_json_writer);
+
+    if (matrix_json_writer->binary) {
+        g_string_append_c(matrix_json_writer->buffer, BINARY_TAG_INT);
+        matrix_json_writer_write_varint(matrix_json_writer, ((guint64)value << 1) ^ (guint64)(value >> 63));
+    } else {
+        g_string_append_printf(matrix_json_writer->buffer, "%" G_GINT64_FORMAT, value);
+    }
+}
+
+/**
+ * matrix_json_writer_add_double_value:
+ * @writer: a #MatrixJsonWriter
+ * @value: a floating point value
+ * @error: a #GError, or %NULL to ignore errors
+ *
+ * Add a floating point value.  It is formatted the same way as #JsonGenerator does, so it
+ * always has a decimal point or an exponent, even if it is integral (1.0 is written as `1.0`,
+ * not `1`).
+ *
+ * JSON can’t represent infinities and NaN.  For those, a JSON null is written instead, so the
+ * output remains well formed, and %MATRIX_ERROR_INVALID_FORMAT is returned.
+ *
+ * Returns: %TRUE if @value could be added
+ */
+gboolean
+matrix_json_writer_add_double_value(MatrixJsonWriter *matrix_json_writer, gdouble value, GError **error)
+{
+    gchar buf[G_ASCII_DTOSTR_BUF_SIZE];
+
+    g_return_val_if_fail(matrix_json_writer != NULL, FALSE);
+
+    if (!isfinite(value)) {
+        g_set_error(error, MATRIX_ERROR, MATRIX_ERROR_INVALID_FORMAT,
+                    "Can't write %s as a JSON number", (isnan(value)) ? "NaN" : "an infinity");
+        matrix_json_writer_add_null_value(matrix_json_writer);
+
+        return FALSE;
+    }
+
+    matrix_json_writer_begin_value(matrix_json_writer);
+
+    if (matrix_json_writer->binary) {
+        guint64 bits;
+
+        memcpy(&bits, &value, sizeof(bits));
+        bits = GUINT64_TO_LE(bits);
+
+        g_string_append_c(matrix_json_writer->buffer, BINARY_TAG_DOUBLE);
+        g_string_append_len(matrix_json_writer->buffer, (const gchar *)&bits, sizeof(bits));
+    } else {
+        g_ascii_dtostr(buf, sizeof(buf), value);
+        g_string_append(matrix_json_writer->buffer, buf);
+
+        // Keep the value a floating point one when it is read back
+        if (strpbrk(buf, ".eE") == NULL) {
+            g_string_append(matrix_json_writer->buffer, ".0");
+        }
+    }
+
+    return TRUE;
+}
+
+/**
+ * matrix_json_writer_add_boolean_value:
+ * @writer: a #MatrixJsonWriter
+ * @value: a boolean value
+ *
+ * Add a boolean value.
+ */
+void
+matrix_json_writer_add_boolean_value(MatrixJsonWriter *matrix_json_writer, gboolean value)
+{
+    g_return_if_fail(matrix_json_writer != NULL);
+
+    matrix_json_writer_begin_value(matrix_json_writer);
+
+    if (matrix_json_writer->binary) {
+        g_string_append_c(matrix_json_writer->buffer, (value) ? BINARY_TAG_TRUE : BINARY_TAG_FALSE);
+    } else {
+        g_string_append(matrix_json_writer->buffer, (value) ? "true" : "false");
+    }
+}
+
+/**
+ * matrix_json_writer_add_null_value:
+ * @writer: a #MatrixJsonWriter
+ *
+ * Add a JSON null.
+ */
+void
+matrix_json_writer_add_null_value(MatrixJsonWriter *matrix_json_writer)
+{
+    g_return_if_fail(matrix_json_writer != NULL);
+
+    matrix_json_writer_begin_value(matrix_json_writer);
+
+    if (matrix_json_writer->binary) {
+        g_string_append_c(matrix_json_writer->buffer, BINARY_TAG_NULL);
+    } else {
+        g_string_append(matrix_json_writer->buffer, "null");
+    }
+}
+
+/**
+ * matrix_json_writer_add_node:
+ * @writer: a #MatrixJsonWriter
+ * @node: (nullable): a #JsonNode
+ * @error: a #GError, or %NULL to ignore errors
+ *
+ * Serialize @node and all of its children.  If @node is %NULL, a JSON null is written.
+ *
+ * If @node holds a value that can’t be represented in JSON (see
+ * matrix_json_writer_add_double_value()), it is replaced by a JSON null, the rest of @node is
+ * still written, and the first such problem is returned in @error.
+ *
+ * Returns: %TRUE if @node could be serialized without changes
+ */
+gboolean
+matrix_json_writer_add_node(MatrixJsonWriter *matrix_json_writer, JsonNode *node, GError **error)
+{
+    gboolean ret = TRUE;
+
+    g_return_val_if_fail(matrix_json_writer != NULL, FALSE);
+
+    if (node == NULL) {
+        matrix_json_writer_add_null_value(matrix_json_writer);
+
+        return TRUE;
+    }
+
+    switch (json_node_get_node_type(node)) {
+        case JSON_NODE_OBJECT:
+        {
+            JsonObjectIter iter;
+            const gchar *member_name;
+            JsonNode *member_node;
+
+            matrix_json_writer_begin_object(matrix_json_writer);
+            json_object_iter_init(&iter, json_node_get_object(node));
+
+            while (json_object_iter_next(&iter, &member_name, &member_node)) {
+                matrix_json_writer_set_member_name(matrix_json_writer, member_name);
+
+                if (!matrix_json_writer_add_node(matrix_json_writer, member_node, (ret) ? error : NULL)) {
+                    ret = FALSE;
+                }
+            }
+
+            matrix_json_writer_end_object(matrix_json_writer);
+
+            break;
+        }
+        case JSON_NODE_ARRAY:
+        {
+            JsonArray *array = json_node_get_array(node);
+            guint len = json_array_get_length(array);
+            guint i;
+
+            matrix_json_writer_begin_array(matrix_json_writer);
+
+            for (i = 0; i < len; i++) {
+                if (!matrix_json_writer_add_node(matrix_json_writer, json_array_get_element(array, i), (ret) ? error : NULL)) {
+                    ret = FALSE;
+                }
+            }
+
+            matrix_json_writer_end_array(matrix_json_writer);
+
+            break;
+        }
+        case JSON_NODE_VALUE:
+            switch (json_node_get_value_type(node)) {
+                case G_TYPE_STRING:
+                    matrix_json_writer_add_string_value(matrix_json_writer, json_node_get_string(node));
+
+                    break;
+                case G_TYPE_INT64:
+                    matrix_json_writer_add_int_value(matrix_json_writer, json_node_get_int(node));
+
+                    break;
+                case G_TYPE_DOUBLE:
+                    ret = matrix_json_writer_add_double_value(matrix_json_writer, json_node_get_double(node), error);
+
+                    break;
+                case G_TYPE_BOOLEAN:
+                    matrix_json_writer_add_boolean_value(matrix_json_writer, json_node_get_boolean(node));
+
+                    break;
+                default:
+                    g_warning("Unsupported JSON value type %s", g_type_name(json_node_get_value_type(node)));
+                    matrix_json_writer_add_null_value(matrix_json_writer);
+
+                    break;
+            }
+
+            break;
+        case JSON_NODE_NULL:
+            matrix_json_writer_add_null_value(matrix_json_writer);
+
+            break;
+    }
+
+    return ret;
+}
+
+/*
+ * Receiver of the values decoded from the binary encoding.  This lets the same decoder feed
+ * a #MatrixJsonWriter (to transcode into JSON text) or a #JsonBuilder (to build a #JsonNode).
+ */
+typedef struct {
+    void (*begin_object)(gpointer target);
+    void (*end_object)(gpointer target);
+    void (*begin_array)(gpointer target);
+    void (*end_array)(gpointer target);
+    void (*member_name)(gpointer target, const gchar *name);
+    void (*string_value)(gpointer target, const gchar *value);
+    void (*int_value)(gpointer target, gint64 value);
+    void (*double_value)(gpointer target, gdouble value);
+    void (*boolean_value)(gpointer target, gboolean value);
+    void (*null_value)(gpointer target);
+} MatrixJsonBinarySink;
+
+typedef struct {
+    const guchar *data;
+    gsize len;
+    gsize pos;
+
+    /* Keys introduced literally in the data, in order of appearance */
+    GPtrArray *keys;
+
+    /* Scratch space to NUL terminate strings before passing them to the sink */
+    GString *scratch;
+
+    const MatrixJsonBinarySink *sink;
+    gpointer target;
+} MatrixJsonBinaryReader;
+
+static gboolean
+matrix_json_binary_read_byte(MatrixJsonBinaryReader *reader, guchar *byte, GError **error)
+{
+    if (reader->pos >= reader->len) {
+        g_set_error(error, MATRIX_ERROR, MATRIX_ERROR_INVALID_FORMAT,
+                    "Binary event data is truncated");
+
+        return FALSE;
+    }
+
+    *byte = reader->data[reader->pos++];
+
+    return TRUE;
+}
+
+static gboolean
+matrix_json_binary_read_varint(MatrixJsonBinaryReader *reader, guint64 *value, GError **error)
+{
+    guint shift;
+
+    *value = 0;
+
+    for (shift = 0; shift < 64; shift += 7) {
+        guchar byte;
+
+        if (!matrix_json_binary_read_byte(reader, &byte, error)) {
+            return FALSE;
+        }
+
+        *value |= (guint64)(byte & 0x7f) << shift;
+
+        if ((byte & 0x80) == 0) {
+            return TRUE;
+        }
+    }
+
+    g_set_error(error, MATRIX_ERROR, MATRIX_ERROR_INVALID_FORMAT,
+                "Binary event data contains an overlong integer");
+
+    return FALSE;
+}
+
+/*
+ * Read a length prefixed UTF-8 string into reader->scratch.
+ */
+static gboolean
+matrix_json_binary_read_string(MatrixJsonBinaryReader *reader, GError **error)
+{
+    guint64 len;
+
+    if (!matrix_json_binary_read_varint(reader, &len, error)) {
+        return FALSE;
+    }
+
+    if (len > reader->len - reader->pos) {
+        g_set_error(error, MATRIX_ERROR, MATRIX_ERROR_INVALID_FORMAT,
+                    "Binary event data is truncated");
+
+        return FALSE;
+    }
+
+    if (!g_utf8_validate((const gchar *)reader->data + reader->pos, len, NULL)) {
+        g_set_error(error, MATRIX_ERROR, MATRIX_ERROR_INVALID_FORMAT,
+                    "Binary event data contains an invalid string");
+
+        return FALSE;
+    }
+
+    g_string_truncate(reader->scratch, 0);
+    g_string_append_len(reader->scratch, (const gchar *)reader->data + reader->pos, len);
+    reader->pos += len;
+
+    return TRUE;
+}
+
+static gboolean
+matrix_json_binary_read_value(MatrixJsonBinaryReader *reader, guint depth, GError **error);
+
+static gboolean
+matrix_json_binary_read_object(MatrixJsonBinaryReader *reader, guint depth, GError **error)
+{
+    guint n_static = G_N_ELEMENTS(matrix_json_binary_keys);
+
+    reader->sink->begin_object(reader->target);
+
+    while (TRUE) {
+        guint64 code;
+        const gchar *key;
+
+        if (!matrix_json_binary_read_varint(reader, &code, error)) {
+            return FALSE;
+        }
+
+        if (code == BINARY_KEY_END) {
+            break;
+        }
+
+        if (code == BINARY_KEY_LITERAL) {
+            if (!matrix_json_binary_read_string(reader, error)) {
+                return FALSE;
+            }
+
+            key = g_strdup(reader->scratch->str);
+            g_ptr_array_add(reader->keys, (gpointer)key);
+        } else {
+            guint64 index = code - BINARY_KEY_FIRST_INDEX;
+
+            if (index < n_static) {
+                key = matrix_json_binary_keys[index];
+            } else if (index - n_static < reader->keys->len) {
+                key = g_ptr_array_index(reader->keys, index - n_static);
+            } else {
+                g_set_error(error, MATRIX_ERROR, MATRIX_ERROR_INVALID_FORMAT,
+                            "Binary event data refers to an unknown key");
+
+                return FALSE;
+            }
+        }
+
+        reader->sink->member_name(reader->target, key);
+
+        if (!matrix_json_binary_read_value(reader, depth, error)) {
+            return FALSE;
+        }
+    }
+
+    reader->sink->end_object(reader->target);
+
+    return TRUE;
+}
+
+static gboolean
+matrix_json_binary_read_array(MatrixJsonBinaryReader *reader, guint depth, GError **error)
+{
+    reader->sink->begin_array(reader->target);
+
+    while (TRUE) {
+        if (reader->pos >= reader->len) {
+            g_set_error(error, MATRIX_ERROR, MATRIX_ERROR_INVALID_FORMAT,
+                        "Binary event data is truncated");
+
+            return FALSE;
+        }
+
+        if (reader->data[reader->pos] == BINARY_TAG_END) {
+            reader->pos++;
+
+            break;
+        }
+
+        if (!matrix_json_binary_read_value(reader, depth, error)) {
+            return FALSE;
+        }
+    }
+
+    reader->sink->end_array(reader->target);
+
+    return TRUE;
+}
+
+static gboolean
+matrix_json_binary_read_value(MatrixJsonBinaryReader *reader, guint depth, GError **error)
+{
+    guchar tag;
+    guint64 raw;
+
+    if (!matrix_json_binary_read_byte(reader, &tag, error)) {
+        return FALSE;
+    }
+
+    switch (tag) {
+        case BINARY_TAG_NULL:
+            reader->sink->null_value(reader->target);
+
+            break;
+        case BINARY_TAG_FALSE:
+        case BINARY_TAG_TRUE:
+            reader->sink->boolean_value(reader->target, tag == BINARY_TAG_TRUE);
+
+            break;
+        case BINARY_TAG_INT:
+            if (!matrix_json_binary_read_varint(reader, &raw, error)) {
+                return FALSE;
+            }
+
+            reader->sink->int_value(reader->target, (gint64)(raw >> 1) ^ -(gint64)(raw & 1));
+
+            break;
+        case BINARY_TAG_DOUBLE:
+        {
+            gdouble value;
+
+            if (reader->len - reader->pos < sizeof(raw)) {
+                g_set_error(error, MATRIX_ERROR, MATRIX_ERROR_INVALID_FORMAT,
+                            "Binary event data is truncated");
+
+                return FALSE;
+            }
+
+            memcpy(&raw, reader->data + reader->pos, sizeof(raw));
+            reader->pos += sizeof(raw);
+            raw = GUINT64_FROM_LE(raw);
+            memcpy(&value, &raw, sizeof(value));
+
+            // The writer never produces these, as JSON can’t hold them
+            if (!isfinite(value)) {
+                g_set_error(error, MATRIX_ERROR, MATRIX_ERROR_INVALID_FORMAT,
+                            "Binary event data contains a non-finite number");
+
+                return FALSE;
+            }
+
+            reader->sink->double_value(reader->target, value);
+
+            break;
+        }
+        case BINARY_TAG_STRING:
+            if (!matrix_json_binary_read_string(reader, error)) {
+                return FALSE;
+            }
+
+            reader->sink->string_value(reader->target, reader->scratch->str);
+
+            break;
+        case BINARY_TAG_OBJECT:
+        case BINARY_TAG_ARRAY:
+            if (depth >= MATRIX_JSON_BINARY_MAX_DEPTH) {
+                g_set_error(error, MATRIX_ERROR, MATRIX_ERROR_INVALID_FORMAT,
+                            "Binary event data is nested too deeply");
+
+                return FALSE;
+            }
+
+            if (tag == BINARY_TAG_OBJECT) {
+                return matrix_json_binary_read_object(reader, depth + 1, error);
+            } else {
+                return matrix_json_binary_read_array(reader, depth + 1, error);
+            }
+        default:
+            g_set_error(error, MATRIX_ERROR, MATRIX_ERROR_INVALID_FORMAT,
+                        "Binary event data contains an unknown tag %u", tag);
+
+            return FALSE;
+    }
+
+    return TRUE;
+}
+
+static gboolean
+matrix_json_binary_decode(GBytes *data,
+                          const MatrixJsonBinarySink *sink,
+                          gpointer target,
+                          GError **error)
+{
+    MatrixJsonBinaryReader reader;
+    gboolean ret;
+
+    reader.data = g_bytes_get_data(data, &reader.len);
+    reader.pos = MATRIX_JSON_BINARY_HEADER_LEN;
+
+    if ((reader.len < MATRIX_JSON_BINARY_HEADER_LEN)
+        || (memcmp(reader.data, MATRIX_JSON_BINARY_MAGIC, 3) != 0)) {
+        g_set_error(error, MATRIX_ERROR, MATRIX_ERROR_INVALID_FORMAT,
+                    "Data is not binary encoded JSON");
+
+        return FALSE;
+    }
+
+    if (reader.data[3] != MATRIX_JSON_BINARY_VERSION) {
+        g_set_error(error, MATRIX_ERROR, MATRIX_ERROR_UNSUPPORTED,
+                    "Unsupported binary encoding version %u", reader.data[3]);
+
+        return FALSE;
+    }
+
+    reader.keys = g_ptr_array_new_with_free_func(g_free);
+    reader.scratch = g_string_sized_new(64);
+    reader.sink = sink;
+    reader.target = target;
+
+    if ((ret = matrix_json_binary_read_value(&reader, 0, error)) && (reader.pos != reader.len)) {
+        g_set_error(error, MATRIX_ERROR, MATRIX_ERROR_INVALID_FORMAT,
+                    "Binary event data has trailing garbage");
+
+        ret = FALSE;
+    }
+
+    g_ptr_array_unref(reader.keys);
+    g_string_free(reader.scratch, TRUE);
+
+    return ret;
+}
+
+static void
+matrix_json_binary_writer_double_value(gpointer writer, gdouble value)
+{
+    // The decoder already rejected values that can’t be written
+    matrix_json_writer_add_double_value(writer, value, NULL);
+}
+
+static const MatrixJsonBinarySink matrix_json_binary_writer_sink = {
+    (void (*)(gpointer))matrix_json_writer_begin_object,
+    (void (*)(gpointer))matrix_json_writer_end_object,
+    (void (*)(gpointer))matrix_json_writer_begin_array,
+    (void (*)(gpointer))matrix_json_writer_end_array,
+    (void (*)(gpointer, const gchar *))matrix_json_writer_set_member_name,
+    (void (*)(gpointer, const gchar *))matrix_json_writer_add_string_value,
+    (void (*)(gpointer, gint64))matrix_json_writer_add_int_value,
+    matrix_json_binary_writer_double_value,
+    (void (*)(gpointer, gboolean))matrix_json_writer_add_boolean_value,
+    (void (*)(gpointer))matrix_json_writer_add_null_value,
+};
+
+/**
+ * matrix_json_writer_add_binary:
+ * @writer: a #MatrixJsonWriter
+ * @data: data produced by a writer created with matrix_json_writer_new_binary()
+ * @error: (nullable): a #GError, or %NULL to ignore errors
+ *
+ * Decode @data and add the value it holds to @writer.  This can be used to transcode the
+ * binary encoding to JSON text (or the other way around) without building a #JsonNode tree.
+ *
+ * If @data is invalid, @error is set and @writer is left in an undefined state; it should be
+ * freed without using its contents.
+ *
+ * Returns: %TRUE if @data could be decoded
+ */
+gboolean
+matrix_json_writer_add_binary(MatrixJsonWriter *matrix_json_writer, GBytes *data, GError **error)
+{
+    g_return_val_if_fail(matrix_json_writer != NULL, FALSE);
+    g_return_val_if_fail(data != NULL, FALSE);
+
+    return matrix_json_binary_decode(data, &matrix_json_binary_writer_sink, matrix_json_writer, error);
+}
+
+static void
+matrix_json_binary_builder_begin_object(gpointer builder)
+{
+    json_builder_begin_object(builder);
+}
+
+static void
+matrix_json_binary_builder_end_object(gpointer builder)
+{
+    json_builder_end_object(builder);
+}
+
+static void
+matrix_json_binary_builder_begin_array(gpointer builder)
+{
+    json_builder_begin_array(builder);
+}
+
+static void
+matrix_json_binary_builder_end_array(gpointer builder)
+{
+    json_builder_end_array(builder);
+}
+
+static void
+matrix_json_binary_builder_member_name(gpointer builder, const gchar *name)
+{
+    json_builder_set_member_name(builder, name);
+}
+
+static void
+matrix_json_binary_builder_string_value(gpointer builder, const gchar *value)
+{
+    json_builder_add_string_value(builder, value);
+}
+
+static void
+matrix_json_binary_builder_int_value(gpointer builder, gint64 value)
+{
+    json_builder_add_int_value(builder, value);
+}
+
+static void
+matrix_json_binary_builder_double_value(gpointer builder, gdouble value)
+{
+    json_builder_add_double_value(builder, value);
+}
+
+static void
+matrix_json_binary_builder_boolean_value(gpointer builder, gboolean value)
+{
+    json_builder_add_boolean_value(builder, value);
+}
+
+static void
+matrix_json_binary_builder_null_value(gpointer builder)
+{
+    json_builder_add_null_value(builder);
+}
+
+static const MatrixJsonBinarySink matrix_json_binary_builder_sink = {
+    matrix_json_binary_builder_begin_object,
+    matrix_json_binary_builder_end_object,
+    matrix_json_binary_builder_begin_array,
+    matrix_json_binary_builder_end_array,
+    matrix_json_binary_builder_member_name,
+    matrix_json_binary_builder_string_value,
+    matrix_json_binary_builder_int_value,
+    matrix_json_binary_builder_double_value,
+    matrix_json_binary_builder_boolean_value,
+    matrix_json_binary_builder_null_value,
+};
+
+/**
+ * matrix_json_binary_to_node:
+ * @data: data produced by a writer created with matrix_json_writer_new_binary()
+ * @error: (nullable): a #GError, or %NULL to ignore errors
+ *
+ * Decode @data into a #JsonNode tree.
+ *
+ * Returns: (transfer full) (nullable): the decoded value, or %NULL if @data is invalid
+ */
+JsonNode *
+matrix_json_binary_to_node(GBytes *data, GError **error)
+{
+    JsonBuilder *builder;
+    JsonNode *ret = NULL;
+
+    g_return_val_if_fail(data != NULL, NULL);
+
+    builder = json_builder_new();
+
+    if (matrix_json_binary_decode(data, &matrix_json_binary_builder_sink, builder, error)) {
+        ret = json_builder_get_root(builder);
+    }
+
+    g_object_unref(builder);
+
+    return ret;
+}
@@ -0,0 +1,54 @@
+/*
+ * This file is part of matrix-glib-sdk
+ *
+ * matrix-glib-sdk is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * matrix-glib-sdk is distributed in the hope that it will be
+ * useful, but WITHOUT ANY WARRANTY; without even the implied
+ * warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with matrix-glib-sdk. If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __MATRIX_GLIB_SDK_JSON_WRITER_H__
+# define __MATRIX_GLIB_SDK_JSON_WRITER_H__
+
+# include <glib.h>
+# include <json-glib/json-glib.h>
+
+G_BEGIN_DECLS
+
+typedef struct _MatrixJsonWriter MatrixJsonWriter;
+
+MatrixJsonWriter *matrix_json_writer_new(void);
+MatrixJsonWriter *matrix_json_writer_new_sized(gsize reserved_size);
+MatrixJsonWriter *matrix_json_writer_new_binary(void);
+MatrixJsonWriter *matrix_json_writer_new_for_member(const gchar *member_name);
+void matrix_json_writer_free(MatrixJsonWriter *writer);
+GBytes *matrix_json_writer_free_to_bytes(MatrixJsonWriter *writer);
+G_DEFINE_AUTOPTR_CLEANUP_FUNC(MatrixJsonWriter, matrix_json_writer_free)
+
+void matrix_json_writer_begin_object(MatrixJsonWriter *writer);
+void matrix_json_writer_end_object(MatrixJsonWriter *writer);
+void matrix_json_writer_begin_array(MatrixJsonWriter *writer);
+void matrix_json_writer_end_array(MatrixJsonWriter *writer);
+void matrix_json_writer_set_member_name(MatrixJsonWriter *writer, const gchar *member_name);
+void matrix_json_writer_add_string_value(MatrixJsonWriter *writer, const gchar *value);
+void matrix_json_writer_add_int_value(MatrixJsonWriter *writer, gint64 value);
+gboolean matrix_json_writer_add_double_value(MatrixJsonWriter *writer, gdouble value, GError **error);
+void matrix_json_writer_add_boolean_value(MatrixJsonWriter *writer, gboolean value);
+void matrix_json_writer_add_null_value(MatrixJsonWriter *writer);
+gboolean matrix_json_writer_add_node(MatrixJsonWriter *writer, JsonNode *node, GError **error);
+gboolean matrix_json_writer_add_binary(MatrixJsonWriter *writer, GBytes *data, GError **error);
+
+JsonNode *matrix_json_binary_to_node(GBytes *data, GError **error);
+
+G_END_DECLS
+
+#endif  /* __MATRIX_GLIB_SDK_JSON_WRITER_H__ */
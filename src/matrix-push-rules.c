@@ -0,0 +1,882 @@
+/*
+ * This file is part of matrix-glib-sdk
+ *
+ * matrix-glib-sdk is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * matrix-glib-sdk is distributed in the hope that it will be
+ * useful, but WITHOUT ANY WARRANTY; without even the implied
+ * warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with matrix-glib-sdk. If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#include <string.h>
+#include "matrix-push-rules.h"
+#include "matrix-types.h"
+
+/**
+ * SECTION:matrix-push-rules
+ * @short_description: client side push rule evaluation
+ * @title: push rules
+ *
+ * #MatrixPushRules evaluates the push rules of the user against incoming events, so clients
+ * can decide which events should notify or highlight without asking the homeserver.
+ *
+ * The rule set, as returned by matrix_api_get_pushrules() or found in the `m.push_rules`
+ * account data event, is compiled once by matrix_push_rules_load().  Key paths are split and
+ * interned, glob patterns are lowercased and prepared for matching, and room and sender rules
+ * are put in hash tables, so evaluating an event doesn’t allocate memory.
+ *
+ * Glob matching is case insensitive for ASCII characters only.  Rules with condition kinds
+ * not known by this implementation never match, as the specification requires.
+ */
+
+/**
+ * MatrixPushRuleResult:
+ * @rule_id: the ID of the rule that matched the event
+ * @notify: %TRUE if the event should notify the user
+ * @highlight: %TRUE if the event should be highlighted
+ * @sound: (nullable): the sound to play for the notification
+ *
+ * The outcome of matching an event against push rules.  The strings are owned by the
+ * #MatrixPushRules object, and are valid until the rules are reloaded or cleared.
+ */
+
+typedef enum {
+    MATRIX_PUSH_CONDITION_EVENT_MATCH,
+    MATRIX_PUSH_CONDITION_CONTAINS_DISPLAY_NAME,
+    MATRIX_PUSH_CONDITION_ROOM_MEMBER_COUNT,
+    MATRIX_PUSH_CONDITION_SENDER_NOTIFICATION_PERMISSION
+} MatrixPushConditionKind;
+
+typedef enum {
+    MATRIX_PUSH_COMPARE_EQ,
+    MATRIX_PUSH_COMPARE_LT,
+    MATRIX_PUSH_COMPARE_GT,
+    MATRIX_PUSH_COMPARE_LE,
+    MATRIX_PUSH_COMPARE_GE
+} MatrixPushCompare;
+
+typedef struct {
+    MatrixPushConditionKind kind;
+
+    /* event_match: the key split at dots, with every component interned */
+    const gchar **path;
+    gchar *pattern;
+    gsize pattern_len;
+    gboolean literal;
+
+    /* If set, pattern must match whole words of the value, instead of the whole value.  This
+     * is the case for content.body. */
+    gboolean words;
+
+    /* room_member_count */
+    MatrixPushCompare compare;
+    guint64 count;
+} MatrixPushCondition;
+
+typedef struct {
+    gchar *rule_id;
+    MatrixPushCondition *conditions;
+    guint n_conditions;
+    gboolean notify;
+    gboolean highlight;
+    gchar *sound;
+} MatrixPushRule;
+
+typedef struct {
+    /* All the rules; the lists and tables below don’t own them */
+    GPtrArray *rules;
+    GPtrArray *override_rules;
+    GPtrArray *content_rules;
+    GHashTable *room_rules;
+    GHashTable *sender_rules;
+    GPtrArray *underride_rules;
+} MatrixPushRulesPrivate;
+
+typedef struct {
+    JsonObject *event;
+    MatrixRoom *room;
+    const gchar *user_id;
+    const gchar *sender;
+} MatrixPushContext;
+
+enum {
+    SIGNAL_NOTIFICATION,
+    NUM_SIGNALS
+};
+static guint matrix_push_rules_signals[NUM_SIGNALS] = {0};
+
+/**
+ * MatrixPushRules:
+ *
+ * A compiled set of push rules.
+ */
+G_DEFINE_TYPE_WITH_PRIVATE(MatrixPushRules, matrix_push_rules, G_TYPE_OBJECT);
+
+static void
+matrix_push_rule_free(MatrixPushRule *rule)
+{
+    for (guint i = 0; i < rule->n_conditions; i++) {
+        g_free(rule->conditions[i].path);
+        g_free(rule->conditions[i].pattern);
+    }
+
+    g_free(rule->conditions);
+    g_free(rule->rule_id);
+    g_free(rule->sound);
+    g_free(rule);
+}
+
+/**
+ * matrix_push_rules_new:
+ *
+ * Create a new, empty #MatrixPushRules object.
+ *
+ * Returns: (transfer full): a new #MatrixPushRules
+ */
+MatrixPushRules *
+matrix_push_rules_new(void)
+{
+    return (MatrixPushRules *)g_object_new(MATRIX_TYPE_PUSH_RULES, NULL);
+}
+
+static const gchar *
+matrix_push_rules_get_string_member(JsonObject *object, const gchar *member_name)
+{
+    JsonNode *node;
+
+    if ((object == NULL)
+        || ((node = json_object_get_member(object, member_name)) == NULL)
+        || (json_node_get_value_type(node) != G_TYPE_STRING)) {
+        return NULL;
+    }
+
+    return json_node_get_string(node);
+}
+
+static gboolean
+matrix_push_is_word_char(gchar c)
+{
+    /* Non-ASCII characters are treated as parts of words */
+    return g_ascii_isalnum(c) || (c == '_') || ((guchar)c >= 0x80);
+}
+
+/*
+ * Match a glob pattern against text (up to text_end).  If words is set, the pattern only has
+ * to match up to a word boundary.
+ *
+ * This doesn’t recurse: only the position of the last * is remembered, and on a mismatch the
+ * match restarts from there, with that * consuming one more character.  This is enough for
+ * globs, and keeps the matching linear in the length of text for most patterns.
+ */
+static gboolean
+matrix_push_glob_match(const gchar *pattern, const gchar *text, const gchar *text_end, gboolean words)
+{
+    const gchar *star_pattern = NULL;
+    const gchar *star_text = NULL;
+
+    while (TRUE) {
+        if (*pattern == '*') {
+            while (*pattern == '*') {
+                pattern++;
+            }
+
+            if ((*pattern == '\0') && !words) {
+                return TRUE;
+            }
+
+            star_pattern = pattern;
+            star_text = text;
+
+            continue;
+        }
+
+        if (*pattern == '\0') {
+            if ((text == text_end) || (words && !matrix_push_is_word_char(*text))) {
+                return TRUE;
+            }
+        } else if (text != text_end) {
+            if (*pattern == '?') {
+                text = MIN(g_utf8_next_char(text), text_end);
+                pattern++;
+
+                continue;
+            }
+
+            if (*pattern == g_ascii_tolower(*text)) {
+                text++;
+                pattern++;
+
+                continue;
+            }
+        }
+
+        // Mismatch; let the last * consume one more character, if there is one
+        if ((star_pattern == NULL) || (star_text == text_end)) {
+            return FALSE;
+        }
+
+        star_text = MIN(g_utf8_next_char(star_text), text_end);
+        pattern = star_pattern;
+        text = star_text;
+    }
+}
+
+/*
+ * Check if pattern appears in text as a separate word (or words).
+ */
+static gboolean
+matrix_push_match_words(const gchar *pattern, gsize pattern_len, gboolean literal, const gchar *text)
+{
+    const gchar *text_end = text + strlen(text);
+    gchar first = ((pattern[0] == '*') || (pattern[0] == '?')) ? '\0' : g_ascii_tolower(pattern[0]);
+
+    for (const gchar *t = text; t < text_end; t++) {
+        if ((t > text) && matrix_push_is_word_char(*(t - 1))) {
+            continue;
+        }
+
+        if ((first != '\0') && (g_ascii_tolower(*t) != first)) {
+            continue;
+        }
+
+        if (literal) {
+            if (((gsize)(text_end - t) >= pattern_len)
+                && (g_ascii_strncasecmp(t, pattern, pattern_len) == 0)
+                && ((t + pattern_len == text_end) || !matrix_push_is_word_char(t[pattern_len]))) {
+                return TRUE;
+            }
+        } else if (matrix_push_glob_match(pattern, t, text_end, TRUE)) {
+            return TRUE;
+        }
+    }
+
+    return FALSE;
+}
+
+static const gchar *
+matrix_push_get_event_value(JsonObject *event, const gchar **path)
+{
+    JsonNode *node = NULL;
+
+    for (guint i = 0; path[i] != NULL; i++) {
+        if ((event == NULL) || ((node = json_object_get_member(event, path[i])) == NULL)) {
+            return NULL;
+        }
+
+        event = JSON_NODE_HOLDS_OBJECT(node) ? json_node_get_object(node) : NULL;
+    }
+
+    if ((node == NULL) || (json_node_get_value_type(node) != G_TYPE_STRING)) {
+        return NULL;
+    }
+
+    return json_node_get_string(node);
+}
+
+static const gchar *
+matrix_push_get_body(JsonObject *event)
+{
+    static const gchar *path[] = {"content", "body", NULL};
+
+    return matrix_push_get_event_value(event, path);
+}
+
+static gboolean
+matrix_push_condition_matches(MatrixPushCondition *condition, MatrixPushContext *context)
+{
+    const gchar *value;
+
+    switch (condition->kind) {
+        case MATRIX_PUSH_CONDITION_EVENT_MATCH:
+            if ((value = matrix_push_get_event_value(context->event, condition->path)) == NULL) {
+                return FALSE;
+            }
+
+            if (condition->words) {
+                return matrix_push_match_words(condition->pattern, condition->pattern_len, condition->literal, value);
+            }
+
+            if (condition->literal) {
+                return (strlen(value) == condition->pattern_len)
+                    && (g_ascii_strcasecmp(value, condition->pattern) == 0);
+            }
+
+            return matrix_push_glob_match(condition->pattern, value, value + strlen(value), FALSE);
+        case MATRIX_PUSH_CONDITION_CONTAINS_DISPLAY_NAME: {
+            MatrixProfile *profile;
+            const gchar *display_name;
+
+            if ((context->room == NULL)
+                || (context->user_id == NULL)
+                || ((value = matrix_push_get_body(context->event)) == NULL)
+                || ((profile = matrix_room_get_member(context->room, context->user_id, NULL, NULL)) == NULL)
+                || ((display_name = matrix_profile_get_display_name(profile)) == NULL)
+                || (*display_name == '\0')) {
+                return FALSE;
+            }
+
+            return matrix_push_match_words(display_name, strlen(display_name), TRUE, value);
+        }
+        case MATRIX_PUSH_CONDITION_ROOM_MEMBER_COUNT: {
+            guint64 n_members;
+
+            if (context->room == NULL) {
+                return FALSE;
+            }
+
+            // Only joined members count, not the ones who left, got banned, or are invited
+            n_members = matrix_room_get_joined_member_count(context->room);
+
+            switch (condition->compare) {
+                case MATRIX_PUSH_COMPARE_EQ:
+                    return n_members == condition->count;
+                case MATRIX_PUSH_COMPARE_LT:
+                    return n_members < condition->count;
+                case MATRIX_PUSH_COMPARE_GT:
+                    return n_members > condition->count;
+                case MATRIX_PUSH_COMPARE_LE:
+                    return n_members <= condition->count;
+                case MATRIX_PUSH_COMPARE_GE:
+                    return n_members >= condition->count;
+            }
+
+            return FALSE;
+        }
+        case MATRIX_PUSH_CONDITION_SENDER_NOTIFICATION_PERMISSION:
+            return (context->room != NULL)
+                && (context->sender != NULL)
+                && (matrix_room_get_user_level(context->room, context->sender) >= matrix_room_get_room_notification_level(context->room));
+    }
+
+    return FALSE;
+}
+
+static gboolean
+matrix_push_rule_matches(MatrixPushRule *rule, MatrixPushContext *context)
+{
+    for (guint i = 0; i < rule->n_conditions; i++) {
+        if (!matrix_push_condition_matches(&(rule->conditions[i]), context)) {
+            return FALSE;
+        }
+    }
+
+    return TRUE;
+}
+
+static void
+matrix_push_condition_set_pattern(MatrixPushCondition *condition, const gchar *key, const gchar *pattern)
+{
+    gchar **components = g_strsplit(key, ".", -1);
+    guint n_components = g_strv_length(components);
+
+    condition->kind = MATRIX_PUSH_CONDITION_EVENT_MATCH;
+    condition->path = g_new0(const gchar *, n_components + 1);
+
+    for (guint i = 0; i < n_components; i++) {
+        condition->path[i] = g_intern_string(components[i]);
+    }
+
+    g_strfreev(components);
+
+    condition->pattern = g_ascii_strdown(pattern, -1);
+    condition->pattern_len = strlen(condition->pattern);
+    condition->literal = (strpbrk(condition->pattern, "*?") == NULL);
+    condition->words = (g_strcmp0(key, "content.body") == 0);
+}
+
+/*
+ * Compile a condition.  Returns FALSE if the condition is not understood; rules with such
+ * conditions never match.
+ */
+static gboolean
+matrix_push_condition_compile(MatrixPushCondition *condition, JsonObject *condition_root)
+{
+    const gchar *kind = matrix_push_rules_get_string_member(condition_root, "kind");
+
+    if (g_strcmp0(kind, "event_match") == 0) {
+        const gchar *key = matrix_push_rules_get_string_member(condition_root, "key");
+        const gchar *pattern = matrix_push_rules_get_string_member(condition_root, "pattern");
+
+        if ((key == NULL) || (pattern == NULL)) {
+            return FALSE;
+        }
+
+        matrix_push_condition_set_pattern(condition, key, pattern);
+
+        return TRUE;
+    } else if (g_strcmp0(kind, "contains_display_name") == 0) {
+        condition->kind = MATRIX_PUSH_CONDITION_CONTAINS_DISPLAY_NAME;
+
+        return TRUE;
+    } else if (g_strcmp0(kind, "room_member_count") == 0) {
+        const gchar *is = matrix_push_rules_get_string_member(condition_root, "is");
+        gchar *end;
+
+        if (is == NULL) {
+            return FALSE;
+        }
+
+        condition->kind = MATRIX_PUSH_CONDITION_ROOM_MEMBER_COUNT;
+
+        if (g_str_has_prefix(is, "==")) {
+            condition->compare = MATRIX_PUSH_COMPARE_EQ;
+            is += 2;
+        } else if (g_str_has_prefix(is, "<=")) {
+            condition->compare = MATRIX_PUSH_COMPARE_LE;
+            is += 2;
+        } else if (g_str_has_prefix(is, ">=")) {
+            condition->compare = MATRIX_PUSH_COMPARE_GE;
+            is += 2;
+        } else if (*is == '<') {
+            condition->compare = MATRIX_PUSH_COMPARE_LT;
+            is++;
+        } else if (*is == '>') {
+            condition->compare = MATRIX_PUSH_COMPARE_GT;
+            is++;
+        } else {
+            condition->compare = MATRIX_PUSH_COMPARE_EQ;
+        }
+
+        condition->count = g_ascii_strtoull(is, &end, 10);
+
+        return (end != is) && (*end == '\0');
+    } else if (g_strcmp0(kind, "sender_notification_permission") == 0) {
+        condition->kind = MATRIX_PUSH_CONDITION_SENDER_NOTIFICATION_PERMISSION;
+
+        return (g_strcmp0(matrix_push_rules_get_string_member(condition_root, "key"), "room") == 0);
+    }
+
+    return FALSE;
+}
+
+static void
+matrix_push_rule_compile_actions(MatrixPushRule *rule, JsonNode *actions)
+{
+    JsonArray *array;
+    guint len;
+
+    if ((actions == NULL) || !JSON_NODE_HOLDS_ARRAY(actions)) {
+        return;
+    }
+
+    array = json_node_get_array(actions);
+    len = json_array_get_length(array);
+
+    for (guint i = 0; i < len; i++) {
+        JsonNode *action = json_array_get_element(array, i);
+
+        if (json_node_get_value_type(action) == G_TYPE_STRING) {
+            const gchar *action_name = json_node_get_string(action);
+
+            if ((g_strcmp0(action_name, "notify") == 0) || (g_strcmp0(action_name, "coalesce") == 0)) {
+                rule->notify = TRUE;
+            } else if (g_strcmp0(action_name, "dont_notify") == 0) {
+                rule->notify = FALSE;
+            }
+        } else if (JSON_NODE_HOLDS_OBJECT(action)) {
+            JsonObject *tweak = json_node_get_object(action);
+            const gchar *tweak_name = matrix_push_rules_get_string_member(tweak, "set_tweak");
+            JsonNode *value = json_object_get_member(tweak, "value");
+
+            if (g_strcmp0(tweak_name, "highlight") == 0) {
+                rule->highlight = (value == NULL)
+                    || (JSON_NODE_HOLDS_VALUE(value) && json_node_get_boolean(value));
+            } else if (g_strcmp0(tweak_name, "sound") == 0) {
+                g_free(rule->sound);
+                rule->sound = g_strdup(matrix_push_rules_get_string_member(tweak, "value"));
+            }
+        }
+    }
+}
+
+/*
+ * Compile a rule of the given kind.  Returns NULL if the rule is disabled, malformed, or can
+ * never match.
+ */
+static MatrixPushRule *
+matrix_push_rule_compile(MatrixPusherKind kind, JsonObject *rule_root)
+{
+    MatrixPushRule *rule;
+    const gchar *rule_id = matrix_push_rules_get_string_member(rule_root, "rule_id");
+    JsonNode *node;
+
+    if ((rule_id == NULL)
+        || (((node = json_object_get_member(rule_root, "enabled")) != NULL)
+            && JSON_NODE_HOLDS_VALUE(node)
+            && !json_node_get_boolean(node))) {
+        return NULL;
+    }
+
+    rule = g_new0(MatrixPushRule, 1);
+    rule->rule_id = g_strdup(rule_id);
+
+    switch (kind) {
+        case MATRIX_PUSHER_KIND_CONTENT: {
+            const gchar *pattern = matrix_push_rules_get_string_member(rule_root, "pattern");
+
+            if (pattern == NULL) {
+                matrix_push_rule_free(rule);
+
+                return NULL;
+            }
+
+            rule->conditions = g_new0(MatrixPushCondition, 1);
+            rule->n_conditions = 1;
+            matrix_push_condition_set_pattern(&(rule->conditions[0]), "content.body", pattern);
+
+            break;
+        }
+        case MATRIX_PUSHER_KIND_OVERRIDE:
+        case MATRIX_PUSHER_KIND_UNDERRIDE:
+            if (((node = json_object_get_member(rule_root, "conditions")) != NULL)
+                && JSON_NODE_HOLDS_ARRAY(node)) {
+                JsonArray *conditions = json_node_get_array(node);
+                guint len = json_array_get_length(conditions);
+
+                rule->conditions = g_new0(MatrixPushCondition, len);
+
+                for (guint i = 0; i < len; i++) {
+                    JsonNode *condition = json_array_get_element(conditions, i);
+
+                    if (!JSON_NODE_HOLDS_OBJECT(condition)
+                        || !matrix_push_condition_compile(&(rule->conditions[i]), json_node_get_object(condition))) {
+                        rule->n_conditions = i + 1;
+                        matrix_push_rule_free(rule);
+
+                        return NULL;
+                    }
+                }
+
+                rule->n_conditions = len;
+            }
+
+            break;
+
+        /* Room and sender rules are matched by their rule ID */
+        case MATRIX_PUSHER_KIND_ROOM:
+        case MATRIX_PUSHER_KIND_SENDER:
+
+            break;
+    }
+
+    matrix_push_rule_compile_actions(rule, json_object_get_member(rule_root, "actions"));
+
+    return rule;
+}
+
+/**
+ * matrix_push_rules_clear:
+ * @push_rules: a #MatrixPushRules
+ *
+ * Remove all rules from @push_rules.
+ */
+void
+matrix_push_rules_clear(MatrixPushRules *matrix_push_rules)
+{
+    MatrixPushRulesPrivate *priv;
+
+    g_return_if_fail(matrix_push_rules != NULL);
+
+    priv = matrix_push_rules_get_instance_private(matrix_push_rules);
+
+    g_ptr_array_set_size(priv->override_rules, 0);
+    g_ptr_array_set_size(priv->content_rules, 0);
+    g_ptr_array_set_size(priv->underride_rules, 0);
+    g_hash_table_remove_all(priv->room_rules);
+    g_hash_table_remove_all(priv->sender_rules);
+    g_ptr_array_set_size(priv->rules, 0);
+}
+
+/**
+ * matrix_push_rules_load:
+ * @push_rules: a #MatrixPushRules
+ * @rules: the push rules, as a JSON object
+ * @error: (nullable): a #GError, or %NULL to ignore errors
+ *
+ * Compile @rules and replace the current rules of @push_rules with them.  @rules can be the
+ * response of matrix_api_get_pushrules() or the content of an `m.push_rules` account data
+ * event; only the global rules are used.  Disabled rules, and rules that can never match, are
+ * left out.
+ *
+ * If @rules is not a JSON object, @error is set to %MATRIX_ERROR_INVALID_FORMAT and the
+ * current rules are kept.
+ *
+ * Returns: %TRUE if the rules were loaded
+ */
+gboolean
+matrix_push_rules_load(MatrixPushRules *matrix_push_rules, JsonNode *rules, GError **error)
+{
+    static const struct {
+        MatrixPusherKind kind;
+        const gchar *name;
+    } kinds[] = {
+        {MATRIX_PUSHER_KIND_OVERRIDE, "override"},
+        {MATRIX_PUSHER_KIND_CONTENT, "content"},
+        {MATRIX_PUSHER_KIND_ROOM, "room"},
+        {MATRIX_PUSHER_KIND_SENDER, "sender"},
+        {MATRIX_PUSHER_KIND_UNDERRIDE, "underride"}
+    };
+    MatrixPushRulesPrivate *priv;
+    JsonObject *root;
+    JsonNode *node;
+
+    g_return_val_if_fail(matrix_push_rules != NULL, FALSE);
+    g_return_val_if_fail(rules != NULL, FALSE);
+
+    priv = matrix_push_rules_get_instance_private(matrix_push_rules);
+
+    if (!JSON_NODE_HOLDS_OBJECT(rules)) {
+        g_set_error(error, MATRIX_ERROR, MATRIX_ERROR_INVALID_FORMAT,
+                    "Push rules must be a JSON object");
+
+        return FALSE;
+    }
+
+    root = json_node_get_object(rules);
+
+    if (((node = json_object_get_member(root, "global")) != NULL) && JSON_NODE_HOLDS_OBJECT(node)) {
+        root = json_node_get_object(node);
+    }
+
+    matrix_push_rules_clear(matrix_push_rules);
+
+    for (guint k = 0; k < G_N_ELEMENTS(kinds); k++) {
+        JsonArray *kind_rules;
+        guint len;
+
+        if (((node = json_object_get_member(root, kinds[k].name)) == NULL) || !JSON_NODE_HOLDS_ARRAY(node)) {
+            continue;
+        }
+
+        kind_rules = json_node_get_array(node);
+        len = json_array_get_length(kind_rules);
+
+        for (guint i = 0; i < len; i++) {
+            JsonNode *rule_node = json_array_get_element(kind_rules, i);
+            MatrixPushRule *rule;
+
+            if (!JSON_NODE_HOLDS_OBJECT(rule_node)
+                || ((rule = matrix_push_rule_compile(kinds[k].kind, json_node_get_object(rule_node))) == NULL)) {
+                continue;
+            }
+
+            g_ptr_array_add(priv->rules, rule);
+
+            switch (kinds[k].kind) {
+                case MATRIX_PUSHER_KIND_OVERRIDE:
+                    g_ptr_array_add(priv->override_rules, rule);
+
+                    break;
+                case MATRIX_PUSHER_KIND_CONTENT:
+                    g_ptr_array_add(priv->content_rules, rule);
+
+                    break;
+                case MATRIX_PUSHER_KIND_ROOM:
+                    if (!g_hash_table_contains(priv->room_rules, rule->rule_id)) {
+                        g_hash_table_insert(priv->room_rules, rule->rule_id, rule);
+                    }
+
+                    break;
+                case MATRIX_PUSHER_KIND_SENDER:
+                    if (!g_hash_table_contains(priv->sender_rules, rule->rule_id)) {
+                        g_hash_table_insert(priv->sender_rules, rule->rule_id, rule);
+                    }
+
+                    break;
+                case MATRIX_PUSHER_KIND_UNDERRIDE:
+                    g_ptr_array_add(priv->underride_rules, rule);
+
+                    break;
+            }
+        }
+    }
+
+    return TRUE;
+}
+
+/**
+ * matrix_push_rules_get_n_rules:
+ * @push_rules: a #MatrixPushRules
+ *
+ * Get the number of compiled rules.  Disabled rules and rules that can never match are not
+ * counted.
+ *
+ * Returns: the number of rules
+ */
+guint
+matrix_push_rules_get_n_rules(MatrixPushRules *matrix_push_rules)
+{
+    MatrixPushRulesPrivate *priv;
+
+    g_return_val_if_fail(matrix_push_rules != NULL, 0);
+
+    priv = matrix_push_rules_get_instance_private(matrix_push_rules);
+
+    return priv->rules->len;
+}
+
+static MatrixPushRule *
+matrix_push_rules_find_in(GPtrArray *rules, MatrixPushContext *context)
+{
+    for (guint i = 0; i < rules->len; i++) {
+        MatrixPushRule *rule = g_ptr_array_index(rules, i);
+
+        if (matrix_push_rule_matches(rule, context)) {
+            return rule;
+        }
+    }
+
+    return NULL;
+}
+
+/**
+ * matrix_push_rules_evaluate:
+ * @push_rules: a #MatrixPushRules
+ * @event: a raw event
+ * @room: (nullable): the #MatrixRoom @event belongs to
+ * @user_id: (nullable): the Matrix ID of the user the rules belong to
+ * @result: (out caller-allocates): the actions of the matching rule
+ *
+ * Find the first rule that matches @event, in the order defined by the specification
+ * (override, content, room, sender, then underride rules), and fill @result with its actions.
+ *
+ * @room is needed for the `contains_display_name`, `room_member_count` and
+ * `sender_notification_permission` conditions; if it’s %NULL, these conditions don’t match.
+ * The display name of @user_id is taken from the member list of @room.
+ *
+ * Returns: %TRUE if a rule matched @event
+ */
+gboolean
+matrix_push_rules_evaluate(MatrixPushRules *matrix_push_rules, JsonNode *event, MatrixRoom *room, const gchar *user_id, MatrixPushRuleResult *result)
+{
+    MatrixPushRulesPrivate *priv;
+    MatrixPushContext context;
+    MatrixPushRule *rule;
+    const gchar *room_id;
+
+    g_return_val_if_fail(matrix_push_rules != NULL, FALSE);
+    g_return_val_if_fail(event != NULL, FALSE);
+    g_return_val_if_fail(result != NULL, FALSE);
+
+    priv = matrix_push_rules_get_instance_private(matrix_push_rules);
+
+    if (!JSON_NODE_HOLDS_OBJECT(event)) {
+        return FALSE;
+    }
+
+    context.event = json_node_get_object(event);
+    context.room = room;
+    context.user_id = user_id;
+    context.sender = matrix_push_rules_get_string_member(context.event, "sender");
+
+    if (((room_id = matrix_push_rules_get_string_member(context.event, "room_id")) == NULL) && (room != NULL)) {
+        room_id = matrix_room_get_room_id(room);
+    }
+
+    if (((rule = matrix_push_rules_find_in(priv->override_rules, &context)) == NULL)
+        && ((rule = matrix_push_rules_find_in(priv->content_rules, &context)) == NULL)
+        && ((room_id == NULL) || ((rule = g_hash_table_lookup(priv->room_rules, room_id)) == NULL))
+        && ((context.sender == NULL) || ((rule = g_hash_table_lookup(priv->sender_rules, context.sender)) == NULL))
+        && ((rule = matrix_push_rules_find_in(priv->underride_rules, &context)) == NULL)) {
+        return FALSE;
+    }
+
+    result->rule_id = rule->rule_id;
+    result->notify = rule->notify;
+    result->highlight = rule->highlight;
+    result->sound = rule->sound;
+
+    return TRUE;
+}
+
+/**
+ * matrix_push_rules_process_event:
+ * @push_rules: a #MatrixPushRules
+ * @room_id: the ID of the room @event belongs to
+ * @event: a raw event
+ * @room: (nullable): the #MatrixRoom @event belongs to
+ * @user_id: (nullable): the Matrix ID of the user the rules belong to
+ *
+ * Evaluate @event with matrix_push_rules_evaluate(), and emit
+ * #MatrixPushRules::notification if it should notify the user.
+ *
+ * Returns: %TRUE if the event should notify the user
+ */
+gboolean
+matrix_push_rules_process_event(MatrixPushRules *matrix_push_rules, const gchar *room_id, JsonNode *event, MatrixRoom *room, const gchar *user_id)
+{
+    MatrixPushRuleResult result;
+
+    g_return_val_if_fail(matrix_push_rules != NULL, FALSE);
+    g_return_val_if_fail(event != NULL, FALSE);
+
+    if (!matrix_push_rules_evaluate(matrix_push_rules, event, room, user_id, &result) || !result.notify) {
+        return FALSE;
+    }
+
+    g_signal_emit(matrix_push_rules, matrix_push_rules_signals[SIGNAL_NOTIFICATION], 0, room_id, event, result.rule_id, result.highlight);
+
+    return TRUE;
+}
+
+static void
+matrix_push_rules_finalize(GObject *gobject)
+{
+    MatrixPushRulesPrivate *priv = matrix_push_rules_get_instance_private(MATRIX_PUSH_RULES(gobject));
+
+    g_ptr_array_unref(priv->override_rules);
+    g_ptr_array_unref(priv->content_rules);
+    g_ptr_array_unref(priv->underride_rules);
+    g_hash_table_unref(priv->room_rules);
+    g_hash_table_unref(priv->sender_rules);
+    g_ptr_array_unref(priv->rules);
+
+    G_OBJECT_CLASS(matrix_push_rules_parent_class)->finalize(gobject);
+}
+
+static void
+matrix_push_rules_class_init(MatrixPushRulesClass *klass)
+{
+    G_OBJECT_CLASS(klass)->finalize = matrix_push_rules_finalize;
+
+    /**
+     * MatrixPushRules::notification:
+     * @push_rules: the #MatrixPushRules that emitted the signal
+     * @room_id: the ID of the room the event belongs to
+     * @event: the raw event
+     * @rule_id: the ID of the rule that matched the event
+     * @highlight: %TRUE if the event should be highlighted
+     *
+     * This signal is emitted by matrix_push_rules_process_event() for events that should
+     * notify the user.
+     */
+    matrix_push_rules_signals[SIGNAL_NOTIFICATION] = g_signal_new(
+            "notification",
+            MATRIX_TYPE_PUSH_RULES,
+            G_SIGNAL_RUN_LAST,
+            0,
+            NULL, NULL,
+            NULL,
+            G_TYPE_NONE, 4, G_TYPE_STRING, JSON_TYPE_NODE, G_TYPE_STRING, G_TYPE_BOOLEAN);
+}
+
+static void
+matrix_push_rules_init(MatrixPushRules *matrix_push_rules)
+{
+    MatrixPushRulesPrivate *priv = matrix_push_rules_get_instance_private(matrix_push_rules);
+
+    priv->rules = g_ptr_array_new_with_free_func((GDestroyNotify)matrix_push_rule_free);
+    priv->override_rules = g_ptr_array_new();
+    priv->content_rules = g_ptr_array_new();
+    priv->underride_rules = g_ptr_array_new();
+    priv->room_rules = g_hash_table_new(g_str_hash, g_str_equal);
+    priv->sender_rules = g_hash_table_new(g_str_hash, g_str_equal);
+}
@@ -0,0 +1,54 @@
+/*
+ * This file is part of matrix-glib-sdk
+ *
+ * matrix-glib-sdk is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * matrix-glib-sdk is distributed in the hope that it will be
+ * useful, but WITHOUT ANY WARRANTY; without even the implied
+ * warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with matrix-glib-sdk. If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __MATRIX_GLIB_SDK_PUSH_RULES_H__
+# define __MATRIX_GLIB_SDK_PUSH_RULES_H__
+
+# include <glib-object.h>
+# include <json-glib/json-glib.h>
+# include "matrix-room.h"
+
+G_BEGIN_DECLS
+
+typedef struct {
+    const gchar *rule_id;
+    gboolean notify;
+    gboolean highlight;
+    const gchar *sound;
+} MatrixPushRuleResult;
+
+# define MATRIX_TYPE_PUSH_RULES matrix_push_rules_get_type()
+G_DECLARE_DERIVABLE_TYPE(MatrixPushRules, matrix_push_rules, MATRIX, PUSH_RULES, GObject)
+
+struct _MatrixPushRulesClass {
+    GObjectClass parent_class;
+
+    /* < private > */
+    gpointer padding[12];
+};
+
+MatrixPushRules *matrix_push_rules_new(void);
+gboolean matrix_push_rules_load(MatrixPushRules *push_rules, JsonNode *rules, GError **error);
+void matrix_push_rules_clear(MatrixPushRules *push_rules);
+guint matrix_push_rules_get_n_rules(MatrixPushRules *push_rules);
+gboolean matrix_push_rules_evaluate(MatrixPushRules *push_rules, JsonNode *event, MatrixRoom *room, const gchar *user_id, MatrixPushRuleResult *result);
+gboolean matrix_push_rules_process_event(MatrixPushRules *push_rules, const gchar *room_id, JsonNode *event, MatrixRoom *room, const gchar *user_id);
+
+G_END_DECLS
+
+#endif  /* __MATRIX_GLIB_SDK_PUSH_RULES_H__ */
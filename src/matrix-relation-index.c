@@ -0,0 +1,769 @@
+/*
+ * This file is part of matrix-glib-sdk
+ *
+ * matrix-glib-sdk is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * matrix-glib-sdk is distributed in the hope that it will be
+ * useful, but WITHOUT ANY WARRANTY; without even the implied
+ * warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with matrix-glib-sdk. If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#include "matrix-relation-index.h"
+
+/**
+ * SECTION:matrix-relation-index
+ * @short_description: aggregation of event relations
+ * @title: relation index
+ *
+ * #MatrixRelationIndex keeps track of the relations between events (reactions, edits, replies,
+ * threads, etc.), and keeps their aggregates up to date as events arrive.  Queries like “the
+ * reactions to an event” or “the current version of an event” don’t need to scan the history.
+ *
+ * Relations are read from the `m.relates_to` member of the event content.  An event can have
+ * one relation; if it has both a `rel_type` and an `m.in_reply_to` member, the former is used.
+ * Replies are indexed with the relation type %MATRIX_RELATION_TYPE_REPLY.
+ *
+ * Events don’t have to be added in any particular order; relations to events that were not
+ * seen (yet) are kept just the same.
+ *
+ * The index holds at most #MatrixRelationIndex:capacity relations; when it gets full, the
+ * relations added first are dropped, and the aggregates of their targets are updated.
+ */
+
+/**
+ * MATRIX_RELATION_TYPE_ANNOTATION:
+ *
+ * The relation type of reactions.
+ */
+
+/**
+ * MATRIX_RELATION_TYPE_REPLACE:
+ *
+ * The relation type of edits.
+ */
+
+/**
+ * MATRIX_RELATION_TYPE_REPLY:
+ *
+ * The relation type used by #MatrixRelationIndex for replies.
+ */
+
+typedef struct {
+    gchar *event_id;
+    gchar *target;
+    gchar *rel_type;
+    gchar *key;
+    gchar *sender;
+    gint64 origin_server_ts;
+    guint64 serial;
+    JsonNode *new_content;
+
+    /* The link of the relation in the order they were added */
+    GList *link;
+} MatrixRelation;
+
+typedef struct {
+    /* rel_type => GPtrArray of MatrixRelation, in the order they were added */
+    GHashTable *by_type;
+
+    /* annotation key => (sender => number of annotations) */
+    GHashTable *reactions;
+
+    /* The latest edit of each sender */
+    GHashTable *latest_edits;
+} MatrixRelationTarget;
+
+typedef struct {
+    GHashTable *relations;
+    GHashTable *targets;
+    guint64 serial;
+
+    /* The relations, in the order they were added */
+    GQueue *order;
+    guint capacity;
+} MatrixRelationIndexPrivate;
+
+enum  {
+    PROP_0,
+    PROP_CAPACITY,
+    NUM_PROPERTIES
+};
+
+static GParamSpec *matrix_relation_index_properties[NUM_PROPERTIES];
+
+#define MATRIX_RELATION_INDEX_DEFAULT_CAPACITY 100000
+
+/**
+ * MatrixRelationIndex:
+ *
+ * An index of the relations between events.
+ */
+G_DEFINE_TYPE_WITH_PRIVATE(MatrixRelationIndex, matrix_relation_index, G_TYPE_OBJECT);
+
+static void
+matrix_relation_free(MatrixRelation *relation)
+{
+    g_free(relation->event_id);
+    g_free(relation->target);
+    g_free(relation->rel_type);
+    g_free(relation->key);
+    g_free(relation->sender);
+
+    if (relation->new_content != NULL) {
+        json_node_unref(relation->new_content);
+    }
+
+    g_free(relation);
+}
+
+static void
+matrix_relation_target_free(MatrixRelationTarget *target)
+{
+    g_hash_table_unref(target->by_type);
+    g_hash_table_unref(target->reactions);
+    g_hash_table_unref(target->latest_edits);
+    g_free(target);
+}
+
+static MatrixRelationTarget *
+matrix_relation_target_new(void)
+{
+    MatrixRelationTarget *target = g_new0(MatrixRelationTarget, 1);
+
+    target->by_type = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, (GDestroyNotify)g_ptr_array_unref);
+    target->reactions = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, (GDestroyNotify)g_hash_table_unref);
+    target->latest_edits = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+
+    return target;
+}
+
+/**
+ * matrix_relation_index_new:
+ *
+ * Create a new, empty #MatrixRelationIndex.
+ *
+ * Returns: (transfer full): a new #MatrixRelationIndex
+ */
+MatrixRelationIndex *
+matrix_relation_index_new(void)
+{
+    return (MatrixRelationIndex *)g_object_new(MATRIX_TYPE_RELATION_INDEX, NULL);
+}
+
+static const gchar *
+matrix_relation_index_get_string_member(JsonObject *object, const gchar *member_name)
+{
+    JsonNode *node;
+
+    if ((object == NULL)
+        || ((node = json_object_get_member(object, member_name)) == NULL)
+        || (json_node_get_value_type(node) != G_TYPE_STRING)) {
+        return NULL;
+    }
+
+    return json_node_get_string(node);
+}
+
+static JsonObject *
+matrix_relation_index_get_object_member(JsonObject *object, const gchar *member_name)
+{
+    JsonNode *node;
+
+    if ((object == NULL)
+        || ((node = json_object_get_member(object, member_name)) == NULL)
+        || !JSON_NODE_HOLDS_OBJECT(node)) {
+        return NULL;
+    }
+
+    return json_node_get_object(node);
+}
+
+static gboolean
+matrix_relation_is_later(MatrixRelation *relation, MatrixRelation *other)
+{
+    if (other == NULL) {
+        return TRUE;
+    }
+
+    if (relation->origin_server_ts != other->origin_server_ts) {
+        return relation->origin_server_ts > other->origin_server_ts;
+    }
+
+    return relation->serial > other->serial;
+}
+
+/*
+ * Recalculate the latest edits of target after an edit got removed.
+ */
+static void
+matrix_relation_target_update_latest_edits(MatrixRelationTarget *target)
+{
+    GPtrArray *edits = g_hash_table_lookup(target->by_type, MATRIX_RELATION_TYPE_REPLACE);
+
+    g_hash_table_remove_all(target->latest_edits);
+
+    if (edits == NULL) {
+        return;
+    }
+
+    for (guint i = 0; i < edits->len; i++) {
+        MatrixRelation *edit = g_ptr_array_index(edits, i);
+
+        if ((edit->sender != NULL)
+            && matrix_relation_is_later(edit, g_hash_table_lookup(target->latest_edits, edit->sender))) {
+            g_hash_table_replace(target->latest_edits, g_strdup(edit->sender), edit);
+        }
+    }
+}
+
+/*
+ * Remove relation from the index, and update the aggregates of its target.  This frees
+ * relation.
+ */
+static void
+matrix_relation_index_remove_relation(MatrixRelationIndexPrivate *priv, MatrixRelation *relation)
+{
+    MatrixRelationTarget *target = g_hash_table_lookup(priv->targets, relation->target);
+    GPtrArray *related;
+
+    if ((related = g_hash_table_lookup(target->by_type, relation->rel_type)) != NULL) {
+        g_ptr_array_remove(related, relation);
+
+        if (related->len == 0) {
+            g_hash_table_remove(target->by_type, relation->rel_type);
+        }
+    }
+
+    if (relation->key != NULL) {
+        GHashTable *senders = g_hash_table_lookup(target->reactions, relation->key);
+        const gchar *sender = (relation->sender != NULL) ? relation->sender : "";
+        guint count = GPOINTER_TO_UINT(g_hash_table_lookup(senders, sender));
+
+        if (count > 1) {
+            g_hash_table_replace(senders, g_strdup(sender), GUINT_TO_POINTER(count - 1));
+        } else {
+            g_hash_table_remove(senders, sender);
+        }
+
+        if (g_hash_table_size(senders) == 0) {
+            g_hash_table_remove(target->reactions, relation->key);
+        }
+    }
+
+    if (g_strcmp0(relation->rel_type, MATRIX_RELATION_TYPE_REPLACE) == 0) {
+        matrix_relation_target_update_latest_edits(target);
+    }
+
+    if (g_hash_table_size(target->by_type) == 0) {
+        g_hash_table_remove(priv->targets, relation->target);
+    }
+
+    g_queue_delete_link(priv->order, relation->link);
+
+    /* This frees relation */
+    g_hash_table_remove(priv->relations, relation->event_id);
+}
+
+/*
+ * Drop the relations added first until at most n_relations remain.
+ */
+static void
+matrix_relation_index_shrink(MatrixRelationIndexPrivate *priv, guint n_relations)
+{
+    while (g_queue_get_length(priv->order) > n_relations) {
+        matrix_relation_index_remove_relation(priv, g_queue_peek_head(priv->order));
+    }
+}
+
+/**
+ * matrix_relation_index_add_event:
+ * @relation_index: a #MatrixRelationIndex
+ * @event: a #JsonNode holding an event
+ *
+ * Add the relation of @event to @relation_index, and update the aggregates of its target.
+ * Events already in @relation_index (based on their event ID) are not added again.  If
+ * @relation_index is full, the relation added first is dropped.
+ *
+ * Returns: %TRUE if @event has a relation, and it was added
+ */
+gboolean
+matrix_relation_index_add_event(MatrixRelationIndex *matrix_relation_index, JsonNode *event)
+{
+    MatrixRelationIndexPrivate *priv;
+    MatrixRelationTarget *target;
+    MatrixRelation *relation;
+    JsonObject *root;
+    JsonObject *content;
+    JsonObject *relates_to;
+    JsonObject *in_reply_to;
+    JsonNode *node;
+    GPtrArray *related;
+    const gchar *event_id;
+    const gchar *target_id;
+    const gchar *rel_type;
+
+    g_return_val_if_fail(matrix_relation_index != NULL, FALSE);
+    g_return_val_if_fail(event != NULL, FALSE);
+
+    priv = matrix_relation_index_get_instance_private(matrix_relation_index);
+
+    if (!JSON_NODE_HOLDS_OBJECT(event)) {
+        return FALSE;
+    }
+
+    root = json_node_get_object(event);
+    content = matrix_relation_index_get_object_member(root, "content");
+
+    if ((relates_to = matrix_relation_index_get_object_member(content, "m.relates_to")) == NULL) {
+        return FALSE;
+    }
+
+    if (((event_id = matrix_relation_index_get_string_member(root, "event_id")) == NULL)
+        || g_hash_table_contains(priv->relations, event_id)) {
+        return FALSE;
+    }
+
+    if ((rel_type = matrix_relation_index_get_string_member(relates_to, "rel_type")) != NULL) {
+        target_id = matrix_relation_index_get_string_member(relates_to, "event_id");
+    } else if ((in_reply_to = matrix_relation_index_get_object_member(relates_to, "m.in_reply_to")) != NULL) {
+        rel_type = MATRIX_RELATION_TYPE_REPLY;
+        target_id = matrix_relation_index_get_string_member(in_reply_to, "event_id");
+    } else {
+        return FALSE;
+    }
+
+    if (target_id == NULL) {
+        return FALSE;
+    }
+
+    if (priv->capacity > 0) {
+        matrix_relation_index_shrink(priv, priv->capacity - 1);
+    }
+
+    relation = g_new0(MatrixRelation, 1);
+    relation->event_id = g_strdup(event_id);
+    relation->target = g_strdup(target_id);
+    relation->rel_type = g_strdup(rel_type);
+    relation->sender = g_strdup(matrix_relation_index_get_string_member(root, "sender"));
+    relation->serial = priv->serial++;
+
+    if (((node = json_object_get_member(root, "origin_server_ts")) != NULL)
+        && (json_node_get_value_type(node) == G_TYPE_INT64)) {
+        relation->origin_server_ts = json_node_get_int(node);
+    }
+
+    g_hash_table_insert(priv->relations, relation->event_id, relation);
+    g_queue_push_tail(priv->order, relation);
+    relation->link = g_queue_peek_tail_link(priv->order);
+
+    if ((target = g_hash_table_lookup(priv->targets, target_id)) == NULL) {
+        target = matrix_relation_target_new();
+        g_hash_table_insert(priv->targets, g_strdup(target_id), target);
+    }
+
+    if ((related = g_hash_table_lookup(target->by_type, rel_type)) == NULL) {
+        related = g_ptr_array_new();
+        g_hash_table_insert(target->by_type, g_strdup(rel_type), related);
+    }
+
+    g_ptr_array_add(related, relation);
+
+    if (g_strcmp0(rel_type, MATRIX_RELATION_TYPE_ANNOTATION) == 0) {
+        const gchar *key = matrix_relation_index_get_string_member(relates_to, "key");
+
+        if (key != NULL) {
+            GHashTable *senders;
+            const gchar *sender = (relation->sender != NULL) ? relation->sender : "";
+
+            relation->key = g_strdup(key);
+
+            if ((senders = g_hash_table_lookup(target->reactions, key)) == NULL) {
+                senders = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+                g_hash_table_insert(target->reactions, g_strdup(key), senders);
+            }
+
+            g_hash_table_replace(senders, g_strdup(sender),
+                                 GUINT_TO_POINTER(GPOINTER_TO_UINT(g_hash_table_lookup(senders, sender)) + 1));
+        }
+    } else if (g_strcmp0(rel_type, MATRIX_RELATION_TYPE_REPLACE) == 0) {
+        if ((node = json_object_get_member(content, "m.new_content")) != NULL) {
+            relation->new_content = json_node_ref(node);
+        }
+
+        if ((relation->sender != NULL)
+            && matrix_relation_is_later(relation, g_hash_table_lookup(target->latest_edits, relation->sender))) {
+            g_hash_table_replace(target->latest_edits, g_strdup(relation->sender), relation);
+        }
+    }
+
+    return TRUE;
+}
+
+/**
+ * matrix_relation_index_remove_event:
+ * @relation_index: a #MatrixRelationIndex
+ * @event_id: the ID of an event
+ *
+ * Remove the relation of an event from @relation_index, like when the event gets redacted.
+ * The aggregates of its target are updated accordingly.
+ *
+ * Returns: %TRUE if the event had a relation in @relation_index
+ */
+gboolean
+matrix_relation_index_remove_event(MatrixRelationIndex *matrix_relation_index, const gchar *event_id)
+{
+    MatrixRelationIndexPrivate *priv;
+    MatrixRelation *relation;
+
+    g_return_val_if_fail(matrix_relation_index != NULL, FALSE);
+    g_return_val_if_fail(event_id != NULL, FALSE);
+
+    priv = matrix_relation_index_get_instance_private(matrix_relation_index);
+
+    if ((relation = g_hash_table_lookup(priv->relations, event_id)) == NULL) {
+        return FALSE;
+    }
+
+    matrix_relation_index_remove_relation(priv, relation);
+
+    return TRUE;
+}
+
+/**
+ * matrix_relation_index_get_n_relations:
+ * @relation_index: a #MatrixRelationIndex
+ *
+ * Returns: the number of relations in @relation_index
+ */
+guint
+matrix_relation_index_get_n_relations(MatrixRelationIndex *matrix_relation_index)
+{
+    MatrixRelationIndexPrivate *priv;
+
+    g_return_val_if_fail(matrix_relation_index != NULL, 0);
+
+    priv = matrix_relation_index_get_instance_private(matrix_relation_index);
+
+    return g_hash_table_size(priv->relations);
+}
+
+/**
+ * matrix_relation_index_get_related:
+ * @relation_index: a #MatrixRelationIndex
+ * @event_id: the ID of an event
+ * @rel_type: a relation type, like %MATRIX_RELATION_TYPE_REPLY
+ *
+ * Get the events that relate to @event_id with @rel_type, in the order they were added.
+ *
+ * Returns: (transfer full) (element-type utf8): the list of event IDs
+ */
+GPtrArray *
+matrix_relation_index_get_related(MatrixRelationIndex *matrix_relation_index, const gchar *event_id, const gchar *rel_type)
+{
+    MatrixRelationIndexPrivate *priv;
+    MatrixRelationTarget *target;
+    GPtrArray *related;
+    GPtrArray *ret;
+
+    g_return_val_if_fail(matrix_relation_index != NULL, NULL);
+    g_return_val_if_fail(event_id != NULL, NULL);
+    g_return_val_if_fail(rel_type != NULL, NULL);
+
+    priv = matrix_relation_index_get_instance_private(matrix_relation_index);
+    ret = g_ptr_array_new_with_free_func(g_free);
+
+    if (((target = g_hash_table_lookup(priv->targets, event_id)) == NULL)
+        || ((related = g_hash_table_lookup(target->by_type, rel_type)) == NULL)) {
+        return ret;
+    }
+
+    for (guint i = 0; i < related->len; i++) {
+        g_ptr_array_add(ret, g_strdup(((MatrixRelation *)g_ptr_array_index(related, i))->event_id));
+    }
+
+    return ret;
+}
+
+/**
+ * matrix_relation_index_get_relates_to:
+ * @relation_index: a #MatrixRelationIndex
+ * @event_id: the ID of an event
+ * @rel_type: (out) (optional) (transfer none): the type of the relation
+ *
+ * Get the event @event_id relates to.  For replies, following this repeatedly walks up the
+ * reply chain.
+ *
+ * Returns: (transfer none) (nullable): the ID of the target event, or %NULL if @event_id
+ *     has no relation in @relation_index
+ */
+const gchar *
+matrix_relation_index_get_relates_to(MatrixRelationIndex *matrix_relation_index, const gchar *event_id, const gchar **rel_type)
+{
+    MatrixRelationIndexPrivate *priv;
+    MatrixRelation *relation;
+
+    g_return_val_if_fail(matrix_relation_index != NULL, NULL);
+    g_return_val_if_fail(event_id != NULL, NULL);
+
+    priv = matrix_relation_index_get_instance_private(matrix_relation_index);
+
+    if ((relation = g_hash_table_lookup(priv->relations, event_id)) == NULL) {
+        return NULL;
+    }
+
+    if (rel_type != NULL) {
+        *rel_type = relation->rel_type;
+    }
+
+    return relation->target;
+}
+
+/**
+ * matrix_relation_index_get_reaction_keys:
+ * @relation_index: a #MatrixRelationIndex
+ * @event_id: the ID of an event
+ *
+ * Get the keys of the reactions to @event_id.
+ *
+ * Returns: (transfer full) (element-type utf8): the list of reaction keys, in no particular
+ *     order
+ */
+GPtrArray *
+matrix_relation_index_get_reaction_keys(MatrixRelationIndex *matrix_relation_index, const gchar *event_id)
+{
+    MatrixRelationIndexPrivate *priv;
+    MatrixRelationTarget *target;
+    GHashTableIter iter;
+    gpointer key;
+    GPtrArray *ret;
+
+    g_return_val_if_fail(matrix_relation_index != NULL, NULL);
+    g_return_val_if_fail(event_id != NULL, NULL);
+
+    priv = matrix_relation_index_get_instance_private(matrix_relation_index);
+    ret = g_ptr_array_new_with_free_func(g_free);
+
+    if ((target = g_hash_table_lookup(priv->targets, event_id)) == NULL) {
+        return ret;
+    }
+
+    g_hash_table_iter_init(&iter, target->reactions);
+
+    while (g_hash_table_iter_next(&iter, &key, NULL)) {
+        g_ptr_array_add(ret, g_strdup(key));
+    }
+
+    return ret;
+}
+
+/**
+ * matrix_relation_index_get_reaction_count:
+ * @relation_index: a #MatrixRelationIndex
+ * @event_id: the ID of an event
+ * @key: a reaction key
+ *
+ * Get the number of users who reacted to @event_id with @key.
+ *
+ * Returns: the number of reactions
+ */
+guint
+matrix_relation_index_get_reaction_count(MatrixRelationIndex *matrix_relation_index, const gchar *event_id, const gchar *key)
+{
+    MatrixRelationIndexPrivate *priv;
+    MatrixRelationTarget *target;
+    GHashTable *senders;
+
+    g_return_val_if_fail(matrix_relation_index != NULL, 0);
+    g_return_val_if_fail(event_id != NULL, 0);
+    g_return_val_if_fail(key != NULL, 0);
+
+    priv = matrix_relation_index_get_instance_private(matrix_relation_index);
+
+    if (((target = g_hash_table_lookup(priv->targets, event_id)) == NULL)
+        || ((senders = g_hash_table_lookup(target->reactions, key)) == NULL)) {
+        return 0;
+    }
+
+    return g_hash_table_size(senders);
+}
+
+/**
+ * matrix_relation_index_get_latest_edit:
+ * @relation_index: a #MatrixRelationIndex
+ * @event_id: the ID of an event
+ * @sender: the sender of @event_id
+ * @new_content: (out) (optional) (transfer none) (nullable): the new content of @event_id
+ *
+ * Get the latest edit of @event_id, based on the origin server timestamp of the edits.
+ *
+ * Only the original sender of an event may edit it, so only edits sent by @sender are
+ * considered.  If @event_id is in @relation_index itself (eg. it is a reply) and was sent by
+ * someone else than @sender, there is no valid edit, and %NULL is returned.
+ *
+ * Returns: (transfer none) (nullable): the ID of the latest edit, or %NULL if @event_id was
+ *     not edited
+ */
+const gchar *
+matrix_relation_index_get_latest_edit(MatrixRelationIndex *matrix_relation_index, const gchar *event_id, const gchar *sender, JsonNode **new_content)
+{
+    MatrixRelationIndexPrivate *priv;
+    MatrixRelationTarget *target;
+    MatrixRelation *original;
+    MatrixRelation *edit;
+
+    g_return_val_if_fail(matrix_relation_index != NULL, NULL);
+    g_return_val_if_fail(event_id != NULL, NULL);
+    g_return_val_if_fail(sender != NULL, NULL);
+
+    priv = matrix_relation_index_get_instance_private(matrix_relation_index);
+
+    if (((original = g_hash_table_lookup(priv->relations, event_id)) != NULL)
+        && (g_strcmp0(original->sender, sender) != 0)) {
+        return NULL;
+    }
+
+    if (((target = g_hash_table_lookup(priv->targets, event_id)) == NULL)
+        || ((edit = g_hash_table_lookup(target->latest_edits, sender)) == NULL)) {
+        return NULL;
+    }
+
+    if (new_content != NULL) {
+        *new_content = edit->new_content;
+    }
+
+    return edit->event_id;
+}
+
+/**
+ * matrix_relation_index_get_capacity:
+ * @relation_index: a #MatrixRelationIndex
+ *
+ * Returns: the maximum number of relations held by @relation_index, or 0 if it is unlimited
+ */
+guint
+matrix_relation_index_get_capacity(MatrixRelationIndex *matrix_relation_index)
+{
+    MatrixRelationIndexPrivate *priv;
+
+    g_return_val_if_fail(matrix_relation_index != NULL, 0);
+
+    priv = matrix_relation_index_get_instance_private(matrix_relation_index);
+
+    return priv->capacity;
+}
+
+/**
+ * matrix_relation_index_set_capacity:
+ * @relation_index: a #MatrixRelationIndex
+ * @capacity: the maximum number of relations to hold, or 0 for no limit
+ *
+ * Set the maximum number of relations held by @relation_index.  If it holds more relations
+ * than @capacity, the ones added first are dropped.
+ */
+void
+matrix_relation_index_set_capacity(MatrixRelationIndex *matrix_relation_index, guint capacity)
+{
+    MatrixRelationIndexPrivate *priv;
+
+    g_return_if_fail(matrix_relation_index != NULL);
+
+    priv = matrix_relation_index_get_instance_private(matrix_relation_index);
+
+    if (capacity == priv->capacity) {
+        return;
+    }
+
+    priv->capacity = capacity;
+
+    if (capacity > 0) {
+        matrix_relation_index_shrink(priv, capacity);
+    }
+
+    g_object_notify_by_pspec((GObject *)matrix_relation_index, matrix_relation_index_properties[PROP_CAPACITY]);
+}
+
+static void
+matrix_relation_index_finalize(GObject *gobject)
+{
+    MatrixRelationIndexPrivate *priv = matrix_relation_index_get_instance_private(MATRIX_RELATION_INDEX(gobject));
+
+    g_hash_table_unref(priv->targets);
+    g_hash_table_unref(priv->relations);
+    g_queue_free(priv->order);
+
+    G_OBJECT_CLASS(matrix_relation_index_parent_class)->finalize(gobject);
+}
+
+static void
+matrix_relation_index_get_property(GObject *gobject, guint property_id, GValue *value, GParamSpec *pspec)
+{
+    MatrixRelationIndex *matrix_relation_index = MATRIX_RELATION_INDEX(gobject);
+
+    switch (property_id) {
+        case PROP_CAPACITY:
+            g_value_set_uint(value, matrix_relation_index_get_capacity(matrix_relation_index));
+
+            break;
+        default:
+            G_OBJECT_WARN_INVALID_PROPERTY_ID(gobject, property_id, pspec);
+
+            break;
+    }
+}
+
+static void
+matrix_relation_index_set_property(GObject *gobject, guint property_id, const GValue *value, GParamSpec *pspec)
+{
+    MatrixRelationIndex *matrix_relation_index = MATRIX_RELATION_INDEX(gobject);
+
+    switch (property_id) {
+        case PROP_CAPACITY:
+            matrix_relation_index_set_capacity(matrix_relation_index, g_value_get_uint(value));
+
+            break;
+        default:
+            G_OBJECT_WARN_INVALID_PROPERTY_ID(gobject, property_id, pspec);
+
+            break;
+    }
+}
+
+static void
+matrix_relation_index_class_init(MatrixRelationIndexClass *klass)
+{
+    G_OBJECT_CLASS(klass)->get_property = matrix_relation_index_get_property;
+    G_OBJECT_CLASS(klass)->set_property = matrix_relation_index_set_property;
+    G_OBJECT_CLASS(klass)->finalize = matrix_relation_index_finalize;
+
+    /**
+     * MatrixRelationIndex:capacity:
+     *
+     * The maximum number of relations held by the index.  When it is full, the relations
+     * added first are dropped.  0 means no limit.
+     */
+    matrix_relation_index_properties[PROP_CAPACITY] = g_param_spec_uint(
+            "capacity", "capacity", "capacity",
+            0, G_MAXUINT, MATRIX_RELATION_INDEX_DEFAULT_CAPACITY,
+            G_PARAM_STATIC_STRINGS | G_PARAM_READWRITE);
+    g_object_class_install_property(G_OBJECT_CLASS(klass), PROP_CAPACITY, matrix_relation_index_properties[PROP_CAPACITY]);
+}
+
+static void
+matrix_relation_index_init(MatrixRelationIndex *matrix_relation_index)
+{
+    MatrixRelationIndexPrivate *priv = matrix_relation_index_get_instance_private(matrix_relation_index);
+
+    priv->relations = g_hash_table_new_full(g_str_hash, g_str_equal, NULL, (GDestroyNotify)matrix_relation_free);
+    priv->targets = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, (GDestroyNotify)matrix_relation_target_free);
+    priv->serial = 0;
+    priv->order = g_queue_new();
+    priv->capacity = MATRIX_RELATION_INDEX_DEFAULT_CAPACITY;
+}
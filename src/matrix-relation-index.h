@@ -0,0 +1,55 @@
+/*
+ * This file is part of matrix-glib-sdk
+ *
+ * matrix-glib-sdk is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * matrix-glib-sdk is distributed in the hope that it will be
+ * useful, but WITHOUT ANY WARRANTY; without even the implied
+ * warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with matrix-glib-sdk. If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __MATRIX_GLIB_SDK_RELATION_INDEX_H__
+# define __MATRIX_GLIB_SDK_RELATION_INDEX_H__
+
+# include <glib-object.h>
+# include <json-glib/json-glib.h>
+
+G_BEGIN_DECLS
+
+# define MATRIX_RELATION_TYPE_ANNOTATION "m.annotation"
+# define MATRIX_RELATION_TYPE_REPLACE "m.replace"
+# define MATRIX_RELATION_TYPE_REPLY "m.in_reply_to"
+
+# define MATRIX_TYPE_RELATION_INDEX matrix_relation_index_get_type()
+G_DECLARE_DERIVABLE_TYPE(MatrixRelationIndex, matrix_relation_index, MATRIX, RELATION_INDEX, GObject)
+
+struct _MatrixRelationIndexClass {
+    GObjectClass parent_class;
+
+    /* < private > */
+    gpointer padding[12];
+};
+
+MatrixRelationIndex *matrix_relation_index_new(void);
+gboolean matrix_relation_index_add_event(MatrixRelationIndex *relation_index, JsonNode *event);
+gboolean matrix_relation_index_remove_event(MatrixRelationIndex *relation_index, const gchar *event_id);
+guint matrix_relation_index_get_n_relations(MatrixRelationIndex *relation_index);
+GPtrArray *matrix_relation_index_get_related(MatrixRelationIndex *relation_index, const gchar *event_id, const gchar *rel_type);
+const gchar *matrix_relation_index_get_relates_to(MatrixRelationIndex *relation_index, const gchar *event_id, const gchar **rel_type);
+GPtrArray *matrix_relation_index_get_reaction_keys(MatrixRelationIndex *relation_index, const gchar *event_id);
+guint matrix_relation_index_get_reaction_count(MatrixRelationIndex *relation_index, const gchar *event_id, const gchar *key);
+const gchar *matrix_relation_index_get_latest_edit(MatrixRelationIndex *relation_index, const gchar *event_id, const gchar *sender, JsonNode **new_content);
+guint matrix_relation_index_get_capacity(MatrixRelationIndex *relation_index);
+void matrix_relation_index_set_capacity(MatrixRelationIndex *relation_index, guint capacity);
+
+G_END_DECLS
+
+#endif  /* __MATRIX_GLIB_SDK_RELATION_INDEX_H__ */
@@ -0,0 +1,685 @@
+/*
+ * This file is part of matrix-glib-sdk
+ *
+ * matrix-glib-sdk is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * matrix-glib-sdk is distributed in the hope that it will be
+ * useful, but WITHOUT ANY WARRANTY; without even the implied
+ * warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with matrix-glib-sdk. If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#include <string.h>
+#include "matrix-room-state.h"
+
+/**
+ * SECTION:matrix-room-state
+ * @short_description: immutable snapshots of room state
+ * @title: room state
+ *
+ * #MatrixRoomState is the state of a room (members, power levels, name, etc.) at one point of
+ * its history, as a map of (event type, state key) pairs to state events.
+ *
+ * Snapshots are never modified.  Applying a state event creates a new snapshot that shares
+ * everything but the path to the changed entry with the old one, so keeping many versions of
+ * the state of a room costs O(log n) memory and time per state event, where n is the number of
+ * state entries.  Versions that are no longer referenced are freed, without affecting the
+ * ones that share data with them.
+ */
+
+typedef struct _MatrixRoomStateNode MatrixRoomStateNode;
+
+/* A node of a treap ordered by (event_type, state_key), with priority used to keep it balanced.
+ * Priorities are derived from the key, so the shape of the tree doesn’t depend on the order of
+ * the events.  Nodes are shared between snapshots and never modified after creation. */
+struct _MatrixRoomStateNode {
+    const gchar *event_type;
+    gchar *state_key;
+    guint priority;
+    JsonNode *event;
+    MatrixRoomStateNode *left;
+    MatrixRoomStateNode *right;
+
+    volatile int refcount;
+};
+
+/**
+ * MatrixRoomState: (ref-func matrix_room_state_ref) (unref-func matrix_room_state_unref)
+ *
+ * An immutable snapshot of the state of a room.
+ */
+struct _MatrixRoomState {
+    MatrixRoomStateNode *root;
+    guint size;
+    gchar *event_id;
+
+    volatile int refcount;
+};
+G_DEFINE_BOXED_TYPE(MatrixRoomState, matrix_room_state, (GBoxedCopyFunc)matrix_room_state_ref, (GBoxedFreeFunc)matrix_room_state_unref);
+
+/**
+ * MatrixRoomStateFunc:
+ * @event_type: the type of the state event
+ * @state_key: the state key of the state event
+ * @event: the state event
+ * @user_data: the user data passed to matrix_room_state_foreach()
+ *
+ * Callback type for matrix_room_state_foreach().
+ */
+
+/**
+ * MatrixRoomStateDiffFunc:
+ * @event_type: the type of the state event
+ * @state_key: the state key of the state event
+ * @old_event: (nullable): the state event in the old state, or %NULL if it was added
+ * @new_event: (nullable): the state event in the new state, or %NULL if it was removed
+ * @user_data: the user data passed to matrix_room_state_diff()
+ *
+ * Callback type for matrix_room_state_diff().
+ */
+
+static MatrixRoomStateNode *
+matrix_room_state_node_ref(MatrixRoomStateNode *node)
+{
+    if (node != NULL) {
+        node->refcount++;
+    }
+
+    return node;
+}
+
+static void
+matrix_room_state_node_unref(MatrixRoomStateNode *node)
+{
+    if ((node == NULL) || (--(node->refcount) > 0)) {
+        return;
+    }
+
+    matrix_room_state_node_unref(node->left);
+    matrix_room_state_node_unref(node->right);
+    json_node_unref(node->event);
+    g_free(node->state_key);
+    g_free(node);
+}
+
+/*
+ * Create a new node.  The references to left and right are taken over by the new node.
+ */
+static MatrixRoomStateNode *
+matrix_room_state_node_new(const gchar *event_type, const gchar *state_key, guint priority, JsonNode *event, MatrixRoomStateNode *left, MatrixRoomStateNode *right)
+{
+    MatrixRoomStateNode *node = g_new(MatrixRoomStateNode, 1);
+
+    node->event_type = event_type;
+    node->state_key = g_strdup(state_key);
+    node->priority = priority;
+    node->event = json_node_ref(event);
+    node->left = left;
+    node->right = right;
+    node->refcount = 1;
+
+    return node;
+}
+
+/*
+ * The priority of a node.  g_str_hash() of similar keys (eg. user IDs differing in their last
+ * character) follow their order, so the hashes are mixed to keep the tree balanced.
+ */
+static guint
+matrix_room_state_priority(const gchar *event_type, const gchar *state_key)
+{
+    guint32 h = g_str_hash(event_type) * 31 + g_str_hash(state_key);
+
+    h ^= h >> 16;
+    h *= 0x85ebca6bU;
+    h ^= h >> 13;
+    h *= 0xc2b2ae35U;
+    h ^= h >> 16;
+
+    return h;
+}
+
+static gint
+matrix_room_state_compare(const gchar *event_type, const gchar *state_key, MatrixRoomStateNode *node)
+{
+    gint cmp;
+
+    if ((cmp = strcmp(event_type, node->event_type)) != 0) {
+        return cmp;
+    }
+
+    return strcmp(state_key, node->state_key);
+}
+
+/*
+ * Insert or replace an entry, copying the nodes on the path to it.  node is not changed;
+ * the returned tree shares the rest of it.
+ */
+static MatrixRoomStateNode *
+matrix_room_state_node_insert(MatrixRoomStateNode *node, const gchar *event_type, const gchar *state_key, guint priority, JsonNode *event, gboolean *added)
+{
+    MatrixRoomStateNode *child;
+    MatrixRoomStateNode *root;
+    gint cmp;
+
+    if (node == NULL) {
+        *added = TRUE;
+
+        return matrix_room_state_node_new(event_type, state_key, priority, event, NULL, NULL);
+    }
+
+    cmp = matrix_room_state_compare(event_type, state_key, node);
+
+    if (cmp == 0) {
+        return matrix_room_state_node_new(node->event_type, node->state_key, node->priority, event,
+                                          matrix_room_state_node_ref(node->left),
+                                          matrix_room_state_node_ref(node->right));
+    }
+
+    if (cmp < 0) {
+        child = matrix_room_state_node_insert(node->left, event_type, state_key, priority, event, added);
+
+        if (child->priority <= node->priority) {
+            return matrix_room_state_node_new(node->event_type, node->state_key, node->priority, node->event,
+                                              child,
+                                              matrix_room_state_node_ref(node->right));
+        }
+
+        /* Rotate right */
+        root = matrix_room_state_node_new(child->event_type, child->state_key, child->priority, child->event,
+                                          matrix_room_state_node_ref(child->left),
+                                          matrix_room_state_node_new(node->event_type, node->state_key, node->priority, node->event,
+                                                                     matrix_room_state_node_ref(child->right),
+                                                                     matrix_room_state_node_ref(node->right)));
+    } else {
+        child = matrix_room_state_node_insert(node->right, event_type, state_key, priority, event, added);
+
+        if (child->priority <= node->priority) {
+            return matrix_room_state_node_new(node->event_type, node->state_key, node->priority, node->event,
+                                              matrix_room_state_node_ref(node->left),
+                                              child);
+        }
+
+        /* Rotate left */
+        root = matrix_room_state_node_new(child->event_type, child->state_key, child->priority, child->event,
+                                          matrix_room_state_node_new(node->event_type, node->state_key, node->priority, node->event,
+                                                                     matrix_room_state_node_ref(node->left),
+                                                                     matrix_room_state_node_ref(child->left)),
+                                          matrix_room_state_node_ref(child->right));
+    }
+
+    matrix_room_state_node_unref(child);
+
+    return root;
+}
+
+/**
+ * matrix_room_state_new:
+ *
+ * Create a new, empty #MatrixRoomState with a reference count of 1.
+ *
+ * Returns: (transfer full): a new #MatrixRoomState
+ */
+MatrixRoomState *
+matrix_room_state_new(void)
+{
+    MatrixRoomState *ret = g_new0(MatrixRoomState, 1);
+
+    ret->refcount = 1;
+
+    return ret;
+}
+
+/**
+ * matrix_room_state_ref:
+ * @state: a #MatrixRoomState
+ *
+ * Increment reference count on @state.
+ *
+ * Returns: (transfer full): @state
+ */
+MatrixRoomState *
+matrix_room_state_ref(MatrixRoomState *matrix_room_state)
+{
+    g_return_val_if_fail(matrix_room_state != NULL, NULL);
+
+    matrix_room_state->refcount++;
+
+    return matrix_room_state;
+}
+
+/**
+ * matrix_room_state_unref:
+ * @state: (transfer full): a #MatrixRoomState
+ *
+ * Decrement reference count on @state.  If reference count reaches zero, the snapshot is
+ * freed, along with the state entries no other snapshot shares.
+ */
+void
+matrix_room_state_unref(MatrixRoomState *matrix_room_state)
+{
+    g_return_if_fail(matrix_room_state != NULL);
+
+    if (--(matrix_room_state->refcount) == 0) {
+        matrix_room_state_node_unref(matrix_room_state->root);
+        g_free(matrix_room_state->event_id);
+        g_free(matrix_room_state);
+    }
+}
+
+/**
+ * matrix_room_state_apply_event:
+ * @state: a #MatrixRoomState
+ * @event: a raw state event
+ *
+ * Create the state that follows @state after @event.  @state is not changed.  If @event is
+ * not a state event, a new reference to @state is returned.
+ *
+ * Returns: (transfer full): the new state
+ */
+MatrixRoomState *
+matrix_room_state_apply_event(MatrixRoomState *matrix_room_state, JsonNode *event)
+{
+    MatrixRoomState *ret;
+    JsonObject *root;
+    JsonNode *node;
+    const gchar *event_type;
+    const gchar *state_key;
+    const gchar *event_id = NULL;
+    gboolean added = FALSE;
+
+    g_return_val_if_fail(matrix_room_state != NULL, NULL);
+    g_return_val_if_fail(event != NULL, NULL);
+
+    if (!JSON_NODE_HOLDS_OBJECT(event)) {
+        return matrix_room_state_ref(matrix_room_state);
+    }
+
+    root = json_node_get_object(event);
+
+    if (((node = json_object_get_member(root, "type")) == NULL)
+        || (json_node_get_value_type(node) != G_TYPE_STRING)) {
+        return matrix_room_state_ref(matrix_room_state);
+    }
+
+    event_type = json_node_get_string(node);
+
+    if (((node = json_object_get_member(root, "state_key")) == NULL)
+        || (json_node_get_value_type(node) != G_TYPE_STRING)) {
+        return matrix_room_state_ref(matrix_room_state);
+    }
+
+    state_key = json_node_get_string(node);
+
+    if (((node = json_object_get_member(root, "event_id")) != NULL)
+        && (json_node_get_value_type(node) == G_TYPE_STRING)) {
+        event_id = json_node_get_string(node);
+    }
+
+    ret = matrix_room_state_new();
+    ret->root = matrix_room_state_node_insert(matrix_room_state->root,
+                                              g_intern_string(event_type), state_key,
+                                              matrix_room_state_priority(event_type, state_key),
+                                              event, &added);
+    ret->size = matrix_room_state->size + (added ? 1 : 0);
+    ret->event_id = g_strdup(event_id);
+
+    return ret;
+}
+
+/**
+ * matrix_room_state_lookup:
+ * @state: a #MatrixRoomState
+ * @event_type: an event type
+ * @state_key: a state key
+ *
+ * Get the state event of @event_type with @state_key in @state.
+ *
+ * Returns: (transfer none) (nullable): the state event, or %NULL if there is none
+ */
+JsonNode *
+matrix_room_state_lookup(MatrixRoomState *matrix_room_state, const gchar *event_type, const gchar *state_key)
+{
+    MatrixRoomStateNode *node;
+
+    g_return_val_if_fail(matrix_room_state != NULL, NULL);
+    g_return_val_if_fail(event_type != NULL, NULL);
+    g_return_val_if_fail(state_key != NULL, NULL);
+
+    node = matrix_room_state->root;
+
+    while (node != NULL) {
+        gint cmp = matrix_room_state_compare(event_type, state_key, node);
+
+        if (cmp == 0) {
+            return node->event;
+        }
+
+        node = (cmp < 0) ? node->left : node->right;
+    }
+
+    return NULL;
+}
+
+/**
+ * matrix_room_state_get_size:
+ * @state: a #MatrixRoomState
+ *
+ * Returns: the number of state entries in @state
+ */
+guint
+matrix_room_state_get_size(MatrixRoomState *matrix_room_state)
+{
+    g_return_val_if_fail(matrix_room_state != NULL, 0);
+
+    return matrix_room_state->size;
+}
+
+/**
+ * matrix_room_state_get_event_id:
+ * @state: a #MatrixRoomState
+ *
+ * Returns: (transfer none) (nullable): the ID of the last state event applied to get @state
+ */
+const gchar *
+matrix_room_state_get_event_id(MatrixRoomState *matrix_room_state)
+{
+    g_return_val_if_fail(matrix_room_state != NULL, NULL);
+
+    return matrix_room_state->event_id;
+}
+
+static void
+matrix_room_state_node_foreach(MatrixRoomStateNode *node, const gchar *event_type, MatrixRoomStateFunc func, gpointer user_data)
+{
+    while (node != NULL) {
+        gint cmp = (event_type == NULL) ? 0 : strcmp(event_type, node->event_type);
+
+        if (cmp <= 0) {
+            matrix_room_state_node_foreach(node->left, event_type, func, user_data);
+        }
+
+        if (cmp == 0) {
+            func(node->event_type, node->state_key, node->event, user_data);
+        }
+
+        if (cmp < 0) {
+            return;
+        }
+
+        node = node->right;
+    }
+}
+
+static const gchar *
+matrix_room_state_event_id(JsonNode *event)
+{
+    JsonNode *node;
+
+    if (JSON_NODE_HOLDS_OBJECT(event)
+        && ((node = json_object_get_member(json_node_get_object(event), "event_id")) != NULL)
+        && (json_node_get_value_type(node) == G_TYPE_STRING)) {
+        return json_node_get_string(node);
+    }
+
+    return NULL;
+}
+
+static gboolean matrix_room_state_json_equal(JsonNode *a, JsonNode *b);
+
+static gboolean
+matrix_room_state_json_array_equal(JsonArray *a, JsonArray *b)
+{
+    guint len = json_array_get_length(a);
+
+    if (json_array_get_length(b) != len) {
+        return FALSE;
+    }
+
+    for (guint i = 0; i < len; i++) {
+        if (!matrix_room_state_json_equal(json_array_get_element(a, i), json_array_get_element(b, i))) {
+            return FALSE;
+        }
+    }
+
+    return TRUE;
+}
+
+static gboolean
+matrix_room_state_json_object_equal(JsonObject *a, JsonObject *b)
+{
+    GList *members;
+    gboolean equal = TRUE;
+
+    if (json_object_get_size(a) != json_object_get_size(b)) {
+        return FALSE;
+    }
+
+    members = json_object_get_members(a);
+
+    for (GList *l = members; equal && (l != NULL); l = l->next) {
+        equal = matrix_room_state_json_equal(json_object_get_member(a, l->data), json_object_get_member(b, l->data));
+    }
+
+    g_list_free(members);
+
+    return equal;
+}
+
+/*
+ * Compare two JSON trees without serialising them.
+ */
+static gboolean
+matrix_room_state_json_equal(JsonNode *a, JsonNode *b)
+{
+    if (a == b) {
+        return TRUE;
+    }
+
+    if ((a == NULL) || (b == NULL) || (json_node_get_node_type(a) != json_node_get_node_type(b))) {
+        return FALSE;
+    }
+
+    switch (json_node_get_node_type(a)) {
+        case JSON_NODE_OBJECT:
+            return matrix_room_state_json_object_equal(json_node_get_object(a), json_node_get_object(b));
+        case JSON_NODE_ARRAY:
+            return matrix_room_state_json_array_equal(json_node_get_array(a), json_node_get_array(b));
+        case JSON_NODE_NULL:
+            return TRUE;
+        case JSON_NODE_VALUE:
+            break;
+    }
+
+    if (json_node_get_value_type(a) != json_node_get_value_type(b)) {
+        return FALSE;
+    }
+
+    switch (json_node_get_value_type(a)) {
+        case G_TYPE_STRING:
+            return g_strcmp0(json_node_get_string(a), json_node_get_string(b)) == 0;
+        case G_TYPE_INT64:
+            return json_node_get_int(a) == json_node_get_int(b);
+        case G_TYPE_DOUBLE:
+            return json_node_get_double(a) == json_node_get_double(b);
+        case G_TYPE_BOOLEAN:
+            return json_node_get_boolean(a) == json_node_get_boolean(b);
+        default:
+            return FALSE;
+    }
+}
+
+/*
+ * Two entries are the same if they share the node or the event, or if their events have the
+ * same ID.  Events without an ID are compared by content.
+ */
+static gboolean
+matrix_room_state_node_equal(MatrixRoomStateNode *a, MatrixRoomStateNode *b)
+{
+    const gchar *a_id;
+    const gchar *b_id;
+
+    if ((a == b) || (a->event == b->event)) {
+        return TRUE;
+    }
+
+    a_id = matrix_room_state_event_id(a->event);
+    b_id = matrix_room_state_event_id(b->event);
+
+    if ((a_id != NULL) || (b_id != NULL)) {
+        return g_strcmp0(a_id, b_id) == 0;
+    }
+
+    return matrix_room_state_json_equal(a->event, b->event);
+}
+
+/* An entry of the traversal stacks of matrix_room_state_diff(): either a whole subtree not
+ * looked into yet, or a single node whose subtrees are already on the stack */
+typedef struct {
+    MatrixRoomStateNode *node;
+    gboolean single;
+} MatrixRoomStateDiffItem;
+
+static void
+matrix_room_state_diff_push(GArray *stack, MatrixRoomStateNode *node, gboolean single)
+{
+    MatrixRoomStateDiffItem item = {node, single};
+
+    if (node != NULL) {
+        g_array_append_val(stack, item);
+    }
+}
+
+/*
+ * Replace the subtree on the top of stack with its left subtree, its root, and its right
+ * subtree, so the top of the stack is always the next part in key order.
+ */
+static void
+matrix_room_state_diff_expand(GArray *stack)
+{
+    MatrixRoomStateNode *node = g_array_index(stack, MatrixRoomStateDiffItem, stack->len - 1).node;
+
+    g_array_set_size(stack, stack->len - 1);
+    matrix_room_state_diff_push(stack, node->right, FALSE);
+    matrix_room_state_diff_push(stack, node, TRUE);
+    matrix_room_state_diff_push(stack, node->left, FALSE);
+}
+
+/**
+ * matrix_room_state_diff:
+ * @old_state: a #MatrixRoomState
+ * @new_state: another #MatrixRoomState
+ * @func: (scope call): the function to call for each difference
+ * @user_data: user data to pass to @func
+ *
+ * Call @func for each state entry that was added, removed or replaced between @old_state and
+ * @new_state, ordered by event type and state key.  Entries holding the same event (by event
+ * ID) in both states are skipped.
+ *
+ * Parts of the state shared by the two snapshots are skipped without looking into them, so
+ * comparing a state with one derived from it by k state events takes about O(k log n) time.
+ */
+void
+matrix_room_state_diff(MatrixRoomState *old_state, MatrixRoomState *new_state, MatrixRoomStateDiffFunc func, gpointer user_data)
+{
+    GArray *old_stack;
+    GArray *new_stack;
+
+    g_return_if_fail(old_state != NULL);
+    g_return_if_fail(new_state != NULL);
+    g_return_if_fail(func != NULL);
+
+    if (old_state->root == new_state->root) {
+        return;
+    }
+
+    old_stack = g_array_new(FALSE, FALSE, sizeof(MatrixRoomStateDiffItem));
+    new_stack = g_array_new(FALSE, FALSE, sizeof(MatrixRoomStateDiffItem));
+    matrix_room_state_diff_push(old_stack, old_state->root, FALSE);
+    matrix_room_state_diff_push(new_stack, new_state->root, FALSE);
+
+    /* Walk both trees in key order, like merging two sorted lists, but only open up subtrees
+     * as far as needed to compare them */
+    while ((old_stack->len > 0) || (new_stack->len > 0)) {
+        MatrixRoomStateDiffItem *old_item = (old_stack->len > 0) ? &g_array_index(old_stack, MatrixRoomStateDiffItem, old_stack->len - 1) : NULL;
+        MatrixRoomStateDiffItem *new_item = (new_stack->len > 0) ? &g_array_index(new_stack, MatrixRoomStateDiffItem, new_stack->len - 1) : NULL;
+        gint cmp;
+
+        if ((old_item != NULL) && (new_item != NULL)
+            && !old_item->single && !new_item->single
+            && (old_item->node == new_item->node)) {
+            /* A shared subtree holds the same entries in both states */
+            g_array_set_size(old_stack, old_stack->len - 1);
+            g_array_set_size(new_stack, new_stack->len - 1);
+
+            continue;
+        }
+
+        /* Open the subtree higher up in its tree first; it is the bigger one */
+        if ((old_item != NULL) && !old_item->single
+            && ((new_item == NULL) || new_item->single || (old_item->node->priority >= new_item->node->priority))) {
+            matrix_room_state_diff_expand(old_stack);
+
+            continue;
+        }
+
+        if ((new_item != NULL) && !new_item->single) {
+            matrix_room_state_diff_expand(new_stack);
+
+            continue;
+        }
+
+        if (old_item == NULL) {
+            cmp = 1;
+        } else if (new_item == NULL) {
+            cmp = -1;
+        } else {
+            cmp = matrix_room_state_compare(old_item->node->event_type, old_item->node->state_key, new_item->node);
+        }
+
+        if (cmp < 0) {
+            func(old_item->node->event_type, old_item->node->state_key, old_item->node->event, NULL, user_data);
+            g_array_set_size(old_stack, old_stack->len - 1);
+        } else if (cmp > 0) {
+            func(new_item->node->event_type, new_item->node->state_key, NULL, new_item->node->event, user_data);
+            g_array_set_size(new_stack, new_stack->len - 1);
+        } else {
+            if (!matrix_room_state_node_equal(old_item->node, new_item->node)) {
+                func(new_item->node->event_type, new_item->node->state_key, old_item->node->event, new_item->node->event, user_data);
+            }
+
+            g_array_set_size(old_stack, old_stack->len - 1);
+            g_array_set_size(new_stack, new_stack->len - 1);
+        }
+    }
+
+    g_array_unref(old_stack);
+    g_array_unref(new_stack);
+}
+
+/**
+ * matrix_room_state_foreach:
+ * @state: a #MatrixRoomState
+ * @event_type: (nullable): an event type, or %NULL for all types
+ * @func: (scope call): the function to call for each state entry
+ * @user_data: user data to pass to @func
+ *
+ * Call @func for each state event of @event_type in @state (eg. `m.room.member` for every
+ * member), ordered by event type and state key.  Only the matching part of the state is
+ * walked.
+ */
+void
+matrix_room_state_foreach(MatrixRoomState *matrix_room_state, const gchar *event_type, MatrixRoomStateFunc func, gpointer user_data)
+{
+    g_return_if_fail(matrix_room_state != NULL);
+    g_return_if_fail(func != NULL);
+
+    matrix_room_state_node_foreach(matrix_room_state->root, event_type, func, user_data);
+}
@@ -0,0 +1,47 @@
+/*
+ * This file is part of matrix-glib-sdk
+ *
+ * matrix-glib-sdk is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * matrix-glib-sdk is distributed in the hope that it will be
+ * useful, but WITHOUT ANY WARRANTY; without even the implied
+ * warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with matrix-glib-sdk. If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __MATRIX_GLIB_SDK_ROOM_STATE_H__
+# define __MATRIX_GLIB_SDK_ROOM_STATE_H__
+
+# include <glib-object.h>
+# include <json-glib/json-glib.h>
+
+G_BEGIN_DECLS
+
+typedef struct _MatrixRoomState MatrixRoomState;
+
+typedef void (*MatrixRoomStateFunc)(const gchar *event_type, const gchar *state_key, JsonNode *event, gpointer user_data);
+typedef void (*MatrixRoomStateDiffFunc)(const gchar *event_type, const gchar *state_key, JsonNode *old_event, JsonNode *new_event, gpointer user_data);
+
+GType matrix_room_state_get_type(void);
+# define MATRIX_TYPE_ROOM_STATE matrix_room_state_get_type()
+
+MatrixRoomState *matrix_room_state_new(void);
+MatrixRoomState *matrix_room_state_ref(MatrixRoomState *state);
+void matrix_room_state_unref(MatrixRoomState *state);
+MatrixRoomState *matrix_room_state_apply_event(MatrixRoomState *state, JsonNode *event);
+JsonNode *matrix_room_state_lookup(MatrixRoomState *state, const gchar *event_type, const gchar *state_key);
+guint matrix_room_state_get_size(MatrixRoomState *state);
+const gchar *matrix_room_state_get_event_id(MatrixRoomState *state);
+void matrix_room_state_foreach(MatrixRoomState *state, const gchar *event_type, MatrixRoomStateFunc func, gpointer user_data);
+void matrix_room_state_diff(MatrixRoomState *old_state, MatrixRoomState *new_state, MatrixRoomStateDiffFunc func, gpointer user_data);
+
+G_END_DECLS
+
+#endif  /* __MATRIX_GLIB_SDK_ROOM_STATE_H__ */
@@ -18,6 +18,8 @@
 
 #include "matrix-room.h"
 #include "matrix-enumtypes.h"
+#include "matrix-marshalers.h"
+#include "utils-private.h"
 
 /**
  * SECTION:matrix-room
@@ -47,20 +49,77 @@ enum  {
     PROP_KICK_LEVEL,
     PROP_REDACT_LEVEL,
     PROP_INVITE_LEVEL,
+    PROP_ROOM_NOTIFICATION_LEVEL,
     PROP_TOPIC,
     PROP_TYPING_USERS,
     PROP_AVATAR_INFO,
     PROP_AVATAR_THUMBNAIL_INFO,
+    PROP_TIMELINE_CAPACITY,
+    PROP_TIMELINE_MEMORY_BUDGET,
+    PROP_UNREAD_COUNT,
+    PROP_NOTIFICATION_COUNT,
+    PROP_HIGHLIGHT_COUNT,
+    PROP_DISPLAY_NAME,
+    PROP_STATE_HISTORY_SIZE,
     NUM_PROPERTIES
 };
 
 static GParamSpec *matrix_room_properties[NUM_PROPERTIES];
 
+enum {
+    SIGNAL_TIMELINE_PAGINATED,
+    SIGNAL_TIMELINE_EVENT_FETCHED,
+    SIGNAL_STATE_CHANGED,
+    NUM_SIGNALS
+};
+
+static guint matrix_room_signals[NUM_SIGNALS];
+
+/* The timeline is off by default, as every event it holds has to be decoded */
+#define MATRIX_ROOM_TIMELINE_DEFAULT_CAPACITY 0
+
+/* Start fetching older events when a consumer gets this close to the edge of the known
+ * timeline */
+#define MATRIX_ROOM_PREFETCH_DISTANCE 10
+#define MATRIX_ROOM_PAGINATION_LIMIT 50
+
+typedef struct {
+    MatrixEventRoom *event;
+    gsize size;
+
+    /* TRUE if there is a known gap right before this event, ie. it is a key of timeline_gaps.
+     * This lets timeline accessors find nearby gaps without looking them up one by one. */
+    gboolean gap_before;
+} MatrixRoomTimelineEntry;
+
 typedef struct {
     MatrixProfile* profile;
     gboolean thirdparty;
+    MatrixRoomMembership membership;
+
+    /* For the display name index: name is the display name the member is indexed with, and
+     * name_handler follows the changes of profile */
+    MatrixRoom *room;
+    gchar *user_id;
+    gchar *name;
+    gulong name_handler;
 } MatrixRoomMemberData;
 
+/* A recorded state, and its link in state_history_order */
+typedef struct {
+    MatrixRoomState *state;
+    GList *link;
+} MatrixRoomStateSnapshot;
+
+/* The latest receipt of a user with a receipt type.  receipt_type is an interned string for
+ * the receipt types defined by the spec, and a copy owned by the receipt for any other. */
+typedef struct {
+    gchar *user_id;
+    const gchar *receipt_type;
+    gchar *event_id;
+    guint64 ts;
+} MatrixRoomReceipt;
+
 MatrixRoomMemberData *
 matrix_room_member_data_new(void)
 {
@@ -72,7 +131,13 @@ matrix_room_member_data_free(MatrixRoomMemberData *member_data)
 {
     g_return_if_fail(member_data != NULL);
 
+    if (member_data->name_handler != 0) {
+        g_signal_handler_disconnect(member_data->profile, member_data->name_handler);
+    }
+
     g_object_unref(member_data->profile);
+    g_free(member_data->user_id);
+    g_free(member_data->name);
     g_free(member_data);
 }
 
@@ -98,12 +163,75 @@ typedef struct {
     gint kick_level;
     gint redact_level;
     gint invite_level;
+    gint room_notification_level;
     gchar *topic;
     gchar **typing_users;
     gint typing_users_len;
     GHashTable* event_levels;
     GHashTable* user_levels;
     GHashTable* members;
+    guint n_third_party_members;
+
+    /* The number of members whose membership was set to join with
+     * matrix_room_set_member_membership() */
+    guint n_joined_members;
+
+    /* Display name => set of the user IDs of members using it */
+    GHashTable *member_names;
+
+    /* The timeline is a ring buffer of timeline_capacity entries, of which timeline_len are
+     * used, starting at timeline_start (the oldest event) */
+    MatrixRoomTimelineEntry *timeline;
+    guint timeline_capacity;
+    guint timeline_start;
+    guint timeline_len;
+    gsize timeline_size;
+    guint64 timeline_memory_budget;
+    GHashTable *timeline_index;
+
+    /* Back pagination state.  timeline_start_token can be used to fetch events older than
+     * the oldest one in the timeline; timeline_gaps maps event IDs to the token for fetching
+     * the events missing right before them. */
+    gchar *timeline_start_token;
+    GHashTable *timeline_gaps;
+    gchar *pending_gap_token;
+    MatrixAPI *api;
+    gboolean back_paginating;
+    gchar *paginating_gap;
+
+    /* Read receipts.  receipts is a set of MatrixRoomReceipt, keyed by user and receipt type;
+     * receipt_readers maps event IDs to the set of receipts pointing at them. */
+    GHashTable *receipts;
+    GHashTable *receipt_readers;
+
+    /* unread_count is counted locally from the timeline and our own receipts; the other two
+     * come from the server */
+    guint unread_count;
+    guint notification_count;
+    guint highlight_count;
+
+    /* The room summary, as received in /sync, and the display name computed from it.  If the
+     * member counts were never received, the member list is counted instead. */
+    gchar **heroes;
+    gint heroes_len;
+    gboolean has_member_counts;
+    guint joined_member_count;
+    guint invited_member_count;
+    gchar *display_name;
+
+    /* Changes are collected while update_depth is positive, and emitted in one
+     * MatrixRoom::state-changed signal when the outermost update ends */
+    guint update_depth;
+    MatrixRoomChanges pending_changes;
+
+    /* The current state, and the snapshots kept of earlier states (MatrixRoomStateSnapshot),
+     * keyed by event ID (or any other ID passed to matrix_room_snapshot_state()).
+     * state_history_order holds the keys of state_history in the order they were recorded, so
+     * the oldest can be dropped first. */
+    MatrixRoomState *state;
+    GHashTable *state_history;
+    GQueue state_history_order;
+    guint state_history_size;
 } MatrixRoomPrivate;
 
 /**
@@ -114,6 +242,263 @@ typedef struct {
  */
 G_DEFINE_TYPE_WITH_PRIVATE(MatrixRoom, matrix_room, G_TYPE_OBJECT);
 
+/* The kind of change each property belongs to */
+static const MatrixRoomChanges matrix_room_property_changes[NUM_PROPERTIES] = {
+    [PROP_ROOM_ID] = MATRIX_ROOM_CHANGES_OTHER,
+    [PROP_ALIASES] = MATRIX_ROOM_CHANGES_NAME,
+    [PROP_AVATAR_URL] = MATRIX_ROOM_CHANGES_AVATAR,
+    [PROP_AVATAR_THUMBNAIL_URL] = MATRIX_ROOM_CHANGES_AVATAR,
+    [PROP_CANONICAL_ALIAS] = MATRIX_ROOM_CHANGES_NAME,
+    [PROP_CREATOR] = MATRIX_ROOM_CHANGES_SETTINGS,
+    [PROP_FEDERATE] = MATRIX_ROOM_CHANGES_SETTINGS,
+    [PROP_GUEST_ACCESS] = MATRIX_ROOM_CHANGES_SETTINGS,
+    [PROP_HISTORY_VISIBILITY] = MATRIX_ROOM_CHANGES_SETTINGS,
+    [PROP_JOIN_RULES] = MATRIX_ROOM_CHANGES_SETTINGS,
+    [PROP_NAME] = MATRIX_ROOM_CHANGES_NAME,
+    [PROP_DEFAULT_POWER_LEVEL] = MATRIX_ROOM_CHANGES_POWER_LEVELS,
+    [PROP_DEFAULT_EVENT_LEVEL] = MATRIX_ROOM_CHANGES_POWER_LEVELS,
+    [PROP_DEFAULT_STATE_LEVEL] = MATRIX_ROOM_CHANGES_POWER_LEVELS,
+    [PROP_BAN_LEVEL] = MATRIX_ROOM_CHANGES_POWER_LEVELS,
+    [PROP_KICK_LEVEL] = MATRIX_ROOM_CHANGES_POWER_LEVELS,
+    [PROP_REDACT_LEVEL] = MATRIX_ROOM_CHANGES_POWER_LEVELS,
+    [PROP_INVITE_LEVEL] = MATRIX_ROOM_CHANGES_POWER_LEVELS,
+    [PROP_ROOM_NOTIFICATION_LEVEL] = MATRIX_ROOM_CHANGES_POWER_LEVELS,
+    [PROP_TOPIC] = MATRIX_ROOM_CHANGES_TOPIC,
+    [PROP_TYPING_USERS] = MATRIX_ROOM_CHANGES_TYPING,
+    [PROP_AVATAR_INFO] = MATRIX_ROOM_CHANGES_AVATAR,
+    [PROP_AVATAR_THUMBNAIL_INFO] = MATRIX_ROOM_CHANGES_AVATAR,
+    [PROP_TIMELINE_CAPACITY] = MATRIX_ROOM_CHANGES_OTHER,
+    [PROP_TIMELINE_MEMORY_BUDGET] = MATRIX_ROOM_CHANGES_OTHER,
+    [PROP_UNREAD_COUNT] = MATRIX_ROOM_CHANGES_UNREAD,
+    [PROP_NOTIFICATION_COUNT] = MATRIX_ROOM_CHANGES_UNREAD,
+    [PROP_HIGHLIGHT_COUNT] = MATRIX_ROOM_CHANGES_UNREAD,
+    [PROP_DISPLAY_NAME] = MATRIX_ROOM_CHANGES_NAME,
+    [PROP_STATE_HISTORY_SIZE] = MATRIX_ROOM_CHANGES_OTHER,
+};
+
+static void
+matrix_room_emit_changes(MatrixRoom *matrix_room)
+{
+    MatrixRoomPrivate *priv = matrix_room_get_instance_private(matrix_room);
+    MatrixRoomChanges changes = priv->pending_changes;
+
+    if (changes == MATRIX_ROOM_CHANGES_NONE) {
+        return;
+    }
+
+    priv->pending_changes = MATRIX_ROOM_CHANGES_NONE;
+
+    g_signal_emit(matrix_room, matrix_room_signals[SIGNAL_STATE_CHANGED], 0, changes);
+}
+
+/*
+ * Record a change.  Outside of matrix_room_begin_update()/matrix_room_end_update() it is
+ * emitted right away.
+ */
+static void
+matrix_room_add_changes(MatrixRoom *matrix_room, MatrixRoomChanges changes)
+{
+    MatrixRoomPrivate *priv = matrix_room_get_instance_private(matrix_room);
+
+    priv->pending_changes |= changes;
+
+    if (priv->update_depth == 0) {
+        matrix_room_emit_changes(matrix_room);
+    }
+}
+
+static gboolean
+matrix_room_is_hero(MatrixRoomPrivate *priv, const gchar *user_id)
+{
+    for (gint i = 0; i < priv->heroes_len; i++) {
+        if (g_strcmp0(priv->heroes[i], user_id) == 0) {
+            return TRUE;
+        }
+    }
+
+    return FALSE;
+}
+
+static void
+matrix_room_index_member(MatrixRoomPrivate *priv, MatrixRoomMemberData *data)
+{
+    const gchar *display_name = matrix_profile_get_display_name(data->profile);
+    GHashTable *users;
+
+    if ((display_name == NULL) || (*display_name == '\0')) {
+        return;
+    }
+
+    data->name = g_strdup(display_name);
+
+    if ((users = g_hash_table_lookup(priv->member_names, data->name)) == NULL) {
+        users = g_hash_table_new(g_str_hash, g_str_equal);
+        g_hash_table_insert(priv->member_names, g_strdup(data->name), users);
+    }
+
+    g_hash_table_add(users, data->user_id);
+}
+
+static void
+matrix_room_unindex_member(MatrixRoomPrivate *priv, MatrixRoomMemberData *data)
+{
+    GHashTable *users;
+
+    if (data->name == NULL) {
+        return;
+    }
+
+    if ((users = g_hash_table_lookup(priv->member_names, data->name)) != NULL) {
+        g_hash_table_remove(users, data->user_id);
+
+        if (g_hash_table_size(users) == 0) {
+            g_hash_table_remove(priv->member_names, data->name);
+        }
+    }
+
+    g_free(data->name);
+    data->name = NULL;
+}
+
+/*
+ * Get the name of a member as the specification describes it: the display name, followed by
+ * the user ID if another member uses the same display name, or just the user ID if there is
+ * no display name.
+ */
+static gchar *
+matrix_room_format_member_name(MatrixRoomPrivate *priv, const gchar *user_id)
+{
+    MatrixRoomMemberData *data;
+    GHashTable *users;
+
+    if (((data = g_hash_table_lookup(priv->members, user_id)) == NULL) || (data->name == NULL)) {
+        return g_strdup(user_id);
+    }
+
+    if (((users = g_hash_table_lookup(priv->member_names, data->name)) != NULL)
+        && (g_hash_table_size(users) > 1)) {
+        return g_strdup_printf("%s (%s)", data->name, user_id);
+    }
+
+    return g_strdup(data->name);
+}
+
+/*
+ * Check if a member using name as display name affects the name of a hero, and thus the
+ * display name of the room.
+ */
+static gboolean
+matrix_room_name_affects_heroes(MatrixRoomPrivate *priv, const gchar *user_id, const gchar *name)
+{
+    if (matrix_room_is_hero(priv, user_id)) {
+        return TRUE;
+    }
+
+    if (name == NULL) {
+        return FALSE;
+    }
+
+    for (gint i = 0; i < priv->heroes_len; i++) {
+        MatrixRoomMemberData *data = g_hash_table_lookup(priv->members, priv->heroes[i]);
+
+        if ((data != NULL) && (g_strcmp0(data->name, name) == 0)) {
+            return TRUE;
+        }
+    }
+
+    return FALSE;
+}
+
+/*
+ * Compute the display name of the room as the specification describes it: the room name, the
+ * canonical alias, or the names of the heroes.
+ */
+static gchar *
+matrix_room_compute_display_name(MatrixRoomPrivate *priv)
+{
+    GString *heroes;
+    guint n_members;
+
+    if ((priv->name != NULL) && (*(priv->name) != '\0')) {
+        return g_strdup(priv->name);
+    }
+
+    if ((priv->canonical_alias != NULL) && (*(priv->canonical_alias) != '\0')) {
+        return g_strdup(priv->canonical_alias);
+    }
+
+    if (priv->has_member_counts) {
+        n_members = priv->joined_member_count + priv->invited_member_count;
+    } else {
+        n_members = g_hash_table_size(priv->members) - priv->n_third_party_members;
+    }
+
+    if (priv->heroes_len == 0) {
+        return g_strdup("Empty room");
+    }
+
+    heroes = g_string_new(NULL);
+
+    for (gint i = 0; i < priv->heroes_len; i++) {
+        gchar *hero_name = matrix_room_format_member_name(priv, priv->heroes[i]);
+
+        if (i > 0) {
+            g_string_append(heroes, ((i == priv->heroes_len - 1) && (n_members <= (guint)priv->heroes_len + 1)) ? " and " : ", ");
+        }
+
+        g_string_append(heroes, hero_name);
+        g_free(hero_name);
+    }
+
+    if (n_members <= 1) {
+        gchar *display_name = g_strdup_printf("Empty room (was %s)", heroes->str);
+
+        g_string_free(heroes, TRUE);
+
+        return display_name;
+    }
+
+    if (n_members > (guint)priv->heroes_len + 1) {
+        g_string_append_printf(heroes, " and %u others", n_members - priv->heroes_len - 1);
+    }
+
+    return g_string_free(heroes, FALSE);
+}
+
+static void
+matrix_room_update_display_name(MatrixRoom *matrix_room)
+{
+    MatrixRoomPrivate *priv = matrix_room_get_instance_private(matrix_room);
+    gchar *display_name = matrix_room_compute_display_name(priv);
+
+    if (g_strcmp0(display_name, priv->display_name) == 0) {
+        g_free(display_name);
+
+        return;
+    }
+
+    g_free(priv->display_name);
+    priv->display_name = display_name;
+
+    g_object_notify_by_pspec((GObject *)matrix_room, matrix_room_properties[PROP_DISPLAY_NAME]);
+}
+
+static void
+matrix_room_member_name_changed(MatrixProfile *profile, GParamSpec *pspec, MatrixRoomMemberData *data)
+{
+    MatrixRoomPrivate *priv = matrix_room_get_instance_private(data->room);
+    gboolean affects_heroes = matrix_room_name_affects_heroes(priv, data->user_id, data->name);
+
+    matrix_room_unindex_member(priv, data);
+    matrix_room_index_member(priv, data);
+
+    if (affects_heroes || matrix_room_name_affects_heroes(priv, data->user_id, data->name)) {
+        matrix_room_update_display_name(data->room);
+    }
+
+    matrix_room_add_changes(data->room, MATRIX_ROOM_CHANGES_MEMBERS);
+}
+
 /**
  * matrix_room_new:
  * @room_id: a room ID
@@ -170,8 +555,23 @@ matrix_room_add_member(MatrixRoom *matrix_room, const gchar *user_id, MatrixProf
     }
 
     data->thirdparty = third_party;
+    data->room = matrix_room;
+    data->user_id = g_strdup(user_id);
+
+    if (third_party) {
+        priv->n_third_party_members++;
+    }
 
     g_hash_table_insert(priv->members, g_strdup(user_id), data);
+
+    matrix_room_index_member(priv, data);
+    data->name_handler = g_signal_connect(data->profile, "notify::display-name", G_CALLBACK(matrix_room_member_name_changed), data);
+
+    if (!priv->has_member_counts || matrix_room_name_affects_heroes(priv, user_id, data->name)) {
+        matrix_room_update_display_name(matrix_room);
+    }
+
+    matrix_room_add_changes(matrix_room, MATRIX_ROOM_CHANGES_MEMBERS);
 }
 
 /**
@@ -201,7 +601,7 @@ matrix_room_get_or_add_member(MatrixRoom *matrix_room, const gchar *user_id, gbo
         return profile;
     }
 
-    if ((inner_error->domain != MATRIX_ERROR) || (inner_error->code == MATRIX_ERROR_NOT_FOUND)) {
+    if ((inner_error->domain != MATRIX_ERROR) || (inner_error->code != MATRIX_ERROR_NOT_FOUND)) {
         g_propagate_error(error, inner_error);
 
         return NULL;
@@ -278,6 +678,7 @@ matrix_room_remove_member(MatrixRoom *matrix_room, const gchar *user_id, GError
 {
     MatrixRoomMemberData *data;
     MatrixRoomPrivate *priv;
+    gboolean affects_heroes;
 
     g_return_if_fail(matrix_room != NULL);
     g_return_if_fail(user_id != NULL);
@@ -291,7 +692,136 @@ matrix_room_remove_member(MatrixRoom *matrix_room, const gchar *user_id, GError
         return;
     }
 
+    if (data->thirdparty) {
+        priv->n_third_party_members--;
+    }
+
+    if (data->membership == MATRIX_ROOM_MEMBERSHIP_JOIN) {
+        priv->n_joined_members--;
+    }
+
+    affects_heroes = matrix_room_name_affects_heroes(priv, user_id, data->name);
+    matrix_room_unindex_member(priv, data);
     g_hash_table_remove(priv->members, user_id);
+
+    if (!priv->has_member_counts || affects_heroes) {
+        matrix_room_update_display_name(matrix_room);
+    }
+
+    matrix_room_add_changes(matrix_room, MATRIX_ROOM_CHANGES_MEMBERS);
+}
+
+/**
+ * matrix_room_set_member_membership:
+ * @room: a #MatrixRoom
+ * @user_id: a Matrix ID
+ * @membership: the membership of @user_id, as in their latest m.room.member event
+ *
+ * Set the membership of @user_id in @room.  The user is added to the member list if needed.
+ * This is what the number of joined members is counted from, if the room summary doesn’t
+ * tell it; see matrix_room_get_joined_member_count().
+ */
+void
+matrix_room_set_member_membership(MatrixRoom *matrix_room, const gchar *user_id, MatrixRoomMembership membership)
+{
+    MatrixRoomPrivate *priv;
+    MatrixRoomMemberData *data;
+
+    g_return_if_fail(matrix_room != NULL);
+    g_return_if_fail(user_id != NULL);
+
+    priv = matrix_room_get_instance_private(matrix_room);
+
+    if ((data = g_hash_table_lookup(priv->members, user_id)) == NULL) {
+        matrix_room_add_member(matrix_room, user_id, NULL, FALSE, NULL);
+
+        if ((data = g_hash_table_lookup(priv->members, user_id)) == NULL) {
+            return;
+        }
+    }
+
+    if (data->membership == membership) {
+        return;
+    }
+
+    if (data->membership == MATRIX_ROOM_MEMBERSHIP_JOIN) {
+        priv->n_joined_members--;
+    } else if (membership == MATRIX_ROOM_MEMBERSHIP_JOIN) {
+        priv->n_joined_members++;
+    }
+
+    data->membership = membership;
+
+    matrix_room_add_changes(matrix_room, MATRIX_ROOM_CHANGES_MEMBERS);
+}
+
+/**
+ * matrix_room_get_member_name:
+ * @room: a #MatrixRoom
+ * @user_id: a Matrix ID
+ *
+ * Get the name to display for @user_id in @room.  This is the display name of the member,
+ * followed by the user ID in parentheses if another member of @room uses the same display
+ * name.  If the member has no display name, or is not a member of @room, it is the user ID.
+ *
+ * Members are indexed by their display names, so this doesn’t depend on the size of the
+ * room.
+ *
+ * Returns: (transfer full): the disambiguated name of @user_id
+ */
+gchar *
+matrix_room_get_member_name(MatrixRoom *matrix_room, const gchar *user_id)
+{
+    MatrixRoomPrivate *priv;
+
+    g_return_val_if_fail(matrix_room != NULL, NULL);
+    g_return_val_if_fail(user_id != NULL, NULL);
+
+    priv = matrix_room_get_instance_private(matrix_room);
+
+    return matrix_room_format_member_name(priv, user_id);
+}
+
+/**
+ * matrix_room_is_member_name_ambiguous:
+ * @room: a #MatrixRoom
+ * @display_name: a display name
+ *
+ * Returns: %TRUE if more than one member of @room uses @display_name
+ */
+gboolean
+matrix_room_is_member_name_ambiguous(MatrixRoom *matrix_room, const gchar *display_name)
+{
+    MatrixRoomPrivate *priv;
+    GHashTable *users;
+
+    g_return_val_if_fail(matrix_room != NULL, FALSE);
+    g_return_val_if_fail(display_name != NULL, FALSE);
+
+    priv = matrix_room_get_instance_private(matrix_room);
+
+    return ((users = g_hash_table_lookup(priv->member_names, display_name)) != NULL)
+        && (g_hash_table_size(users) > 1);
+}
+
+/**
+ * matrix_room_get_n_members:
+ * @room: a #MatrixRoom
+ *
+ * Get the number of members in @room, not counting pending 3rd party invitations.
+ *
+ * Returns: the number of room members
+ */
+guint
+matrix_room_get_n_members(MatrixRoom *matrix_room)
+{
+    MatrixRoomPrivate *priv;
+
+    g_return_val_if_fail(matrix_room != NULL, 0);
+
+    priv = matrix_room_get_instance_private(matrix_room);
+
+    return g_hash_table_size(priv->members) - priv->n_third_party_members;
 }
 
 /**
@@ -310,7 +840,10 @@ matrix_room_clear_user_levels(MatrixRoom *matrix_room)
 
     priv = matrix_room_get_instance_private(matrix_room);
 
-    g_hash_table_remove_all(priv->user_levels);
+    if (g_hash_table_size(priv->user_levels) > 0) {
+        g_hash_table_remove_all(priv->user_levels);
+        matrix_room_add_changes(matrix_room, MATRIX_ROOM_CHANGES_POWER_LEVELS);
+    }
 }
 
 /**
@@ -325,13 +858,20 @@ void
 matrix_room_set_user_level(MatrixRoom *matrix_room, const gchar *user_id, gint level)
 {
     MatrixRoomPrivate *priv;
+    gpointer old_level;
 
     g_return_if_fail(matrix_room != NULL);
     g_return_if_fail(user_id != NULL);
 
     priv = matrix_room_get_instance_private(matrix_room);
 
-    g_hash_table_insert (priv->user_levels, g_strdup(user_id), GINT_TO_POINTER(level));
+    if (g_hash_table_lookup_extended(priv->user_levels, user_id, NULL, &old_level)
+        && (GPOINTER_TO_INT(old_level) == level)) {
+        return;
+    }
+
+    g_hash_table_insert(priv->user_levels, g_strdup(user_id), GINT_TO_POINTER(level));
+    matrix_room_add_changes(matrix_room, MATRIX_ROOM_CHANGES_POWER_LEVELS);
 }
 
 /**
@@ -379,7 +919,10 @@ matrix_room_clear_event_levels(MatrixRoom *matrix_room)
 
     priv = matrix_room_get_instance_private(matrix_room);
 
-    g_hash_table_remove_all(priv->event_levels);
+    if (g_hash_table_size(priv->event_levels) > 0) {
+        g_hash_table_remove_all(priv->event_levels);
+        matrix_room_add_changes(matrix_room, MATRIX_ROOM_CHANGES_POWER_LEVELS);
+    }
 }
 
 /**
@@ -394,13 +937,20 @@ void
 matrix_room_set_event_level(MatrixRoom *matrix_room, const gchar *event_type, gint level)
 {
     MatrixRoomPrivate *priv;
+    gpointer old_level;
 
     g_return_if_fail(matrix_room != NULL);
     g_return_if_fail (event_type != NULL);
 
     priv = matrix_room_get_instance_private(matrix_room);
 
+    if (g_hash_table_lookup_extended(priv->event_levels, event_type, NULL, &old_level)
+        && (GPOINTER_TO_INT(old_level) == level)) {
+        return;
+    }
+
     g_hash_table_insert(priv->event_levels, g_strdup(event_type), GINT_TO_POINTER(level));
+    matrix_room_add_changes(matrix_room, MATRIX_ROOM_CHANGES_POWER_LEVELS);
 }
 
 /**
@@ -435,20 +985,194 @@ matrix_room_get_event_level(MatrixRoom *matrix_room, const gchar *event_type, GE
     return GPOINTER_TO_INT(level);
 }
 
-const gchar *
-matrix_room_get_room_id(MatrixRoom *matrix_room)
+/*
+ * Make levels equal to new_levels (or empty, if new_levels is NULL), touching only the
+ * entries that differ.  Keys are only copied for new entries.  Returns TRUE if anything
+ * changed.
+ */
+static gboolean
+matrix_room_apply_levels(GHashTable *levels, GHashTable *new_levels)
 {
-    MatrixRoomPrivate *priv;
+    GHashTableIter iter;
+    gpointer key;
+    gpointer level;
+    gboolean changed = FALSE;
 
-    g_return_val_if_fail(matrix_room != NULL, NULL);
+    g_hash_table_iter_init(&iter, levels);
 
-    priv = matrix_room_get_instance_private(matrix_room);
+    while (g_hash_table_iter_next(&iter, &key, NULL)) {
+        if ((new_levels == NULL) || !g_hash_table_contains(new_levels, key)) {
+            g_hash_table_iter_remove(&iter);
+            changed = TRUE;
+        }
+    }
 
-    return priv->room_id;
+    if (new_levels == NULL) {
+        return changed;
+    }
+
+    g_hash_table_iter_init(&iter, new_levels);
+
+    while (g_hash_table_iter_next(&iter, &key, &level)) {
+        gpointer old_key;
+        gpointer old_level;
+
+        if (!g_hash_table_lookup_extended(levels, key, &old_key, &old_level)) {
+            g_hash_table_insert(levels, g_strdup(key), level);
+            changed = TRUE;
+        } else if (old_level != level) {
+            /* Re-insert the key we already own, instead of copying it again */
+            g_hash_table_steal(levels, old_key);
+            g_hash_table_insert(levels, old_key, level);
+            changed = TRUE;
+        }
+    }
+
+    return changed;
 }
 
-static void
-matrix_room_set_room_id(MatrixRoom *matrix_room, const gchar *room_id)
+/**
+ * matrix_room_set_user_levels:
+ * @room: a #MatrixRoom
+ * @user_levels: (nullable): a table of user IDs and power levels, like the one returned by
+ *     matrix_event_room_power_levels_get_user_levels()
+ *
+ * Replace the individual user levels of @room with @user_levels.  Only the differences are
+ * applied, so this is cheap if only a few levels changed.  The levels are copied; @room
+ * doesn’t keep a reference to @user_levels.
+ */
+void
+matrix_room_set_user_levels(MatrixRoom *matrix_room, GHashTable *user_levels)
+{
+    MatrixRoomPrivate *priv;
+
+    g_return_if_fail(matrix_room != NULL);
+
+    priv = matrix_room_get_instance_private(matrix_room);
+
+    if (matrix_room_apply_levels(priv->user_levels, user_levels)) {
+        matrix_room_add_changes(matrix_room, MATRIX_ROOM_CHANGES_POWER_LEVELS);
+    }
+}
+
+/**
+ * matrix_room_set_event_levels:
+ * @room: a #MatrixRoom
+ * @event_levels: (nullable): a table of event types and power levels, like the one returned
+ *     by matrix_event_room_power_levels_get_event_levels()
+ *
+ * Replace the event level requirements of @room with @event_levels.  Only the differences
+ * are applied.
+ */
+void
+matrix_room_set_event_levels(MatrixRoom *matrix_room, GHashTable *event_levels)
+{
+    MatrixRoomPrivate *priv;
+
+    g_return_if_fail(matrix_room != NULL);
+
+    priv = matrix_room_get_instance_private(matrix_room);
+
+    if (matrix_room_apply_levels(priv->event_levels, event_levels)) {
+        matrix_room_add_changes(matrix_room, MATRIX_ROOM_CHANGES_POWER_LEVELS);
+    }
+}
+
+/**
+ * matrix_room_get_required_level:
+ * @room: a #MatrixRoom
+ * @event_type: an event type
+ * @state_event: %TRUE if @event_type is a state event
+ *
+ * Get the level required to send an event of type @event_type.  Unlike
+ * matrix_room_get_event_level(), this falls back to #MatrixRoom:default-state-level or
+ * #MatrixRoom:default-event-level if there is no requirement for @event_type.
+ *
+ * Returns: the level required to send @event_type
+ */
+gint
+matrix_room_get_required_level(MatrixRoom *matrix_room, const gchar *event_type, gboolean state_event)
+{
+    MatrixRoomPrivate *priv;
+    gpointer level;
+
+    g_return_val_if_fail(matrix_room != NULL, 0);
+    g_return_val_if_fail(event_type != NULL, 0);
+
+    priv = matrix_room_get_instance_private(matrix_room);
+
+    if (g_hash_table_lookup_extended(priv->event_levels, event_type, NULL, &level)) {
+        return GPOINTER_TO_INT(level);
+    }
+
+    return state_event ? priv->default_state_level : priv->default_event_level;
+}
+
+/**
+ * matrix_room_check_user_levels:
+ * @room: a #MatrixRoom
+ * @required_level: the required power level, eg. the result of
+ *     matrix_room_get_required_level() or matrix_room_get_ban_level()
+ * @user_ids: (array length=n_user_ids): a list of user IDs
+ * @n_user_ids: the length of @user_ids
+ * @allowed: (out caller-allocates) (array length=n_user_ids) (nullable): placeholder for the
+ *     result for each user, or %NULL to ignore
+ *
+ * Check which of @user_ids have at least @required_level in @room.  This is cheaper than
+ * calling matrix_room_get_user_level() for each user: the required level is computed by the
+ * caller once, and each user costs one lookup.
+ *
+ * Returns: the number of users in @user_ids that have @required_level
+ */
+guint
+matrix_room_check_user_levels(MatrixRoom *matrix_room, gint required_level, const gchar **user_ids, int n_user_ids, gboolean *allowed)
+{
+    MatrixRoomPrivate *priv;
+    gboolean default_allowed;
+    guint n_allowed = 0;
+
+    g_return_val_if_fail(matrix_room != NULL, 0);
+    g_return_val_if_fail((user_ids != NULL) || (n_user_ids == 0), 0);
+
+    priv = matrix_room_get_instance_private(matrix_room);
+    default_allowed = (priv->default_power_level >= required_level);
+
+    for (gint i = 0; i < n_user_ids; i++) {
+        gpointer level;
+        gboolean user_allowed;
+
+        if (g_hash_table_lookup_extended(priv->user_levels, user_ids[i], NULL, &level)) {
+            user_allowed = (GPOINTER_TO_INT(level) >= required_level);
+        } else {
+            user_allowed = default_allowed;
+        }
+
+        if (allowed != NULL) {
+            allowed[i] = user_allowed;
+        }
+
+        if (user_allowed) {
+            n_allowed++;
+        }
+    }
+
+    return n_allowed;
+}
+
+const gchar *
+matrix_room_get_room_id(MatrixRoom *matrix_room)
+{
+    MatrixRoomPrivate *priv;
+
+    g_return_val_if_fail(matrix_room != NULL, NULL);
+
+    priv = matrix_room_get_instance_private(matrix_room);
+
+    return priv->room_id;
+}
+
+static void
+matrix_room_set_room_id(MatrixRoom *matrix_room, const gchar *room_id)
 {
     MatrixRoomPrivate *priv;
 
@@ -659,6 +1383,8 @@ matrix_room_set_canonical_alias(MatrixRoom *matrix_room, const gchar *canonical_
         priv->canonical_alias = g_strdup(canonical_alias);
 
         g_object_notify_by_pspec((GObject *)matrix_room, matrix_room_properties[PROP_CANONICAL_ALIAS]);
+
+        matrix_room_update_display_name(matrix_room);
     }
 }
 
@@ -829,7 +1555,164 @@ matrix_room_set_name(MatrixRoom *matrix_room, const gchar *name)
         priv->name = g_strdup(name);
 
         g_object_notify_by_pspec((GObject *)matrix_room, matrix_room_properties[PROP_NAME]);
+
+        matrix_room_update_display_name(matrix_room);
+    }
+}
+
+/**
+ * matrix_room_get_heroes:
+ * @room: a #MatrixRoom
+ * @n_heroes: (nullable): placeholder for the length of the list, or %NULL to ignore
+ *
+ * Get the heroes of @room, the members that are used to name it if it has no name or
+ * canonical alias.
+ *
+ * Returns: (transfer none) (nullable): the user IDs of the heroes.  The returned value is
+ *     owned by @room and should not be freed.
+ */
+gchar **
+matrix_room_get_heroes(MatrixRoom *matrix_room, int *n_heroes)
+{
+    MatrixRoomPrivate *priv;
+
+    g_return_val_if_fail(matrix_room != NULL, NULL);
+
+    priv = matrix_room_get_instance_private(matrix_room);
+
+    if (n_heroes != NULL) {
+        *n_heroes = priv->heroes_len;
+    }
+
+    return priv->heroes;
+}
+
+/**
+ * matrix_room_set_heroes:
+ * @room: a #MatrixRoom
+ * @heroes: the user IDs of the heroes, as received in the `m.heroes` field of the room summary
+ * @n_heroes: the length of @heroes
+ *
+ * Set the heroes of @room, and update #MatrixRoom:display-name with their names.
+ */
+void
+matrix_room_set_heroes(MatrixRoom *matrix_room, const gchar **heroes, int n_heroes)
+{
+    MatrixRoomPrivate *priv;
+
+    g_return_if_fail(matrix_room != NULL);
+
+    priv = matrix_room_get_instance_private(matrix_room);
+
+    for (gint i = 0; i < priv->heroes_len; i++) {
+        g_free(priv->heroes[i]);
+    }
+
+    g_free(priv->heroes);
+
+    priv->heroes = g_new(gchar *, n_heroes);
+
+    for (gint i = 0; i < n_heroes; i++) {
+        priv->heroes[i] = g_strdup(heroes[i]);
+    }
+
+    priv->heroes_len = n_heroes;
+
+    matrix_room_update_display_name(matrix_room);
+}
+
+/**
+ * matrix_room_set_member_counts:
+ * @room: a #MatrixRoom
+ * @joined_member_count: the number of joined members
+ * @invited_member_count: the number of invited members
+ *
+ * Set the member counts of @room, as received in the room summary.  Until this is called,
+ * the member list is counted to compute the display name.
+ */
+void
+matrix_room_set_member_counts(MatrixRoom *matrix_room, guint joined_member_count, guint invited_member_count)
+{
+    MatrixRoomPrivate *priv;
+
+    g_return_if_fail(matrix_room != NULL);
+
+    priv = matrix_room_get_instance_private(matrix_room);
+
+    if (priv->has_member_counts
+        && (priv->joined_member_count == joined_member_count)
+        && (priv->invited_member_count == invited_member_count)) {
+        return;
     }
+
+    priv->has_member_counts = TRUE;
+    priv->joined_member_count = joined_member_count;
+    priv->invited_member_count = invited_member_count;
+
+    matrix_room_update_display_name(matrix_room);
+    matrix_room_add_changes(matrix_room, MATRIX_ROOM_CHANGES_MEMBERS);
+}
+
+/**
+ * matrix_room_get_joined_member_count:
+ * @room: a #MatrixRoom
+ *
+ * Get the number of joined members of @room.  This is the count received in the room
+ * summary if there was one; otherwise it is counted from the memberships set with
+ * matrix_room_set_member_membership().  Unlike matrix_room_get_n_members(), it doesn’t
+ * include users who left, got banned, or are only invited.
+ *
+ * Returns: the number of joined members
+ */
+guint
+matrix_room_get_joined_member_count(MatrixRoom *matrix_room)
+{
+    MatrixRoomPrivate *priv;
+
+    g_return_val_if_fail(matrix_room != NULL, 0);
+
+    priv = matrix_room_get_instance_private(matrix_room);
+
+    return (priv->has_member_counts) ? priv->joined_member_count : priv->n_joined_members;
+}
+
+/**
+ * matrix_room_get_invited_member_count:
+ * @room: a #MatrixRoom
+ *
+ * Returns: the number of invited members, as received in the room summary
+ */
+guint
+matrix_room_get_invited_member_count(MatrixRoom *matrix_room)
+{
+    MatrixRoomPrivate *priv;
+
+    g_return_val_if_fail(matrix_room != NULL, 0);
+
+    priv = matrix_room_get_instance_private(matrix_room);
+
+    return priv->invited_member_count;
+}
+
+/**
+ * matrix_room_get_display_name:
+ * @room: a #MatrixRoom
+ *
+ * Get the name of @room to display to the user.  It is kept up to date as the name, the
+ * canonical alias, the room summary or the display name of a hero changes.
+ *
+ * Returns: (transfer none): the display name of @room
+ */
+const gchar *
+matrix_room_get_display_name(MatrixRoom *matrix_room)
+{
+    MatrixRoomPrivate *priv;
+
+    g_return_val_if_fail(matrix_room != NULL, NULL);
+
+    priv = matrix_room_get_instance_private(matrix_room);
+
+    return priv->display_name;
 }
 
 gint
@@ -877,31 +1760,1403 @@ matrix_room_set_default_event_level(MatrixRoom *matrix_room, gint default_event_
 {
     MatrixRoomPrivate *priv;
 
-    g_return_if_fail(matrix_room != NULL);
+    g_return_if_fail(matrix_room != NULL);
+
+    priv = matrix_room_get_instance_private(matrix_room);
+
+    if (priv->default_event_level != default_event_level) {
+        priv->default_event_level = default_event_level;
+
+        g_object_notify_by_pspec((GObject *)matrix_room, matrix_room_properties[PROP_DEFAULT_EVENT_LEVEL]);
+    }
+}
+
+gint
+matrix_room_get_default_state_level(MatrixRoom *matrix_room)
+{
+    MatrixRoomPrivate *priv;
+
+    g_return_val_if_fail(matrix_room != NULL, 0);
+
+    priv = matrix_room_get_instance_private(matrix_room);
+
+    return priv->default_state_level;
+}
+
+void
+matrix_room_set_default_state_level(MatrixRoom *matrix_room, gint defaul_state_level)
+{
+    MatrixRoomPrivate *priv;
+
+    g_return_if_fail(matrix_room != NULL);
+
+    priv = matrix_room_get_instance_private(matrix_room);
+
+    if (priv->default_state_level != defaul_state_level) {
+        priv->default_state_level = defaul_state_level;
+
+        g_object_notify_by_pspec((GObject *)matrix_room, matrix_room_properties[PROP_DEFAULT_STATE_LEVEL]);
+    }
+}
+
+gint
+matrix_room_get_ban_level(MatrixRoom *matrix_room)
+{
+    MatrixRoomPrivate *priv;
+
+    g_return_val_if_fail(matrix_room != NULL, 0);
+
+    priv = matrix_room_get_instance_private(matrix_room);
+
+    return priv->ban_level;
+}
+
+void
+matrix_room_set_ban_level(MatrixRoom *matrix_room, gint ban_level)
+{
+    MatrixRoomPrivate *priv;
+
+    g_return_if_fail(matrix_room != NULL);
+
+    priv = matrix_room_get_instance_private(matrix_room);
+
+    if (priv->ban_level != ban_level) {
+        priv->ban_level = ban_level;
+
+        g_object_notify_by_pspec((GObject *)matrix_room, matrix_room_properties[PROP_BAN_LEVEL]);
+    }
+}
+
+gint
+matrix_room_get_kick_level(MatrixRoom *matrix_room)
+{
+    MatrixRoomPrivate *priv;
+
+    g_return_val_if_fail(matrix_room != NULL, 0);
+
+    priv = matrix_room_get_instance_private(matrix_room);
+
+    return priv->kick_level;
+}
+
+void
+matrix_room_set_kick_level(MatrixRoom *matrix_room, gint kick_level)
+{
+    MatrixRoomPrivate *priv;
+
+    g_return_if_fail(matrix_room != NULL);
+
+    priv = matrix_room_get_instance_private(matrix_room);
+
+    if (priv->kick_level != kick_level) {
+        priv->kick_level = kick_level;
+
+        g_object_notify_by_pspec((GObject *)matrix_room, matrix_room_properties[PROP_KICK_LEVEL]);
+    }
+}
+
+gint
+matrix_room_get_redact_level(MatrixRoom *matrix_room)
+{
+    MatrixRoomPrivate *priv;
+
+    g_return_val_if_fail(matrix_room != NULL, 0);
+
+    priv = matrix_room_get_instance_private(matrix_room);
+
+    return priv->redact_level;
+}
+
+void
+matrix_room_set_redact_level(MatrixRoom *matrix_room, gint redact_level)
+{
+    MatrixRoomPrivate *priv;
+
+    g_return_if_fail(matrix_room != NULL);
+
+    priv = matrix_room_get_instance_private(matrix_room);
+
+    if (priv->redact_level != redact_level) {
+        priv->redact_level = redact_level;
+
+        g_object_notify_by_pspec((GObject *)matrix_room, matrix_room_properties[PROP_REDACT_LEVEL]);
+    }
+}
+
+gint
+matrix_room_get_invite_level(MatrixRoom *matrix_room)
+{
+    MatrixRoomPrivate *priv;
+
+    g_return_val_if_fail(matrix_room != NULL, 0);
+
+    priv = matrix_room_get_instance_private(matrix_room);
+
+    return priv->invite_level;
+}
+
+void
+matrix_room_set_invite_level(MatrixRoom *matrix_room, gint invite_level)
+{
+    MatrixRoomPrivate *priv;
+
+    g_return_if_fail(matrix_room != NULL);
+
+    priv = matrix_room_get_instance_private(matrix_room);
+
+    if (priv->invite_level != invite_level) {
+        priv->invite_level = invite_level;
+
+        g_object_notify_by_pspec((GObject *)matrix_room, matrix_room_properties[PROP_INVITE_LEVEL]);
+    }
+}
+
+gint
+matrix_room_get_room_notification_level(MatrixRoom *matrix_room)
+{
+    MatrixRoomPrivate *priv;
+
+    g_return_val_if_fail(matrix_room != NULL, 0);
+
+    priv = matrix_room_get_instance_private(matrix_room);
+
+    return priv->room_notification_level;
+}
+
+void
+matrix_room_set_room_notification_level(MatrixRoom *matrix_room, gint room_notification_level)
+{
+    MatrixRoomPrivate *priv;
+
+    g_return_if_fail(matrix_room != NULL);
+
+    priv = matrix_room_get_instance_private(matrix_room);
+
+    if (priv->room_notification_level != room_notification_level) {
+        priv->room_notification_level = room_notification_level;
+
+        g_object_notify_by_pspec((GObject *)matrix_room, matrix_room_properties[PROP_ROOM_NOTIFICATION_LEVEL]);
+    }
+}
+
+const gchar *
+matrix_room_get_topic(MatrixRoom *matrix_room)
+{
+    MatrixRoomPrivate *priv;
+
+    g_return_val_if_fail(matrix_room != NULL, NULL);
+
+    priv = matrix_room_get_instance_private(matrix_room);
+
+    return priv->topic;
+}
+
+void
+matrix_room_set_topic(MatrixRoom *matrix_room, const gchar *topic)
+{
+    MatrixRoomPrivate *priv;
+
+    g_return_if_fail(matrix_room != NULL);
+
+    priv = matrix_room_get_instance_private(matrix_room);
+
+    if (g_strcmp0(topic, priv->topic) != 0) {
+        g_free(priv->topic);
+        priv->topic = g_strdup(topic);
+
+        g_object_notify_by_pspec((GObject *)matrix_room, matrix_room_properties[PROP_TOPIC]);
+    }
+}
+
+/**
+ * matrix_room_get_typing_users:
+ * @room: a #MatrixRoom
+ * @n_typing_users: (nullable): placeholder for the length of the returned list
+ *
+ * Returns: (transfer none): the list of typing users in @room
+ */
+gchar **
+matrix_room_get_typing_users(MatrixRoom *matrix_room, int *n_typing_users)
+{
+    MatrixRoomPrivate *priv;
+
+    g_return_val_if_fail(matrix_room != NULL, NULL);
+
+    priv = matrix_room_get_instance_private(matrix_room);
+
+    if (n_typing_users != NULL) {
+        *n_typing_users = priv->typing_users_len;
+    }
+
+    return priv->typing_users;
+}
+
+void
+matrix_room_set_typing_users(MatrixRoom *matrix_room, gchar **typing_users, int n_typing_users)
+{
+    MatrixRoomPrivate *priv;
+
+    g_return_if_fail(matrix_room != NULL);
+
+    priv = matrix_room_get_instance_private(matrix_room);
+
+    for (gint i = 0; i < priv->typing_users_len; i++) {
+        g_free(priv->typing_users[i]);
+    }
+
+    g_free(priv->typing_users);
+
+    priv->typing_users = g_new(gchar *, n_typing_users);
+
+    for (gint i = 0; i < n_typing_users; i++) {
+        priv->typing_users[i] = g_strdup(typing_users[i]);
+    }
+
+    g_object_notify_by_pspec((GObject *)matrix_room, matrix_room_properties[PROP_TYPING_USERS]);
+}
+
+/*
+ * Drop the oldest event from the timeline.  If there is a known gap before the new oldest
+ * event, its token becomes the start token; otherwise the start token is lost, as it pointed
+ * before the dropped event.
+ */
+static void
+matrix_room_timeline_drop_oldest(MatrixRoomPrivate *priv)
+{
+    MatrixRoomTimelineEntry *entry = &(priv->timeline[priv->timeline_start]);
+    const gchar *event_id = matrix_event_room_get_event_id(entry->event);
+
+    if (event_id != NULL) {
+        if (g_hash_table_lookup(priv->timeline_index, event_id) == entry->event) {
+            g_hash_table_remove(priv->timeline_index, event_id);
+        }
+
+        g_hash_table_remove(priv->timeline_gaps, event_id);
+    }
+
+    priv->timeline_size -= entry->size;
+    g_clear_object(&(entry->event));
+    entry->size = 0;
+    entry->gap_before = FALSE;
+
+    priv->timeline_start = (priv->timeline_start + 1) % priv->timeline_capacity;
+    priv->timeline_len--;
+
+    g_clear_pointer(&(priv->timeline_start_token), g_free);
+
+    if (priv->timeline_len > 0) {
+        event_id = matrix_event_room_get_event_id(priv->timeline[priv->timeline_start].event);
+
+        if ((event_id != NULL) && g_hash_table_contains(priv->timeline_gaps, event_id)) {
+            priv->timeline_start_token = g_strdup(g_hash_table_lookup(priv->timeline_gaps, event_id));
+            g_hash_table_remove(priv->timeline_gaps, event_id);
+        }
+
+        priv->timeline[priv->timeline_start].gap_before = FALSE;
+    }
+}
+
+/*
+ * Find the position of an event in the timeline, counted from the oldest event.
+ */
+static gint
+matrix_room_timeline_find(MatrixRoomPrivate *priv, const gchar *event_id)
+{
+    MatrixEventRoom *event;
+
+    if ((event = g_hash_table_lookup(priv->timeline_index, event_id)) == NULL) {
+        return -1;
+    }
+
+    for (guint i = 0; i < priv->timeline_len; i++) {
+        if (priv->timeline[(priv->timeline_start + i) % priv->timeline_capacity].event == event) {
+            return i;
+        }
+    }
+
+    return -1;
+}
+
+static MatrixRoomTimelineEntry *
+matrix_room_timeline_get_entry(MatrixRoomPrivate *priv, guint pos)
+{
+    return &(priv->timeline[(priv->timeline_start + pos) % priv->timeline_capacity]);
+}
+
+static MatrixEventRoom *
+matrix_room_timeline_get(MatrixRoomPrivate *priv, guint pos)
+{
+    return matrix_room_timeline_get_entry(priv, pos)->event;
+}
+
+/*
+ * Insert event at position *pos of the timeline, counted from the oldest event.  If the
+ * timeline is full, or the memory budget would be exceeded, the oldest events are dropped
+ * first, and *pos is updated accordingly.  Returns FALSE if there is no room for the event
+ * because it would be the oldest one.
+ */
+static gboolean
+matrix_room_timeline_insert(MatrixRoomPrivate *priv, guint *pos, MatrixEventRoom *event, gsize size)
+{
+    const gchar *event_id;
+
+    while ((priv->timeline_len == priv->timeline_capacity)
+           || ((priv->timeline_len > 0)
+               && (priv->timeline_memory_budget > 0)
+               && (priv->timeline_size + size > priv->timeline_memory_budget))) {
+        if (*pos == 0) {
+            return FALSE;
+        }
+
+        matrix_room_timeline_drop_oldest(priv);
+        (*pos)--;
+    }
+
+    for (guint i = priv->timeline_len; i > *pos; i--) {
+        priv->timeline[(priv->timeline_start + i) % priv->timeline_capacity] =
+            priv->timeline[(priv->timeline_start + i - 1) % priv->timeline_capacity];
+    }
+
+    priv->timeline[(priv->timeline_start + *pos) % priv->timeline_capacity].event = g_object_ref(event);
+    priv->timeline[(priv->timeline_start + *pos) % priv->timeline_capacity].size = size;
+    priv->timeline[(priv->timeline_start + *pos) % priv->timeline_capacity].gap_before = FALSE;
+    priv->timeline_len++;
+    priv->timeline_size += size;
+
+    if ((event_id = matrix_event_room_get_event_id(event)) != NULL) {
+        g_hash_table_insert(priv->timeline_index, g_strdup(event_id), event);
+    }
+
+    return TRUE;
+}
+
+/**
+ * matrix_room_append_timeline_event:
+ * @room: a #MatrixRoom
+ * @event: (transfer none): a room event
+ * @size: the approximate memory used by @event, in bytes
+ *
+ * Add @event to the end of the timeline of @room.  If the timeline is full, or adding @event
+ * would exceed #MatrixRoom:timeline-memory-budget, the oldest events are dropped first.  The
+ * newest event is always kept, even if it alone exceeds the memory budget.
+ *
+ * Events already in the timeline (based on their event ID) are not added again.
+ *
+ * If matrix_room_mark_timeline_gap() was called before, the gap is recorded before @event.
+ *
+ * Returns: %TRUE if @event was added to the timeline
+ */
+gboolean
+matrix_room_append_timeline_event(MatrixRoom *matrix_room, MatrixEventRoom *event, gsize size)
+{
+    MatrixRoomPrivate *priv;
+    const gchar *event_id;
+    guint pos;
+
+    g_return_val_if_fail(matrix_room != NULL, FALSE);
+    g_return_val_if_fail(event != NULL, FALSE);
+
+    priv = matrix_room_get_instance_private(matrix_room);
+
+    if (priv->timeline_capacity == 0) {
+        return FALSE;
+    }
+
+    event_id = matrix_event_room_get_event_id(event);
+
+    if ((event_id != NULL) && g_hash_table_contains(priv->timeline_index, event_id)) {
+        return FALSE;
+    }
+
+    pos = priv->timeline_len;
+
+    /* pos can only be 0 here if the timeline is empty, so this never fails */
+    matrix_room_timeline_insert(priv, &pos, event, size);
+
+    if (priv->pending_gap_token != NULL) {
+        if (pos == 0) {
+            g_free(priv->timeline_start_token);
+            priv->timeline_start_token = priv->pending_gap_token;
+        } else if (event_id != NULL) {
+            g_hash_table_replace(priv->timeline_gaps, g_strdup(event_id), priv->pending_gap_token);
+            matrix_room_timeline_get_entry(priv, pos)->gap_before = TRUE;
+        } else {
+            g_free(priv->pending_gap_token);
+        }
+
+        priv->pending_gap_token = NULL;
+    }
+
+    return TRUE;
+}
+
+/**
+ * matrix_room_mark_timeline_gap:
+ * @room: a #MatrixRoom
+ * @prev_batch: a pagination token pointing before the next event
+ *
+ * Record that the next event added with matrix_room_append_timeline_event() doesn’t follow
+ * the current last event of the timeline, like after a limited sync response.  The missing
+ * events can be fetched using @prev_batch.
+ *
+ * If the timeline is empty, @prev_batch will be used to fetch events older than the oldest
+ * one instead.
+ */
+void
+matrix_room_mark_timeline_gap(MatrixRoom *matrix_room, const gchar *prev_batch)
+{
+    MatrixRoomPrivate *priv;
+
+    g_return_if_fail(matrix_room != NULL);
+    g_return_if_fail(prev_batch != NULL);
+
+    priv = matrix_room_get_instance_private(matrix_room);
+
+    g_free(priv->pending_gap_token);
+    priv->pending_gap_token = g_strdup(prev_batch);
+}
+
+/**
+ * matrix_room_has_timeline_gap:
+ * @room: a #MatrixRoom
+ * @event_id: (nullable): an event ID
+ *
+ * Check if there are known to be missing events right before @event_id in the timeline of
+ * @room.  If @event_id is %NULL, check if older events than the oldest one in the timeline
+ * can be fetched.
+ *
+ * Returns: %TRUE if there is a gap that can be filled with matrix_room_paginate_timeline()
+ */
+gboolean
+matrix_room_has_timeline_gap(MatrixRoom *matrix_room, const gchar *event_id)
+{
+    MatrixRoomPrivate *priv;
+
+    g_return_val_if_fail(matrix_room != NULL, FALSE);
+
+    priv = matrix_room_get_instance_private(matrix_room);
+
+    if (event_id == NULL) {
+        return (priv->timeline_start_token != NULL);
+    }
+
+    return g_hash_table_contains(priv->timeline_gaps, event_id);
+}
+
+static void
+matrix_room_paginate_cb(MatrixAPI *matrix_api, const gchar *content_type, JsonNode *json_content, GByteArray *raw_content, GError *err, gpointer user_data)
+{
+    MatrixRoom *matrix_room = MATRIX_ROOM(user_data);
+    MatrixRoomPrivate *priv = matrix_room_get_instance_private(matrix_room);
+    gchar *gap_event_id = priv->paginating_gap;
+    JsonObject *root;
+    JsonNode *node;
+    JsonArray *chunk;
+    const gchar *end_token = NULL;
+    gboolean closed = FALSE;
+    gboolean full = FALSE;
+    guint added = 0;
+    guint len;
+    gint found;
+    guint pos = 0;
+
+    priv->back_paginating = FALSE;
+    priv->paginating_gap = NULL;
+
+    if ((err != NULL) || (json_content == NULL) || (json_node_get_node_type(json_content) != JSON_NODE_OBJECT)) {
+        goto out;
+    }
+
+    root = json_node_get_object(json_content);
+
+    if (((node = json_object_get_member(root, "chunk")) == NULL)
+        || (json_node_get_node_type(node) != JSON_NODE_ARRAY)) {
+        goto out;
+    }
+
+    chunk = json_node_get_array(node);
+    len = json_array_get_length(chunk);
+
+    if (((node = json_object_get_member(root, "end")) != NULL)
+        && (json_node_get_value_type(node) == G_TYPE_STRING)) {
+        end_token = json_node_get_string(node);
+    }
+
+    if (gap_event_id != NULL) {
+        /* The event after the gap may have been dropped while we were waiting */
+        if ((found = matrix_room_timeline_find(priv, gap_event_id)) < 0) {
+            g_hash_table_remove(priv->timeline_gaps, gap_event_id);
+
+            goto out;
+        }
+
+        pos = found;
+    }
+
+    /* Events arrive newest first; each one is inserted before the previous */
+    for (guint i = 0; i < len; i++) {
+        JsonNode *event_node = json_array_get_element(chunk, i);
+        MatrixEventBase *evt;
+        const gchar *event_id;
+
+        if (json_node_get_node_type(event_node) != JSON_NODE_OBJECT) {
+            continue;
+        }
+
+        if (((node = json_object_get_member(json_node_get_object(event_node), "event_id")) != NULL)
+            && ((event_id = json_node_get_string(node)) != NULL)
+            && g_hash_table_contains(priv->timeline_index, event_id)) {
+            closed = TRUE;
+
+            break;
+        }
+
+        if ((evt = matrix_event_base_new_from_json(NULL, event_node, NULL)) == NULL) {
+            continue;
+        }
+
+        if (MATRIX_EVENT_IS_ROOM(evt)) {
+            if (matrix_event_room_get_room_id(MATRIX_EVENT_ROOM(evt)) == NULL) {
+                matrix_event_room_set_room_id(MATRIX_EVENT_ROOM(evt), priv->room_id);
+            }
+
+            if (!matrix_room_timeline_insert(priv, &pos, MATRIX_EVENT_ROOM(evt), _matrix_json_node_get_size(event_node))) {
+                full = TRUE;
+                g_object_unref(evt);
+
+                break;
+            }
+
+            added++;
+            g_signal_emit(matrix_room, matrix_room_signals[SIGNAL_TIMELINE_EVENT_FETCHED], 0, event_node, evt);
+        }
+
+        g_object_unref(evt);
+    }
+
+    /* The gap is now before the last event inserted.  If it is closed, we reached the
+     * beginning of the room, or we ran out of space, there is nothing more to fetch. */
+    if (gap_event_id != NULL) {
+        g_hash_table_remove(priv->timeline_gaps, gap_event_id);
+
+        // Every event inserted moved the one after the gap one position further
+        if (pos + added < priv->timeline_len) {
+            matrix_room_timeline_get_entry(priv, pos + added)->gap_before = FALSE;
+        }
+    }
+
+    if (closed || full || (len == 0) || (end_token == NULL)) {
+        end_token = NULL;
+    }
+
+    if (pos == 0) {
+        g_free(priv->timeline_start_token);
+        priv->timeline_start_token = g_strdup(end_token);
+    } else if ((end_token != NULL) && (pos < priv->timeline_len)) {
+        const gchar *event_id = matrix_event_room_get_event_id(matrix_room_timeline_get(priv, pos));
+
+        if (event_id != NULL) {
+            g_hash_table_replace(priv->timeline_gaps, g_strdup(event_id), g_strdup(end_token));
+            matrix_room_timeline_get_entry(priv, pos)->gap_before = TRUE;
+        }
+    }
+
+out:
+    g_signal_emit(matrix_room, matrix_room_signals[SIGNAL_TIMELINE_PAGINATED], 0, added);
+
+    g_free(gap_event_id);
+    g_object_unref(matrix_room);
+}
+
+/**
+ * matrix_room_paginate_timeline:
+ * @room: a #MatrixRoom
+ * @gap_event_id: (nullable): the event ID after the gap to fill, or %NULL to fetch events
+ *     older than the oldest one in the timeline
+ * @limit: the maximum number of events to fetch, or 0 to use a default value
+ * @error: (nullable): a #GError, or %NULL to ignore errors
+ *
+ * Fetch events missing from the timeline of @room using the #MatrixAPI set with
+ * matrix_room_set_api().  Events already in the timeline are skipped, and the gap is
+ * considered filled when one is found.  #MatrixRoom::timeline-paginated is emitted when the
+ * request is finished.
+ *
+ * Only one such request can be in progress for a room; if there is one already, @error is
+ * set to %MATRIX_ERROR_ALREADY_EXISTS.
+ *
+ * Returns: %TRUE if the request was sent
+ */
+gboolean
+matrix_room_paginate_timeline(MatrixRoom *matrix_room, const gchar *gap_event_id, guint limit, GError **error)
+{
+    MatrixRoomPrivate *priv;
+    const gchar *token;
+    GError *inner_error = NULL;
+
+    g_return_val_if_fail(matrix_room != NULL, FALSE);
+
+    priv = matrix_room_get_instance_private(matrix_room);
+
+    if (priv->api == NULL) {
+        g_set_error(error, MATRIX_ERROR, MATRIX_ERROR_UNAVAILABLE,
+                    "No API set for room %s", priv->room_id);
+
+        return FALSE;
+    }
+
+    if (priv->back_paginating) {
+        g_set_error(error, MATRIX_ERROR, MATRIX_ERROR_ALREADY_EXISTS,
+                    "Pagination is already in progress for room %s", priv->room_id);
+
+        return FALSE;
+    }
+
+    if (gap_event_id == NULL) {
+        token = priv->timeline_start_token;
+    } else {
+        token = g_hash_table_lookup(priv->timeline_gaps, gap_event_id);
+    }
+
+    if (token == NULL) {
+        g_set_error(error, MATRIX_ERROR, MATRIX_ERROR_NOT_FOUND,
+                    "No known gap in the timeline of room %s", priv->room_id);
+
+        return FALSE;
+    }
+
+    priv->back_paginating = TRUE;
+    priv->paginating_gap = g_strdup(gap_event_id);
+
+    matrix_api_list_room_messages(priv->api,
+                                  priv->room_id, token, MATRIX_EVENT_DIRECTION_BACKWARD,
+                                  (limit == 0) ? MATRIX_ROOM_PAGINATION_LIMIT : limit,
+                                  matrix_room_paginate_cb, g_object_ref(matrix_room),
+                                  &inner_error);
+
+    if (inner_error != NULL) {
+        priv->back_paginating = FALSE;
+        g_clear_pointer(&(priv->paginating_gap), g_free);
+        g_object_unref(matrix_room);
+        g_propagate_error(error, inner_error);
+
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+/*
+ * Called when a consumer accesses the timeline at position pos (counted from the oldest
+ * event).  If it gets close to a gap or to the oldest event, start fetching the missing
+ * events, so they are likely to be there by the time the consumer gets there.
+ *
+ * This is called from read accessors, so it only looks at the entries within
+ * MATRIX_ROOM_PREFETCH_DISTANCE of pos, using their gap flag, instead of looking up every
+ * known gap.
+ */
+static void
+matrix_room_timeline_prefetch(MatrixRoom *matrix_room, guint pos)
+{
+    MatrixRoomPrivate *priv = matrix_room_get_instance_private(matrix_room);
+    guint first;
+
+    if ((priv->api == NULL) || priv->back_paginating) {
+        return;
+    }
+
+    if ((pos < MATRIX_ROOM_PREFETCH_DISTANCE)
+        && (priv->timeline_start_token != NULL)
+        && (priv->timeline_len < priv->timeline_capacity)) {
+        matrix_room_paginate_timeline(matrix_room, NULL, 0, NULL);
+
+        return;
+    }
+
+    if (g_hash_table_size(priv->timeline_gaps) == 0) {
+        return;
+    }
+
+    first = (pos >= MATRIX_ROOM_PREFETCH_DISTANCE) ? pos - MATRIX_ROOM_PREFETCH_DISTANCE + 1 : 0;
+
+    // Look for the closest gap first
+    for (guint i = pos + 1; i > first; i--) {
+        MatrixRoomTimelineEntry *entry = matrix_room_timeline_get_entry(priv, i - 1);
+        const gchar *event_id;
+
+        if (entry->gap_before && ((event_id = matrix_event_room_get_event_id(entry->event)) != NULL)) {
+            matrix_room_paginate_timeline(matrix_room, event_id, 0, NULL);
+
+            return;
+        }
+    }
+}
+
+/**
+ * matrix_room_set_api:
+ * @room: a #MatrixRoom
+ * @api: (nullable): a #MatrixAPI
+ *
+ * Set the #MatrixAPI used to fetch missing timeline events.  @room doesn’t keep a reference
+ * on @api.  If it is set, events are fetched automatically when timeline accessors get close
+ * to a gap.
+ */
+void
+matrix_room_set_api(MatrixRoom *matrix_room, MatrixAPI *api)
+{
+    MatrixRoomPrivate *priv;
+
+    g_return_if_fail(matrix_room != NULL);
+
+    priv = matrix_room_get_instance_private(matrix_room);
+
+    if (priv->api != NULL) {
+        g_object_remove_weak_pointer(G_OBJECT(priv->api), (gpointer *)&(priv->api));
+    }
+
+    priv->api = api;
+
+    if (api != NULL) {
+        g_object_add_weak_pointer(G_OBJECT(api), (gpointer *)&(priv->api));
+    }
+}
+
+/**
+ * matrix_room_get_timeline_length:
+ * @room: a #MatrixRoom
+ *
+ * Returns: the number of events currently held in the timeline of @room
+ */
+guint
+matrix_room_get_timeline_length(MatrixRoom *matrix_room)
+{
+    MatrixRoomPrivate *priv;
+
+    g_return_val_if_fail(matrix_room != NULL, 0);
+
+    priv = matrix_room_get_instance_private(matrix_room);
+
+    return priv->timeline_len;
+}
+
+/**
+ * matrix_room_get_timeline_event_nth:
+ * @room: a #MatrixRoom
+ * @n: the position of the event, counted backwards from the newest one
+ *
+ * Get an event from the timeline of @room.  @n is 0 for the newest event, 1 for the one
+ * before, and so on.
+ *
+ * Returns: (transfer none) (nullable): the event, or %NULL if the timeline holds less than
+ *     @n + 1 events
+ */
+MatrixEventRoom *
+matrix_room_get_timeline_event_nth(MatrixRoom *matrix_room, guint n)
+{
+    MatrixRoomPrivate *priv;
+
+    g_return_val_if_fail(matrix_room != NULL, NULL);
+
+    priv = matrix_room_get_instance_private(matrix_room);
+
+    if (n >= priv->timeline_len) {
+        return NULL;
+    }
+
+    matrix_room_timeline_prefetch(matrix_room, priv->timeline_len - 1 - n);
+
+    return matrix_room_timeline_get(priv, priv->timeline_len - 1 - n);
+}
+
+/**
+ * matrix_room_get_last_timeline_events:
+ * @room: a #MatrixRoom
+ * @n: the maximum number of events to return
+ * @n_events: (nullable): placeholder for the length of the returned list
+ *
+ * Get the last @n events from the timeline of @room, oldest first.  If the timeline holds
+ * less than @n events, all of them are returned.
+ *
+ * Returns: (transfer container) (array length=n_events): the list of events.  Free it with
+ *     g_free(), but don’t unref the events
+ */
+MatrixEventRoom **
+matrix_room_get_last_timeline_events(MatrixRoom *matrix_room, guint n, guint *n_events)
+{
+    MatrixRoomPrivate *priv;
+    MatrixEventRoom **ret;
+    guint first;
+
+    g_return_val_if_fail(matrix_room != NULL, NULL);
+
+    priv = matrix_room_get_instance_private(matrix_room);
+
+    n = MIN(n, priv->timeline_len);
+    first = priv->timeline_start + priv->timeline_len - n;
+    ret = g_new(MatrixEventRoom *, n + 1);
+
+    for (guint i = 0; i < n; i++) {
+        ret[i] = priv->timeline[(first + i) % priv->timeline_capacity].event;
+    }
+
+    ret[n] = NULL;
+
+    if (n > 0) {
+        matrix_room_timeline_prefetch(matrix_room, priv->timeline_len - n);
+    }
+
+    if (n_events != NULL) {
+        *n_events = n;
+    }
+
+    return ret;
+}
+
+/**
+ * matrix_room_get_timeline_event:
+ * @room: a #MatrixRoom
+ * @event_id: an event ID
+ *
+ * Look up an event in the timeline of @room by its ID.
+ *
+ * Returns: (transfer none) (nullable): the event, or %NULL if it is not in the timeline
+ */
+MatrixEventRoom *
+matrix_room_get_timeline_event(MatrixRoom *matrix_room, const gchar *event_id)
+{
+    MatrixRoomPrivate *priv;
+
+    g_return_val_if_fail(matrix_room != NULL, NULL);
+    g_return_val_if_fail(event_id != NULL, NULL);
+
+    priv = matrix_room_get_instance_private(matrix_room);
+
+    return g_hash_table_lookup(priv->timeline_index, event_id);
+}
+
+/**
+ * matrix_room_clear_timeline:
+ * @room: a #MatrixRoom
+ *
+ * Remove all events from the timeline of @room.
+ */
+void
+matrix_room_clear_timeline(MatrixRoom *matrix_room)
+{
+    MatrixRoomPrivate *priv;
+
+    g_return_if_fail(matrix_room != NULL);
+
+    priv = matrix_room_get_instance_private(matrix_room);
+
+    while (priv->timeline_len > 0) {
+        matrix_room_timeline_drop_oldest(priv);
+    }
+
+    priv->timeline_start = 0;
+}
+
+/**
+ * matrix_room_get_timeline_capacity:
+ * @room: a #MatrixRoom
+ *
+ * Returns: the maximum number of events held in the timeline of @room
+ */
+guint
+matrix_room_get_timeline_capacity(MatrixRoom *matrix_room)
+{
+    MatrixRoomPrivate *priv;
+
+    g_return_val_if_fail(matrix_room != NULL, 0);
+
+    priv = matrix_room_get_instance_private(matrix_room);
+
+    return priv->timeline_capacity;
+}
+
+/**
+ * matrix_room_set_timeline_capacity:
+ * @room: a #MatrixRoom
+ * @capacity: the maximum number of events to hold
+ *
+ * Set the maximum number of events held in the timeline of @room.  If the timeline holds more
+ * events than @capacity, the oldest ones are dropped.  Setting it to 0 (the default) disables
+ * the timeline.
+ */
+void
+matrix_room_set_timeline_capacity(MatrixRoom *matrix_room, guint capacity)
+{
+    MatrixRoomPrivate *priv;
+    MatrixRoomTimelineEntry *timeline;
+    guint len;
+
+    g_return_if_fail(matrix_room != NULL);
+
+    priv = matrix_room_get_instance_private(matrix_room);
+
+    if (capacity == priv->timeline_capacity) {
+        return;
+    }
+
+    while (priv->timeline_len > capacity) {
+        matrix_room_timeline_drop_oldest(priv);
+    }
+
+    len = priv->timeline_len;
+    timeline = g_new0(MatrixRoomTimelineEntry, capacity);
+
+    for (guint i = 0; i < len; i++) {
+        timeline[i] = priv->timeline[(priv->timeline_start + i) % priv->timeline_capacity];
+    }
+
+    g_free(priv->timeline);
+    priv->timeline = timeline;
+    priv->timeline_capacity = capacity;
+    priv->timeline_start = 0;
+
+    g_object_notify_by_pspec((GObject *)matrix_room, matrix_room_properties[PROP_TIMELINE_CAPACITY]);
+}
+
+/**
+ * matrix_room_get_timeline_memory_budget:
+ * @room: a #MatrixRoom
+ *
+ * Returns: the approximate maximum memory used by the timeline of @room, in bytes, or 0 if
+ *     it is not limited
+ */
+guint64
+matrix_room_get_timeline_memory_budget(MatrixRoom *matrix_room)
+{
+    MatrixRoomPrivate *priv;
+
+    g_return_val_if_fail(matrix_room != NULL, 0);
+
+    priv = matrix_room_get_instance_private(matrix_room);
+
+    return priv->timeline_memory_budget;
+}
+
+/**
+ * matrix_room_set_timeline_memory_budget:
+ * @room: a #MatrixRoom
+ * @memory_budget: the approximate maximum memory to use, in bytes, or 0 for no limit
+ *
+ * Limit the memory used by the timeline of @room.  The oldest events are dropped until the
+ * timeline fits into @memory_budget, but the newest event is always kept.
+ */
+void
+matrix_room_set_timeline_memory_budget(MatrixRoom *matrix_room, guint64 memory_budget)
+{
+    MatrixRoomPrivate *priv;
+
+    g_return_if_fail(matrix_room != NULL);
+
+    priv = matrix_room_get_instance_private(matrix_room);
+
+    if (memory_budget == priv->timeline_memory_budget) {
+        return;
+    }
+
+    priv->timeline_memory_budget = memory_budget;
+
+    while ((memory_budget > 0) && (priv->timeline_len > 1) && (priv->timeline_size > memory_budget)) {
+        matrix_room_timeline_drop_oldest(priv);
+    }
+
+    g_object_notify_by_pspec((GObject *)matrix_room, matrix_room_properties[PROP_TIMELINE_MEMORY_BUDGET]);
+}
+
+/* Event types that count as unread messages */
+static const gchar *matrix_room_unread_event_types[] = {
+    "m.room.message",
+    "m.room.encrypted",
+    "m.sticker",
+    NULL
+};
+
+static gboolean
+matrix_room_is_unread_event_type(const gchar *event_type)
+{
+    for (guint i = 0; matrix_room_unread_event_types[i] != NULL; i++) {
+        if (g_strcmp0(event_type, matrix_room_unread_event_types[i]) == 0) {
+            return TRUE;
+        }
+    }
+
+    return FALSE;
+}
+
+static const gchar *
+matrix_room_get_own_user_id(MatrixRoomPrivate *priv)
+{
+    return (priv->api != NULL) ? matrix_api_get_user_id(priv->api) : NULL;
+}
+
+static void
+matrix_room_set_unread_count(MatrixRoom *matrix_room, guint unread_count)
+{
+    MatrixRoomPrivate *priv = matrix_room_get_instance_private(matrix_room);
+
+    if (priv->unread_count != unread_count) {
+        priv->unread_count = unread_count;
+
+        g_object_notify_by_pspec((GObject *)matrix_room, matrix_room_properties[PROP_UNREAD_COUNT]);
+    }
+}
+
+/*
+ * Recount unread events after our own read receipt moved to event_id.  Only the timeline is
+ * looked at, walking back from the newest event to the one read, so only the events counted
+ * are visited.  If event_id is not in the timeline, the count is left alone, as we can not
+ * tell how many of the events we hold come after it.
+ */
+static void
+matrix_room_recount_unread(MatrixRoom *matrix_room, const gchar *event_id)
+{
+    MatrixRoomPrivate *priv = matrix_room_get_instance_private(matrix_room);
+    const gchar *own_user_id = matrix_room_get_own_user_id(priv);
+    MatrixEventRoom *read_event;
+    guint unread_count = 0;
+
+    if ((read_event = g_hash_table_lookup(priv->timeline_index, event_id)) == NULL) {
+        return;
+    }
+
+    for (guint i = priv->timeline_len; i > 0; i--) {
+        MatrixEventRoom *event = matrix_room_timeline_get(priv, i - 1);
+
+        if (event == read_event) {
+            break;
+        }
+
+        if (matrix_room_is_unread_event_type(matrix_event_base_get_event_type(MATRIX_EVENT_BASE(event)))
+            && (g_strcmp0(matrix_event_room_get_sender(event), own_user_id) != 0)) {
+            unread_count++;
+        }
+    }
+
+    matrix_room_set_unread_count(matrix_room, unread_count);
+}
+
+/**
+ * matrix_room_add_unread_event:
+ * @room: a #MatrixRoom
+ * @event_type: the type of a new timeline event
+ * @sender: the sender of the event
+ *
+ * Update the unread counter of @room with a new timeline event.  Messages from others
+ * increase it; any event we sent ourselves resets it, as sending implies reading the room.
+ * Our own user ID is taken from the #MatrixAPI set with matrix_room_set_api().
+ */
+void
+matrix_room_add_unread_event(MatrixRoom *matrix_room, const gchar *event_type, const gchar *sender)
+{
+    MatrixRoomPrivate *priv;
+    const gchar *own_user_id;
+
+    g_return_if_fail(matrix_room != NULL);
+
+    priv = matrix_room_get_instance_private(matrix_room);
+    own_user_id = matrix_room_get_own_user_id(priv);
+
+    if ((own_user_id != NULL) && (g_strcmp0(sender, own_user_id) == 0)) {
+        matrix_room_set_unread_count(matrix_room, 0);
+    } else if (matrix_room_is_unread_event_type(event_type)) {
+        matrix_room_set_unread_count(matrix_room, priv->unread_count + 1);
+    }
+}
+
+/**
+ * matrix_room_get_unread_count:
+ * @room: a #MatrixRoom
+ *
+ * Returns: the number of messages from others after our own read receipt, as counted locally
+ */
+guint
+matrix_room_get_unread_count(MatrixRoom *matrix_room)
+{
+    MatrixRoomPrivate *priv;
+
+    g_return_val_if_fail(matrix_room != NULL, 0);
+
+    priv = matrix_room_get_instance_private(matrix_room);
+
+    return priv->unread_count;
+}
+
+/**
+ * matrix_room_set_unread_notifications:
+ * @room: a #MatrixRoom
+ * @notification_count: the number of unread notifications
+ * @highlight_count: the number of unread highlighted notifications
+ *
+ * Set the notification counters of @room, as reported by the homeserver in the
+ * `unread_notifications` section of a sync response.
+ */
+void
+matrix_room_set_unread_notifications(MatrixRoom *matrix_room, guint notification_count, guint highlight_count)
+{
+    MatrixRoomPrivate *priv;
+
+    g_return_if_fail(matrix_room != NULL);
+
+    priv = matrix_room_get_instance_private(matrix_room);
+
+    if (priv->notification_count != notification_count) {
+        priv->notification_count = notification_count;
+
+        g_object_notify_by_pspec((GObject *)matrix_room, matrix_room_properties[PROP_NOTIFICATION_COUNT]);
+    }
+
+    if (priv->highlight_count != highlight_count) {
+        priv->highlight_count = highlight_count;
+
+        g_object_notify_by_pspec((GObject *)matrix_room, matrix_room_properties[PROP_HIGHLIGHT_COUNT]);
+    }
+}
+
+/**
+ * matrix_room_get_notification_count:
+ * @room: a #MatrixRoom
+ *
+ * Returns: the number of unread notifications in @room
+ */
+guint
+matrix_room_get_notification_count(MatrixRoom *matrix_room)
+{
+    MatrixRoomPrivate *priv;
+
+    g_return_val_if_fail(matrix_room != NULL, 0);
+
+    priv = matrix_room_get_instance_private(matrix_room);
+
+    return priv->notification_count;
+}
+
+/**
+ * matrix_room_get_highlight_count:
+ * @room: a #MatrixRoom
+ *
+ * Returns: the number of unread highlighted notifications in @room
+ */
+guint
+matrix_room_get_highlight_count(MatrixRoom *matrix_room)
+{
+    MatrixRoomPrivate *priv;
+
+    g_return_val_if_fail(matrix_room != NULL, 0);
+
+    priv = matrix_room_get_instance_private(matrix_room);
+
+    return priv->highlight_count;
+}
+
+static guint
+matrix_room_receipt_hash(gconstpointer key)
+{
+    const MatrixRoomReceipt *receipt = key;
+
+    return g_str_hash(receipt->user_id) ^ g_str_hash(receipt->receipt_type);
+}
+
+static gboolean
+matrix_room_receipt_equal(gconstpointer a, gconstpointer b)
+{
+    const MatrixRoomReceipt *receipt_a = a;
+    const MatrixRoomReceipt *receipt_b = b;
+
+    return ((receipt_a->receipt_type == receipt_b->receipt_type)
+            || (g_strcmp0(receipt_a->receipt_type, receipt_b->receipt_type) == 0))
+        && (g_strcmp0(receipt_a->user_id, receipt_b->user_id) == 0);
+}
+
+static void
+matrix_room_receipt_free(MatrixRoomReceipt *receipt)
+{
+    if (_matrix_receipt_type_intern(receipt->receipt_type) == NULL) {
+        g_free((gchar *)receipt->receipt_type);
+    }
+
+    g_free(receipt->user_id);
+    g_free(receipt->event_id);
+    g_free(receipt);
+}
+
+static void
+matrix_room_receipt_remove_reader(MatrixRoomPrivate *priv, MatrixRoomReceipt *receipt)
+{
+    GHashTable *readers;
+
+    if ((readers = g_hash_table_lookup(priv->receipt_readers, receipt->event_id)) == NULL) {
+        return;
+    }
+
+    g_hash_table_remove(readers, receipt);
+
+    if (g_hash_table_size(readers) == 0) {
+        g_hash_table_remove(priv->receipt_readers, receipt->event_id);
+    }
+}
+
+/**
+ * matrix_room_set_receipt:
+ * @room: a #MatrixRoom
+ * @user_id: a user ID
+ * @receipt_type: a receipt type, like `m.read`
+ * @event_id: the ID of the event the receipt points to
+ * @ts: the timestamp of the receipt
+ *
+ * Record that @user_id sent a receipt of @receipt_type for @event_id.  This replaces the
+ * previous receipt of @user_id with the same type, unless that one has a later timestamp.
+ * A @ts of 0 means the timestamp is unknown; such receipts are compared by arrival, so they
+ * always replace the previous one.
+ *
+ * If this is our own read receipt, #MatrixRoom:unread-count is recounted.
+ *
+ * Returns: %TRUE if the receipt of @user_id changed
+ */
+gboolean
+matrix_room_set_receipt(MatrixRoom *matrix_room, const gchar *user_id, const gchar *receipt_type, const gchar *event_id, guint64 ts)
+{
+    MatrixRoomPrivate *priv;
+    MatrixRoomReceipt lookup;
+    MatrixRoomReceipt *receipt;
+    GHashTable *readers;
+
+    g_return_val_if_fail(matrix_room != NULL, FALSE);
+    g_return_val_if_fail(user_id != NULL, FALSE);
+    g_return_val_if_fail(receipt_type != NULL, FALSE);
+    g_return_val_if_fail(event_id != NULL, FALSE);
+
+    priv = matrix_room_get_instance_private(matrix_room);
+
+    lookup.user_id = (gchar *)user_id;
+    lookup.receipt_type = receipt_type;
+
+    if ((receipt = g_hash_table_lookup(priv->receipts, &lookup)) != NULL) {
+        // Without a timestamp, the receipt that arrived later is the newer one
+        if ((g_strcmp0(receipt->event_id, event_id) == 0) || ((ts != 0) && (receipt->ts > ts))) {
+            return FALSE;
+        }
+
+        matrix_room_receipt_remove_reader(priv, receipt);
+        g_free(receipt->event_id);
+    } else {
+        const gchar *interned_type = _matrix_receipt_type_intern(receipt_type);
+
+        receipt = g_new(MatrixRoomReceipt, 1);
+        receipt->user_id = g_strdup(user_id);
+        receipt->receipt_type = (interned_type != NULL) ? interned_type : g_strdup(receipt_type);
+        g_hash_table_add(priv->receipts, receipt);
+    }
+
+    receipt->event_id = g_strdup(event_id);
+    receipt->ts = ts;
+
+    if ((readers = g_hash_table_lookup(priv->receipt_readers, event_id)) == NULL) {
+        readers = g_hash_table_new(g_direct_hash, g_direct_equal);
+        g_hash_table_insert(priv->receipt_readers, g_strdup(event_id), readers);
+    }
+
+    g_hash_table_add(readers, receipt);
+
+    if (g_str_has_prefix(receipt->receipt_type, "m.read")
+        && (g_strcmp0(user_id, matrix_room_get_own_user_id(priv)) == 0)) {
+        matrix_room_recount_unread(matrix_room, event_id);
+    }
+
+    matrix_room_add_changes(matrix_room, MATRIX_ROOM_CHANGES_RECEIPTS);
+
+    return TRUE;
+}
+
+/**
+ * matrix_room_get_receipt:
+ * @room: a #MatrixRoom
+ * @user_id: a user ID
+ * @receipt_type: a receipt type, like `m.read`
+ * @ts: (out) (optional): the timestamp of the receipt
+ *
+ * Get the event the latest receipt of @user_id with @receipt_type points to.
+ *
+ * Returns: (transfer none) (nullable): an event ID, or %NULL if @user_id has no such receipt
+ */
+const gchar *
+matrix_room_get_receipt(MatrixRoom *matrix_room, const gchar *user_id, const gchar *receipt_type, guint64 *ts)
+{
+    MatrixRoomPrivate *priv;
+    MatrixRoomReceipt lookup;
+    MatrixRoomReceipt *receipt;
+
+    g_return_val_if_fail(matrix_room != NULL, NULL);
+    g_return_val_if_fail(user_id != NULL, NULL);
+    g_return_val_if_fail(receipt_type != NULL, NULL);
+
+    priv = matrix_room_get_instance_private(matrix_room);
+
+    lookup.user_id = (gchar *)user_id;
+    lookup.receipt_type = receipt_type;
+
+    if ((receipt = g_hash_table_lookup(priv->receipts, &lookup)) == NULL) {
+        return NULL;
+    }
+
+    if (ts != NULL) {
+        *ts = receipt->ts;
+    }
+
+    return receipt->event_id;
+}
+
+/**
+ * matrix_room_get_readers:
+ * @room: a #MatrixRoom
+ * @event_id: an event ID
+ * @receipt_type: (nullable): a receipt type, like `m.read`, or %NULL for any type
+ *
+ * Get the users whose latest receipt of @receipt_type points to @event_id.
+ *
+ * Returns: (transfer full) (element-type utf8): the list of user IDs, in no particular order
+ */
+GPtrArray *
+matrix_room_get_readers(MatrixRoom *matrix_room, const gchar *event_id, const gchar *receipt_type)
+{
+    MatrixRoomPrivate *priv;
+    GHashTable *readers;
+    GHashTableIter iter;
+    gpointer key;
+    GPtrArray *ret;
+
+    g_return_val_if_fail(matrix_room != NULL, NULL);
+    g_return_val_if_fail(event_id != NULL, NULL);
 
     priv = matrix_room_get_instance_private(matrix_room);
+    ret = g_ptr_array_new_with_free_func(g_free);
 
-    if (priv->default_event_level != default_event_level) {
-        priv->default_event_level = default_event_level;
-
-        g_object_notify_by_pspec((GObject *)matrix_room, matrix_room_properties[PROP_DEFAULT_EVENT_LEVEL]);
+    if ((readers = g_hash_table_lookup(priv->receipt_readers, event_id)) == NULL) {
+        return ret;
     }
-}
 
-gint
-matrix_room_get_default_state_level(MatrixRoom *matrix_room)
-{
-    MatrixRoomPrivate *priv;
+    g_hash_table_iter_init(&iter, readers);
 
-    g_return_val_if_fail(matrix_room != NULL, 0);
+    while (g_hash_table_iter_next(&iter, &key, NULL)) {
+        MatrixRoomReceipt *receipt = key;
 
-    priv = matrix_room_get_instance_private(matrix_room);
+        if ((receipt_type == NULL) || (g_strcmp0(receipt->receipt_type, receipt_type) == 0)) {
+            g_ptr_array_add(ret, g_strdup(receipt->user_id));
+        }
+    }
 
-    return priv->default_state_level;
+    return ret;
 }
 
+/**
+ * matrix_room_clear_receipts:
+ * @room: a #MatrixRoom
+ *
+ * Forget all receipts of @room.
+ */
 void
-matrix_room_set_default_state_level(MatrixRoom *matrix_room, gint defaul_state_level)
+matrix_room_clear_receipts(MatrixRoom *matrix_room)
 {
     MatrixRoomPrivate *priv;
 
@@ -909,27 +3164,44 @@ matrix_room_set_default_state_level(MatrixRoom *matrix_room, gint defaul_state_l
 
     priv = matrix_room_get_instance_private(matrix_room);
 
-    if (priv->default_state_level != defaul_state_level) {
-        priv->default_state_level = defaul_state_level;
+    g_hash_table_remove_all(priv->receipt_readers);
+    g_hash_table_remove_all(priv->receipts);
 
-        g_object_notify_by_pspec((GObject *)matrix_room, matrix_room_properties[PROP_DEFAULT_STATE_LEVEL]);
-    }
+    matrix_room_add_changes(matrix_room, MATRIX_ROOM_CHANGES_RECEIPTS);
 }
 
-gint
-matrix_room_get_ban_level(MatrixRoom *matrix_room)
+/**
+ * matrix_room_begin_update:
+ * @room: a #MatrixRoom
+ *
+ * Start a batch of changes to @room.  Until the matching matrix_room_end_update() call,
+ * property change notifications and #MatrixRoom::state-changed are held back.  Calls can be
+ * nested; only the outermost pair has an effect.
+ */
+void
+matrix_room_begin_update(MatrixRoom *matrix_room)
 {
     MatrixRoomPrivate *priv;
 
-    g_return_val_if_fail(matrix_room != NULL, 0);
+    g_return_if_fail(matrix_room != NULL);
 
     priv = matrix_room_get_instance_private(matrix_room);
 
-    return priv->ban_level;
+    if (priv->update_depth++ == 0) {
+        g_object_freeze_notify(G_OBJECT(matrix_room));
+    }
 }
 
+/**
+ * matrix_room_end_update:
+ * @room: a #MatrixRoom
+ *
+ * End a batch of changes started with matrix_room_begin_update().  If this ends the
+ * outermost batch, the held back property change notifications are emitted, followed by one
+ * #MatrixRoom::state-changed signal with all the changes of the batch.
+ */
 void
-matrix_room_set_ban_level(MatrixRoom *matrix_room, gint ban_level)
+matrix_room_end_update(MatrixRoom *matrix_room)
 {
     MatrixRoomPrivate *priv;
 
@@ -937,151 +3209,236 @@ matrix_room_set_ban_level(MatrixRoom *matrix_room, gint ban_level)
 
     priv = matrix_room_get_instance_private(matrix_room);
 
-    if (priv->ban_level != ban_level) {
-        priv->ban_level = ban_level;
+    g_return_if_fail(priv->update_depth > 0);
 
-        g_object_notify_by_pspec((GObject *)matrix_room, matrix_room_properties[PROP_BAN_LEVEL]);
-    }
-}
+    if (priv->update_depth > 1) {
+        priv->update_depth--;
 
-gint
-matrix_room_get_kick_level(MatrixRoom *matrix_room)
-{
-    MatrixRoomPrivate *priv;
+        return;
+    }
 
-    g_return_val_if_fail(matrix_room != NULL, 0);
+    /* Thawing dispatches the property notifications, which only add to the pending changes
+     * while update_depth is still set */
+    g_object_thaw_notify(G_OBJECT(matrix_room));
+    priv->update_depth = 0;
 
-    priv = matrix_room_get_instance_private(matrix_room);
+    matrix_room_emit_changes(matrix_room);
+}
 
-    return priv->kick_level;
+static void
+matrix_room_state_snapshot_free(MatrixRoomStateSnapshot *snapshot)
+{
+    matrix_room_state_unref(snapshot->state);
+    g_free(snapshot);
 }
 
-void
-matrix_room_set_kick_level(MatrixRoom *matrix_room, gint kick_level)
+static void
+matrix_room_trim_state_history(MatrixRoomPrivate *priv)
 {
-    MatrixRoomPrivate *priv;
+    while (g_queue_get_length(&priv->state_history_order) > priv->state_history_size) {
+        // The queue doesn’t own its data, the hash table does
+        g_hash_table_remove(priv->state_history, g_queue_pop_head(&priv->state_history_order));
+    }
+}
 
-    g_return_if_fail(matrix_room != NULL);
+static void
+matrix_room_record_state(MatrixRoomPrivate *priv, const gchar *id)
+{
+    MatrixRoomStateSnapshot *snapshot;
+    gchar *key;
 
-    priv = matrix_room_get_instance_private(matrix_room);
+    if (priv->state_history_size == 0) {
+        return;
+    }
 
-    if (priv->kick_level != kick_level) {
-        priv->kick_level = kick_level;
+    if (g_hash_table_lookup_extended(priv->state_history, id, (gpointer *)&key, (gpointer *)&snapshot)) {
+        // Recording an ID again makes it the newest one
+        matrix_room_state_ref(priv->state);
+        matrix_room_state_unref(snapshot->state);
+        snapshot->state = priv->state;
+        g_queue_unlink(&priv->state_history_order, snapshot->link);
+        g_queue_push_tail_link(&priv->state_history_order, snapshot->link);
 
-        g_object_notify_by_pspec((GObject *)matrix_room, matrix_room_properties[PROP_KICK_LEVEL]);
+        return;
     }
+
+    key = g_strdup(id);
+    snapshot = g_new(MatrixRoomStateSnapshot, 1);
+    snapshot->state = matrix_room_state_ref(priv->state);
+    g_queue_push_tail(&priv->state_history_order, key);
+    snapshot->link = g_queue_peek_tail_link(&priv->state_history_order);
+    g_hash_table_insert(priv->state_history, key, snapshot);
+    matrix_room_trim_state_history(priv);
 }
 
-gint
-matrix_room_get_redact_level(MatrixRoom *matrix_room)
+/**
+ * matrix_room_apply_state_event:
+ * @room: a #MatrixRoom
+ * @event: a raw state event
+ *
+ * Apply @event to the state of @room.  If the state history is enabled and @event has an
+ * event ID, the resulting state is also recorded under that ID.
+ *
+ * Returns: %TRUE if @event was a state event
+ */
+gboolean
+matrix_room_apply_state_event(MatrixRoom *matrix_room, JsonNode *event)
 {
     MatrixRoomPrivate *priv;
+    MatrixRoomState *state;
+    const gchar *event_id;
 
-    g_return_val_if_fail(matrix_room != NULL, 0);
+    g_return_val_if_fail(matrix_room != NULL, FALSE);
+    g_return_val_if_fail(event != NULL, FALSE);
 
     priv = matrix_room_get_instance_private(matrix_room);
 
-    return priv->redact_level;
-}
-
-void
-matrix_room_set_redact_level(MatrixRoom *matrix_room, gint redact_level)
-{
-    MatrixRoomPrivate *priv;
+    state = matrix_room_state_apply_event(priv->state, event);
 
-    g_return_if_fail(matrix_room != NULL);
+    if (state == priv->state) {
+        matrix_room_state_unref(state);
 
-    priv = matrix_room_get_instance_private(matrix_room);
+        return FALSE;
+    }
 
-    if (priv->redact_level != redact_level) {
-        priv->redact_level = redact_level;
+    matrix_room_state_unref(priv->state);
+    priv->state = state;
 
-        g_object_notify_by_pspec((GObject *)matrix_room, matrix_room_properties[PROP_REDACT_LEVEL]);
+    if ((event_id = matrix_room_state_get_event_id(state)) != NULL) {
+        matrix_room_record_state(priv, event_id);
     }
+
+    return TRUE;
 }
 
-gint
-matrix_room_get_invite_level(MatrixRoom *matrix_room)
+/**
+ * matrix_room_get_state:
+ * @room: a #MatrixRoom
+ *
+ * Get the current state of @room.  The returned snapshot doesn’t change when new state
+ * events arrive; take a reference to keep it around.
+ *
+ * Returns: (transfer none): the current state of @room
+ */
+MatrixRoomState *
+matrix_room_get_state(MatrixRoom *matrix_room)
 {
     MatrixRoomPrivate *priv;
 
-    g_return_val_if_fail(matrix_room != NULL, 0);
+    g_return_val_if_fail(matrix_room != NULL, NULL);
 
     priv = matrix_room_get_instance_private(matrix_room);
 
-    return priv->invite_level;
+    return priv->state;
 }
 
+/**
+ * matrix_room_replace_state:
+ * @room: a #MatrixRoom
+ * @state: a #MatrixRoomState
+ *
+ * Make @state the current state of @room, eg. after fetching the full state from the server.
+ * The state history is kept.  This only replaces the snapshot; the properties of @room are
+ * updated from the state events themselves.
+ */
 void
-matrix_room_set_invite_level(MatrixRoom *matrix_room, gint invite_level)
+matrix_room_replace_state(MatrixRoom *matrix_room, MatrixRoomState *state)
 {
     MatrixRoomPrivate *priv;
 
     g_return_if_fail(matrix_room != NULL);
+    g_return_if_fail(state != NULL);
 
     priv = matrix_room_get_instance_private(matrix_room);
 
-    if (priv->invite_level != invite_level) {
-        priv->invite_level = invite_level;
-
-        g_object_notify_by_pspec((GObject *)matrix_room, matrix_room_properties[PROP_INVITE_LEVEL]);
-    }
+    matrix_room_state_ref(state);
+    matrix_room_state_unref(priv->state);
+    priv->state = state;
 }
 
-const gchar *
-matrix_room_get_topic(MatrixRoom *matrix_room)
+/**
+ * matrix_room_snapshot_state:
+ * @room: a #MatrixRoom
+ * @id: an ID to record the state under, eg. the ID of a timeline event or a sync token
+ *
+ * Record the current state of @room under @id, so it can be retrieved later with
+ * matrix_room_get_state_at().  This only takes a reference to the current state.  If @id
+ * was already recorded, it is replaced and counts as the newest entry of the history.  Does
+ * nothing if #MatrixRoom:state-history-size is 0.
+ */
+void
+matrix_room_snapshot_state(MatrixRoom *matrix_room, const gchar *id)
 {
     MatrixRoomPrivate *priv;
 
-    g_return_val_if_fail(matrix_room != NULL, NULL);
+    g_return_if_fail(matrix_room != NULL);
+    g_return_if_fail(id != NULL);
 
     priv = matrix_room_get_instance_private(matrix_room);
 
-    return priv->topic;
+    matrix_room_record_state(priv, id);
 }
 
-void
-matrix_room_set_topic(MatrixRoom *matrix_room, const gchar *topic)
+/**
+ * matrix_room_get_state_at:
+ * @room: a #MatrixRoom
+ * @id: the ID of a state event, or an ID passed to matrix_room_snapshot_state()
+ *
+ * Get the state of @room as it was recorded at @id.  States are recorded after each state
+ * event, and, by #MatrixHTTPClient, at the end of each sync batch under its sync token.
+ * Other events don’t get snapshots of their own; the state they were sent in is the one
+ * recorded at the last state event or sync token before them.
+ *
+ * Returns: (transfer none) (nullable): the recorded state, or %NULL if it is not (or no
+ *     longer) in the state history
+ */
+MatrixRoomState *
+matrix_room_get_state_at(MatrixRoom *matrix_room, const gchar *id)
 {
     MatrixRoomPrivate *priv;
+    MatrixRoomStateSnapshot *snapshot;
 
-    g_return_if_fail(matrix_room != NULL);
+    g_return_val_if_fail(matrix_room != NULL, NULL);
+    g_return_val_if_fail(id != NULL, NULL);
 
     priv = matrix_room_get_instance_private(matrix_room);
 
-    if (g_strcmp0(topic, priv->topic) != 0) {
-        g_free(priv->topic);
-        priv->topic = g_strdup(topic);
-
-        g_object_notify_by_pspec((GObject *)matrix_room, matrix_room_properties[PROP_TOPIC]);
+    if ((snapshot = g_hash_table_lookup(priv->state_history, id)) == NULL) {
+        return NULL;
     }
+
+    return snapshot->state;
 }
 
 /**
- * matrix_room_get_typing_users:
+ * matrix_room_get_state_history_size:
  * @room: a #MatrixRoom
- * @n_typing_users: (nullable): placeholder for the length of the returned list
  *
- * Returns: (transfer none): the list of typing users in @room
+ * Returns: the maximum number of earlier states kept for @room
  */
-gchar **
-matrix_room_get_typing_users(MatrixRoom *matrix_room, int *n_typing_users)
+guint
+matrix_room_get_state_history_size(MatrixRoom *matrix_room)
 {
     MatrixRoomPrivate *priv;
 
-    g_return_val_if_fail(matrix_room != NULL, NULL);
+    g_return_val_if_fail(matrix_room != NULL, 0);
 
     priv = matrix_room_get_instance_private(matrix_room);
 
-    if (n_typing_users != NULL) {
-        *n_typing_users = priv->typing_users_len;
-    }
-
-    return priv->typing_users;
+    return priv->state_history_size;
 }
 
+/**
+ * matrix_room_set_state_history_size:
+ * @room: a #MatrixRoom
+ * @size: the maximum number of earlier states to keep
+ *
+ * Set the number of earlier states kept for matrix_room_get_state_at().  When the history is
+ * full, the oldest recorded state is dropped.  As snapshots share most of their data, each
+ * one costs memory proportional to the logarithm of the size of the state.
+ */
 void
-matrix_room_set_typing_users(MatrixRoom *matrix_room, gchar **typing_users, int n_typing_users)
+matrix_room_set_state_history_size(MatrixRoom *matrix_room, guint size)
 {
     MatrixRoomPrivate *priv;
 
@@ -1089,19 +3446,32 @@ matrix_room_set_typing_users(MatrixRoom *matrix_room, gchar **typing_users, int
 
     priv = matrix_room_get_instance_private(matrix_room);
 
-    for (gint i = 0; i < priv->typing_users_len; i++) {
-        g_free(priv->typing_users[i]);
+    if (size == priv->state_history_size) {
+        return;
     }
 
-    g_free(priv->typing_users);
+    priv->state_history_size = size;
+    matrix_room_trim_state_history(priv);
 
-    priv->typing_users = g_new(gchar *, n_typing_users);
+    g_object_notify_by_pspec((GObject *)matrix_room, matrix_room_properties[PROP_STATE_HISTORY_SIZE]);
+}
 
-    for (gint i = 0; i < n_typing_users; i++) {
-        priv->typing_users[i] = g_strdup(typing_users[i]);
+static void
+matrix_room_dispatch_properties_changed(GObject *gobject, guint n_pspecs, GParamSpec **pspecs)
+{
+    MatrixRoomChanges changes = MATRIX_ROOM_CHANGES_NONE;
+
+    for (guint i = 0; i < n_pspecs; i++) {
+        if ((pspecs[i]->owner_type == MATRIX_TYPE_ROOM) && (pspecs[i]->param_id < NUM_PROPERTIES)) {
+            changes |= matrix_room_property_changes[pspecs[i]->param_id];
+        } else {
+            changes |= MATRIX_ROOM_CHANGES_OTHER;
+        }
     }
 
-    g_object_notify_by_pspec((GObject *)matrix_room, matrix_room_properties[PROP_TYPING_USERS]);
+    G_OBJECT_CLASS(matrix_room_parent_class)->dispatch_properties_changed(gobject, n_pspecs, pspecs);
+
+    matrix_room_add_changes(MATRIX_ROOM(gobject), changes);
 }
 
 static void
@@ -1125,6 +3495,13 @@ matrix_room_finalize(GObject *gobject)
     g_free(priv->name);
     g_free(priv->topic);
 
+    for (gint i = 0; i < priv->heroes_len; i++) {
+        g_free(priv->heroes[i]);
+    }
+
+    g_free(priv->heroes);
+    g_free(priv->display_name);
+
     for (gint i = 0; i < priv->typing_users_len; i++) {
         g_free(priv->typing_users[i]);
     }
@@ -1133,6 +3510,20 @@ matrix_room_finalize(GObject *gobject)
     g_hash_table_unref(priv->event_levels);
     g_hash_table_unref(priv->user_levels);
     g_hash_table_unref(priv->members);
+    g_hash_table_unref(priv->member_names);
+
+    matrix_room_set_api(MATRIX_ROOM(gobject), NULL);
+    matrix_room_clear_timeline(MATRIX_ROOM(gobject));
+    g_free(priv->timeline);
+    g_hash_table_unref(priv->timeline_index);
+    g_hash_table_unref(priv->timeline_gaps);
+    g_free(priv->timeline_start_token);
+    g_free(priv->pending_gap_token);
+    g_hash_table_unref(priv->receipt_readers);
+    g_hash_table_unref(priv->receipts);
+    matrix_room_state_unref(priv->state);
+    g_queue_clear(&priv->state_history_order);
+    g_hash_table_unref(priv->state_history);
 
     G_OBJECT_CLASS(matrix_room_parent_class)->finalize(gobject);
 }
@@ -1214,6 +3605,10 @@ matrix_room_get_property(GObject *gobject, guint property_id, GValue *value, GPa
         case PROP_INVITE_LEVEL:
             g_value_set_int(value, matrix_room_get_invite_level(matrix_room));
 
+            break;
+        case PROP_ROOM_NOTIFICATION_LEVEL:
+            g_value_set_int(value, matrix_room_get_room_notification_level(matrix_room));
+
             break;
         case PROP_TOPIC:
             g_value_set_string(value, matrix_room_get_topic(matrix_room));
@@ -1230,6 +3625,34 @@ matrix_room_get_property(GObject *gobject, guint property_id, GValue *value, GPa
         case PROP_AVATAR_THUMBNAIL_INFO:
             g_value_set_boxed(value, matrix_room_get_avatar_thumbnail_info(matrix_room));
 
+            break;
+        case PROP_TIMELINE_CAPACITY:
+            g_value_set_uint(value, matrix_room_get_timeline_capacity(matrix_room));
+
+            break;
+        case PROP_STATE_HISTORY_SIZE:
+            g_value_set_uint(value, matrix_room_get_state_history_size(matrix_room));
+
+            break;
+        case PROP_TIMELINE_MEMORY_BUDGET:
+            g_value_set_uint64(value, matrix_room_get_timeline_memory_budget(matrix_room));
+
+            break;
+        case PROP_UNREAD_COUNT:
+            g_value_set_uint(value, matrix_room_get_unread_count(matrix_room));
+
+            break;
+        case PROP_NOTIFICATION_COUNT:
+            g_value_set_uint(value, matrix_room_get_notification_count(matrix_room));
+
+            break;
+        case PROP_HIGHLIGHT_COUNT:
+            g_value_set_uint(value, matrix_room_get_highlight_count(matrix_room));
+
+            break;
+        case PROP_DISPLAY_NAME:
+            g_value_set_string(value, matrix_room_get_display_name(matrix_room));
+
             break;
         default:
             G_OBJECT_WARN_INVALID_PROPERTY_ID(gobject, property_id, pspec);
@@ -1319,6 +3742,10 @@ matrix_room_set_property(GObject *gobject, guint property_id, const GValue *valu
         case PROP_INVITE_LEVEL:
             matrix_room_set_invite_level(matrix_room, g_value_get_int(value));
 
+            break;
+        case PROP_ROOM_NOTIFICATION_LEVEL:
+            matrix_room_set_room_notification_level(matrix_room, g_value_get_int(value));
+
             break;
         case PROP_TOPIC:
             matrix_room_set_topic(matrix_room, g_value_get_string(value));
@@ -1339,6 +3766,18 @@ matrix_room_set_property(GObject *gobject, guint property_id, const GValue *valu
         case PROP_AVATAR_THUMBNAIL_INFO:
             matrix_room_set_avatar_thumbnail_info(matrix_room, g_value_get_boxed(value));
 
+            break;
+        case PROP_TIMELINE_CAPACITY:
+            matrix_room_set_timeline_capacity(matrix_room, g_value_get_uint(value));
+
+            break;
+        case PROP_STATE_HISTORY_SIZE:
+            matrix_room_set_state_history_size(matrix_room, g_value_get_uint(value));
+
+            break;
+        case PROP_TIMELINE_MEMORY_BUDGET:
+            matrix_room_set_timeline_memory_budget(matrix_room, g_value_get_uint64(value));
+
             break;
         default:
             G_OBJECT_WARN_INVALID_PROPERTY_ID(gobject, property_id, pspec);
@@ -1353,6 +3792,7 @@ matrix_room_class_init(MatrixRoomClass *klass)
     G_OBJECT_CLASS(klass)->get_property = matrix_room_get_property;
     G_OBJECT_CLASS(klass)->set_property = matrix_room_set_property;
     G_OBJECT_CLASS(klass)->finalize = matrix_room_finalize;
+    G_OBJECT_CLASS(klass)->dispatch_properties_changed = matrix_room_dispatch_properties_changed;
 
     /**
      * MatrixRoom:room-id:
@@ -1554,6 +3994,17 @@ matrix_room_class_init(MatrixRoomClass *klass)
             G_PARAM_STATIC_STRINGS | G_PARAM_READWRITE);
     g_object_class_install_property(G_OBJECT_CLASS(klass), PROP_INVITE_LEVEL, matrix_room_properties[PROP_INVITE_LEVEL]);
 
+    /**
+     * MatrixRoom:room-notification-level:
+     *
+     * The power level required to notify everyone in the room with `@room`.
+     */
+    matrix_room_properties[PROP_ROOM_NOTIFICATION_LEVEL] = g_param_spec_int(
+            "room-notification-level", "room-notification-level", "room-notification-level",
+            G_MININT, G_MAXINT, 50,
+            G_PARAM_STATIC_STRINGS | G_PARAM_READWRITE);
+    g_object_class_install_property(G_OBJECT_CLASS(klass), PROP_ROOM_NOTIFICATION_LEVEL, matrix_room_properties[PROP_ROOM_NOTIFICATION_LEVEL]);
+
     /**
      * MatrixRoom:topic:
      *
@@ -1597,6 +4048,147 @@ matrix_room_class_init(MatrixRoomClass *klass)
             MATRIX_TYPE_IMAGE_INFO,
             G_PARAM_STATIC_STRINGS | G_PARAM_READWRITE);
     g_object_class_install_property(G_OBJECT_CLASS(klass), PROP_AVATAR_THUMBNAIL_INFO, matrix_room_properties[PROP_AVATAR_THUMBNAIL_INFO]);
+
+    /**
+     * MatrixRoom:timeline-capacity:
+     *
+     * The maximum number of events held in the room’s timeline.  0, the default, disables the
+     * timeline.
+     */
+    matrix_room_properties[PROP_TIMELINE_CAPACITY] = g_param_spec_uint(
+            "timeline-capacity", "timeline-capacity", "timeline-capacity",
+            0, G_MAXUINT, MATRIX_ROOM_TIMELINE_DEFAULT_CAPACITY,
+            G_PARAM_STATIC_STRINGS | G_PARAM_READWRITE);
+    g_object_class_install_property(G_OBJECT_CLASS(klass), PROP_TIMELINE_CAPACITY, matrix_room_properties[PROP_TIMELINE_CAPACITY]);
+
+    /**
+     * MatrixRoom:timeline-memory-budget:
+     *
+     * The approximate maximum memory used by the room’s timeline, in bytes.  0 means no limit.
+     */
+    matrix_room_properties[PROP_TIMELINE_MEMORY_BUDGET] = g_param_spec_uint64(
+            "timeline-memory-budget", "timeline-memory-budget", "timeline-memory-budget",
+            0, G_MAXUINT64, 0,
+            G_PARAM_STATIC_STRINGS | G_PARAM_READWRITE);
+    g_object_class_install_property(G_OBJECT_CLASS(klass), PROP_TIMELINE_MEMORY_BUDGET, matrix_room_properties[PROP_TIMELINE_MEMORY_BUDGET]);
+
+    /**
+     * MatrixRoom:state-history-size:
+     *
+     * The maximum number of earlier states of the room kept for matrix_room_get_state_at().
+     * 0 disables the history.
+     */
+    matrix_room_properties[PROP_STATE_HISTORY_SIZE] = g_param_spec_uint(
+            "state-history-size", "state-history-size", "state-history-size",
+            0, G_MAXUINT, 0,
+            G_PARAM_STATIC_STRINGS | G_PARAM_READWRITE);
+    g_object_class_install_property(G_OBJECT_CLASS(klass), PROP_STATE_HISTORY_SIZE, matrix_room_properties[PROP_STATE_HISTORY_SIZE]);
+
+    /**
+     * MatrixRoom:unread-count:
+     *
+     * The number of messages from others after our own read receipt.  This is counted
+     * locally, from timeline events and our receipts.
+     */
+    matrix_room_properties[PROP_UNREAD_COUNT] = g_param_spec_uint(
+            "unread-count", "unread-count", "unread-count",
+            0, G_MAXUINT, 0,
+            G_PARAM_STATIC_STRINGS | G_PARAM_READABLE);
+    g_object_class_install_property(G_OBJECT_CLASS(klass), PROP_UNREAD_COUNT, matrix_room_properties[PROP_UNREAD_COUNT]);
+
+    /**
+     * MatrixRoom:notification-count:
+     *
+     * The number of unread notifications, as reported by the homeserver.
+     */
+    matrix_room_properties[PROP_NOTIFICATION_COUNT] = g_param_spec_uint(
+            "notification-count", "notification-count", "notification-count",
+            0, G_MAXUINT, 0,
+            G_PARAM_STATIC_STRINGS | G_PARAM_READABLE);
+    g_object_class_install_property(G_OBJECT_CLASS(klass), PROP_NOTIFICATION_COUNT, matrix_room_properties[PROP_NOTIFICATION_COUNT]);
+
+    /**
+     * MatrixRoom:highlight-count:
+     *
+     * The number of unread highlighted notifications, as reported by the homeserver.
+     */
+    matrix_room_properties[PROP_HIGHLIGHT_COUNT] = g_param_spec_uint(
+            "highlight-count", "highlight-count", "highlight-count",
+            0, G_MAXUINT, 0,
+            G_PARAM_STATIC_STRINGS | G_PARAM_READABLE);
+    g_object_class_install_property(G_OBJECT_CLASS(klass), PROP_HIGHLIGHT_COUNT, matrix_room_properties[PROP_HIGHLIGHT_COUNT]);
+
+    /**
+     * MatrixRoom:display-name:
+     *
+     * The name of the room to display to the user, computed from the room name, the canonical
+     * alias, or the heroes of the room.
+     */
+    matrix_room_properties[PROP_DISPLAY_NAME] = g_param_spec_string(
+            "display-name", "display-name", "display-name",
+            NULL,
+            G_PARAM_STATIC_STRINGS | G_PARAM_READABLE);
+    g_object_class_install_property(G_OBJECT_CLASS(klass), PROP_DISPLAY_NAME, matrix_room_properties[PROP_DISPLAY_NAME]);
+
+    /**
+     * MatrixRoom::timeline-paginated:
+     * @room: the #MatrixRoom that emitted the signal
+     * @n_events: the number of events added to the timeline
+     *
+     * This signal is emitted when a request started by matrix_room_paginate_timeline() (or
+     * by prefetching) finishes, even if it failed.
+     */
+    matrix_room_signals[SIGNAL_TIMELINE_PAGINATED] = g_signal_new(
+            "timeline-paginated",
+            MATRIX_TYPE_ROOM,
+            G_SIGNAL_RUN_LAST,
+            0,
+            NULL, NULL,
+            g_cclosure_marshal_VOID__UINT,
+            G_TYPE_NONE, 1, G_TYPE_UINT);
+
+    /**
+     * MatrixRoom::timeline-event-fetched:
+     * @room: the #MatrixRoom that emitted the signal
+     * @event_node: the event as received from the homeserver
+     * @event: the event as added to the timeline
+     *
+     * This signal is emitted for every past event added to the timeline by
+     * matrix_room_paginate_timeline() (or by prefetching).  These events don’t go through
+     * the event stream of #MatrixClient, so this is the place to store or index them.
+     *
+     * As they are older than the current state of the room, they must not be used to update
+     * it.  #MatrixHTTPClient adds them to its relation index, and applies redactions among
+     * them.  They are not added to its event store or search index, which keep the events of a
+     * room in the order they happened.
+     */
+    matrix_room_signals[SIGNAL_TIMELINE_EVENT_FETCHED] = g_signal_new(
+            "timeline-event-fetched",
+            MATRIX_TYPE_ROOM,
+            G_SIGNAL_RUN_LAST,
+            0,
+            NULL, NULL,
+            _matrix_marshal_VOID__BOXED_OBJECT,
+            G_TYPE_NONE, 2, JSON_TYPE_NODE, MATRIX_EVENT_TYPE_ROOM);
+
+    /**
+     * MatrixRoom::state-changed:
+     * @room: the #MatrixRoom that emitted the signal
+     * @changes: the kinds of changes
+     *
+     * This signal is emitted after the room changed.  Changes made between
+     * matrix_room_begin_update() and matrix_room_end_update() are collected, and reported
+     * with one emission.  #MatrixHTTPClient does this for every room touched by a sync
+     * response.
+     */
+    matrix_room_signals[SIGNAL_STATE_CHANGED] = g_signal_new(
+            "state-changed",
+            MATRIX_TYPE_ROOM,
+            G_SIGNAL_RUN_LAST,
+            0,
+            NULL, NULL,
+            g_cclosure_marshal_VOID__FLAGS,
+            G_TYPE_NONE, 1, MATRIX_TYPE_ROOM_CHANGES);
 }
 
 static void
@@ -1622,8 +4214,24 @@ matrix_room_init(MatrixRoom *matrix_room)
     priv->kick_level = 5;
     priv->redact_level = 20;
     priv->invite_level = 0;
+    priv->room_notification_level = 50;
     priv->topic = NULL;
-    priv->event_levels = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_free);
-    priv->user_levels = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_free);
+    priv->event_levels = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+    priv->user_levels = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
     priv->members = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, (GDestroyNotify)matrix_room_member_data_free);
+    priv->member_names = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, (GDestroyNotify)g_hash_table_unref);
+    priv->timeline_capacity = MATRIX_ROOM_TIMELINE_DEFAULT_CAPACITY;
+    priv->timeline = g_new0(MatrixRoomTimelineEntry, priv->timeline_capacity);
+    priv->timeline_index = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+    priv->timeline_gaps = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_free);
+    priv->receipts = g_hash_table_new_full(matrix_room_receipt_hash, matrix_room_receipt_equal, (GDestroyNotify)matrix_room_receipt_free, NULL);
+    priv->receipt_readers = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, (GDestroyNotify)g_hash_table_unref);
+    priv->heroes = NULL;
+    priv->heroes_len = 0;
+    priv->has_member_counts = FALSE;
+    priv->display_name = matrix_room_compute_display_name(priv);
+    priv->state = matrix_room_state_new();
+    priv->state_history = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, (GDestroyNotify)matrix_room_state_snapshot_free);
+    g_queue_init(&priv->state_history_order);
+    priv->state_history_size = 0;
 }
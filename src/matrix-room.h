@@ -22,6 +22,9 @@
 # include <glib-object.h>
 # include "matrix-profile.h"
 # include "matrix-types.h"
+# include "matrix-event-room-base.h"
+# include "matrix-api.h"
+# include "matrix-room-state.h"
 
 G_BEGIN_DECLS
 
@@ -37,12 +40,20 @@ void matrix_room_add_member(MatrixRoom *room, const gchar *user_id, MatrixProfil
 MatrixProfile *matrix_room_get_or_add_member(MatrixRoom *room, const gchar *user_id, gboolean third_party, GError **error);
 MatrixProfile *matrix_room_get_member(MatrixRoom *room, const gchar *user_id, gboolean *third_party, GError **error);
 void matrix_room_remove_member(MatrixRoom *room, const gchar *user_id, GError **error);
+guint matrix_room_get_n_members(MatrixRoom *room);
+void matrix_room_set_member_membership(MatrixRoom *room, const gchar *user_id, MatrixRoomMembership membership);
+gchar *matrix_room_get_member_name(MatrixRoom *room, const gchar *user_id);
+gboolean matrix_room_is_member_name_ambiguous(MatrixRoom *room, const gchar *display_name);
 void matrix_room_clear_user_levels(MatrixRoom *room);
 void matrix_room_set_user_level(MatrixRoom *room, const gchar *user_id, gint level);
 gint matrix_room_get_user_level(MatrixRoom *room, const gchar *user_id);
 void matrix_room_clear_event_levels(MatrixRoom *room);
 void matrix_room_set_event_level(MatrixRoom *room, const gchar *event_type, gint level);
 gint matrix_room_get_event_level(MatrixRoom *room, const gchar *event_type, GError **error);
+void matrix_room_set_user_levels(MatrixRoom *room, GHashTable *user_levels);
+void matrix_room_set_event_levels(MatrixRoom *room, GHashTable *event_levels);
+gint matrix_room_get_required_level(MatrixRoom *room, const gchar *event_type, gboolean state_event);
+guint matrix_room_check_user_levels(MatrixRoom *room, gint required_level, const gchar **user_ids, int n_user_ids, gboolean *allowed);
 const gchar *matrix_room_get_room_id(MatrixRoom *room);
 gchar **matrix_room_get_aliases(MatrixRoom *room, int *n_aliases);
 void matrix_room_set_aliases(MatrixRoom *room, const gchar **aliases, int n_aliases);
@@ -68,6 +79,12 @@ MatrixJoinRules matrix_room_get_join_rules(MatrixRoom *room);
 void matrix_room_set_join_rules(MatrixRoom *room, MatrixJoinRules join_rules);
 const gchar *matrix_room_get_name(MatrixRoom *room);
 void matrix_room_set_name(MatrixRoom *room, const gchar *name);
+gchar **matrix_room_get_heroes(MatrixRoom *room, int *n_heroes);
+void matrix_room_set_heroes(MatrixRoom *room, const gchar **heroes, int n_heroes);
+void matrix_room_set_member_counts(MatrixRoom *room, guint joined_member_count, guint invited_member_count);
+guint matrix_room_get_joined_member_count(MatrixRoom *room);
+guint matrix_room_get_invited_member_count(MatrixRoom *room);
+const gchar *matrix_room_get_display_name(MatrixRoom *room);
 gint matrix_room_get_default_power_level(MatrixRoom *room);
 void matrix_room_set_default_power_level(MatrixRoom *room, gint default_power_level);
 gint matrix_room_get_default_event_level(MatrixRoom *room);
@@ -82,10 +99,44 @@ gint matrix_room_get_redact_level(MatrixRoom *room);
 void matrix_room_set_redact_level(MatrixRoom *room, gint redact_level);
 gint matrix_room_get_invite_level(MatrixRoom *room);
 void matrix_room_set_invite_level(MatrixRoom *room, gint invite_level);
+gint matrix_room_get_room_notification_level(MatrixRoom *room);
+void matrix_room_set_room_notification_level(MatrixRoom *room, gint room_notification_level);
 const gchar *matrix_room_get_topic(MatrixRoom *room);
 void matrix_room_set_topic(MatrixRoom *room, const gchar *topic);
 gchar **matrix_room_get_typing_users(MatrixRoom *room, int *n_typing_users);
 void matrix_room_set_typing_users(MatrixRoom *room, gchar **typing_users, int n_typing_users);
+gboolean matrix_room_append_timeline_event(MatrixRoom *room, MatrixEventRoom *event, gsize size);
+guint matrix_room_get_timeline_length(MatrixRoom *room);
+MatrixEventRoom *matrix_room_get_timeline_event_nth(MatrixRoom *room, guint n);
+MatrixEventRoom **matrix_room_get_last_timeline_events(MatrixRoom *room, guint n, guint *n_events);
+MatrixEventRoom *matrix_room_get_timeline_event(MatrixRoom *room, const gchar *event_id);
+void matrix_room_clear_timeline(MatrixRoom *room);
+guint matrix_room_get_timeline_capacity(MatrixRoom *room);
+void matrix_room_set_timeline_capacity(MatrixRoom *room, guint capacity);
+guint64 matrix_room_get_timeline_memory_budget(MatrixRoom *room);
+void matrix_room_set_timeline_memory_budget(MatrixRoom *room, guint64 memory_budget);
+void matrix_room_mark_timeline_gap(MatrixRoom *room, const gchar *prev_batch);
+gboolean matrix_room_has_timeline_gap(MatrixRoom *room, const gchar *event_id);
+gboolean matrix_room_paginate_timeline(MatrixRoom *room, const gchar *gap_event_id, guint limit, GError **error);
+void matrix_room_set_api(MatrixRoom *room, MatrixAPI *api);
+gboolean matrix_room_set_receipt(MatrixRoom *room, const gchar *user_id, const gchar *receipt_type, const gchar *event_id, guint64 ts);
+const gchar *matrix_room_get_receipt(MatrixRoom *room, const gchar *user_id, const gchar *receipt_type, guint64 *ts);
+GPtrArray *matrix_room_get_readers(MatrixRoom *room, const gchar *event_id, const gchar *receipt_type);
+void matrix_room_clear_receipts(MatrixRoom *room);
+void matrix_room_begin_update(MatrixRoom *room);
+void matrix_room_end_update(MatrixRoom *room);
+void matrix_room_add_unread_event(MatrixRoom *room, const gchar *event_type, const gchar *sender);
+guint matrix_room_get_unread_count(MatrixRoom *room);
+void matrix_room_set_unread_notifications(MatrixRoom *room, guint notification_count, guint highlight_count);
+guint matrix_room_get_notification_count(MatrixRoom *room);
+guint matrix_room_get_highlight_count(MatrixRoom *room);
+gboolean matrix_room_apply_state_event(MatrixRoom *room, JsonNode *event);
+MatrixRoomState *matrix_room_get_state(MatrixRoom *room);
+void matrix_room_replace_state(MatrixRoom *room, MatrixRoomState *state);
+void matrix_room_snapshot_state(MatrixRoom *room, const gchar *id);
+MatrixRoomState *matrix_room_get_state_at(MatrixRoom *room, const gchar *id);
+guint matrix_room_get_state_history_size(MatrixRoom *room);
+void matrix_room_set_state_history_size(MatrixRoom *room, guint size);
 
 G_END_DECLS
 
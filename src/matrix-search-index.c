@@ -0,0 +1,1120 @@
+/*
+ * This file is part of matrix-glib-sdk
+ *
+ * matrix-glib-sdk is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * matrix-glib-sdk is distributed in the hope that it will be
+ * useful, but WITHOUT ANY WARRANTY; without even the implied
+ * warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with matrix-glib-sdk. If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#include "matrix-search-index.h"
+#include "matrix-event-base.h"
+#include "matrix-event-room-message.h"
+#include "matrix-event-room-name.h"
+#include "matrix-event-room-topic.h"
+#include "matrix-types.h"
+
+/**
+ * SECTION:matrix-search-index
+ * @short_description: local full-text search over room events
+ * @title: search index
+ *
+ * #MatrixSearchIndex is an in-memory inverted index of room events, which can be used to
+ * search received messages without asking the homeserver.
+ *
+ * matrix_search_index_search() takes the same #MatrixSearchRoomEvents object as
+ * matrix_api_search(), so callers can easily switch between local and server side search.
+ * It honours the search term, the searched keys, the ordering, the room and sender lists of
+ * the timeline filter, and the event context limits.  Result groupings, include_state and
+ * filter IDs are not supported.
+ *
+ * Words are matched case insensitively, and all words of the search term must match.
+ * Results are ranked by term frequency weighted by how rare each word is.
+ *
+ * The index holds at most #MatrixSearchIndex:capacity events; when it gets full, the oldest
+ * ones are dropped.  Events added as JSON with matrix_search_index_add_event_node() are only
+ * turned into #MatrixEventRoom objects when they are returned in search results.
+ */
+
+/**
+ * MatrixSearchResult:
+ * @event: the matching event
+ * @rank: the rank of the result; higher is better
+ * @events_before: (element-type MatrixEventRoom): indexed events of the same room before
+ *     @event, oldest first
+ * @events_after: (element-type MatrixEventRoom): indexed events of the same room after
+ *     @event, oldest first
+ *
+ * One result of matrix_search_index_search().
+ */
+
+typedef struct {
+    /* Only one of these is set; both are NULL if the event was removed */
+    MatrixEventRoom *event;
+    JsonNode *node;
+    guint32 room;
+    guint32 room_position;
+} MatrixSearchIndexDocument;
+
+#define MATRIX_SEARCH_INDEX_DOCUMENT_REMOVED(d) (((d)->event == NULL) && ((d)->node == NULL))
+
+typedef struct {
+    guint32 document;
+    guint16 key;
+    guint16 count;
+} MatrixSearchIndexPosting;
+
+typedef struct {
+    GArray *documents;
+    GHashTable *document_ids;
+    GPtrArray *room_ids;
+    GHashTable *rooms_by_id;
+    GPtrArray *room_documents;
+    GHashTable *postings;
+    guint n_events;
+    guint capacity;
+
+    /* The oldest document that may still be present */
+    guint32 oldest;
+
+    /* The number of removed documents still taking up space in documents and postings */
+    guint n_removed;
+} MatrixSearchIndexPrivate;
+
+enum  {
+    PROP_0,
+    PROP_CAPACITY,
+    NUM_PROPERTIES
+};
+
+static GParamSpec *matrix_search_index_properties[NUM_PROPERTIES];
+
+/* Removed documents are only compacted away if there are at least this many of them, and
+ * they make up at least half of all documents */
+#define MATRIX_SEARCH_INDEX_COMPACT_MIN 1024
+
+#define MATRIX_SEARCH_INDEX_DEFAULT_CAPACITY 100000
+
+/**
+ * MatrixSearchIndex:
+ *
+ * An in-memory full-text index of room events.
+ */
+G_DEFINE_TYPE_WITH_PRIVATE(MatrixSearchIndex, matrix_search_index, G_TYPE_OBJECT);
+
+/**
+ * matrix_search_result_free:
+ * @result: (transfer full): a #MatrixSearchResult
+ *
+ * Free @result.
+ */
+void
+matrix_search_result_free(MatrixSearchResult *result)
+{
+    g_return_if_fail(result != NULL);
+
+    g_object_unref(result->event);
+    g_ptr_array_unref(result->events_before);
+    g_ptr_array_unref(result->events_after);
+    g_free(result);
+}
+
+/**
+ * matrix_search_index_new:
+ *
+ * Create a new, empty #MatrixSearchIndex.
+ *
+ * Returns: (transfer full): a new #MatrixSearchIndex
+ */
+MatrixSearchIndex *
+matrix_search_index_new(void)
+{
+    return (MatrixSearchIndex *)g_object_new(MATRIX_TYPE_SEARCH_INDEX, NULL);
+}
+
+/*
+ * Split text into lower case words, and count the occurences of each of them in counts.
+ */
+static void
+matrix_search_index_tokenize(const gchar *text, GHashTable *counts)
+{
+    gchar *normalized;
+    gchar *folded;
+    const gchar *word_start = NULL;
+    const gchar *p;
+
+    if ((normalized = g_utf8_normalize(text, -1, G_NORMALIZE_ALL)) == NULL) {
+        return;
+    }
+
+    folded = g_utf8_casefold(normalized, -1);
+    g_free(normalized);
+
+    for (p = folded; ; p = g_utf8_next_char(p)) {
+        gunichar c = g_utf8_get_char(p);
+
+        if ((c != 0) && g_unichar_isalnum(c)) {
+            if (word_start == NULL) {
+                word_start = p;
+            }
+
+            continue;
+        }
+
+        if (word_start != NULL) {
+            gchar *word = g_strndup(word_start, p - word_start);
+            guint count = GPOINTER_TO_UINT(g_hash_table_lookup(counts, word));
+
+            g_hash_table_replace(counts, word, GUINT_TO_POINTER(count + 1));
+            word_start = NULL;
+        }
+
+        if (c == 0) {
+            break;
+        }
+    }
+
+    g_free(folded);
+}
+
+static void
+matrix_search_index_add_text(MatrixSearchIndexPrivate *priv, guint32 document, MatrixSearchKey key, const gchar *text)
+{
+    GHashTable *counts;
+    GHashTableIter iter;
+    gpointer word;
+    gpointer count;
+
+    if (text == NULL) {
+        return;
+    }
+
+    counts = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+    matrix_search_index_tokenize(text, counts);
+    g_hash_table_iter_init(&iter, counts);
+
+    while (g_hash_table_iter_next(&iter, &word, &count)) {
+        GArray *postings = g_hash_table_lookup(priv->postings, word);
+        MatrixSearchIndexPosting posting;
+
+        if (postings == NULL) {
+            postings = g_array_new(FALSE, FALSE, sizeof(MatrixSearchIndexPosting));
+            g_hash_table_insert(priv->postings, g_strdup(word), postings);
+        }
+
+        posting.document = document;
+        posting.key = key;
+        posting.count = MIN(GPOINTER_TO_UINT(count), G_MAXUINT16);
+        g_array_append_val(postings, posting);
+    }
+
+    g_hash_table_unref(counts);
+}
+
+static const gchar *
+matrix_search_index_node_get_string(JsonObject *object, const gchar *member_name)
+{
+    JsonNode *node;
+
+    if ((object == NULL)
+        || ((node = json_object_get_member(object, member_name)) == NULL)
+        || (json_node_get_value_type(node) != G_TYPE_STRING)) {
+        return NULL;
+    }
+
+    return json_node_get_string(node);
+}
+
+static const gchar *
+matrix_search_index_document_get_event_id(MatrixSearchIndexDocument *document)
+{
+    if (document->event != NULL) {
+        return matrix_event_room_get_event_id(document->event);
+    }
+
+    return matrix_search_index_node_get_string(json_node_get_object(document->node), "event_id");
+}
+
+static const gchar *
+matrix_search_index_document_get_sender(MatrixSearchIndexDocument *document)
+{
+    if (document->event != NULL) {
+        return matrix_event_room_get_sender(document->event);
+    }
+
+    return matrix_search_index_node_get_string(json_node_get_object(document->node), "sender");
+}
+
+/*
+ * Get the event of a document, creating it from JSON if it was added as such.
+ */
+static MatrixEventRoom *
+matrix_search_index_document_get_event(MatrixSearchIndexPrivate *priv, MatrixSearchIndexDocument *document)
+{
+    MatrixEventBase *event;
+    const gchar *event_type;
+    GError *inner_error = NULL;
+
+    if (document->event != NULL) {
+        return g_object_ref(document->event);
+    }
+
+    if (document->node == NULL) {
+        return NULL;
+    }
+
+    event_type = matrix_search_index_node_get_string(json_node_get_object(document->node), "type");
+    event = matrix_event_base_new_from_json(event_type, document->node, &inner_error);
+
+    if (inner_error != NULL) {
+        g_clear_error(&inner_error);
+        g_clear_object(&event);
+    }
+
+    if ((event == NULL) || !MATRIX_EVENT_IS_ROOM(event)) {
+        g_clear_object(&event);
+
+        return NULL;
+    }
+
+    // The room ID may be stripped from events received during sync
+    if (matrix_event_room_get_room_id(MATRIX_EVENT_ROOM(event)) == NULL) {
+        matrix_event_room_set_room_id(MATRIX_EVENT_ROOM(event), g_ptr_array_index(priv->room_ids, document->room));
+    }
+
+    return MATRIX_EVENT_ROOM(event);
+}
+
+/*
+ * Drop the postings of removed documents, and renumber the rest.
+ */
+static void
+matrix_search_index_compact(MatrixSearchIndexPrivate *priv)
+{
+    guint32 *new_ids = g_new(guint32, priv->documents->len);
+    GArray *documents = g_array_sized_new(FALSE, FALSE, sizeof(MatrixSearchIndexDocument), priv->n_events);
+    GHashTableIter iter;
+    gpointer value;
+
+    for (guint i = 0; i < priv->documents->len; i++) {
+        MatrixSearchIndexDocument *document = &g_array_index(priv->documents, MatrixSearchIndexDocument, i);
+
+        if (MATRIX_SEARCH_INDEX_DOCUMENT_REMOVED(document)) {
+            new_ids[i] = G_MAXUINT32;
+        } else {
+            new_ids[i] = documents->len;
+            g_array_append_val(documents, *document);
+        }
+    }
+
+    for (guint r = 0; r < priv->room_documents->len; r++) {
+        GArray *room_documents = g_ptr_array_index(priv->room_documents, r);
+        guint len = 0;
+
+        for (guint i = 0; i < room_documents->len; i++) {
+            guint32 document_id = new_ids[g_array_index(room_documents, guint32, i)];
+
+            if (document_id != G_MAXUINT32) {
+                g_array_index(documents, MatrixSearchIndexDocument, document_id).room_position = len;
+                g_array_index(room_documents, guint32, len++) = document_id;
+            }
+        }
+
+        g_array_set_size(room_documents, len);
+    }
+
+    /* Renumbering keeps the order of documents, so postings stay sorted */
+    g_hash_table_iter_init(&iter, priv->postings);
+
+    while (g_hash_table_iter_next(&iter, NULL, &value)) {
+        GArray *postings = value;
+        guint len = 0;
+
+        for (guint i = 0; i < postings->len; i++) {
+            MatrixSearchIndexPosting posting = g_array_index(postings, MatrixSearchIndexPosting, i);
+
+            if ((posting.document = new_ids[posting.document]) != G_MAXUINT32) {
+                g_array_index(postings, MatrixSearchIndexPosting, len++) = posting;
+            }
+        }
+
+        if (len == 0) {
+            g_hash_table_iter_remove(&iter);
+        } else {
+            g_array_set_size(postings, len);
+        }
+    }
+
+    g_hash_table_iter_init(&iter, priv->document_ids);
+
+    while (g_hash_table_iter_next(&iter, NULL, &value)) {
+        g_hash_table_iter_replace(&iter, GUINT_TO_POINTER(new_ids[GPOINTER_TO_UINT(value) - 1] + 1));
+    }
+
+    g_array_unref(priv->documents);
+    priv->documents = documents;
+    priv->oldest = 0;
+    priv->n_removed = 0;
+    g_free(new_ids);
+}
+
+static void
+matrix_search_index_remove_document(MatrixSearchIndexPrivate *priv, guint32 document_id)
+{
+    MatrixSearchIndexDocument *document = &g_array_index(priv->documents, MatrixSearchIndexDocument, document_id);
+    const gchar *event_id = matrix_search_index_document_get_event_id(document);
+
+    if (event_id != NULL) {
+        g_hash_table_remove(priv->document_ids, event_id);
+    }
+
+    /* Postings of the document are left in place, and skipped while searching, until the
+     * index gets compacted */
+    g_clear_object(&(document->event));
+    g_clear_pointer(&(document->node), json_node_unref);
+    priv->n_events--;
+    priv->n_removed++;
+
+    if ((priv->n_removed >= MATRIX_SEARCH_INDEX_COMPACT_MIN) && (priv->n_removed * 2 >= priv->documents->len)) {
+        matrix_search_index_compact(priv);
+    }
+}
+
+/*
+ * Drop the oldest events until at most n_events remain.
+ */
+static void
+matrix_search_index_shrink(MatrixSearchIndexPrivate *priv, guint n_events)
+{
+    while (priv->n_events > n_events) {
+        while (MATRIX_SEARCH_INDEX_DOCUMENT_REMOVED(&g_array_index(priv->documents, MatrixSearchIndexDocument, priv->oldest))) {
+            priv->oldest++;
+        }
+
+        matrix_search_index_remove_document(priv, priv->oldest);
+    }
+}
+
+/*
+ * Add a new document for an event or its JSON representation, and return its ID, or
+ * G_MAXUINT32 if it is already in the index.
+ */
+static guint32
+matrix_search_index_add_document(MatrixSearchIndexPrivate *priv, const gchar *room_id, const gchar *event_id, MatrixEventRoom *event, JsonNode *node)
+{
+    MatrixSearchIndexDocument document;
+    GArray *room_documents;
+    gpointer room;
+    guint32 document_id;
+
+    if ((event_id != NULL) && g_hash_table_contains(priv->document_ids, event_id)) {
+        return G_MAXUINT32;
+    }
+
+    if (priv->capacity > 0) {
+        matrix_search_index_shrink(priv, priv->capacity - 1);
+    }
+
+    if ((room = g_hash_table_lookup(priv->rooms_by_id, room_id)) == NULL) {
+        gchar *room_id_copy = g_strdup(room_id);
+
+        g_ptr_array_add(priv->room_ids, room_id_copy);
+        g_ptr_array_add(priv->room_documents, g_array_new(FALSE, FALSE, sizeof(guint32)));
+        room = GUINT_TO_POINTER(priv->room_documents->len);
+        g_hash_table_insert(priv->rooms_by_id, room_id_copy, room);
+    }
+
+    document_id = priv->documents->len;
+    room_documents = g_ptr_array_index(priv->room_documents, GPOINTER_TO_UINT(room) - 1);
+
+    document.event = (event != NULL) ? g_object_ref(event) : NULL;
+    document.node = (node != NULL) ? json_node_ref(node) : NULL;
+    document.room = GPOINTER_TO_UINT(room) - 1;
+    document.room_position = room_documents->len;
+    g_array_append_val(priv->documents, document);
+    g_array_append_val(room_documents, document_id);
+    priv->n_events++;
+
+    if (event_id != NULL) {
+        g_hash_table_insert(priv->document_ids, g_strdup(event_id), GUINT_TO_POINTER(document_id + 1));
+    }
+
+    return document_id;
+}
+
+/**
+ * matrix_search_index_add_event:
+ * @search_index: a #MatrixSearchIndex
+ * @event: a room event
+ *
+ * Add @event to @search_index.  The body of messages, and the name and topic of rooms are indexed;
+ * other events are only kept so they can be returned as context around results.  Events
+ * should be added in the order they happened in their room.
+ *
+ * Events already in @search_index (based on their event ID) are not added again.
+ *
+ * Returns: %TRUE if @event was added
+ */
+gboolean
+matrix_search_index_add_event(MatrixSearchIndex *matrix_search_index, MatrixEventRoom *event)
+{
+    MatrixSearchIndexPrivate *priv;
+    const gchar *room_id;
+    guint32 document_id;
+
+    g_return_val_if_fail(matrix_search_index != NULL, FALSE);
+    g_return_val_if_fail(event != NULL, FALSE);
+
+    priv = matrix_search_index_get_instance_private(matrix_search_index);
+
+    if ((room_id = matrix_event_room_get_room_id(event)) == NULL) {
+        return FALSE;
+    }
+
+    if ((document_id = matrix_search_index_add_document(priv, room_id, matrix_event_room_get_event_id(event), event, NULL)) == G_MAXUINT32) {
+        return FALSE;
+    }
+
+    if (MATRIX_EVENT_IS_ROOM_MESSAGE(event)) {
+        MatrixEventRoomMessage *mevt = MATRIX_EVENT_ROOM_MESSAGE(event);
+        MatrixMessageBase *message = matrix_event_room_message_get_message(mevt);
+        const gchar *body = NULL;
+
+        if (message != NULL) {
+            body = matrix_message_base_get_body(message);
+        }
+
+        if (body == NULL) {
+            body = matrix_event_room_message_get_body(mevt);
+        }
+
+        matrix_search_index_add_text(priv, document_id, MATRIX_SEARCH_KEY_CONTENT_BODY, body);
+    } else if (MATRIX_EVENT_IS_ROOM_NAME(event)) {
+        matrix_search_index_add_text(priv, document_id, MATRIX_SEARCH_KEY_CONTENT_NAME,
+                                     matrix_event_room_name_get_name(MATRIX_EVENT_ROOM_NAME(event)));
+    } else if (MATRIX_EVENT_IS_ROOM_TOPIC(event)) {
+        matrix_search_index_add_text(priv, document_id, MATRIX_SEARCH_KEY_CONTENT_TOPIC,
+                                     matrix_event_room_topic_get_topic(MATRIX_EVENT_ROOM_TOPIC(event)));
+    }
+
+    return TRUE;
+}
+
+/**
+ * matrix_search_index_add_event_node:
+ * @search_index: a #MatrixSearchIndex
+ * @room_id: the room @event_node belongs to
+ * @event_node: the JSON representation of a room event
+ *
+ * Add an event to @search_index, without turning it into a #MatrixEventRoom object.  This is
+ * what #MatrixHTTPClient uses for the events it receives.  The same fields are indexed as by
+ * matrix_search_index_add_event(); the event object is only created if it gets returned in
+ * search results.
+ *
+ * Returns: %TRUE if the event was added
+ */
+gboolean
+matrix_search_index_add_event_node(MatrixSearchIndex *matrix_search_index, const gchar *room_id, JsonNode *event_node)
+{
+    MatrixSearchIndexPrivate *priv;
+    JsonObject *root;
+    JsonObject *content = NULL;
+    JsonNode *node;
+    const gchar *event_type;
+    guint32 document_id;
+
+    g_return_val_if_fail(matrix_search_index != NULL, FALSE);
+    g_return_val_if_fail(room_id != NULL, FALSE);
+    g_return_val_if_fail(event_node != NULL, FALSE);
+
+    priv = matrix_search_index_get_instance_private(matrix_search_index);
+
+    if (!JSON_NODE_HOLDS_OBJECT(event_node)) {
+        return FALSE;
+    }
+
+    root = json_node_get_object(event_node);
+
+    if ((event_type = matrix_search_index_node_get_string(root, "type")) == NULL) {
+        return FALSE;
+    }
+
+    if ((document_id = matrix_search_index_add_document(priv, room_id, matrix_search_index_node_get_string(root, "event_id"), NULL, event_node)) == G_MAXUINT32) {
+        return FALSE;
+    }
+
+    if (((node = json_object_get_member(root, "content")) != NULL) && JSON_NODE_HOLDS_OBJECT(node)) {
+        content = json_node_get_object(node);
+    }
+
+    if (g_strcmp0(event_type, "m.room.message") == 0) {
+        matrix_search_index_add_text(priv, document_id, MATRIX_SEARCH_KEY_CONTENT_BODY,
+                                     matrix_search_index_node_get_string(content, "body"));
+    } else if (g_strcmp0(event_type, "m.room.name") == 0) {
+        matrix_search_index_add_text(priv, document_id, MATRIX_SEARCH_KEY_CONTENT_NAME,
+                                     matrix_search_index_node_get_string(content, "name"));
+    } else if (g_strcmp0(event_type, "m.room.topic") == 0) {
+        matrix_search_index_add_text(priv, document_id, MATRIX_SEARCH_KEY_CONTENT_TOPIC,
+                                     matrix_search_index_node_get_string(content, "topic"));
+    }
+
+    return TRUE;
+}
+
+/**
+ * matrix_search_index_remove_event:
+ * @search_index: a #MatrixSearchIndex
+ * @event_id: the ID of the event to remove
+ *
+ * Remove an event from @search_index, so it won’t appear in search results any more.
+ *
+ * Returns: %TRUE if the event was found in @search_index
+ */
+gboolean
+matrix_search_index_remove_event(MatrixSearchIndex *matrix_search_index, const gchar *event_id)
+{
+    MatrixSearchIndexPrivate *priv;
+    gpointer document_id;
+
+    g_return_val_if_fail(matrix_search_index != NULL, FALSE);
+    g_return_val_if_fail(event_id != NULL, FALSE);
+
+    priv = matrix_search_index_get_instance_private(matrix_search_index);
+
+    if ((document_id = g_hash_table_lookup(priv->document_ids, event_id)) == NULL) {
+        return FALSE;
+    }
+
+    matrix_search_index_remove_document(priv, GPOINTER_TO_UINT(document_id) - 1);
+
+    return TRUE;
+}
+
+/**
+ * matrix_search_index_get_n_events:
+ * @search_index: a #MatrixSearchIndex
+ *
+ * Returns: the number of events in @search_index
+ */
+guint
+matrix_search_index_get_n_events(MatrixSearchIndex *matrix_search_index)
+{
+    MatrixSearchIndexPrivate *priv;
+
+    g_return_val_if_fail(matrix_search_index != NULL, 0);
+
+    priv = matrix_search_index_get_instance_private(matrix_search_index);
+
+    return priv->n_events;
+}
+
+/**
+ * matrix_search_index_get_capacity:
+ * @search_index: a #MatrixSearchIndex
+ *
+ * Returns: the maximum number of events held by @search_index, or 0 if it is unlimited
+ */
+guint
+matrix_search_index_get_capacity(MatrixSearchIndex *matrix_search_index)
+{
+    MatrixSearchIndexPrivate *priv;
+
+    g_return_val_if_fail(matrix_search_index != NULL, 0);
+
+    priv = matrix_search_index_get_instance_private(matrix_search_index);
+
+    return priv->capacity;
+}
+
+/**
+ * matrix_search_index_set_capacity:
+ * @search_index: a #MatrixSearchIndex
+ * @capacity: the maximum number of events to hold, or 0 for no limit
+ *
+ * Set the maximum number of events held by @search_index.  If it holds more events than
+ * @capacity, the oldest ones are dropped.
+ */
+void
+matrix_search_index_set_capacity(MatrixSearchIndex *matrix_search_index, guint capacity)
+{
+    MatrixSearchIndexPrivate *priv;
+
+    g_return_if_fail(matrix_search_index != NULL);
+
+    priv = matrix_search_index_get_instance_private(matrix_search_index);
+
+    if (capacity == priv->capacity) {
+        return;
+    }
+
+    priv->capacity = capacity;
+
+    if (capacity > 0) {
+        matrix_search_index_shrink(priv, capacity);
+    }
+
+    g_object_notify_by_pspec((GObject *)matrix_search_index, matrix_search_index_properties[PROP_CAPACITY]);
+}
+
+/*
+ * Sum the occurences of a word in document, in the keys selected by key_mask.  postings is
+ * sorted by document, so this is a binary search.
+ */
+static guint
+matrix_search_index_get_count(GArray *postings, guint32 document, guint key_mask)
+{
+    guint low = 0;
+    guint high = postings->len;
+    guint count = 0;
+
+    while (low < high) {
+        guint mid = low + (high - low) / 2;
+
+        if (g_array_index(postings, MatrixSearchIndexPosting, mid).document < document) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+
+    for (; low < postings->len; low++) {
+        MatrixSearchIndexPosting *posting = &g_array_index(postings, MatrixSearchIndexPosting, low);
+
+        if (posting->document != document) {
+            break;
+        }
+
+        if (key_mask & (1 << posting->key)) {
+            count += posting->count;
+        }
+    }
+
+    return count;
+}
+
+static gboolean
+matrix_search_index_list_contains(gchar **list, int n_list, const gchar *value)
+{
+    for (int i = 0; i < n_list; i++) {
+        if (g_strcmp0(list[i], value) == 0) {
+            return TRUE;
+        }
+    }
+
+    return FALSE;
+}
+
+/*
+ * Check the room and sender lists of the timeline filter of search.
+ */
+static gboolean
+matrix_search_index_filter_matches(MatrixFilterRules *rules, const gchar *room_id, const gchar *sender)
+{
+    gchar **list;
+    int n_list;
+
+    if (rules == NULL) {
+        return TRUE;
+    }
+
+    if (((list = matrix_filter_rules_get_rooms(rules, &n_list)) != NULL)
+        && (n_list > 0)
+        && !matrix_search_index_list_contains(list, n_list, room_id)) {
+        return FALSE;
+    }
+
+    if (((list = matrix_filter_rules_get_excluded_rooms(rules, &n_list)) != NULL)
+        && matrix_search_index_list_contains(list, n_list, room_id)) {
+        return FALSE;
+    }
+
+    if (((list = matrix_filter_rules_get_senders(rules, &n_list)) != NULL)
+        && (n_list > 0)
+        && !matrix_search_index_list_contains(list, n_list, sender)) {
+        return FALSE;
+    }
+
+    if (((list = matrix_filter_rules_get_excluded_senders(rules, &n_list)) != NULL)
+        && matrix_search_index_list_contains(list, n_list, sender)) {
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+typedef struct {
+    guint32 document;
+    gdouble rank;
+} MatrixSearchIndexHit;
+
+static gint
+matrix_search_index_compare_rank(gconstpointer a, gconstpointer b)
+{
+    const MatrixSearchIndexHit *hit_a = a;
+    const MatrixSearchIndexHit *hit_b = b;
+
+    if (hit_a->rank != hit_b->rank) {
+        return (hit_a->rank < hit_b->rank) ? 1 : -1;
+    }
+
+    return (hit_a->document < hit_b->document) ? 1 : -1;
+}
+
+static gint
+matrix_search_index_compare_recent(gconstpointer a, gconstpointer b)
+{
+    const MatrixSearchIndexHit *hit_a = a;
+    const MatrixSearchIndexHit *hit_b = b;
+
+    if (hit_a->document == hit_b->document) {
+        return 0;
+    }
+
+    return (hit_a->document < hit_b->document) ? 1 : -1;
+}
+
+static gint
+matrix_search_index_compare_postings_len(gconstpointer a, gconstpointer b)
+{
+    GArray *postings_a = *(GArray **)a;
+    GArray *postings_b = *(GArray **)b;
+
+    return (gint)postings_a->len - (gint)postings_b->len;
+}
+
+static GPtrArray *
+matrix_search_index_get_context(MatrixSearchIndexPrivate *priv, MatrixSearchIndexDocument *document, gint before, gint after)
+{
+    GArray *room_documents = g_ptr_array_index(priv->room_documents, document->room);
+    GPtrArray *ret = g_ptr_array_new_with_free_func(g_object_unref);
+    gint step = (before > 0) ? -1 : 1;
+    gint limit = (before > 0) ? before : after;
+    gint64 position = (gint64)document->room_position + step;
+
+    while ((limit > 0) && (position >= 0) && (position < room_documents->len)) {
+        guint32 document_id = g_array_index(room_documents, guint32, position);
+        MatrixEventRoom *event = matrix_search_index_document_get_event(priv, &g_array_index(priv->documents, MatrixSearchIndexDocument, document_id));
+
+        if (event != NULL) {
+            g_ptr_array_add(ret, event);
+            limit--;
+        }
+
+        position += step;
+    }
+
+    /* Events before the result were collected backwards */
+    if (step < 0) {
+        for (guint i = 0; i < ret->len / 2; i++) {
+            gpointer tmp = ret->pdata[i];
+
+            ret->pdata[i] = ret->pdata[ret->len - 1 - i];
+            ret->pdata[ret->len - 1 - i] = tmp;
+        }
+    }
+
+    return ret;
+}
+
+/**
+ * matrix_search_index_search:
+ * @search_index: a #MatrixSearchIndex
+ * @search: the search parameters
+ * @limit: the maximum number of results to return, or 0 for no limit
+ * @error: (nullable): a #GError, or %NULL to ignore errors
+ *
+ * Search @search_index for events matching @search.  See the description of #MatrixSearchIndex
+ * for the supported options.
+ *
+ * Returns: (transfer full) (element-type MatrixSearchResult) (nullable): the list of
+ *     results, best ones first, or %NULL on error
+ */
+GPtrArray *
+matrix_search_index_search(MatrixSearchIndex *matrix_search_index, MatrixSearchRoomEvents *search, guint limit, GError **error)
+{
+    MatrixSearchIndexPrivate *priv;
+    MatrixFilter *filter;
+    MatrixFilterRules *rules = NULL;
+    MatrixEventContext *context;
+    const gchar *search_term;
+    MatrixSearchKey *keys;
+    guint n_keys;
+    guint key_mask = 0;
+    GHashTable *words;
+    GHashTableIter iter;
+    gpointer word;
+    GPtrArray *word_postings;
+    gdouble *idf;
+    GArray *hits;
+    GArray *shortest;
+    GPtrArray *ret;
+
+    g_return_val_if_fail(matrix_search_index != NULL, NULL);
+    g_return_val_if_fail(search != NULL, NULL);
+
+    priv = matrix_search_index_get_instance_private(matrix_search_index);
+
+    if ((search_term = matrix_search_room_events_get_search_term(search)) == NULL) {
+        g_set_error(error, MATRIX_ERROR, MATRIX_ERROR_INCOMPLETE,
+                    "Search term is missing");
+
+        return NULL;
+    }
+
+    if ((matrix_search_room_events_get_filter_id(search) != NULL)
+        && (matrix_search_room_events_get_filter(search) == NULL)) {
+        g_set_error(error, MATRIX_ERROR, MATRIX_ERROR_UNSUPPORTED,
+                    "Filter IDs can not be used for local search");
+
+        return NULL;
+    }
+
+    if (((filter = matrix_search_room_events_get_filter(search)) != NULL)
+        && (matrix_filter_get_room_filter(filter) != NULL)) {
+        rules = matrix_room_filter_get_timeline(matrix_filter_get_room_filter(filter));
+    }
+
+    keys = matrix_search_room_events_get_keys(search, &n_keys);
+
+    for (guint i = 0; i < n_keys; i++) {
+        key_mask |= 1 << keys[i];
+    }
+
+    if (key_mask == 0) {
+        key_mask = (1 << MATRIX_SEARCH_KEY_CONTENT_BODY)
+            | (1 << MATRIX_SEARCH_KEY_CONTENT_NAME)
+            | (1 << MATRIX_SEARCH_KEY_CONTENT_TOPIC);
+    }
+
+    ret = g_ptr_array_new_with_free_func((GDestroyNotify)matrix_search_result_free);
+
+    words = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+    matrix_search_index_tokenize(search_term, words);
+
+    if (g_hash_table_size(words) == 0) {
+        g_hash_table_unref(words);
+
+        return ret;
+    }
+
+    /* Every word must match, so start from the rarest one */
+    word_postings = g_ptr_array_new();
+    g_hash_table_iter_init(&iter, words);
+
+    while (g_hash_table_iter_next(&iter, &word, NULL)) {
+        GArray *postings = g_hash_table_lookup(priv->postings, word);
+
+        if (postings == NULL) {
+            g_ptr_array_set_size(word_postings, 0);
+
+            break;
+        }
+
+        g_ptr_array_add(word_postings, postings);
+    }
+
+    g_hash_table_unref(words);
+
+    if (word_postings->len == 0) {
+        g_ptr_array_unref(word_postings);
+
+        return ret;
+    }
+
+    g_ptr_array_sort(word_postings, matrix_search_index_compare_postings_len);
+    /* Rare words weigh more.  This is a plain inverse document frequency, so the library
+     * doesn’t need to link against libm */
+    idf = g_new(gdouble, word_postings->len);
+
+    for (guint i = 0; i < word_postings->len; i++) {
+        GArray *postings = g_ptr_array_index(word_postings, i);
+
+        idf[i] = (gdouble)priv->documents->len / postings->len;
+    }
+
+    hits = g_array_new(FALSE, FALSE, sizeof(MatrixSearchIndexHit));
+    shortest = g_ptr_array_index(word_postings, 0);
+
+    for (guint i = 0; i < shortest->len; i++) {
+        guint32 document_id = g_array_index(shortest, MatrixSearchIndexPosting, i).document;
+        MatrixSearchIndexDocument *document;
+        MatrixSearchIndexHit hit;
+
+        /* A document may have postings for more than one key; only look at it once */
+        if ((i > 0) && (g_array_index(shortest, MatrixSearchIndexPosting, i - 1).document == document_id)) {
+            continue;
+        }
+
+        document = &g_array_index(priv->documents, MatrixSearchIndexDocument, document_id);
+
+        if (MATRIX_SEARCH_INDEX_DOCUMENT_REMOVED(document)
+            || !matrix_search_index_filter_matches(rules,
+                                                   g_ptr_array_index(priv->room_ids, document->room),
+                                                   matrix_search_index_document_get_sender(document))) {
+            continue;
+        }
+
+        hit.document = document_id;
+        hit.rank = 0;
+
+        for (guint w = 0; w < word_postings->len; w++) {
+            guint count = matrix_search_index_get_count(g_ptr_array_index(word_postings, w), document_id, key_mask);
+
+            if (count == 0) {
+                hit.rank = 0;
+
+                break;
+            }
+
+            hit.rank += count * idf[w];
+        }
+
+        if (hit.rank > 0) {
+            g_array_append_val(hits, hit);
+        }
+    }
+
+    g_free(idf);
+    g_ptr_array_unref(word_postings);
+
+    if (matrix_search_room_events_get_order_by(search) == MATRIX_SEARCH_ORDER_RECENT) {
+        g_array_sort(hits, matrix_search_index_compare_recent);
+    } else {
+        g_array_sort(hits, matrix_search_index_compare_rank);
+    }
+
+    context = matrix_search_room_events_get_event_context(search);
+
+    for (guint i = 0; (i < hits->len) && ((limit == 0) || (ret->len < limit)); i++) {
+        MatrixSearchIndexHit *hit = &g_array_index(hits, MatrixSearchIndexHit, i);
+        MatrixSearchIndexDocument *document = &g_array_index(priv->documents, MatrixSearchIndexDocument, hit->document);
+        MatrixEventRoom *event;
+        MatrixSearchResult *result;
+
+        // Events that can’t be loaded are left out
+        if ((event = matrix_search_index_document_get_event(priv, document)) == NULL) {
+            continue;
+        }
+
+        result = g_new0(MatrixSearchResult, 1);
+        result->event = event;
+        result->rank = hit->rank;
+
+        if (context != NULL) {
+            result->events_before = matrix_search_index_get_context(priv, document, matrix_event_context_get_before_limit(context), 0);
+            result->events_after = matrix_search_index_get_context(priv, document, 0, matrix_event_context_get_after_limit(context));
+        } else {
+            result->events_before = g_ptr_array_new_with_free_func(g_object_unref);
+            result->events_after = g_ptr_array_new_with_free_func(g_object_unref);
+        }
+
+        g_ptr_array_add(ret, result);
+    }
+
+    g_array_unref(hits);
+
+    return ret;
+}
+
+static void
+matrix_search_index_finalize(GObject *gobject)
+{
+    MatrixSearchIndexPrivate *priv = matrix_search_index_get_instance_private(MATRIX_SEARCH_INDEX(gobject));
+
+    for (guint i = 0; i < priv->documents->len; i++) {
+        MatrixSearchIndexDocument *document = &g_array_index(priv->documents, MatrixSearchIndexDocument, i);
+
+        g_clear_object(&(document->event));
+        g_clear_pointer(&(document->node), json_node_unref);
+    }
+
+    g_array_unref(priv->documents);
+    g_hash_table_unref(priv->document_ids);
+    g_hash_table_unref(priv->rooms_by_id);
+    g_ptr_array_unref(priv->room_ids);
+    g_ptr_array_unref(priv->room_documents);
+    g_hash_table_unref(priv->postings);
+
+    G_OBJECT_CLASS(matrix_search_index_parent_class)->finalize(gobject);
+}
+
+static void
+matrix_search_index_get_property(GObject *gobject, guint property_id, GValue *value, GParamSpec *pspec)
+{
+    MatrixSearchIndex *matrix_search_index = MATRIX_SEARCH_INDEX(gobject);
+
+    switch (property_id) {
+        case PROP_CAPACITY:
+            g_value_set_uint(value, matrix_search_index_get_capacity(matrix_search_index));
+
+            break;
+        default:
+            G_OBJECT_WARN_INVALID_PROPERTY_ID(gobject, property_id, pspec);
+
+            break;
+    }
+}
+
+static void
+matrix_search_index_set_property(GObject *gobject, guint property_id, const GValue *value, GParamSpec *pspec)
+{
+    MatrixSearchIndex *matrix_search_index = MATRIX_SEARCH_INDEX(gobject);
+
+    switch (property_id) {
+        case PROP_CAPACITY:
+            matrix_search_index_set_capacity(matrix_search_index, g_value_get_uint(value));
+
+            break;
+        default:
+            G_OBJECT_WARN_INVALID_PROPERTY_ID(gobject, property_id, pspec);
+
+            break;
+    }
+}
+
+static void
+matrix_search_index_class_init(MatrixSearchIndexClass *klass)
+{
+    G_OBJECT_CLASS(klass)->get_property = matrix_search_index_get_property;
+    G_OBJECT_CLASS(klass)->set_property = matrix_search_index_set_property;
+    G_OBJECT_CLASS(klass)->finalize = matrix_search_index_finalize;
+
+    /**
+     * MatrixSearchIndex:capacity:
+     *
+     * The maximum number of events held by the index.  When it is full, the oldest events
+     * are dropped.  0 means no limit.
+     */
+    matrix_search_index_properties[PROP_CAPACITY] = g_param_spec_uint(
+            "capacity", "capacity", "capacity",
+            0, G_MAXUINT, MATRIX_SEARCH_INDEX_DEFAULT_CAPACITY,
+            G_PARAM_STATIC_STRINGS | G_PARAM_READWRITE);
+    g_object_class_install_property(G_OBJECT_CLASS(klass), PROP_CAPACITY, matrix_search_index_properties[PROP_CAPACITY]);
+}
+
+static void
+matrix_search_index_init(MatrixSearchIndex *matrix_search_index)
+{
+    MatrixSearchIndexPrivate *priv = matrix_search_index_get_instance_private(matrix_search_index);
+
+    priv->documents = g_array_new(FALSE, FALSE, sizeof(MatrixSearchIndexDocument));
+    priv->document_ids = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+    /* Keys of rooms_by_id are owned by room_ids */
+    priv->room_ids = g_ptr_array_new_with_free_func(g_free);
+    priv->rooms_by_id = g_hash_table_new(g_str_hash, g_str_equal);
+    priv->room_documents = g_ptr_array_new_with_free_func((GDestroyNotify)g_array_unref);
+    priv->postings = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, (GDestroyNotify)g_array_unref);
+    priv->n_events = 0;
+    priv->capacity = MATRIX_SEARCH_INDEX_DEFAULT_CAPACITY;
+    priv->oldest = 0;
+    priv->n_removed = 0;
+}
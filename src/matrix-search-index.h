@@ -0,0 +1,60 @@
+/*
+ * This file is part of matrix-glib-sdk
+ *
+ * matrix-glib-sdk is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * matrix-glib-sdk is distributed in the hope that it will be
+ * useful, but WITHOUT ANY WARRANTY; without even the implied
+ * warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with matrix-glib-sdk. If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __MATRIX_GLIB_SDK_SEARCH_INDEX_H__
+# define __MATRIX_GLIB_SDK_SEARCH_INDEX_H__
+
+# include <glib-object.h>
+# include "matrix-compacts.h"
+# include "matrix-event-room-base.h"
+
+G_BEGIN_DECLS
+
+typedef struct _MatrixSearchResult MatrixSearchResult;
+
+struct _MatrixSearchResult {
+    MatrixEventRoom *event;
+    gdouble rank;
+    GPtrArray *events_before;
+    GPtrArray *events_after;
+};
+
+void matrix_search_result_free(MatrixSearchResult *result);
+
+# define MATRIX_TYPE_SEARCH_INDEX matrix_search_index_get_type()
+G_DECLARE_DERIVABLE_TYPE(MatrixSearchIndex, matrix_search_index, MATRIX, SEARCH_INDEX, GObject)
+
+struct _MatrixSearchIndexClass {
+    GObjectClass parent_class;
+
+    /* < private > */
+    gpointer padding[12];
+};
+
+MatrixSearchIndex *matrix_search_index_new(void);
+gboolean matrix_search_index_add_event(MatrixSearchIndex *search_index, MatrixEventRoom *event);
+gboolean matrix_search_index_add_event_node(MatrixSearchIndex *search_index, const gchar *room_id, JsonNode *event_node);
+gboolean matrix_search_index_remove_event(MatrixSearchIndex *search_index, const gchar *event_id);
+guint matrix_search_index_get_n_events(MatrixSearchIndex *search_index);
+guint matrix_search_index_get_capacity(MatrixSearchIndex *search_index);
+void matrix_search_index_set_capacity(MatrixSearchIndex *search_index, guint capacity);
+GPtrArray *matrix_search_index_search(MatrixSearchIndex *search_index, MatrixSearchRoomEvents *search, guint limit, GError **error);
+
+G_END_DECLS
+
+#endif  /* __MATRIX_GLIB_SDK_SEARCH_INDEX_H__ */
@@ -92,6 +92,34 @@
  */
 G_DEFINE_QUARK(matrix-error-quark, matrix_error);
 
+/**
+ * matrix_error_response_get_retry_after:
+ * @error_content: (nullable): the content of an error response, as passed to a
+ *     #MatrixAPICallback together with the #GError
+ *
+ * Get the time the homeserver asked us to wait before retrying a request, as sent in the
+ * `retry_after_ms` field of its error response (usually one with
+ * #MATRIX_ERROR_M_LIMIT_EXCEEDED).
+ *
+ * Returns: the time to wait in milliseconds, or 0 if the response didn’t specify it
+ */
+gulong
+matrix_error_response_get_retry_after(JsonNode *error_content)
+{
+    JsonNode *node;
+    gint64 ret;
+
+    if ((error_content == NULL)
+        || !JSON_NODE_HOLDS_OBJECT(error_content)
+        || ((node = json_object_get_member(json_node_get_object(error_content), "retry_after_ms")) == NULL)
+        || (json_node_get_value_type(node) != G_TYPE_INT64)
+        || ((ret = json_node_get_int(node)) <= 0)) {
+        return 0;
+    }
+
+    return (gulong)MIN((guint64)ret, G_MAXULONG);
+}
+
 /**
  * MatrixAccountKind:
  * @MATRIX_ACCOUNT_KIND_DEFAULT: use the server default (usually #MATRIX_ACCOUNT_KIND_USER)
@@ -192,6 +220,25 @@ G_DEFINE_QUARK(matrix-error-quark, matrix_error);
  * Room membership types.
  */
 
+/**
+ * MatrixRoomChanges:
+ * @MATRIX_ROOM_CHANGES_NONE: nothing changed
+ * @MATRIX_ROOM_CHANGES_NAME: the name, aliases, canonical alias or display name changed
+ * @MATRIX_ROOM_CHANGES_AVATAR: the avatar changed
+ * @MATRIX_ROOM_CHANGES_TOPIC: the topic changed
+ * @MATRIX_ROOM_CHANGES_SETTINGS: the creator, federation, guest access, history visibility or
+ *     join rules changed
+ * @MATRIX_ROOM_CHANGES_POWER_LEVELS: the power levels changed
+ * @MATRIX_ROOM_CHANGES_MEMBERS: the member list, the member counts or the display name of a
+ *     member changed
+ * @MATRIX_ROOM_CHANGES_TYPING: the list of typing users changed
+ * @MATRIX_ROOM_CHANGES_RECEIPTS: read receipts changed
+ * @MATRIX_ROOM_CHANGES_UNREAD: the unread, notification or highlight counts changed
+ * @MATRIX_ROOM_CHANGES_OTHER: anything else changed
+ *
+ * Flags for the #MatrixRoom::state-changed signal.
+ */
+
 /**
  * MatrixRoomPreset:
  * @MATRIX_ROOM_PRESET_NONE: no preset
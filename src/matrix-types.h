@@ -75,6 +75,7 @@ typedef enum {
 
 # define MATRIX_ERROR matrix_error_quark()
 GQuark matrix_error_quark(void);
+gulong matrix_error_response_get_retry_after(JsonNode *error_content);
 
 typedef enum {
     MATRIX_ACCOUNT_KIND_DEFAULT,
@@ -136,6 +137,20 @@ typedef enum {
     MATRIX_ROOM_MEMBERSHIP_KNOCK
 } MatrixRoomMembership;
 
+typedef enum /*< flags >*/ {
+    MATRIX_ROOM_CHANGES_NONE = 0,
+    MATRIX_ROOM_CHANGES_NAME = 1 << 0,
+    MATRIX_ROOM_CHANGES_AVATAR = 1 << 1,
+    MATRIX_ROOM_CHANGES_TOPIC = 1 << 2,
+    MATRIX_ROOM_CHANGES_SETTINGS = 1 << 3,
+    MATRIX_ROOM_CHANGES_POWER_LEVELS = 1 << 4,
+    MATRIX_ROOM_CHANGES_MEMBERS = 1 << 5,
+    MATRIX_ROOM_CHANGES_TYPING = 1 << 6,
+    MATRIX_ROOM_CHANGES_RECEIPTS = 1 << 7,
+    MATRIX_ROOM_CHANGES_UNREAD = 1 << 8,
+    MATRIX_ROOM_CHANGES_OTHER = 1 << 9
+} MatrixRoomChanges;
+
 typedef enum {
     MATRIX_ROOM_PRESET_NONE,
     MATRIX_ROOM_PRESET_PRIVATE,
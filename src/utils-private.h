@@ -0,0 +1,57 @@
+/*
+ * This file is part of matrix-glib-sdk
+ *
+ * matrix-glib-sdk is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * matrix-glib-sdk is distributed in the hope that it will be
+ * useful, but WITHOUT ANY WARRANTY; without even the implied
+ * warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with matrix-glib-sdk. If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __MATRIX_GLIB_SDK_UTILS_PRIVATE_H__
+# define __MATRIX_GLIB_SDK_UTILS_PRIVATE_H__
+
+# include "utils.h"
+
+G_BEGIN_DECLS
+
+typedef enum {
+    MATRIX_JSON_FIELD_STRING,
+    MATRIX_JSON_FIELD_INT,
+    MATRIX_JSON_FIELD_LONG,
+    MATRIX_JSON_FIELD_BOOLEAN,
+    MATRIX_JSON_FIELD_NODE,
+    MATRIX_JSON_FIELD_OBJECT
+} MatrixJsonFieldType;
+
+typedef struct _MatrixJsonField MatrixJsonField;
+
+struct _MatrixJsonField {
+    const gchar *name;
+    MatrixJsonFieldType type;
+    gsize offset;
+    const MatrixJsonField *subfields;
+    guint n_subfields;
+};
+
+# define MATRIX_JSON_FIELD(name, type, st, member) { (name), (type), G_STRUCT_OFFSET(st, member), NULL, 0 }
+# define MATRIX_JSON_FIELD_NESTED(name, subfields) { (name), MATRIX_JSON_FIELD_OBJECT, 0, (subfields), G_N_ELEMENTS(subfields) }
+
+guint32 _matrix_json_object_decode(JsonObject *object,
+                                   const MatrixJsonField *fields,
+                                   guint n_fields,
+                                   gpointer target);
+
+const gchar *_matrix_receipt_type_intern(const gchar *receipt_type);
+
+G_END_DECLS
+
+#endif  /* __MATRIX_GLIB_SDK_UTILS_PRIVATE_H__ */
@@ -16,7 +16,9 @@
  * <http://www.gnu.org/licenses/>.
  */
 
-#include "utils.h"
+#include <string.h>
+
+#include "utils-private.h"
 #include "matrix-types.h"
 
 // GTK-Doc looking comments in this file intentionally do not begin with a double star, as the
@@ -107,70 +109,356 @@ _matrix_g_enum_nick_to_value(GType enum_type, const gchar *nick, GError **error)
     return ret;
 }
 
-static void
-_copy_obj_member(JsonObject *old_obj, const gchar *member_name, JsonNode *member_node, gpointer user_data)
+/*
+ * _matrix_json_node_dup_object:
+ * @node: a #JsonNode holding a #JsonObject
+ *
+ * Create a new object node with the same members as @node.  The member nodes are shared by
+ * reference, not copied, so members of the new object can be added or replaced without
+ * touching @node, but the shared member nodes themselves must not be modified.
+ *
+ * Returns: (transfer full): a new #JsonNode
+ */
+JsonNode *
+_matrix_json_node_dup_object(JsonNode *node)
 {
-    JsonObject *new_obj = user_data;
+    JsonObjectIter iter;
+    JsonObject *new_obj;
+    JsonNode *ret;
+    const gchar *member_name;
+    JsonNode *member_node;
 
-    json_object_set_member(new_obj, member_name, _matrix_json_node_deep_copy(member_node));
-}
+    g_return_val_if_fail(node != NULL, NULL);
+    g_return_val_if_fail(JSON_NODE_HOLDS_OBJECT(node), NULL);
 
-static void
-_copy_ary_member(JsonArray *old_ary, guint idx, JsonNode *element_node, gpointer user_data)
-{
-    JsonArray *new_ary = user_data;
+    new_obj = json_object_new();
+    json_object_iter_init(&iter, json_node_get_object(node));
+
+    while (json_object_iter_next(&iter, &member_name, &member_node)) {
+        json_object_set_member(new_obj, member_name, json_node_ref(member_node));
+    }
+
+    ret = json_node_new(JSON_NODE_OBJECT);
+    json_node_take_object(ret, new_obj);
 
-    json_array_add_element(new_ary, _matrix_json_node_deep_copy(element_node));
+    return ret;
 }
 
-JsonNode *
-_matrix_json_node_deep_copy(JsonNode *node)
+/*
+ * _matrix_json_node_get_size:
+ * @node: (nullable): a #JsonNode
+ *
+ * Estimate the memory used by @node and its children.  This is not exact; it is meant to
+ * compare the sizes of nodes and to enforce memory budgets.
+ *
+ * Returns: the approximate size of @node in bytes
+ */
+gsize
+_matrix_json_node_get_size(JsonNode *node)
 {
-    JsonNode *ret;
-    JsonNodeType node_type;
+    gsize ret;
 
-    g_return_val_if_fail(node != NULL, NULL);
+    if (node == NULL) {
+        return 0;
+    }
 
-    node_type = json_node_get_node_type(node);
-    ret = json_node_new(node_type);
+    ret = sizeof(JsonNode);
 
-    switch (node_type) {
+    switch (json_node_get_node_type(node)) {
         case JSON_NODE_OBJECT:
         {
-            JsonObject *new_obj = json_object_new();
-            JsonObject *old_obj = json_node_get_object(node);
+            JsonObjectIter iter;
+            const gchar *member_name;
+            JsonNode *member_node;
 
-            json_object_foreach_member(old_obj, _copy_obj_member, new_obj);
+            json_object_iter_init(&iter, json_node_get_object(node));
 
-            json_node_set_object(ret, new_obj);
+            while (json_object_iter_next(&iter, &member_name, &member_node)) {
+                ret += strlen(member_name) + 1 + 4 * sizeof(gpointer);
+                ret += _matrix_json_node_get_size(member_node);
+            }
 
             break;
         }
         case JSON_NODE_ARRAY:
         {
-            JsonArray *new_ary = json_array_new();
-            JsonArray *old_ary = json_node_get_array(node);
+            JsonArray *array = json_node_get_array(node);
+            guint len = json_array_get_length(array);
 
-            json_array_foreach_element(old_ary, _copy_ary_member, new_ary);
-
-            json_node_set_array(ret, new_ary);
+            for (guint i = 0; i < len; i++) {
+                ret += sizeof(gpointer) + _matrix_json_node_get_size(json_array_get_element(array, i));
+            }
 
             break;
         }
         case JSON_NODE_VALUE:
-        {
-            GValue node_value = G_VALUE_INIT;
+            if (json_node_get_value_type(node) == G_TYPE_STRING) {
+                ret += strlen(json_node_get_string(node)) + 1;
+            }
+
+            break;
+        case JSON_NODE_NULL:
+            break;
+    }
 
-            json_node_get_value(node, &node_value);
-            json_node_set_value(ret, &node_value);
+    return ret;
+}
+
+/* Top level keys kept by a redaction */
+static const gchar *_matrix_redaction_kept_keys[] = {
+    "event_id", "type", "room_id", "sender", "state_key", "content", "hashes", "signatures",
+    "depth", "prev_events", "prev_state", "auth_events", "origin", "origin_server_ts",
+    "membership", NULL
+};
+
+/* Content keys kept by a redaction, for each event type */
+static const struct {
+    const gchar *event_type;
+    const gchar *keys[9];
+} _matrix_redaction_kept_content_keys[] = {
+    {"m.room.member", {"membership", NULL}},
+    {"m.room.create", {"creator", NULL}},
+    {"m.room.join_rules", {"join_rule", NULL}},
+    {"m.room.power_levels", {"ban", "events", "events_default", "kick", "redact", "state_default", "users", "users_default", NULL}},
+    {"m.room.aliases", {"aliases", NULL}},
+    {"m.room.history_visibility", {"history_visibility", NULL}},
+};
+
+static gboolean
+_matrix_strv_contains(const gchar * const *strv, const gchar *str)
+{
+    for (; *strv != NULL; strv++) {
+        if (g_strcmp0(*strv, str) == 0) {
+            return TRUE;
+        }
+    }
+
+    return FALSE;
+}
 
-            g_value_unset(&node_value);
+/*
+ * _matrix_event_json_redact:
+ * @event: a #JsonNode holding an event
+ * @redacted_because: (nullable): the ID of the redaction event
+ *
+ * Strip @event to the keys a redaction keeps, as described in the Client-Server API.  If
+ * @redacted_because is not %NULL, it is added to the unsigned data of the result.
+ *
+ * @event is not modified; the kept members are shared by reference.
+ *
+ * Returns: (transfer full): the redacted event
+ */
+JsonNode *
+_matrix_event_json_redact(JsonNode *event, const gchar *redacted_because)
+{
+    JsonObject *root;
+    JsonObject *new_root;
+    JsonObject *new_content;
+    JsonObjectIter iter;
+    const gchar *member_name;
+    JsonNode *member_node;
+    const gchar *event_type = NULL;
+    const gchar * const *content_keys = NULL;
+    JsonNode *ret;
+
+    g_return_val_if_fail(event != NULL, NULL);
+    g_return_val_if_fail(JSON_NODE_HOLDS_OBJECT(event), NULL);
+
+    root = json_node_get_object(event);
+
+    if ((member_node = json_object_get_member(root, "type")) != NULL) {
+        event_type = json_node_get_string(member_node);
+    }
+
+    for (guint i = 0; i < G_N_ELEMENTS(_matrix_redaction_kept_content_keys); i++) {
+        if (g_strcmp0(event_type, _matrix_redaction_kept_content_keys[i].event_type) == 0) {
+            content_keys = _matrix_redaction_kept_content_keys[i].keys;
 
             break;
         }
-        case JSON_NODE_NULL:
-            break;
     }
 
+    new_root = json_object_new();
+    new_content = json_object_new();
+    json_object_iter_init(&iter, root);
+
+    while (json_object_iter_next(&iter, &member_name, &member_node)) {
+        if (g_strcmp0(member_name, "content") == 0) {
+            JsonObjectIter content_iter;
+            const gchar *content_member_name;
+            JsonNode *content_member_node;
+
+            if ((content_keys == NULL) || !JSON_NODE_HOLDS_OBJECT(member_node)) {
+                continue;
+            }
+
+            json_object_iter_init(&content_iter, json_node_get_object(member_node));
+
+            while (json_object_iter_next(&content_iter, &content_member_name, &content_member_node)) {
+                if (_matrix_strv_contains(content_keys, content_member_name)) {
+                    json_object_set_member(new_content, content_member_name, json_node_ref(content_member_node));
+                }
+            }
+        } else if (_matrix_strv_contains(_matrix_redaction_kept_keys, member_name)) {
+            json_object_set_member(new_root, member_name, json_node_ref(member_node));
+        }
+    }
+
+    json_object_set_object_member(new_root, "content", new_content);
+
+    if (redacted_because != NULL) {
+        JsonObject *unsigned_obj = json_object_new();
+
+        json_object_set_string_member(unsigned_obj, "redacted_because", redacted_because);
+        json_object_set_object_member(new_root, "unsigned", unsigned_obj);
+    }
+
+    ret = json_node_new(JSON_NODE_OBJECT);
+    json_node_take_object(ret, new_root);
+
     return ret;
 }
+
+static void
+_matrix_json_field_store(const MatrixJsonField *field, JsonNode *node, gpointer target)
+{
+    gpointer location = G_STRUCT_MEMBER_P(target, field->offset);
+
+    switch (field->type) {
+        case MATRIX_JSON_FIELD_STRING:
+            g_free(*(gchar **)location);
+            *(gchar **)location = g_strdup(json_node_get_string(node));
+
+            break;
+        case MATRIX_JSON_FIELD_INT:
+            *(gint *)location = (gint)json_node_get_int(node);
+
+            break;
+        case MATRIX_JSON_FIELD_LONG:
+            *(glong *)location = (glong)json_node_get_int(node);
+
+            break;
+        case MATRIX_JSON_FIELD_BOOLEAN:
+            *(gboolean *)location = json_node_get_boolean(node);
+
+            break;
+        case MATRIX_JSON_FIELD_NODE:
+            if (*(JsonNode **)location != NULL) {
+                json_node_unref(*(JsonNode **)location);
+            }
+
+            *(JsonNode **)location = json_node_ref(node);
+
+            break;
+        case MATRIX_JSON_FIELD_OBJECT:
+            if (JSON_NODE_HOLDS_OBJECT(node)) {
+                _matrix_json_object_decode(json_node_get_object(node),
+                                           field->subfields, field->n_subfields,
+                                           target);
+            }
+
+            break;
+    }
+}
+
+typedef struct {
+    const MatrixJsonField *fields;
+    guint n_fields;
+    gpointer target;
+    guint32 seen;
+} MatrixJsonDecodeData;
+
+static void
+_matrix_json_decode_member(JsonObject *object, const gchar *member_name, JsonNode *member_node, gpointer user_data)
+{
+    MatrixJsonDecodeData *data = user_data;
+
+    for (guint i = 0; i < data->n_fields; i++) {
+        const gchar *name = data->fields[i].name;
+
+        // Field tables are short, so comparing the first byte rules out almost every
+        // candidate without a full string comparison
+        if ((name[0] == member_name[0]) && (strcmp(name, member_name) == 0)) {
+            _matrix_json_field_store(&data->fields[i], member_node, data->target);
+            data->seen |= (1U << i);
+
+            return;
+        }
+    }
+}
+
+/*
+ * _matrix_json_object_decode:
+ *
+ * @object: the #JsonObject to decode
+ * @fields: (array length=n_fields): a field table describing the members to decode
+ * @n_fields: the number of entries in @fields; it must not exceed 32
+ * @target: the structure the offsets in @fields are relative to, usually an instance’s private
+ *     data
+ *
+ * Decode the members of @object listed in @fields into @target.  String fields are duplicated
+ * (freeing the previous value), node fields are referenced (unreferencing the previous value),
+ * and nested object fields are decoded recursively into the same @target.  Members not listed in
+ * @fields are ignored, and fields missing from @object are left untouched.
+ *
+ * Every member name is hashed by json-glib on each lookup, so this function does whichever is
+ * cheaper: if @object has fewer members than @fields has entries, it walks the members of
+ * @object once and dispatches each of them on the field table; otherwise it looks up each field
+ * directly.
+ *
+ * Returns: a bitmask with bit `i` set if `fields[i]` was present in @object
+ */
+guint32
+_matrix_json_object_decode(JsonObject *object,
+                           const MatrixJsonField *fields,
+                           guint n_fields,
+                           gpointer target)
+{
+    guint32 seen = 0;
+
+    g_return_val_if_fail(object != NULL, 0);
+    g_return_val_if_fail(fields != NULL, 0);
+    g_return_val_if_fail(n_fields <= 32, 0);
+    g_return_val_if_fail(target != NULL, 0);
+
+    if (json_object_get_size(object) < n_fields) {
+        MatrixJsonDecodeData data = {fields, n_fields, target, 0};
+
+        json_object_foreach_member(object, _matrix_json_decode_member, &data);
+
+        return data.seen;
+    }
+
+    for (guint i = 0; i < n_fields; i++) {
+        JsonNode *node;
+
+        if ((node = json_object_get_member(object, fields[i].name)) != NULL) {
+            _matrix_json_field_store(&fields[i], node, target);
+            seen |= (1U << i);
+        }
+    }
+
+    return seen;
+}
+
+/*
+ * _matrix_receipt_type_intern:
+ * @receipt_type: (nullable): a receipt type
+ *
+ * Get the interned version of @receipt_type if it is one defined by the spec.  Only these are
+ * interned, as interned strings are never freed, and receipt types come from other users.
+ *
+ * Returns: (transfer none) (nullable): the interned receipt type, or %NULL if @receipt_type
+ *     is not defined by the spec
+ */
+const gchar *
+_matrix_receipt_type_intern(const gchar *receipt_type)
+{
+    if (g_strcmp0(receipt_type, "m.read") == 0) {
+        return g_intern_static_string("m.read");
+    } else if (g_strcmp0(receipt_type, "m.read.private") == 0) {
+        return g_intern_static_string("m.read.private");
+    }
+
+    return NULL;
+}
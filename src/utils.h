@@ -26,7 +26,9 @@ G_BEGIN_DECLS
 
 gchar *_matrix_g_enum_to_string(GType enum_type, gint value, gchar convert_dashes);
 gint _matrix_g_enum_nick_to_value(GType enum_type, const gchar *nick, GError **error);
-JsonNode *_matrix_json_node_deep_copy(JsonNode *node);
+JsonNode *_matrix_json_node_dup_object(JsonNode *node);
+gsize _matrix_json_node_get_size(JsonNode *node);
+JsonNode *_matrix_event_json_redact(JsonNode *event, const gchar *redacted_because);
 
 G_END_DECLS
 